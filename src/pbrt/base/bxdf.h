@@ -186,6 +186,15 @@ class BxDF
         Vector3f wo, Vector3f wi, TransportMode mode,
         BxDFReflTransFlags sampleFlags = BxDFReflTransFlags::All) const;
 
+    // Batched evaluation of _f()_ and _PDF()_ for a common $\wo$; results are
+    // written to the corresponding entries of _result_.
+    PBRT_CPU_GPU inline void f(Vector3f wo, pstd::span<const Vector3f> wi,
+                               TransportMode mode,
+                               pstd::span<SampledSpectrum> result) const;
+    PBRT_CPU_GPU inline void PDF(Vector3f wo, pstd::span<const Vector3f> wi,
+                                 TransportMode mode, BxDFReflTransFlags sampleFlags,
+                                 pstd::span<Float> result) const;
+
     PBRT_CPU_GPU
     SampledSpectrum rho(Vector3f wo, pstd::span<const Float> uc,
                         pstd::span<const Point2f> u2) const;
@@ -50,6 +50,13 @@ class Camera : public TaggedPointer<PerspectiveCamera, OrthographicCamera,
     pstd::optional<CameraRayDifferential> GenerateRayDifferential(
         CameraSample sample, SampledWavelengths &lambda) const;
 
+    void GenerateRays(pstd::span<const CameraSample> samples,
+                      pstd::span<SampledWavelengths> lambda,
+                      pstd::span<pstd::optional<CameraRay>> rays) const;
+    void GenerateRayDifferentials(
+        pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+        pstd::span<pstd::optional<CameraRayDifferential>> rays) const;
+
     PBRT_CPU_GPU inline Film GetFilm() const;
 
     PBRT_CPU_GPU inline Float SampleTime(Float u) const;
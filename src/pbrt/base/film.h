@@ -57,6 +57,7 @@ class Film : public TaggedPointer<RGBFilm, GBufferFilm, SpectralFilm> {
     PBRT_CPU_GPU inline Filter GetFilter() const;
     PBRT_CPU_GPU inline const PixelSensor *GetPixelSensor() const;
     std::string GetFilename() const;
+    void SetFilename(const std::string &filename);
 
     using TaggedPointer::TaggedPointer;
 
@@ -43,6 +43,27 @@ class BSDF {
         return bxdf.f(wo, wi, mode);
     }
 
+    PBRT_CPU_GPU
+    void f(Vector3f woRender, pstd::span<const Vector3f> wiRender,
+           pstd::span<SampledSpectrum> f,
+           TransportMode mode = TransportMode::Radiance) const {
+        Vector3f wo = RenderToLocal(woRender);
+        // Transform incident directions to the local frame in fixed-size chunks
+        Vector3f wi[BatchSize];
+        for (size_t start = 0; start < wiRender.size(); start += BatchSize) {
+            size_t n = std::min<size_t>(BatchSize, wiRender.size() - start);
+            pstd::span<SampledSpectrum> fChunk = f.subspan(start, n);
+            if (wo.z == 0) {
+                for (SampledSpectrum &fc : fChunk)
+                    fc = SampledSpectrum(0.f);
+                continue;
+            }
+            for (size_t i = 0; i < n; ++i)
+                wi[i] = RenderToLocal(wiRender[start + i]);
+            bxdf.f(wo, pstd::span<const Vector3f>(wi, n), mode, fChunk);
+        }
+    }
+
     template <typename BxDF>
     PBRT_CPU_GPU SampledSpectrum f(Vector3f woRender, Vector3f wiRender,
                                    TransportMode mode = TransportMode::Radiance) const {
@@ -86,6 +107,26 @@ class BSDF {
         return bxdf.PDF(wo, wi, mode, sampleFlags);
     }
 
+    PBRT_CPU_GPU
+    void PDF(Vector3f woRender, pstd::span<const Vector3f> wiRender,
+             pstd::span<Float> pdf, TransportMode mode = TransportMode::Radiance,
+             BxDFReflTransFlags sampleFlags = BxDFReflTransFlags::All) const {
+        Vector3f wo = RenderToLocal(woRender);
+        Vector3f wi[BatchSize];
+        for (size_t start = 0; start < wiRender.size(); start += BatchSize) {
+            size_t n = std::min<size_t>(BatchSize, wiRender.size() - start);
+            pstd::span<Float> pdfChunk = pdf.subspan(start, n);
+            if (wo.z == 0) {
+                for (Float &p : pdfChunk)
+                    p = 0;
+                continue;
+            }
+            for (size_t i = 0; i < n; ++i)
+                wi[i] = RenderToLocal(wiRender[start + i]);
+            bxdf.PDF(wo, pstd::span<const Vector3f>(wi, n), mode, sampleFlags, pdfChunk);
+        }
+    }
+
     template <typename BxDF>
     PBRT_CPU_GPU pstd::optional<BSDFSample> Sample_f(
         Vector3f woRender, Float u, Point2f u2,
@@ -147,6 +188,7 @@ class BSDF {
 
   private:
     // BSDF Private Members
+    static constexpr int BatchSize = 16;
     BxDF bxdf;
     Frame shadingFrame;
 };
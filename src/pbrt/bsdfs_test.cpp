@@ -818,3 +818,178 @@ TEST(Hair, SamplingConsistency) {
             EXPECT_LT(err, 0.05);
         }
 }
+
+///////////////////////////////////////////////////////////////////////////
+// Tabulated Layered BxDF Tests
+
+static CoatedDiffuseBxDF CoatedDiffuse(const SampledWavelengths &lambda, Float alpha,
+                                       int nSamples) {
+    // Use a spectrally-varying base so that wavelength interpolation is exercised
+    SampledSpectrum r;
+    for (int i = 0; i < NSpectrumSamples; ++i)
+        r[i] = Lerp((lambda[i] - Lambda_min) / (Lambda_max - Lambda_min), .2f, .8f);
+    TrowbridgeReitzDistribution distrib(alpha, alpha);
+    return CoatedDiffuseBxDF(DielectricBxDF(1.5f, distrib), DiffuseBxDF(r), 0.01f,
+                             SampledSpectrum(0.f), 0.f, 10, nSamples);
+}
+
+TEST(LayeredBxDFTable, CoatedDiffuse) {
+    for (Float alpha : {Float(0), Float(0.3)}) {
+        LayeredBxDFTable *table = LayeredBxDFTable::Create<CoatedDiffuseBxDF>(
+            [=](SampledWavelengths &lambda) { return CoatedDiffuse(lambda, alpha, 1); },
+            64, Allocator());
+
+        RNG rng;
+        Float errorSum = 0, referenceSum = 0;
+        for (int i = 0; i < 200; ++i) {
+            SampledWavelengths lambda =
+                SampledWavelengths::SampleUniform(rng.Uniform<Float>());
+            CoatedDiffuseBxDF reference = CoatedDiffuse(lambda, alpha, 256);
+            CoatedDiffuseBxDF tabulated = CoatedDiffuse(lambda, alpha, 1);
+            tabulated.SetTable(table, lambda);
+
+            // Compare tabulated BSDF values to the stochastic reference
+            Point2f uo(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Point2f ui(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Vector3f wo = SampleUniformHemisphere(uo), wi = SampleUniformHemisphere(ui);
+            SampledSpectrum fRef = reference.f(wo, wi, TransportMode::Radiance);
+            SampledSpectrum fTab = tabulated.f(wo, wi, TransportMode::Radiance);
+            for (int c = 0; c < NSpectrumSamples; ++c) {
+                EXPECT_LT(std::abs(fTab[c] - fRef[c]), 0.5f * fRef[c] + 0.05f)
+                    << "alpha " << alpha << " wo " << wo << " wi " << wi;
+                errorSum += std::abs(fTab[c] - fRef[c]);
+                referenceSum += fRef[c];
+            }
+
+            // Sampled directions must report the tabulated value and PDF
+            pstd::optional<BSDFSample> bs =
+                tabulated.Sample_f(wo, rng.Uniform<Float>(),
+                                   {rng.Uniform<Float>(), rng.Uniform<Float>()},
+                                   TransportMode::Radiance);
+            if (bs && !bs->IsSpecular()) {
+                SampledSpectrum f = tabulated.f(wo, bs->wi, TransportMode::Radiance);
+                Float pdf = tabulated.PDF(wo, bs->wi, TransportMode::Radiance);
+                EXPECT_FLOAT_EQ(f[0], bs->f[0]);
+                EXPECT_FLOAT_EQ(pdf, bs->pdf);
+            }
+        }
+        EXPECT_LT(errorSum / referenceSum, 0.1f) << "alpha " << alpha;
+
+        // Compare directional albedos and check that the PDF is normalized
+        SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
+        CoatedDiffuseBxDF reference = CoatedDiffuse(lambda, alpha, 1);
+        CoatedDiffuseBxDF tabulated = CoatedDiffuse(lambda, alpha, 1);
+        tabulated.SetTable(table, lambda);
+        for (Float cosTheta : {Float(0.2), Float(0.6), Float(0.95)}) {
+            Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+            const int n = 65536;
+            SampledSpectrum rhoRef(0.f), rhoTab(0.f);
+            Float pdfIntegral = 0;
+            for (int i = 0; i < n; ++i) {
+                Float uc = rng.Uniform<Float>();
+                Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+                pstd::optional<BSDFSample> bs =
+                    reference.Sample_f(wo, uc, u, TransportMode::Radiance);
+                if (bs && bs->pdf > 0)
+                    rhoRef += bs->f * AbsCosTheta(bs->wi) / bs->pdf;
+                bs = tabulated.Sample_f(wo, uc, u, TransportMode::Radiance);
+                if (bs && bs->pdf > 0)
+                    rhoTab += bs->f * AbsCosTheta(bs->wi) / bs->pdf;
+
+                Vector3f w = SampleUniformSphere(u);
+                pdfIntegral += tabulated.PDF(wo, w, TransportMode::Radiance) /
+                               UniformSpherePDF();
+            }
+            rhoRef /= n;
+            rhoTab /= n;
+            pdfIntegral /= n;
+            for (int c = 0; c < NSpectrumSamples; ++c)
+                EXPECT_LT(std::abs(rhoTab[c] - rhoRef[c]), 0.03f)
+                    << "alpha " << alpha << " cosTheta " << cosTheta << " rhoRef "
+                    << rhoRef << " rhoTab " << rhoTab;
+            if (alpha == 0)
+                // Specular reflection isn't included in the PDF
+                EXPECT_LT(pdfIntegral, 1.01f);
+            else
+                EXPECT_NEAR(pdfIntegral, 1, 0.1f) << "cosTheta " << cosTheta;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Batched Evaluation Tests
+
+TEST(BSDFBatched, MatchesScalar) {
+    SampledWavelengths lambda = SampledWavelengths::SampleVisible(0.5f);
+    TrowbridgeReitzDistribution isotropic(0.3f, 0.3f), anisotropic(0.4f, 0.1f);
+    DiffuseBxDF diffuse(SampledSpectrum(0.5f));
+    ConductorBxDF conductor(anisotropic, SampledSpectrum(0.2f), SampledSpectrum(3.f));
+    DielectricBxDF dielectric(1.5f, isotropic), dielectricInv(1 / 1.5f, anisotropic);
+    CoatedDiffuseBxDF coated = CoatedDiffuse(lambda, 0.3f, 1);
+    BxDF bxdfs[] = {&diffuse, &conductor, &dielectric, &dielectricInv, &coated};
+
+    // Use an orthonormal shading frame, as surfaces provide, so that local
+    // directions are normalized
+    Vector3f ns = Normalize(Vector3f(1, 2, 3));
+    Vector3f dpdus = Cross(ns, Vector3f(1, 0, 0));
+
+    RNG rng;
+    for (BxDF bxdf : bxdfs) {
+        BSDF bsdf(Normal3f(ns), dpdus, bxdf);
+        // LayeredBxDF seeds its random walks by hashing the local directions,
+        // so its values only match for bit-identical directions; the frame
+        // transformation may be rounded differently in the batched path.
+        bool stochastic = bxdf.Is<CoatedDiffuseBxDF>();
+        auto check = [&](pstd::span<const SampledSpectrum> f, pstd::span<const Float> pdf,
+                         auto fScalar, auto pdfScalar, Vector3f wo,
+                         const std::vector<Vector3f> &wi) {
+            for (size_t i = 0; i < wi.size(); ++i) {
+                SampledSpectrum fs = fScalar(wi[i]);
+                for (int c = 0; c < NSpectrumSamples; ++c)
+                    EXPECT_NEAR(fs[c], f[i][c], 1e-3f * std::max<Float>(1, fs[c]))
+                        << bxdf.ToString() << " wo " << wo << " wi " << wi[i];
+                Float ps = pdfScalar(wi[i]);
+                EXPECT_NEAR(ps, pdf[i], 1e-3f * std::max<Float>(1, ps))
+                    << bxdf.ToString() << " wo " << wo << " wi " << wi[i];
+            }
+        };
+
+        for (int trial = 0; trial < 20; ++trial) {
+            // Use a direction count that isn't a multiple of any packet width
+            // or of the BSDF's batch size
+            Vector3f wo =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            std::vector<Vector3f> wi(37);
+            for (Vector3f &w : wi)
+                w = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Vector3f woLocal = bsdf.RenderToLocal(wo);
+            std::vector<Vector3f> wiLocal(wi.size());
+            for (size_t i = 0; i < wi.size(); ++i)
+                wiLocal[i] = bsdf.RenderToLocal(wi[i]);
+
+            std::vector<SampledSpectrum> f(wi.size());
+            std::vector<Float> pdf(wi.size());
+            for (TransportMode mode :
+                 {TransportMode::Radiance, TransportMode::Importance}) {
+                // Compare the BxDF's batched methods to its scalar ones
+                bxdf.f(woLocal, wiLocal, mode, pstd::MakeSpan(f));
+                bxdf.PDF(woLocal, wiLocal, mode, BxDFReflTransFlags::All,
+                         pstd::MakeSpan(pdf));
+                check(
+                    f, pdf, [&](Vector3f w) { return bxdf.f(woLocal, w, mode); },
+                    [&](Vector3f w) { return bxdf.PDF(woLocal, w, mode); }, woLocal,
+                    wiLocal);
+
+                // Compare the BSDF's batched methods, which transform the
+                // directions in chunks, to its scalar ones
+                if (stochastic)
+                    continue;
+                bsdf.f(wo, wi, pstd::MakeSpan(f), mode);
+                bsdf.PDF(wo, wi, pstd::MakeSpan(pdf), mode);
+                check(
+                    f, pdf, [&](Vector3f w) { return bsdf.f(wo, w, mode); },
+                    [&](Vector3f w) { return bsdf.PDF(wo, w, mode); }, wo, wi);
+            }
+        }
+    }
+}
@@ -18,10 +18,12 @@
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/stats.h>
 
+#include <numeric>
 #include <unordered_map>
 
 namespace pbrt {
@@ -69,8 +71,130 @@ std::string DiffuseTransmissionBxDF::ToString() const {
 template <typename TopBxDF, typename BottomBxDF, bool twoSided>
 std::string LayeredBxDF<TopBxDF, BottomBxDF, twoSided>::ToString() const {
     return StringPrintf(
-        "[ LayeredBxDF top: %s bottom: %s thickness: %f albedo: %s g: %f ]", top, bottom,
-        thickness, albedo, g);
+        "[ LayeredBxDF top: %s bottom: %s thickness: %f albedo: %s g: %f tabulated: %s ]",
+        top, bottom, thickness, albedo, g, table != nullptr);
+}
+
+// LayeredBxDFTable Method Definitions
+STAT_MEMORY_COUNTER("Memory/Layered BxDF tables", layeredTableBytes);
+
+template <typename BxDF>
+LayeredBxDFTable *LayeredBxDFTable::Create(
+    std::function<BxDF(SampledWavelengths &)> getBxDF, int nEstimates, Allocator alloc) {
+    LayeredBxDFTable *table = alloc.new_object<LayeredBxDFTable>(alloc);
+    table->values.resize(nLambda * nTheta * nTheta * nPhi);
+
+    // Determine whether all wavelengths of a _SampledWavelengths_ are usable
+    // Tables are built at wavelengths at the centers of _nLambda_ equal
+    // intervals; each _SampledWavelengths_ covers _NSpectrumSamples_ of
+    // them unless a dispersive interface terminates secondary wavelengths.
+    SampledWavelengths probe = SampledWavelengths::SampleUniform(0.5f / nLambda);
+    getBxDF(probe);
+    bool perWavelength = probe.SecondaryTerminated();
+    int lambdaStride = nLambda / NSpectrumSamples;
+    int nPasses = perWavelength ? nLambda : lambdaStride;
+
+    // Estimate light transport in the layers at the table's nodes
+    ParallelFor(0, nPasses * nTheta, [&](int64_t index) {
+        int pass = index / nTheta, io = index % nTheta;
+        SampledWavelengths lambda =
+            SampledWavelengths::SampleUniform((pass + 0.5f) / nLambda);
+        BxDF bxdf = getBxDF(lambda);
+        RNG rng(Hash(pass, io));
+
+        Float cosTheta_o = (io + 0.5f) / nTheta;
+        Float sinTheta_o = SafeSqrt(1 - Sqr(cosTheta_o));
+        for (int ii = 0; ii < nTheta; ++ii) {
+            Float cosTheta_i = (ii + 0.5f) / nTheta;
+            Float sinTheta_i = SafeSqrt(1 - Sqr(cosTheta_i));
+            for (int ip = 0; ip < nPhi; ++ip) {
+                Float phi = (ip + 0.5f) / nPhi * Pi;
+                // Average estimates over rotations of the isotropic BSDF,
+                // each of which gets independent random walks.
+                SampledSpectrum sum(0.f);
+                for (int s = 0; s < nEstimates; ++s) {
+                    Float psi = 2 * Pi * (s + rng.Uniform<Float>()) / nEstimates;
+                    Vector3f wo = SphericalDirection(sinTheta_o, cosTheta_o, psi);
+                    Vector3f wi = SphericalDirection(sinTheta_i, cosTheta_i, psi + phi);
+                    TransportMode mode = TransportMode::Radiance;
+                    sum += bxdf.f(wo, wi, mode) - bxdf.top.f(wo, wi, mode);
+                }
+                sum = ClampZero(sum / nEstimates);
+
+                // Store estimate for each of the pass's wavelengths
+                auto value = [&](int il) -> Float & {
+                    return table->values[((il * nTheta + io) * nTheta + ii) * nPhi + ip];
+                };
+                if (perWavelength)
+                    value(pass) = sum[0];
+                else
+                    for (int i = 0; i < NSpectrumSamples; ++i)
+                        value(pass + i * lambdaStride) = sum[i];
+            }
+        }
+    });
+
+    // Compute sampling distributions for each $\cos\theta_\roman{o}$ bin
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f / nLambda);
+    BxDF bxdf = getBxDF(lambda);
+    RNG rng;
+    for (int io = 0; io < nTheta; ++io) {
+        // Compute spectrally-averaged projected values of _wo_'s slice of the table
+        std::vector<Float> func(nTheta * nPhi, Float(0));
+        for (int il = 0; il < nLambda; ++il)
+            for (int ii = 0; ii < nTheta; ++ii)
+                for (int ip = 0; ip < nPhi; ++ip) {
+                    int offset = ((il * nTheta + io) * nTheta + ii) * nPhi + ip;
+                    Float cosTheta_i = (ii + 0.5f) / nTheta;
+                    func[ip * nTheta + ii] +=
+                        table->values[offset] * cosTheta_i / nLambda;
+                }
+        // Compute albedo of light scattered in the layers
+        Float funcSum = std::accumulate(func.begin(), func.end(), Float(0));
+        Float layersAlbedo = funcSum * (2 * Pi) / (nTheta * nPhi);
+        // Ensure that all directions can be sampled
+        for (Float &v : func)
+            v += 0.05f * funcSum / func.size() + 1e-6f;
+        table->distributions.emplace_back(func, nTheta, nPhi,
+                                          Bounds2f(Point2f(0, 0), Point2f(1, 1)), alloc);
+
+        // Estimate albedo of reflection at the entrance interface
+        Float cosTheta_o = (io + 0.5f) / nTheta;
+        Vector3f wo(SafeSqrt(1 - Sqr(cosTheta_o)), 0, cosTheta_o);
+        Float topAlbedo = 0;
+        for (int s = 0; s < nEstimates; ++s) {
+            Float uc = (s + rng.Uniform<Float>()) / nEstimates;
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            pstd::optional<BSDFSample> bs = bxdf.top.Sample_f(
+                wo, uc, u, TransportMode::Radiance, BxDFReflTransFlags::Reflection);
+            if (bs && bs->pdf > 0)
+                topAlbedo += bs->f.Average() * AbsCosTheta(bs->wi) / bs->pdf;
+        }
+        topAlbedo /= nEstimates;
+
+        // Sample entrance reflection in proportion to its albedo
+        Float pTop = (topAlbedo + layersAlbedo > 0)
+                         ? topAlbedo / (topAlbedo + layersAlbedo)
+                         : 0.5f;
+        table->topSampleProbability.push_back(Clamp(pTop, 0.05f, 0.95f));
+    }
+
+    layeredTableBytes += table->BytesUsed();
+    return table;
+}
+
+size_t LayeredBxDFTable::BytesUsed() const {
+    size_t bytes = sizeof(*this) + values.size() * sizeof(Float) +
+                   topSampleProbability.size() * sizeof(Float);
+    for (const PiecewiseConstant2D &d : distributions)
+        bytes += d.BytesUsed();
+    return bytes;
+}
+
+std::string LayeredBxDFTable::ToString() const {
+    return StringPrintf("[ LayeredBxDFTable nLambda: %d nTheta: %d nPhi: %d "
+                        "topSampleProbability: %s ]",
+                        nLambda, nTheta, nPhi, topSampleProbability);
 }
 
 // DielectricBxDF Method Definitions
@@ -257,6 +381,117 @@ Float DielectricBxDF::PDF(Vector3f wo, Vector3f wi, TransportMode mode,
     return pdf;
 }
 
+void DielectricBxDF::f(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+                       pstd::span<SampledSpectrum> result) const {
+    if (eta == 1 || mfDistrib.EffectivelySmooth() || wo.z == 0) {
+        for (SampledSpectrum &r : result)
+            r = SampledSpectrum(0.f);
+        return;
+    }
+    Float lambda_o = mfDistrib.Lambda(wo), cosTheta_o = CosTheta(wo);
+    constexpr int Width = MicrofacetPacket::Width;
+    for (size_t start = 0; start < wi.size(); start += Width) {
+        // Compute generalized half vectors and scalar factors for packet lanes
+        MicrofacetPacket packet;
+        Float scale[Width];
+        for (int j = 0; j < Width; ++j) {
+            size_t i = start + j;
+            scale[j] = 0;
+            packet.Clear(j);
+            if (i >= wi.size())
+                continue;
+            Float cosTheta_i = CosTheta(wi[i]);
+            bool reflect = cosTheta_i * cosTheta_o > 0;
+            Float etap = 1;
+            if (!reflect)
+                etap = cosTheta_o > 0 ? eta : (1 / eta);
+            Vector3f wm = wi[i] * etap + wo;
+            if (cosTheta_i == 0 || LengthSquared(wm) == 0)
+                continue;
+            wm = FaceForward(Normalize(wm), Normal3f(0, 0, 1));
+            if (Dot(wm, wi[i]) * cosTheta_i < 0 || Dot(wm, wo) * cosTheta_o < 0)
+                continue;
+
+            if (!packet.Set(j, wm, wi[i]))
+                continue;
+            Float F = FrDielectric(Dot(wo, wm), eta);
+            if (reflect)
+                scale[j] = F / std::abs(4 * cosTheta_i * cosTheta_o);
+            else {
+                Float denom =
+                    Sqr(Dot(wi[i], wm) + Dot(wo, wm) / etap) * cosTheta_i * cosTheta_o;
+                scale[j] = (1 - F) * std::abs(Dot(wi[i], wm) * Dot(wo, wm) / denom);
+                if (mode == TransportMode::Radiance)
+                    scale[j] /= Sqr(etap);
+            }
+        }
+
+        // Evaluate $D$ and $G$ for the packet and scale each lane's value
+        Float dg[Width];
+        packet.DG(mfDistrib, lambda_o, dg);
+        for (int j = 0; j < Width && start + j < wi.size(); ++j)
+            result[start + j] = SampledSpectrum(scale[j] > 0 ? dg[j] * scale[j] : 0);
+    }
+}
+
+void DielectricBxDF::PDF(Vector3f wo, pstd::span<const Vector3f> wi,
+                         TransportMode mode, BxDFReflTransFlags sampleFlags,
+                         pstd::span<Float> result) const {
+    if (eta == 1 || mfDistrib.EffectivelySmooth() || wo.z == 0) {
+        for (Float &r : result)
+            r = 0;
+        return;
+    }
+    Float cosTheta_o = CosTheta(wo);
+    constexpr int Width = MicrofacetPacket::Width;
+    for (size_t start = 0; start < wi.size(); start += Width) {
+        // Compute generalized half vectors and sampling factors for packet lanes
+        MicrofacetPacket packet;
+        Float scale[Width];
+        for (int j = 0; j < Width; ++j) {
+            size_t i = start + j;
+            scale[j] = 0;
+            packet.Clear(j);
+            if (i >= wi.size())
+                continue;
+            Float cosTheta_i = CosTheta(wi[i]);
+            bool reflect = cosTheta_i * cosTheta_o > 0;
+            Float etap = 1;
+            if (!reflect)
+                etap = cosTheta_o > 0 ? eta : (1 / eta);
+            Vector3f wm = wi[i] * etap + wo;
+            if (cosTheta_i == 0 || LengthSquared(wm) == 0)
+                continue;
+            wm = FaceForward(Normalize(wm), Normal3f(0, 0, 1));
+            if (Dot(wm, wi[i]) * cosTheta_i < 0 || Dot(wm, wo) * cosTheta_o < 0)
+                continue;
+
+            // Account for the probabilities of sampling reflection and transmission
+            Float pr = FrDielectric(Dot(wo, wm), eta), pt = 1 - pr;
+            if (!(sampleFlags & BxDFReflTransFlags::Reflection))
+                pr = 0;
+            if (!(sampleFlags & BxDFReflTransFlags::Transmission))
+                pt = 0;
+            if (pr == 0 && pt == 0)
+                continue;
+
+            if (!packet.Set(j, wm, wi[i]))
+                continue;
+            if (reflect)
+                scale[j] = pr / (pr + pt) / (4 * AbsDot(wo, wm));
+            else {
+                Float denom = Sqr(Dot(wi[i], wm) + Dot(wo, wm) / etap);
+                scale[j] = AbsDot(wi[i], wm) / denom * pt / (pr + pt);
+            }
+        }
+
+        Float pdf[Width];
+        packet.PDF(mfDistrib, wo, pdf);
+        for (int j = 0; j < Width && start + j < wi.size(); ++j)
+            result[start + j] = scale[j] > 0 ? pdf[j] * scale[j] : 0;
+    }
+}
+
 std::string DielectricBxDF::ToString() const {
     return StringPrintf("[ DielectricBxDF eta: %f mfDistrib: %s ]", eta,
                         mfDistrib.ToString());
@@ -1168,4 +1403,9 @@ std::string BxDF::ToString() const {
 template class LayeredBxDF<DielectricBxDF, DiffuseBxDF, true>;
 template class LayeredBxDF<DielectricBxDF, ConductorBxDF, true>;
 
+template LayeredBxDFTable *LayeredBxDFTable::Create(
+    std::function<CoatedDiffuseBxDF(SampledWavelengths &)>, int, Allocator);
+template LayeredBxDFTable *LayeredBxDFTable::Create(
+    std::function<CoatedConductorBxDF(SampledWavelengths &)>, int, Allocator);
+
 }  // namespace pbrt
@@ -14,18 +14,74 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/sampling.h>
 #include <pbrt/util/scattering.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <limits>
 #include <string>
+#include <type_traits>
 
 namespace pbrt {
 
+// MicrofacetPacket Definition
+// Batched BxDF evaluation computes microfacet terms for groups of
+// _MicrofacetPacket::Width_ directions at a time; the per-direction setup and
+// the Fresnel terms remain scalar.
+struct MicrofacetPacket {
+    // MicrofacetPacket Public Methods
+    // Returns false and clears the lane for microfacet normals where the scalar
+    // _TrowbridgeReitzDistribution::D()_ returns zero
+    PBRT_CPU_GPU
+    bool Set(int lane, Vector3f wm, Vector3f wi) {
+        if (Sqr(Cos2Theta(wm)) < 1e-16f) {
+            Clear(lane);
+            return false;
+        }
+        wmx[lane] = wm.x;
+        wmy[lane] = wm.y;
+        wmz[lane] = wm.z;
+        wix[lane] = wi.x;
+        wiy[lane] = wi.y;
+        wiz[lane] = wi.z;
+        return true;
+    }
+    // Unused lanes are given a valid configuration so that they stay finite
+    PBRT_CPU_GPU
+    void Clear(int lane) {
+        wmx[lane] = wmy[lane] = wix[lane] = wiy[lane] = 0;
+        wmz[lane] = wiz[lane] = 1;
+    }
+
+    PBRT_CPU_GPU
+    void DG(const TrowbridgeReitzDistribution &mfDistrib, Float lambda_o,
+            Float *dg) const {
+        Packet D = mfDistrib.D(Packet::Load(wmx), Packet::Load(wmy), Packet::Load(wmz));
+        Packet lambda_i =
+            mfDistrib.Lambda(Packet::Load(wix), Packet::Load(wiy), Packet::Load(wiz));
+        (D / (Packet(1 + lambda_o) + lambda_i)).Store(dg);
+    }
+
+    PBRT_CPU_GPU
+    void PDF(const TrowbridgeReitzDistribution &mfDistrib, Vector3f wo,
+             Float *pdf) const {
+        mfDistrib.PDF(wo, Packet::Load(wmx), Packet::Load(wmy), Packet::Load(wmz))
+            .Store(pdf);
+    }
+
+    // MicrofacetPacket Public Members
+    static constexpr int Width = MaxFloatPacketWidth;
+    using Packet = FloatPacket<Width>;
+    Float wmx[Width], wmy[Width], wmz[Width];
+    Float wix[Width], wiy[Width], wiz[Width];
+};
+
 // DiffuseBxDF Definition
 class DiffuseBxDF {
   public:
@@ -41,6 +97,14 @@ class DiffuseBxDF {
         return R * InvPi;
     }
 
+    PBRT_CPU_GPU
+    void f(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+           pstd::span<SampledSpectrum> result) const {
+        SampledSpectrum fr = R * InvPi;
+        for (size_t i = 0; i < wi.size(); ++i)
+            result[i] = SameHemisphere(wo, wi[i]) ? fr : SampledSpectrum(0.f);
+    }
+
     PBRT_CPU_GPU
     pstd::optional<BSDFSample> Sample_f(
         Vector3f wo, Float uc, Point2f u, TransportMode mode,
@@ -64,6 +128,13 @@ class DiffuseBxDF {
         return CosineHemispherePDF(AbsCosTheta(wi));
     }
 
+    PBRT_CPU_GPU
+    void PDF(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+             BxDFReflTransFlags sampleFlags, pstd::span<Float> result) const {
+        for (size_t i = 0; i < wi.size(); ++i)
+            result[i] = PDF(wo, wi[i], mode, sampleFlags);
+    }
+
     PBRT_CPU_GPU
     static constexpr const char *Name() { return "DiffuseBxDF"; }
 
@@ -191,6 +262,13 @@ class DielectricBxDF {
     Float PDF(Vector3f wo, Vector3f wi, TransportMode mode,
               BxDFReflTransFlags sampleFlags = BxDFReflTransFlags::All) const;
 
+    PBRT_CPU_GPU
+    void f(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+           pstd::span<SampledSpectrum> result) const;
+    PBRT_CPU_GPU
+    void PDF(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+             BxDFReflTransFlags sampleFlags, pstd::span<Float> result) const;
+
     PBRT_CPU_GPU
     static constexpr const char *Name() { return "DielectricBxDF"; }
 
@@ -349,6 +427,46 @@ class ConductorBxDF {
         return mfDistrib.D(wm) * F * mfDistrib.G(wo, wi) / (4 * cosTheta_i * cosTheta_o);
     }
 
+    PBRT_CPU_GPU
+    void f(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+           pstd::span<SampledSpectrum> result) const {
+        if (mfDistrib.EffectivelySmooth() || wo.z == 0) {
+            for (SampledSpectrum &r : result)
+                r = SampledSpectrum(0.f);
+            return;
+        }
+        Float lambda_o = mfDistrib.Lambda(wo);
+        constexpr int Width = MicrofacetPacket::Width;
+        for (size_t start = 0; start < wi.size(); start += Width) {
+            // Compute half vectors and non-microfacet factors for packet lanes
+            MicrofacetPacket packet;
+            Float cosTheta_h[Width], scale[Width];
+            for (int j = 0; j < Width; ++j) {
+                size_t i = start + j;
+                scale[j] = 0;
+                Vector3f wm = i < wi.size() ? wi[i] + wo : Vector3f();
+                if (i >= wi.size() || !SameHemisphere(wo, wi[i]) || wi[i].z == 0 ||
+                    LengthSquared(wm) == 0) {
+                    packet.Clear(j);
+                    continue;
+                }
+                wm = Normalize(wm);
+                if (!packet.Set(j, wm, wi[i]))
+                    continue;
+                cosTheta_h[j] = AbsDot(wo, wm);
+                scale[j] = 1 / (4 * AbsCosTheta(wi[i]) * AbsCosTheta(wo));
+            }
+
+            // Evaluate $D$ and $G$ for the packet and apply Fresnel term per lane
+            Float dg[Width];
+            packet.DG(mfDistrib, lambda_o, dg);
+            for (int j = 0; j < Width && start + j < wi.size(); ++j)
+                result[start + j] = scale[j] > 0 ? FrComplex(cosTheta_h[j], eta, k) *
+                                                       (dg[j] * scale[j])
+                                                 : SampledSpectrum(0.f);
+        }
+    }
+
     PBRT_CPU_GPU
     Float PDF(Vector3f wo, Vector3f wi, TransportMode mode,
               BxDFReflTransFlags sampleFlags) const {
@@ -367,6 +485,41 @@ class ConductorBxDF {
         return mfDistrib.PDF(wo, wm) / (4 * AbsDot(wo, wm));
     }
 
+    PBRT_CPU_GPU
+    void PDF(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+             BxDFReflTransFlags sampleFlags, pstd::span<Float> result) const {
+        if (!(sampleFlags & BxDFReflTransFlags::Reflection) ||
+            mfDistrib.EffectivelySmooth()) {
+            for (Float &r : result)
+                r = 0;
+            return;
+        }
+        constexpr int Width = MicrofacetPacket::Width;
+        for (size_t start = 0; start < wi.size(); start += Width) {
+            // Compute half vectors and Jacobians of reflection for packet lanes
+            MicrofacetPacket packet;
+            Float scale[Width];
+            for (int j = 0; j < Width; ++j) {
+                size_t i = start + j;
+                scale[j] = 0;
+                Vector3f wm = i < wi.size() ? wo + wi[i] : Vector3f();
+                if (i >= wi.size() || !SameHemisphere(wo, wi[i]) ||
+                    LengthSquared(wm) == 0) {
+                    packet.Clear(j);
+                    continue;
+                }
+                wm = FaceForward(Normalize(wm), Normal3f(0, 0, 1));
+                if (packet.Set(j, wm, wi[i]))
+                    scale[j] = 1 / (4 * AbsDot(wo, wm));
+            }
+
+            Float pdf[Width];
+            packet.PDF(mfDistrib, wo, pdf);
+            for (int j = 0; j < Width && start + j < wi.size(); ++j)
+                result[start + j] = scale[j] > 0 ? pdf[j] * scale[j] : 0;
+        }
+    }
+
     PBRT_CPU_GPU
     static constexpr const char *Name() { return "ConductorBxDF"; }
     std::string ToString() const;
@@ -380,6 +533,111 @@ class ConductorBxDF {
     SampledSpectrum eta, k;
 };
 
+// LayeredBxDFTable Definition
+class LayeredBxDFTable {
+  public:
+    // LayeredBxDFTable Public Constants
+    static constexpr int nLambda = 4 * NSpectrumSamples, nTheta = 16, nPhi = 16;
+
+    // LayeredBxDFTable Public Methods
+    LayeredBxDFTable(Allocator alloc)
+        : values(alloc), distributions(alloc), topSampleProbability(alloc) {}
+
+    template <typename BxDF>
+    static LayeredBxDFTable *Create(std::function<BxDF(SampledWavelengths &)> getBxDF,
+                                    int nEstimates, Allocator alloc);
+
+    PBRT_CPU_GPU
+    SampledSpectrum f(Vector3f wo, Vector3f wi, const SampledWavelengths &lambda) const {
+        // Compute interpolation offsets and weights for _wo_ and _wi_
+        int io, ii, ip;
+        Float to, ti, tp;
+        FindNodes(wo.z, nTheta, &io, &to);
+        FindNodes(wi.z, nTheta, &ii, &ti);
+        FindNodes(RelativeAzimuth(wo, wi), nPhi, &ip, &tp);
+
+        // Interpolate tabulated values at each sampled wavelength
+        auto lookup = [&](int il) {
+            auto v = [&](int o, int i, int p) {
+                return values[((il * nTheta + io + o) * nTheta + ii + i) * nPhi + ip + p];
+            };
+            return Lerp(to,
+                        Lerp(ti, Lerp(tp, v(0, 0, 0), v(0, 0, 1)),
+                             Lerp(tp, v(0, 1, 0), v(0, 1, 1))),
+                        Lerp(ti, Lerp(tp, v(1, 0, 0), v(1, 0, 1)),
+                             Lerp(tp, v(1, 1, 0), v(1, 1, 1))));
+        };
+        SampledSpectrum result;
+        for (int i = 0; i < NSpectrumSamples; ++i) {
+            int il;
+            Float tl;
+            FindNodes((lambda[i] - Lambda_min) / (Lambda_max - Lambda_min), nLambda, &il,
+                      &tl);
+            result[i] = Lerp(tl, lookup(il), lookup(il + 1));
+        }
+        return result;
+    }
+
+    PBRT_CPU_GPU
+    Float TopSampleProbability(Vector3f wo) const {
+        return topSampleProbability[ThetaIndex(wo.z)];
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<Vector3f> Sample(Vector3f wo, Float uc, Point2f u, Float *pdf) const {
+        // Sample $\cos\theta_\roman{i}$ and relative azimuth from _wo_'s distribution
+        Float mapPDF;
+        Point2f p = distributions[ThetaIndex(wo.z)].Sample(u, &mapPDF);
+        if (mapPDF == 0)
+            return {};
+        *pdf = mapPDF / (2 * Pi);
+
+        // Compute _wi_ for sampled angles; _uc_ selects the side of _wo_
+        Float phi = std::atan2(wo.y, wo.x) + (uc < 0.5f ? Pi : -Pi) * p[1];
+        Float cosTheta = p[0], sinTheta = SafeSqrt(1 - Sqr(cosTheta));
+        return SphericalDirection(sinTheta, cosTheta, phi);
+    }
+
+    PBRT_CPU_GPU
+    Float PDF(Vector3f wo, Vector3f wi) const {
+        Point2f p(wi.z, RelativeAzimuth(wo, wi));
+        return distributions[ThetaIndex(wo.z)].PDF(p) / (2 * Pi);
+    }
+
+    size_t BytesUsed() const;
+
+    std::string ToString() const;
+
+  private:
+    // LayeredBxDFTable Private Methods
+    PBRT_CPU_GPU
+    static int ThetaIndex(Float cosTheta) {
+        return Clamp(int(cosTheta * nTheta), 0, nTheta - 1);
+    }
+
+    // Returns the azimuth between _wo_ and _wi_ remapped to $[0,1]$
+    PBRT_CPU_GPU
+    static Float RelativeAzimuth(Vector3f wo, Vector3f wi) {
+        Float denom = std::sqrt((Sqr(wo.x) + Sqr(wo.y)) * (Sqr(wi.x) + Sqr(wi.y)));
+        if (denom == 0)
+            return 0;
+        return SafeACos((wo.x * wi.x + wo.y * wi.y) / denom) * InvPi;
+    }
+
+    // Finds the pair of table nodes (at cell centers) around _x_ in $[0,1]$
+    PBRT_CPU_GPU
+    static void FindNodes(Float x, int n, int *i, Float *t) {
+        Float xn = x * n - 0.5f;
+        *i = Clamp(int(pstd::floor(xn)), 0, n - 2);
+        *t = Clamp(xn - *i, 0, 1);
+    }
+
+    // LayeredBxDFTable Private Members
+    pstd::vector<Float> values;
+    pstd::vector<PiecewiseConstant2D> distributions;
+    pstd::vector<Float> topSampleProbability;
+};
+
 // TopOrBottomBxDF Definition
 template <typename TopBxDF, typename BottomBxDF>
 class TopOrBottomBxDF {
@@ -452,6 +710,13 @@ class LayeredBxDF {
         bottom.Regularize();
     }
 
+    PBRT_CPU_GPU
+    void SetTable(const LayeredBxDFTable *t, const SampledWavelengths &lambda) {
+        DCHECK(twoSided && !IsTransmissive(bottom.Flags()));
+        table = t;
+        tableLambda = lambda;
+    }
+
     PBRT_CPU_GPU
     BxDFFlags Flags() const {
         BxDFFlags topFlags = top.Flags(), bottomFlags = bottom.Flags();
@@ -475,6 +740,21 @@ class LayeredBxDF {
 
     PBRT_CPU_GPU
     SampledSpectrum f(Vector3f wo, Vector3f wi, TransportMode mode) const {
+        if (table) {
+            // Evaluate layered BSDF using tabulated light transport in the layers
+            if (twoSided && wo.z < 0) {
+                wo = -wo;
+                wi = -wi;
+            }
+            if (wo.z == 0 || !SameHemisphere(wo, wi))
+                return SampledSpectrum(0.f);
+            // The table holds radiance transport; use reciprocity for importance
+            SampledSpectrum fLayers = (mode == TransportMode::Radiance)
+                                          ? table->f(wo, wi, tableLambda)
+                                          : table->f(wi, wo, tableLambda);
+            return top.f(wo, wi, mode) + fLayers;
+        }
+
         SampledSpectrum f(0.);
         // Estimate _LayeredBxDF_ value _f_ using random sampling
         // Set _wo_ and _wi_ for layered BSDF evaluation
@@ -664,6 +944,44 @@ class LayeredBxDF {
             flipWi = true;
         }
 
+        if (table) {
+            // Sample tabulated layered BSDF
+            // Sample either entrance interface reflection or the table
+            Float pTop = table->TopSampleProbability(wo);
+            Vector3f wi;
+            if (uc < pTop) {
+                pstd::optional<BSDFSample> bs =
+                    top.Sample_f(wo, std::min(uc / pTop, OneMinusEpsilon), u, mode,
+                                 BxDFReflTransFlags::Reflection);
+                if (!bs || !bs->f || bs->pdf == 0 || bs->wi.z == 0)
+                    return {};
+                if (bs->IsSpecular()) {
+                    bs->pdf *= pTop;
+                    if (flipWi)
+                        bs->wi = -bs->wi;
+                    return bs;
+                }
+                wi = bs->wi;
+            } else {
+                Float tablePDF;
+                pstd::optional<Vector3f> w = table->Sample(
+                    wo, std::min((uc - pTop) / (1 - pTop), OneMinusEpsilon), u,
+                    &tablePDF);
+                if (!w || w->z == 0)
+                    return {};
+                wi = *w;
+            }
+
+            // Return _BSDFSample_ with the full tabulated BSDF value and PDF
+            SampledSpectrum fs = f(wo, wi, mode);
+            Float pdf = PDF(wo, wi, mode);
+            if (!fs || pdf == 0)
+                return {};
+            BxDFFlags flags = IsDiffuse(Flags()) ? BxDFFlags::DiffuseReflection
+                                                 : BxDFFlags::GlossyReflection;
+            return BSDFSample(fs, flipWi ? -wi : wi, pdf, flags);
+        }
+
         // Sample BSDF at entrance interface to get initial direction _w_
         bool enteredTop = twoSided || wo.z > 0;
         pstd::optional<BSDFSample> bs =
@@ -784,6 +1102,17 @@ class LayeredBxDF {
             wi = -wi;
         }
 
+        if (table) {
+            // Return PDF of tabulated layered BSDF sampling
+            if (wo.z == 0 || !SameHemisphere(wo, wi))
+                return 0;
+            Float pTop = table->TopSampleProbability(wo);
+            Float pdf = (1 - pTop) * table->PDF(wo, wi);
+            if (!IsSpecular(top.Flags()))
+                pdf += pTop * top.PDF(wo, wi, mode, BxDFReflTransFlags::Reflection);
+            return pdf;
+        }
+
         // Declare _RNG_ for layered PDF evaluation
         RNG rng(Hash(GetOptions().seed, wi), Hash(wo));
         auto r = [&rng]() {
@@ -891,12 +1220,16 @@ class LayeredBxDF {
         return FastExp(-std::abs(dz / w.z));
     }
 
+    friend class LayeredBxDFTable;
+
     // LayeredBxDF Private Members
     TopBxDF top;
     BottomBxDF bottom;
     Float thickness, g;
     SampledSpectrum albedo;
     int maxDepth, nSamples;
+    const LayeredBxDFTable *table = nullptr;
+    SampledWavelengths tableLambda;
 };
 
 // CoatedDiffuseBxDF Definition
@@ -1151,6 +1484,44 @@ inline Float BxDF::PDF(Vector3f wo, Vector3f wi, TransportMode mode,
     return Dispatch(pdf);
 }
 
+// HasBatchedEvaluation Definition
+// BxDFs that provide span-based _f()_ and _PDF()_ methods are evaluated with them
+// in batched queries; all others fall back to a loop over their scalar methods.
+template <typename T, typename = void>
+struct HasBatchedEvaluation : std::false_type {};
+
+template <typename T>
+struct HasBatchedEvaluation<
+    T, std::void_t<decltype(std::declval<const T &>().f(
+           Vector3f(), pstd::span<const Vector3f>(), TransportMode::Radiance,
+           pstd::span<SampledSpectrum>()))>> : std::true_type {};
+
+inline void BxDF::f(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+                    pstd::span<SampledSpectrum> result) const {
+    auto f = [&](auto ptr) {
+        using BxDF = std::remove_cv_t<std::remove_pointer_t<decltype(ptr)>>;
+        if constexpr (HasBatchedEvaluation<BxDF>::value)
+            ptr->f(wo, wi, mode, result);
+        else
+            for (size_t i = 0; i < wi.size(); ++i)
+                result[i] = ptr->f(wo, wi[i], mode);
+    };
+    Dispatch(f);
+}
+
+inline void BxDF::PDF(Vector3f wo, pstd::span<const Vector3f> wi, TransportMode mode,
+                      BxDFReflTransFlags sampleFlags, pstd::span<Float> result) const {
+    auto pdf = [&](auto ptr) {
+        using BxDF = std::remove_cv_t<std::remove_pointer_t<decltype(ptr)>>;
+        if constexpr (HasBatchedEvaluation<BxDF>::value)
+            ptr->PDF(wo, wi, mode, sampleFlags, result);
+        else
+            for (size_t i = 0; i < wi.size(); ++i)
+                result[i] = ptr->PDF(wo, wi[i], mode, sampleFlags);
+    };
+    Dispatch(pdf);
+}
+
 inline BxDFFlags BxDF::Flags() const {
     auto flags = [&](auto ptr) { return ptr->Flags(); };
     return Dispatch(flags);
@@ -17,6 +17,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/stats.h>
 
 #include <algorithm>
@@ -56,6 +57,90 @@ CameraTransform::CameraTransform(const AnimatedTransform &worldFromCamera) {
                                          worldFromCamera.endTime);
 }
 
+// Applies affine transformation _m_ to components _v_ of points or vectors
+template <int N>
+static void ApplyAffine(const SquareMatrix<4> &m, const FloatPacket<N> v[3],
+                        bool isPoint, FloatPacket<N> vt[3]) {
+    using Packet = FloatPacket<N>;
+    for (int r = 0; r < 3; ++r)
+        vt[r] = FMA(Packet(m[r][0]), v[0],
+                    FMA(Packet(m[r][1]), v[1],
+                        FMA(Packet(m[r][2]), v[2], Packet(isPoint ? m[r][3] : 0))));
+}
+
+// Transforms rays _[start, end)_ of _batch_ by _m_, _N_ rays at a time
+template <int N>
+static void TransformCameraRays(const SquareMatrix<4> &m, CameraRayBatch &batch,
+                                int start, int end) {
+    using Packet = FloatPacket<N>;
+    auto load = [](const Float a[3][CameraRayBatch::MaxSize], int i, Packet v[3]) {
+        for (int c = 0; c < 3; ++c)
+            v[c] = Packet::Load(&a[c][i]);
+    };
+    auto store = [](const Packet v[3], int i, Float a[3][CameraRayBatch::MaxSize]) {
+        for (int c = 0; c < 3; ++c)
+            v[c].Store(&a[c][i]);
+    };
+
+    for (int i = start; i + N <= end; i += N) {
+        // Transform ray origins and directions
+        Packet o[3], d[3], ot[3], dt[3];
+        load(batch.o, i, o);
+        load(batch.d, i, d);
+        ApplyAffine(m, o, true, ot);
+        ApplyAffine(m, d, false, dt);
+
+        // Offset ray origins to edge of their transformed error bounds
+        Packet offset(0.f);
+        for (int r = 0; r < 3; ++r) {
+            Packet error = Abs(Packet(m[r][0]) * o[0]) + Abs(Packet(m[r][1]) * o[1]) +
+                           Abs(Packet(m[r][2]) * o[2]) + Packet(std::abs(m[r][3]));
+            offset = FMA(Abs(dt[r]), Packet(gamma(3)) * error, offset);
+        }
+        offset = SafeDiv(offset, dt[0] * dt[0] + dt[1] * dt[1] + dt[2] * dt[2]);
+        for (int c = 0; c < 3; ++c)
+            ot[c] = FMA(dt[c], offset, ot[c]);
+        store(ot, i, batch.o);
+        store(dt, i, batch.d);
+
+        if (batch.hasDifferentials) {
+            // Transform ray differential origins and directions
+            Packet v[3], vt[3];
+            for (auto a : {batch.rxOrigin, batch.ryOrigin}) {
+                load(a, i, v);
+                ApplyAffine(m, v, true, vt);
+                store(vt, i, a);
+            }
+            for (auto a : {batch.rxDirection, batch.ryDirection}) {
+                load(a, i, v);
+                ApplyAffine(m, v, false, vt);
+                store(vt, i, a);
+            }
+        }
+    }
+}
+
+void CameraTransform::RenderFromCamera(CameraRayBatch &batch) const {
+    const SquareMatrix<4> &m = renderFromCamera.startTransform.GetMatrix();
+    if (renderFromCamera.IsAnimated() || m[3][0] != 0 || m[3][1] != 0 ||
+        m[3][2] != 0 || m[3][3] != 1) {
+        // Transform rays individually if the transformation varies or is projective
+        for (int i = 0; i < batch.size; ++i) {
+            if (batch.hasDifferentials)
+                batch.Set(i, renderFromCamera(batch.GetRayDifferential(i)));
+            else
+                batch.Set(i, renderFromCamera(batch.GetRay(i)));
+        }
+        return;
+    }
+
+    // Transform full packets of rays and then the remainder
+    constexpr int N = MaxFloatPacketWidth;
+    int nPacketRays = batch.size - batch.size % N;
+    TransformCameraRays<N>(m, batch, 0, nPacketRays);
+    TransformCameraRays<1>(m, batch, nPacketRays, batch.size);
+}
+
 std::string CameraTransform::ToString() const {
     return StringPrintf("[ CameraTransform renderFromCamera: %s worldFromRender: %s ]",
                         renderFromCamera, worldFromRender);
@@ -280,9 +365,48 @@ CameraBaseParameters::CameraBaseParameters(const CameraTransform &cameraTransfor
     }
 }
 
+// Generates camera rays in batches, transforming the camera-space rays
+// returned by _cameraSpaceRay_ to rendering space together
+template <typename CameraRayType, typename F>
+static void GenerateRaysBatched(const CameraTransform &cameraTransform,
+                                pstd::span<const CameraSample> samples,
+                                pstd::span<pstd::optional<CameraRayType>> rays,
+                                F cameraSpaceRay) {
+    CameraRayBatch batch;
+    for (size_t start = 0; start < samples.size(); start += CameraRayBatch::MaxSize) {
+        // Compute camera-space rays for the batch's samples
+        batch.size = std::min<size_t>(CameraRayBatch::MaxSize, samples.size() - start);
+        for (int i = 0; i < batch.size; ++i)
+            batch.Set(i, cameraSpaceRay(samples[start + i]));
+
+        // Transform rays to rendering space and return them
+        cameraTransform.RenderFromCamera(batch);
+        for (int i = 0; i < batch.size; ++i) {
+            if constexpr (std::is_same_v<CameraRayType, CameraRay>)
+                rays[start + i] = CameraRay{batch.GetRay(i)};
+            else
+                rays[start + i] = CameraRayDifferential{batch.GetRayDifferential(i)};
+        }
+    }
+}
+
 // OrthographicCamera Method Definitions
-pstd::optional<CameraRay> OrthographicCamera::GenerateRay(
-    CameraSample sample, SampledWavelengths &lambda) const {
+void OrthographicCamera::GenerateRays(pstd::span<const CameraSample> samples,
+                                      pstd::span<SampledWavelengths> lambda,
+                                      pstd::span<pstd::optional<CameraRay>> rays) const {
+    GenerateRaysBatched(cameraTransform, samples, rays,
+                        [&](CameraSample sample) { return CameraSpaceRay(sample); });
+}
+
+void OrthographicCamera::GenerateRayDifferentials(
+    pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+    pstd::span<pstd::optional<CameraRayDifferential>> rays) const {
+    GenerateRaysBatched(cameraTransform, samples, rays, [&](CameraSample sample) {
+        return CameraSpaceRayDifferential(sample);
+    });
+}
+
+Ray OrthographicCamera::CameraSpaceRay(CameraSample sample) const {
     // Compute raster and camera sample positions
     Point3f pFilm = Point3f(sample.pFilm.x, sample.pFilm.y, 0);
     Point3f pCamera = cameraFromRaster(pFilm);
@@ -302,11 +426,11 @@ pstd::optional<CameraRay> OrthographicCamera::GenerateRay(
         ray.d = Normalize(pFocus - ray.o);
     }
 
-    return CameraRay{RenderFromCamera(ray)};
+    return ray;
 }
 
-pstd::optional<CameraRayDifferential> OrthographicCamera::GenerateRayDifferential(
-    CameraSample sample, SampledWavelengths &lambda) const {
+RayDifferential OrthographicCamera::CameraSpaceRayDifferential(
+    CameraSample sample) const {
     // Compute main orthographic viewing ray
     // Compute raster and camera sample positions
     Point3f pFilm = Point3f(sample.pFilm.x, sample.pFilm.y, 0);
@@ -349,7 +473,7 @@ pstd::optional<CameraRayDifferential> OrthographicCamera::GenerateRayDifferentia
     }
 
     ray.hasDifferentials = true;
-    return CameraRayDifferential{RenderFromCamera(ray)};
+    return ray;
 }
 
 std::string OrthographicCamera::ToString() const {
@@ -401,8 +525,22 @@ OrthographicCamera *OrthographicCamera::Create(const ParameterDictionary &parame
 }
 
 // PerspectiveCamera Method Definitions
-pstd::optional<CameraRay> PerspectiveCamera::GenerateRay(
-    CameraSample sample, SampledWavelengths &lambda) const {
+void PerspectiveCamera::GenerateRays(pstd::span<const CameraSample> samples,
+                                     pstd::span<SampledWavelengths> lambda,
+                                     pstd::span<pstd::optional<CameraRay>> rays) const {
+    GenerateRaysBatched(cameraTransform, samples, rays,
+                        [&](CameraSample sample) { return CameraSpaceRay(sample); });
+}
+
+void PerspectiveCamera::GenerateRayDifferentials(
+    pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+    pstd::span<pstd::optional<CameraRayDifferential>> rays) const {
+    GenerateRaysBatched(cameraTransform, samples, rays, [&](CameraSample sample) {
+        return CameraSpaceRayDifferential(sample);
+    });
+}
+
+Ray PerspectiveCamera::CameraSpaceRay(CameraSample sample) const {
     // Compute raster and camera sample positions
     Point3f pFilm = Point3f(sample.pFilm.x, sample.pFilm.y, 0);
     Point3f pCamera = cameraFromRaster(pFilm);
@@ -423,11 +561,11 @@ pstd::optional<CameraRay> PerspectiveCamera::GenerateRay(
         ray.d = Normalize(pFocus - ray.o);
     }
 
-    return CameraRay{RenderFromCamera(ray)};
+    return ray;
 }
 
-pstd::optional<CameraRayDifferential> PerspectiveCamera::GenerateRayDifferential(
-    CameraSample sample, SampledWavelengths &lambda) const {
+RayDifferential PerspectiveCamera::CameraSpaceRayDifferential(
+    CameraSample sample) const {
     // Compute raster and camera sample positions
     Point3f pFilm = Point3f(sample.pFilm.x, sample.pFilm.y, 0);
     Point3f pCamera = cameraFromRaster(pFilm);
@@ -474,7 +612,7 @@ pstd::optional<CameraRayDifferential> PerspectiveCamera::GenerateRayDifferential
     }
 
     ray.hasDifferentials = true;
-    return CameraRayDifferential{RenderFromCamera(ray)};
+    return ray;
 }
 
 std::string PerspectiveCamera::ToString() const {
@@ -695,11 +833,12 @@ std::string SphericalCamera::ToString() const {
 RealisticCamera::RealisticCamera(CameraBaseParameters baseParameters,
                                  std::vector<Float> &lensParameters, Float focusDistance,
                                  Float setApertureDiameter, Image apertureImage,
-                                 Allocator alloc)
+                                 int lensTableResolution, Allocator alloc)
     : CameraBase(baseParameters),
       elementInterfaces(alloc),
+      apertureImage(std::move(apertureImage)),
       exitPupilBounds(alloc),
-      apertureImage(std::move(apertureImage)) {
+      lensTable(alloc) {
     // Compute film's physical extent
     Float aspect = (Float)film.FullResolution().y / (Float)film.FullResolution().x;
     Float diagonal = film.Diagonal();
@@ -742,6 +881,15 @@ RealisticCamera::RealisticCamera(CameraBaseParameters baseParameters,
         exitPupilBounds[i] = BoundExitPupil(r0, r1);
     });
 
+    // Tabulate ray transfer through lens system, if requested
+    if (lensTableResolution > 0) {
+        if (this->apertureImage)
+            Warning("\"lenstableresolution\" is not supported with an aperture image. "
+                    "Tracing all rays through the lens system.");
+        else
+            InitializeLensTable(std::max(lensTableResolution, 2));
+    }
+
     // Compute minimum differentials for _RealisticCamera_
     FindMinimumDifferentials(this);
 }
@@ -931,7 +1079,10 @@ pstd::optional<CameraRay> RealisticCamera::GenerateRay(CameraSample sample,
         return {};
     Ray rFilm(pFilm, eps->pPupil - pFilm);
     Ray ray;
-    Float weight = TraceLensesFromFilm(rFilm, &ray);
+    pstd::optional<Float> tableWeight;
+    if (lensTableResolution > 0)
+        tableWeight = LookupLensTable(pFilm, eps->pPupil, &ray);
+    Float weight = tableWeight ? *tableWeight : TraceLensesFromFilm(rFilm, &ray);
     if (weight == 0)
         return {};
 
@@ -950,6 +1101,148 @@ pstd::optional<CameraRay> RealisticCamera::GenerateRay(CameraSample sample,
 
 STAT_PERCENT("Camera/Rays vignetted by lens system", vignettedRays, totalRays);
 
+void RealisticCamera::InitializeLensTable(int resolution) {
+    // Bound pupil sample points over all film radii
+    Bounds2f pupilBounds;
+    for (const Bounds2f &b : exitPupilBounds)
+        if (!b.IsDegenerate())
+            pupilBounds = Union(pupilBounds, b);
+    if (pupilBounds.IsDegenerate())
+        return;
+
+    // Trace rays from film radius and pupil points at table vertices
+    lensTableResolution = resolution;
+    lensTablePupilBounds = pupilBounds;
+    int n = resolution;
+    lensTable.resize(size_t(n) * n * n);
+    ParallelFor(0, n, [&](int ri) {
+        Point3f pFilm(Float(ri) / (n - 1) * film.Diagonal() / 2, 0, 0);
+        for (int yi = 0; yi < n; ++yi)
+            for (int xi = 0; xi < n; ++xi) {
+                Point2f pLens =
+                    pupilBounds.Lerp(Point2f(Float(xi) / (n - 1), Float(yi) / (n - 1)));
+                Point3f pRear(pLens.x, pLens.y, LensRearZ());
+                Ray ray;
+                Float weight = TraceLensesFromFilm(Ray(pFilm, pRear - pFilm), &ray);
+                LensTableEntry &entry = lensTable[(size_t(ri) * n + yi) * n + xi];
+                if (weight > 0)
+                    entry = LensTableEntry{ray.o, Normalize(ray.d), weight};
+                else
+                    entry = LensTableEntry{Point3f(), Vector3f(), 0};
+            }
+    });
+
+    // Compare lens table to tracing the lens system at random sample points
+    struct LensTableErrors {
+        int nTraced = 0, nMismatched = 0, nCompared = 0;
+        Float sumAngleError = 0, maxAngleError = 0;
+    };
+    constexpr int nTestChunks = 64, nChunkTests = 256;
+    std::vector<LensTableErrors> chunkErrors(nTestChunks);
+    ParallelFor(0, nTestChunks, [&](int chunk) {
+        RNG rng(chunk);
+        LensTableErrors &errors = chunkErrors[chunk];
+        for (int i = 0; i < nChunkTests; ++i) {
+            Float rFilm = rng.Uniform<Float>() * film.Diagonal() / 2;
+            int rIndex = rFilm / (film.Diagonal() / 2) * exitPupilBounds.size();
+            rIndex = std::min<int>(exitPupilBounds.size() - 1, rIndex);
+            if (exitPupilBounds[rIndex].IsDegenerate())
+                continue;
+            Point2f pLens = exitPupilBounds[rIndex].Lerp(
+                Point2f(rng.Uniform<Float>(), rng.Uniform<Float>()));
+            Point3f pFilm(rFilm, 0, 0), pPupil(pLens.x, pLens.y, LensRearZ());
+
+            Ray rTable, rTrace;
+            pstd::optional<Float> tableWeight = LookupLensTable(pFilm, pPupil, &rTable);
+            Float traceWeight = TraceLensesFromFilm(Ray(pFilm, pPupil - pFilm), &rTrace);
+            if (!tableWeight)
+                ++errors.nTraced;
+            else if ((*tableWeight > 0) != (traceWeight > 0))
+                ++errors.nMismatched;
+            else if (traceWeight > 0) {
+                Float angle = AngleBetween(Normalize(rTable.d), Normalize(rTrace.d));
+                errors.maxAngleError = std::max(errors.maxAngleError, angle);
+                errors.sumAngleError += angle;
+                ++errors.nCompared;
+            }
+        }
+    });
+    LensTableErrors errors;
+    for (const LensTableErrors &e : chunkErrors) {
+        errors.nTraced += e.nTraced;
+        errors.nMismatched += e.nMismatched;
+        errors.nCompared += e.nCompared;
+        errors.sumAngleError += e.sumAngleError;
+        errors.maxAngleError = std::max(errors.maxAngleError, e.maxAngleError);
+    }
+
+    // Report lens table accuracy and warn if it is worse than expected
+    int nTests = nTestChunks * nChunkTests;
+    Float mismatchedPercent = 100.f * errors.nMismatched / nTests;
+    Float maxAngleError = Degrees(errors.maxAngleError);
+    LOG_VERBOSE("Lens table %d^3: %f%% of samples traced, %f%% vignetting mismatches, "
+                "direction error mean %f max %f degrees",
+                n, 100.f * errors.nTraced / nTests, mismatchedPercent,
+                Degrees(errors.nCompared ? errors.sumAngleError / errors.nCompared : 0.f),
+                maxAngleError);
+    if (mismatchedPercent > .1f || maxAngleError > .01f)
+        Warning("Lens table %d^3 differs from tracing the lens system: %f%% vignetting "
+                "mismatches, max direction error %f degrees. Increasing "
+                "\"lenstableresolution\" or setting it to 0 will give more accurate "
+                "rays.",
+                n, mismatchedPercent, maxAngleError);
+}
+
+pstd::optional<Float> RealisticCamera::LookupLensTable(Point3f pFilm, Point3f pPupil,
+                                                       Ray *rOut) const {
+    // Rotate pupil point to frame where _pFilm_ lies on the $+x$ axis
+    Float rFilm = std::sqrt(Sqr(pFilm.x) + Sqr(pFilm.y));
+    Float sinTheta = (rFilm != 0) ? pFilm.y / rFilm : 0;
+    Float cosTheta = (rFilm != 0) ? pFilm.x / rFilm : 1;
+    Point2f pLens(cosTheta * pPupil.x + sinTheta * pPupil.y,
+                  -sinTheta * pPupil.x + cosTheta * pPupil.y);
+
+    // Find table cell containing film radius and pupil point
+    int n = lensTableResolution;
+    Float cr = rFilm / (film.Diagonal() / 2) * (n - 1);
+    Vector2f cp = lensTablePupilBounds.Offset(pLens) * (n - 1);
+    if (!(cr <= n - 1 && cp.x >= 0 && cp.x <= n - 1 && cp.y >= 0 && cp.y <= n - 1))
+        return {};
+    int r0 = std::min<int>(cr, n - 2), x0 = std::min<int>(cp.x, n - 2);
+    int y0 = std::min<int>(cp.y, n - 2);
+    Float dr = cr - r0, dx = cp.x - x0, dy = cp.y - y0;
+
+    // Interpolate cell corner entries if all are either vignetted or not
+    Point3f o;
+    Vector3f d;
+    Float weight = 0;
+    int nVignetted = 0;
+    for (int c = 0; c < 8; ++c) {
+        int ri = r0 + (c & 1), xi = x0 + ((c >> 1) & 1), yi = y0 + (c >> 2);
+        const LensTableEntry &entry = lensTable[(size_t(ri) * n + yi) * n + xi];
+        if (entry.weight == 0) {
+            ++nVignetted;
+            continue;
+        }
+        Float w = ((c & 1) ? dr : 1 - dr) * ((c & 2) ? dx : 1 - dx) *
+                  ((c & 4) ? dy : 1 - dy);
+        o += w * Vector3f(entry.o);
+        d += w * entry.d;
+        weight += w * entry.weight;
+    }
+    if (nVignetted == 8)
+        return Float(0);
+    if (nVignetted > 0)
+        return {};
+
+    // Rotate interpolated ray back to _pFilm_'s frame
+    *rOut = Ray(Point3f(cosTheta * o.x - sinTheta * o.y, sinTheta * o.x + cosTheta * o.y,
+                        o.z),
+                Vector3f(cosTheta * d.x - sinTheta * d.y, sinTheta * d.x + cosTheta * d.y,
+                         d.z));
+    return weight;
+}
+
 std::string RealisticCamera::LensElementInterface::ToString() const {
     return StringPrintf("[ LensElementInterface curvatureRadius: %f thickness: %f "
                         "eta: %f apertureRadius: %f ]",
@@ -1287,8 +1580,10 @@ void RealisticCamera::TestExitPupilBounds() const {
 
 std::string RealisticCamera::ToString() const {
     return StringPrintf(
-        "[ RealisticCamera %s elementInterfaces: %s exitPupilBounds: %s ]",
-        CameraBase::ToString(), elementInterfaces, exitPupilBounds);
+        "[ RealisticCamera %s elementInterfaces: %s exitPupilBounds: %s "
+        "lensTableResolution: %d lensTablePupilBounds: %s ]",
+        CameraBase::ToString(), elementInterfaces, exitPupilBounds, lensTableResolution,
+        lensTablePupilBounds);
 }
 
 RealisticCamera *RealisticCamera::Create(const ParameterDictionary &parameters,
@@ -1302,6 +1597,7 @@ RealisticCamera *RealisticCamera::Create(const ParameterDictionary &parameters,
     std::string lensFile = ResolveFilename(parameters.GetOneString("lensfile", ""));
     Float apertureDiameter = parameters.GetOneFloat("aperturediameter", 1.0);
     Float focusDistance = parameters.GetOneFloat("focusdistance", 10.0);
+    int lensTableResolution = parameters.GetOneInt("lenstableresolution", 0);
 
     if (lensFile.empty()) {
         Error(loc, "No lens description file supplied!");
@@ -1437,7 +1733,8 @@ RealisticCamera *RealisticCamera::Create(const ParameterDictionary &parameters,
 
     return alloc.new_object<RealisticCamera>(cameraBaseParameters, lensParameters,
                                              focusDistance, apertureDiameter,
-                                             std::move(apertureImage), alloc);
+                                             std::move(apertureImage),
+                                             lensTableResolution, alloc);
 }
 
 }  // namespace pbrt
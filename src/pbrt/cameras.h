@@ -19,10 +19,13 @@
 #include <algorithm>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace pbrt {
 
+struct CameraRayBatch;
+
 // CameraTransform Definition
 class CameraTransform {
   public:
@@ -86,6 +89,8 @@ class CameraTransform {
     PBRT_CPU_GPU
     const AnimatedTransform &RenderFromCamera() const { return renderFromCamera; }
 
+    void RenderFromCamera(CameraRayBatch &batch) const;
+
     PBRT_CPU_GPU
     const Transform &WorldFromRender() const { return worldFromRender; }
 
@@ -125,6 +130,52 @@ struct CameraRayDifferential {
     SampledSpectrum weight = SampledSpectrum(1);
 };
 
+// CameraRayBatch Definition
+struct CameraRayBatch {
+    // CameraRayBatch Public Methods
+    void Set(int i, const Ray &r) {
+        for (int c = 0; c < 3; ++c) {
+            o[c][i] = r.o[c];
+            d[c][i] = r.d[c];
+        }
+        time[i] = r.time;
+        medium = r.medium;
+    }
+    void Set(int i, const RayDifferential &r) {
+        Set(i, static_cast<const Ray &>(r));
+        for (int c = 0; c < 3; ++c) {
+            rxOrigin[c][i] = r.rxOrigin[c];
+            ryOrigin[c][i] = r.ryOrigin[c];
+            rxDirection[c][i] = r.rxDirection[c];
+            ryDirection[c][i] = r.ryDirection[c];
+        }
+        hasDifferentials = r.hasDifferentials;
+    }
+
+    Ray GetRay(int i) const {
+        return Ray(Point3f(o[0][i], o[1][i], o[2][i]),
+                   Vector3f(d[0][i], d[1][i], d[2][i]), time[i], medium);
+    }
+    RayDifferential GetRayDifferential(int i) const {
+        RayDifferential r(GetRay(i));
+        r.hasDifferentials = hasDifferentials;
+        r.rxOrigin = Point3f(rxOrigin[0][i], rxOrigin[1][i], rxOrigin[2][i]);
+        r.ryOrigin = Point3f(ryOrigin[0][i], ryOrigin[1][i], ryOrigin[2][i]);
+        r.rxDirection = Vector3f(rxDirection[0][i], rxDirection[1][i], rxDirection[2][i]);
+        r.ryDirection = Vector3f(ryDirection[0][i], ryDirection[1][i], ryDirection[2][i]);
+        return r;
+    }
+
+    // CameraRayBatch Public Members
+    static constexpr int MaxSize = 64;
+    int size = 0;
+    bool hasDifferentials = false;
+    Medium medium;
+    Float o[3][MaxSize], d[3][MaxSize], time[MaxSize];
+    Float rxOrigin[3][MaxSize], ryOrigin[3][MaxSize];
+    Float rxDirection[3][MaxSize], ryDirection[3][MaxSize];
+};
+
 // CameraBaseParameters Definition
 struct CameraBaseParameters {
     CameraTransform cameraTransform;
@@ -199,6 +250,20 @@ class CameraBase {
     static pstd::optional<CameraRayDifferential> GenerateRayDifferential(
         Camera camera, CameraSample sample, SampledWavelengths &lambda);
 
+    template <typename ConcreteCamera, typename CameraRayType>
+    static void GenerateRays(const ConcreteCamera *camera,
+                             pstd::span<const CameraSample> samples,
+                             pstd::span<SampledWavelengths> lambda,
+                             pstd::span<pstd::optional<CameraRayType>> rays) {
+        // Generate camera rays one sample at a time
+        for (size_t i = 0; i < samples.size(); ++i) {
+            if constexpr (std::is_same_v<CameraRayType, CameraRay>)
+                rays[i] = camera->GenerateRay(samples[i], lambda[i]);
+            else
+                rays[i] = camera->GenerateRayDifferential(samples[i], lambda[i]);
+        }
+    }
+
     PBRT_CPU_GPU
     Ray RenderFromCamera(const Ray &r) const {
         return cameraTransform.RenderFromCamera(r);
@@ -299,11 +364,23 @@ class OrthographicCamera : public ProjectiveCamera {
 
     PBRT_CPU_GPU
     pstd::optional<CameraRay> GenerateRay(CameraSample sample,
-                                          SampledWavelengths &lambda) const;
+                                          SampledWavelengths &lambda) const {
+        return CameraRay{RenderFromCamera(CameraSpaceRay(sample))};
+    }
 
     PBRT_CPU_GPU
     pstd::optional<CameraRayDifferential> GenerateRayDifferential(
-        CameraSample sample, SampledWavelengths &lambda) const;
+        CameraSample sample, SampledWavelengths &lambda) const {
+        RayDifferential ray = CameraSpaceRayDifferential(sample);
+        return CameraRayDifferential{RenderFromCamera(ray)};
+    }
+
+    void GenerateRays(pstd::span<const CameraSample> samples,
+                      pstd::span<SampledWavelengths> lambda,
+                      pstd::span<pstd::optional<CameraRay>> rays) const;
+    void GenerateRayDifferentials(
+        pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+        pstd::span<pstd::optional<CameraRayDifferential>> rays) const;
 
     static OrthographicCamera *Create(const ParameterDictionary &parameters,
                                       const CameraTransform &cameraTransform, Film film,
@@ -332,6 +409,12 @@ class OrthographicCamera : public ProjectiveCamera {
     std::string ToString() const;
 
   private:
+    // OrthographicCamera Private Methods
+    PBRT_CPU_GPU
+    Ray CameraSpaceRay(CameraSample sample) const;
+    PBRT_CPU_GPU
+    RayDifferential CameraSpaceRayDifferential(CameraSample sample) const;
+
     // OrthographicCamera Private Members
     Vector3f dxCamera, dyCamera;
 };
@@ -378,11 +461,23 @@ class PerspectiveCamera : public ProjectiveCamera {
 
     PBRT_CPU_GPU
     pstd::optional<CameraRay> GenerateRay(CameraSample sample,
-                                          SampledWavelengths &lambda) const;
+                                          SampledWavelengths &lambda) const {
+        return CameraRay{RenderFromCamera(CameraSpaceRay(sample))};
+    }
 
     PBRT_CPU_GPU
     pstd::optional<CameraRayDifferential> GenerateRayDifferential(
-        CameraSample sample, SampledWavelengths &lambda) const;
+        CameraSample sample, SampledWavelengths &lambda) const {
+        RayDifferential ray = CameraSpaceRayDifferential(sample);
+        return CameraRayDifferential{RenderFromCamera(ray)};
+    }
+
+    void GenerateRays(pstd::span<const CameraSample> samples,
+                      pstd::span<SampledWavelengths> lambda,
+                      pstd::span<pstd::optional<CameraRay>> rays) const;
+    void GenerateRayDifferentials(
+        pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+        pstd::span<pstd::optional<CameraRayDifferential>> rays) const;
 
     PBRT_CPU_GPU
     SampledSpectrum We(const Ray &ray, SampledWavelengths &lambda,
@@ -396,6 +491,12 @@ class PerspectiveCamera : public ProjectiveCamera {
     std::string ToString() const;
 
   private:
+    // PerspectiveCamera Private Methods
+    PBRT_CPU_GPU
+    Ray CameraSpaceRay(CameraSample sample) const;
+    PBRT_CPU_GPU
+    RayDifferential CameraSpaceRayDifferential(CameraSample sample) const;
+
     // PerspectiveCamera Private Members
     Vector3f dxCamera, dyCamera;
     Float cosTotalWidth;
@@ -430,6 +531,17 @@ class SphericalCamera : public CameraBase {
         return CameraBase::GenerateRayDifferential(this, sample, lambda);
     }
 
+    void GenerateRays(pstd::span<const CameraSample> samples,
+                      pstd::span<SampledWavelengths> lambda,
+                      pstd::span<pstd::optional<CameraRay>> rays) const {
+        CameraBase::GenerateRays(this, samples, lambda, rays);
+    }
+    void GenerateRayDifferentials(
+        pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+        pstd::span<pstd::optional<CameraRayDifferential>> rays) const {
+        CameraBase::GenerateRays(this, samples, lambda, rays);
+    }
+
     PBRT_CPU_GPU
     SampledSpectrum We(const Ray &ray, SampledWavelengths &lambda,
                        Point2f *pRaster2 = nullptr) const {
@@ -468,7 +580,8 @@ class RealisticCamera : public CameraBase {
     // RealisticCamera Public Methods
     RealisticCamera(CameraBaseParameters baseParameters,
                     std::vector<Float> &lensParameters, Float focusDistance,
-                    Float apertureDiameter, Image apertureImage, Allocator alloc);
+                    Float apertureDiameter, Image apertureImage,
+                    int lensTableResolution, Allocator alloc);
 
     static RealisticCamera *Create(const ParameterDictionary &parameters,
                                    const CameraTransform &cameraTransform, Film film,
@@ -485,6 +598,17 @@ class RealisticCamera : public CameraBase {
         return CameraBase::GenerateRayDifferential(this, sample, lambda);
     }
 
+    void GenerateRays(pstd::span<const CameraSample> samples,
+                      pstd::span<SampledWavelengths> lambda,
+                      pstd::span<pstd::optional<CameraRay>> rays) const {
+        CameraBase::GenerateRays(this, samples, lambda, rays);
+    }
+    void GenerateRayDifferentials(
+        pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+        pstd::span<pstd::optional<CameraRayDifferential>> rays) const {
+        CameraBase::GenerateRays(this, samples, lambda, rays);
+    }
+
     PBRT_CPU_GPU
     SampledSpectrum We(const Ray &ray, SampledWavelengths &lambda,
                        Point2f *pRaster2 = nullptr) const {
@@ -516,6 +640,12 @@ class RealisticCamera : public CameraBase {
         std::string ToString() const;
     };
 
+    struct LensTableEntry {
+        Point3f o;
+        Vector3f d;
+        Float weight;
+    };
+
     // RealisticCamera Private Methods
     PBRT_CPU_GPU
     Float LensRearZ() const { return elementInterfaces.back().thickness; }
@@ -562,6 +692,12 @@ class RealisticCamera : public CameraBase {
     PBRT_CPU_GPU
     Float TraceLensesFromScene(const Ray &rCamera, Ray *rOut) const;
 
+    PBRT_CPU_GPU
+    pstd::optional<Float> LookupLensTable(Point3f pFilm, Point3f pPupil,
+                                          Ray *rOut) const;
+
+    void InitializeLensTable(int resolution);
+
     void DrawLensSystem() const;
     void DrawRayPathFromFilm(const Ray &r, bool arrow, bool toOpticalIntercept) const;
     void DrawRayPathFromScene(const Ray &r, bool arrow, bool toOpticalIntercept) const;
@@ -582,6 +718,9 @@ class RealisticCamera : public CameraBase {
     pstd::vector<LensElementInterface> elementInterfaces;
     Image apertureImage;
     pstd::vector<Bounds2f> exitPupilBounds;
+    int lensTableResolution = 0;
+    Bounds2f lensTablePupilBounds;
+    pstd::vector<LensTableEntry> lensTable;
 };
 
 inline pstd::optional<CameraRay> Camera::GenerateRay(CameraSample sample,
@@ -590,6 +729,22 @@ inline pstd::optional<CameraRay> Camera::GenerateRay(CameraSample sample,
     return Dispatch(generate);
 }
 
+inline void Camera::GenerateRays(pstd::span<const CameraSample> samples,
+                                 pstd::span<SampledWavelengths> lambda,
+                                 pstd::span<pstd::optional<CameraRay>> rays) const {
+    auto generate = [&](auto ptr) { ptr->GenerateRays(samples, lambda, rays); };
+    DispatchCPU(generate);
+}
+
+inline void Camera::GenerateRayDifferentials(
+    pstd::span<const CameraSample> samples, pstd::span<SampledWavelengths> lambda,
+    pstd::span<pstd::optional<CameraRayDifferential>> rays) const {
+    auto generate = [&](auto ptr) {
+        ptr->GenerateRayDifferentials(samples, lambda, rays);
+    };
+    DispatchCPU(generate);
+}
+
 inline Film Camera::GetFilm() const {
     auto getfilm = [&](auto ptr) { return ptr->GetFilm(); };
     return Dispatch(getfilm);
@@ -0,0 +1,134 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/base/sampler.h>
+#include <pbrt/cameras.h>
+#include <pbrt/film.h>
+#include <pbrt/filters.h>
+#include <pbrt/pbrt.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/vecmath.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// Returns a 50mm double-Gauss RealisticCamera focused at 2m.
+static RealisticCamera *MakeRealisticCamera(int lensTableResolution) {
+    // clang-format off
+    std::vector<Float> lens = {
+        // radius  thickness  eta    aperture
+        29.475,    3.76,      1.67,  25.2,
+        84.83,     0.12,      1,     25.2,
+        19.275,    4.025,     1.67,  23,
+        40.77,     3.275,     1.699, 23,
+        12.75,     5.705,     1,     18,
+        0,         4.5,       0,     17.1,
+        -14.495,   1.18,      1.603, 17,
+        40.77,     6.065,     1.658, 20,
+        -20.385,   0.19,      1,     20,
+        437.065,   3.22,      1.717, 20,
+        -39.73,    5,         1,     20};
+    // clang-format on
+
+    Point2i resolution(400, 300);
+    Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                          .035, PixelSensor::CreateDefault(), "test.exr");
+    RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+    Transform id;
+    CameraBaseParameters cbp(CameraTransform(AnimatedTransform(id, 0, id, 1)), film,
+                             nullptr, {}, nullptr);
+    return new RealisticCamera(cbp, lens, 2.f, 5.6f, Image(), lensTableResolution, {});
+}
+
+static CameraSample RandomCameraSample(RNG &rng) {
+    CameraSample cs;
+    cs.pFilm = Point2f(400 * rng.Uniform<Float>(), 300 * rng.Uniform<Float>());
+    cs.pLens = Point2f(rng.Uniform<Float>(), rng.Uniform<Float>());
+    return cs;
+}
+
+TEST(Camera, GenerateRaysMatchesScalar) {
+    Point2i resolution(400, 300);
+    Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                          PixelSensor::CreateDefault(), "test.exr");
+    RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+    Transform worldFromCamera = Translate(Vector3f(1, -2, 3)) * RotateY(30);
+    CameraBaseParameters cbp(
+        CameraTransform(AnimatedTransform(worldFromCamera, 0, worldFromCamera, 1)), film,
+        nullptr, {}, nullptr);
+    Bounds2f screen(Point2f(-1, -.75), Point2f(1, .75));
+    std::vector<Camera> cameras = {new PerspectiveCamera(cbp, 45, screen, 0, 10),
+                                   new PerspectiveCamera(cbp, 60, screen, .1, 4),
+                                   new OrthographicCamera(cbp, screen, 0, 10),
+                                   new OrthographicCamera(cbp, screen, .05, 2)};
+
+    RNG rng;
+    constexpr int n = 203;
+    std::vector<CameraSample> samples(n);
+    std::vector<SampledWavelengths> lambda(n, SampledWavelengths::SampleVisible(0.5f));
+    for (CameraSample &cs : samples) {
+        cs = RandomCameraSample(rng);
+        cs.time = rng.Uniform<Float>();
+    }
+
+    for (Camera camera : cameras) {
+        std::vector<pstd::optional<CameraRay>> rays(n);
+        std::vector<pstd::optional<CameraRayDifferential>> rayDiffs(n);
+        camera.GenerateRays(samples, pstd::MakeSpan(lambda), pstd::MakeSpan(rays));
+        camera.GenerateRayDifferentials(samples, pstd::MakeSpan(lambda),
+                                        pstd::MakeSpan(rayDiffs));
+        for (int i = 0; i < n; ++i) {
+            // Compare batched rays to rays generated one at a time
+            pstd::optional<CameraRay> cr = camera.GenerateRay(samples[i], lambda[i]);
+            pstd::optional<CameraRayDifferential> crd =
+                camera.GenerateRayDifferential(samples[i], lambda[i]);
+            ASSERT_TRUE(cr && rays[i] && crd && rayDiffs[i]);
+            EXPECT_LT(Distance(cr->ray.o, rays[i]->ray.o), 1e-5f) << camera;
+            EXPECT_LT(Length(cr->ray.d - rays[i]->ray.d), 1e-5f) << camera;
+            EXPECT_EQ(cr->ray.time, rays[i]->ray.time);
+
+            const RayDifferential &r = crd->ray, &rb = rayDiffs[i]->ray;
+            EXPECT_LT(Distance(r.o, rb.o), 1e-5f) << camera;
+            EXPECT_LT(Length(r.d - rb.d), 1e-5f) << camera;
+            EXPECT_EQ(r.hasDifferentials, rb.hasDifferentials);
+            EXPECT_LT(Distance(r.rxOrigin, rb.rxOrigin), 1e-5f) << camera;
+            EXPECT_LT(Distance(r.ryOrigin, rb.ryOrigin), 1e-5f) << camera;
+            EXPECT_LT(Length(r.rxDirection - rb.rxDirection), 1e-5f) << camera;
+            EXPECT_LT(Length(r.ryDirection - rb.ryDirection), 1e-5f) << camera;
+        }
+    }
+}
+
+TEST(RealisticCamera, LensTableMatchesTracing) {
+    RealisticCamera *traced = MakeRealisticCamera(0);
+    RealisticCamera *tabulated = MakeRealisticCamera(64);
+
+    RNG rng;
+    int nMismatched = 0, nRays = 100000;
+    for (int i = 0; i < nRays; ++i) {
+        CameraSample cs = RandomCameraSample(rng);
+        SampledWavelengths lambda = SampledWavelengths::SampleVisible(0.5f);
+        pstd::optional<CameraRay> cr = traced->GenerateRay(cs, lambda);
+        pstd::optional<CameraRay> ct = tabulated->GenerateRay(cs, lambda);
+        if (cr.has_value() != ct.has_value()) {
+            ++nMismatched;
+            continue;
+        }
+        if (!cr)
+            continue;
+
+        // Tabulated rays should closely match exactly traced ones
+        EXPECT_LT(Distance(cr->ray.o, ct->ray.o), 1e-5f);
+        EXPECT_LT(AngleBetween(cr->ray.d, ct->ray.d), Radians(.01f));
+        EXPECT_LT(std::abs(cr->weight[0] - ct->weight[0]), 1e-3f * cr->weight[0]);
+    }
+    EXPECT_LT(nMismatched, nRays / 1000);
+}
@@ -35,6 +35,8 @@ static void usage(const std::string &msg = {}) {
             R"(usage: pbrt [<options>] <filename.pbrt...>
 
 Rendering options:
+  --bvh-cache <directory>       Save built BVHs to the given directory and reuse
+                                them when rendering scenes with the same geometry.
   --cropwindow <x0,x1,y0,y1>    Specify an image crop window w.r.t. [0,1]^2.
   --debugstart <values>         Inform the Integrator where to start rendering for
                                 faster debugging. (<values> are Integrator-specific
@@ -48,6 +50,9 @@ Rendering options:
   --display-server <addr:port>  Connect to display server at given address and port
                                 to display the image as it's being rendered.
   --force-diffuse               Convert all materials to be diffuse.)
+  --frames <first,last>         Render the given range of frames, replacing '#'
+                                characters in "plymesh" filenames and the output
+                                image filename with each frame's number.
   --fullscreen                  Render fullscreen. Only supported with --interactive.)"
 #ifdef PBRT_BUILD_GPU_RENDERER
             R"(
@@ -59,6 +64,7 @@ Rendering options:
   --interactive                 Enable interactive rendering mode.
   --mse-reference-image         Filename for reference image to use for MSE computation.
   --mse-reference-out           File to write MSE error vs spp results.
+  --mse-reference-times         Also write the elapsed render time for each MSE result.
   --nthreads <num>              Use specified number of threads for rendering.
   --outfile <filename>          Write the final image to the given filename.
   --pixel <x,y>                 Render just the specified pixel.
@@ -88,6 +94,8 @@ Logging options:
                                 is "verbose", "error", or "fatal". Default: "error".
   --log-utilization             Periodically print processor and memory use in verbose-
                                 level logging.
+  --trace <filename>            Write a timeline of scene construction and rendering
+                                phases to the given file in Chrome trace format.
 
 Reformatting options:
   --format                      Print a reformatted version of the input file(s) to
@@ -125,7 +133,7 @@ int main(int argc, char *argv[]) {
             exit(1);
         };
 
-        std::string cropWindow, pixelBounds, pixel, pixelMaterial;
+        std::string cropWindow, pixelBounds, pixel, pixelMaterial, frames;
         if (ParseArg(&iter, args.end(), "cropwindow", &cropWindow, onError)) {
             std::vector<Float> c = SplitStringToFloats(cropWindow, ',');
             if (c.size() != 4) {
@@ -133,6 +141,14 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             options.cropWindow = Bounds2f(Point2f(c[0], c[2]), Point2f(c[1], c[3]));
+        } else if (ParseArg(&iter, args.end(), "frames", &frames, onError)) {
+            std::vector<int> f = SplitStringToInts(frames, ',');
+            if (f.size() != 2 || f[0] > f[1]) {
+                usage("Didn't find a valid range of two frames after --frames");
+                return 1;
+            }
+            options.frame = f[0];
+            options.lastFrame = f[1];
         } else if (ParseArg(&iter, args.end(), "pixel", &pixel, onError)) {
             std::vector<int> p = SplitStringToInts(pixel, ',');
             if (p.size() != 2) {
@@ -161,6 +177,8 @@ int main(int argc, char *argv[]) {
             ParseArg(&iter, args.end(), "gpu", &options.useGPU, onError) ||
             ParseArg(&iter, args.end(), "gpu-device", &options.gpuDevice, onError) ||
 #endif
+            ParseArg(&iter, args.end(), "bvh-cache", &options.bvhCacheDirectory,
+                     onError) ||
             ParseArg(&iter, args.end(), "debugstart", &options.debugStart, onError) ||
             ParseArg(&iter, args.end(), "disable-image-textures",
                      &options.disableImageTextures, onError) ||
@@ -187,6 +205,8 @@ int main(int argc, char *argv[]) {
                      onError) ||
             ParseArg(&iter, args.end(), "mse-reference-out", &options.mseReferenceOutput,
                      onError) ||
+            ParseArg(&iter, args.end(), "mse-reference-times", &options.mseReferenceTimes,
+                     onError) ||
             ParseArg(&iter, args.end(), "nthreads", &options.nThreads, onError) ||
             ParseArg(&iter, args.end(), "outfile", &options.imageFile, onError) ||
             ParseArg(&iter, args.end(), "pixelstats", &options.recordPixelStatistics,
@@ -198,6 +218,7 @@ int main(int argc, char *argv[]) {
             ParseArg(&iter, args.end(), "spp", &options.pixelSamples, onError) ||
             ParseArg(&iter, args.end(), "stats", &options.printStatistics, onError) ||
             ParseArg(&iter, args.end(), "toply", &toPly, onError) ||
+            ParseArg(&iter, args.end(), "trace", &options.traceFile, onError) ||
             ParseArg(&iter, args.end(), "wavefront", &options.wavefront, onError) ||
             ParseArg(&iter, args.end(), "write-partial-images",
                      &options.writePartialImages, onError) ||
@@ -241,6 +262,8 @@ int main(int argc, char *argv[]) {
                   "--mse-reference-out");
     if (!options.mseReferenceOutput.empty() && options.mseReferenceImage.empty())
         ErrorExit("Must provide MSE reference image via --mse-reference-image");
+    if (options.mseReferenceTimes && options.mseReferenceOutput.empty())
+        ErrorExit("The --mse-reference-times option requires --mse-reference-out");
 
     if (options.pixelMaterial && options.useGPU) {
         Warning("Disabling --use-gpu since --pixelmaterial was specified.");
@@ -259,6 +282,10 @@ int main(int argc, char *argv[]) {
         ErrorExit("The --interactive option is only supported with the --gpu "
                   "and --wavefront integrators.");
 
+    if (options.frame && (options.useGPU || options.wavefront))
+        ErrorExit("The --frames option is not supported with the --gpu and "
+                  "--wavefront integrators.");
+
     if (options.fullscreen && !options.interactive) {
         ErrorExit("The --fullscreen option is only supported in interactive mode");
     }
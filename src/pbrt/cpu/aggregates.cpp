@@ -5,18 +5,34 @@
 #include <pbrt/cpu/aggregates.h>
 
 #include <pbrt/interaction.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/shapes.h>
+#include <pbrt/textures.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <thread>
 #include <tuple>
+#include <type_traits>
+#include <unordered_set>
 
 namespace pbrt {
 
@@ -24,7 +40,28 @@ STAT_MEMORY_COUNTER("Memory/BVH", treeBytes);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_COUNTER("BVH/Build time (us)", bvhBuildMicroseconds);
+STAT_COUNTER("BVH/Spatial split references", spatialSplitReferences);
+STAT_INT_DISTRIBUTION("BVH/SAH cost before optimization (x1000)",
+                      sahCostBeforeOptimization);
+STAT_INT_DISTRIBUTION("BVH/SAH cost after optimization (x1000)",
+                      sahCostAfterOptimization);
+STAT_COUNTER("BVH/Cache files loaded", bvhCacheLoads);
+STAT_COUNTER("BVH/Cache files written", bvhCacheWrites);
+STAT_COUNTER("BVH/Refits", bvhRefits);
+STAT_COUNTER("BVH/Rebuilds instead of refits", bvhRefitRebuilds);
 STAT_PIXEL_COUNTER("BVH/Nodes visited", bvhNodesVisited);
+STAT_MEMORY_COUNTER("Memory/Triangle mesh BVHs", meshBVHBytes);
+STAT_COUNTER("Geometry/Triangle mesh BVH triangles", meshBVHTriangles);
+STAT_PERCENT("BVH/Triangle packet lanes used", packetTriangles, packetLanes);
+STAT_PERCENT("Intersections/Triangle mesh BVH triangle tests", nMeshTriHits,
+             nMeshTriTests);
+STAT_MEMORY_COUNTER("Memory/Instance arrays", instanceArrayBytes);
+STAT_COUNTER("Scene/Instance array instances", instanceArrayInstances);
+STAT_MEMORY_COUNTER("Memory/Motion BVHs", motionBVHBytes);
+STAT_COUNTER("BVH/Motion BVH time segments", motionBVHSegments);
+
+struct BVHBuildNode;
 
 // MortonPrimitive Definition
 struct MortonPrimitive {
@@ -98,6 +135,140 @@ struct BVHPrimitive {
     Point3f Centroid() const { return .5f * bounds.pMin + .5f * bounds.pMax; }
 };
 
+// BVH Construction Helper Definitions
+// Spans of at least this many primitives are processed in parallel, in
+// chunks of _bvhChunkSize_ primitives
+static constexpr size_t minParallelBVHPrimitives = 64 * 1024;
+static constexpr size_t bvhChunkSize = 16 * 1024;
+// Spatial splits may add up to this fraction of the number of primitives in
+// extra references
+static constexpr Float maxSpatialSplitDuplication = .3f;
+// Cost of traversing a BVH node relative to intersecting a primitive, as
+// used for the SAH during construction
+static constexpr Float bvhTraversalCost = .5f;
+// Treelets restructured during BVH optimization have this many leaves
+static constexpr int maxTreeletLeaves = 7;
+
+template <typename F>
+static void ParallelForBVHChunks(size_t n, F func) {
+    int64_t nChunks = (n + bvhChunkSize - 1) / bvhChunkSize;
+    ParallelFor(0, nChunks, [&](int64_t chunk) {
+        size_t start = chunk * bvhChunkSize;
+        func(chunk, start, std::min(n, start + bvhChunkSize));
+    });
+}
+
+static void ComputeBVHPrimitiveBounds(pstd::span<const BVHPrimitive> bvhPrimitives,
+                                      Bounds3f *bounds, Bounds3f *centroidBounds) {
+    if (bvhPrimitives.size() < minParallelBVHPrimitives) {
+        for (const BVHPrimitive &prim : bvhPrimitives) {
+            *bounds = Union(*bounds, prim.bounds);
+            *centroidBounds = Union(*centroidBounds, prim.Centroid());
+        }
+        return;
+    }
+    // Compute bounds for chunks of primitives in parallel and merge them
+    std::vector<std::pair<Bounds3f, Bounds3f>> chunkBounds(
+        (bvhPrimitives.size() + bvhChunkSize - 1) / bvhChunkSize);
+    ParallelForBVHChunks(bvhPrimitives.size(), [&](int64_t chunk, size_t start,
+                                                   size_t end) {
+        ComputeBVHPrimitiveBounds(bvhPrimitives.subspan(start, end - start),
+                                  &chunkBounds[chunk].first, &chunkBounds[chunk].second);
+    });
+    for (const auto &cb : chunkBounds) {
+        *bounds = Union(*bounds, cb.first);
+        *centroidBounds = Union(*centroidBounds, cb.second);
+    }
+}
+
+// Reorders _bvhPrimitives_ so that those for which _pred_ returns true come
+// first and returns how many there are; large spans are partitioned in parallel.
+template <typename Predicate>
+static size_t PartitionBVHPrimitives(pstd::span<BVHPrimitive> bvhPrimitives,
+                                     Predicate pred) {
+    if (bvhPrimitives.size() < minParallelBVHPrimitives)
+        return std::partition(bvhPrimitives.begin(), bvhPrimitives.end(), pred) -
+               bvhPrimitives.begin();
+    // Count primitives in each chunk that go in the first partition
+    size_t n = bvhPrimitives.size();
+    std::vector<size_t> chunkFirstCounts((n + bvhChunkSize - 1) / bvhChunkSize, 0);
+    ParallelForBVHChunks(n, [&](int64_t chunk, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i)
+            chunkFirstCounts[chunk] += pred(bvhPrimitives[i]);
+    });
+
+    // Compute each chunk's starting offsets in the two partitions
+    std::vector<size_t> firstOffsets(chunkFirstCounts.size()),
+        secondOffsets(chunkFirstCounts.size());
+    size_t nFirst = 0;
+    for (size_t count : chunkFirstCounts)
+        nFirst += count;
+    for (size_t chunk = 0, first = 0, second = nFirst; chunk < chunkFirstCounts.size();
+         ++chunk) {
+        firstOffsets[chunk] = first;
+        secondOffsets[chunk] = second;
+        first += chunkFirstCounts[chunk];
+        second += std::min(bvhChunkSize, n - chunk * bvhChunkSize) -
+                  chunkFirstCounts[chunk];
+    }
+
+    // Scatter primitives to temporary buffer and copy them back
+    std::vector<BVHPrimitive> partitioned(n);
+    ParallelForBVHChunks(n, [&](int64_t chunk, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i)
+            partitioned[pred(bvhPrimitives[i]) ? firstOffsets[chunk]++
+                                               : secondOffsets[chunk]++] =
+                bvhPrimitives[i];
+    });
+    ParallelForBVHChunks(n, [&](int64_t chunk, size_t start, size_t end) {
+        std::copy(partitioned.begin() + start, partitioned.begin() + end,
+                  bvhPrimitives.begin() + start);
+    });
+    return nFirst;
+}
+
+// Returns the bounds of the part of the triangle inside _box_, found by
+// clipping the triangle against each of the box's faces.
+static Bounds3f ClipTriangleBounds(const TriangleMesh *mesh, int triIndex,
+                                   const Bounds3f &box) {
+    // A triangle clipped by six planes has at most nine vertices
+    Point3f poly[9], clipped[9];
+    const int *v = &mesh->vertexIndices[3 * triIndex];
+    int nVertices = 3;
+    for (int i = 0; i < 3; ++i)
+        poly[i] = mesh->p[v[i]];
+
+    for (int axis = 0; axis < 3; ++axis)
+        for (int side = 0; side < 2; ++side) {
+            // Clip polygon against plane of _box_ along _axis_
+            Float plane = side == 0 ? box.pMin[axis] : box.pMax[axis];
+            auto inside = [&](Point3f p) {
+                return side == 0 ? p[axis] >= plane : p[axis] <= plane;
+            };
+            int nClipped = 0;
+            for (int i = 0; i < nVertices; ++i) {
+                Point3f p0 = poly[i], p1 = poly[(i + 1) % nVertices];
+                if (inside(p0))
+                    clipped[nClipped++] = p0;
+                if (inside(p0) != inside(p1)) {
+                    Float t = (plane - p0[axis]) / (p1[axis] - p0[axis]);
+                    Point3f pt = Lerp(t, p0, p1);
+                    pt[axis] = plane;
+                    clipped[nClipped++] = pt;
+                }
+            }
+            nVertices = nClipped;
+            std::copy(clipped, clipped + nClipped, poly);
+        }
+
+    // Bound clipped polygon, limiting the result to _box_ to account for
+    // round-off error
+    Bounds3f bounds;
+    for (int i = 0; i < nVertices; ++i)
+        bounds = Union(bounds, poly[i]);
+    return nVertices > 0 ? Intersect(bounds, box) : Bounds3f();
+}
+
 // BVHBuildNode Definition
 struct BVHBuildNode {
     // BVHBuildNode Public Methods
@@ -106,6 +277,7 @@ struct BVHBuildNode {
         nPrimitives = n;
         bounds = b;
         children[0] = children[1] = nullptr;
+        nSubtreeNodes = 1;
         ++leafNodes;
         ++totalLeafNodes;
         totalPrimitives += n;
@@ -117,12 +289,24 @@ struct BVHBuildNode {
         bounds = Union(c0->bounds, c1->bounds);
         splitAxis = axis;
         nPrimitives = 0;
+        nSubtreeNodes = 1 + c0->nSubtreeNodes + c1->nSubtreeNodes;
         ++interiorNodes;
     }
 
     Bounds3f bounds;
     BVHBuildNode *children[2];
     int splitAxis, firstPrimOffset, nPrimitives;
+    // Number of nodes in the subtree rooted at this node, including it
+    int nSubtreeNodes;
+    // SAH cost of the subtree, only initialized during BVH optimization
+    Float cost;
+};
+
+// BVHSpatialSplit Definition
+struct BVHSpatialSplit {
+    int axis;
+    Float position;
+    Float cost = Infinity;
 };
 
 // LinearBVHNode Definition
@@ -136,20 +320,332 @@ struct alignas(32) LinearBVHNode {
     uint8_t axis;          // interior node: xyz
 };
 
-// BVHAggregate Method Definitions
-BVHAggregate::BVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
-                           SplitMethod splitMethod)
-    : maxPrimsInNode(std::min(255, maxPrimsInNode)),
-      primitives(std::move(prims)),
-      splitMethod(splitMethod) {
-    CHECK(!primitives.empty());
-    // Build BVH from _primitives_
-    // Initialize _bvhPrimitives_ array for primitives
-    std::vector<BVHPrimitive> bvhPrimitives(primitives.size());
-    for (size_t i = 0; i < primitives.size(); ++i)
-        bvhPrimitives[i] = BVHPrimitive(i, primitives[i].Bounds());
+// QuantizedBVHNode Definition
+template <typename T>
+struct QuantizedBVHNode {
+    // QuantizedBVHNode Public Methods
+    static Float Dequantize(int q, Float min, Float max) {
+        constexpr Float invQuantMax = Float(1) / std::numeric_limits<T>::max();
+        return Lerp(q * invQuantMax, min, max);
+    }
+
+    Bounds3f Bounds(const Bounds3f &parentBounds) const {
+        Bounds3f b;
+        for (int c = 0; c < 3; ++c) {
+            b.pMin[c] = Dequantize(qMin[c], parentBounds.pMin[c], parentBounds.pMax[c]);
+            b.pMax[c] = Dequantize(qMax[c], parentBounds.pMin[c], parentBounds.pMax[c]);
+        }
+        return b;
+    }
 
-    // Build BVH for primitives using _bvhPrimitives_
+    // Bounds are stored relative to the parent node's dequantized bounds
+    T qMin[3], qMax[3];
+    union {
+        int primitivesOffset;   // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nPrimitives;  // 0 -> interior node
+    uint8_t axis;          // interior node: xyz
+};
+
+// BVH Node Bounds Functions
+static const Bounds3f &NodeBounds(const LinearBVHNode &node, const Bounds3f &) {
+    return node.bounds;
+}
+
+template <typename T>
+static Bounds3f NodeBounds(const QuantizedBVHNode<T> &node,
+                           const Bounds3f &parentBounds) {
+    return node.Bounds(parentBounds);
+}
+
+// Initializes the quantized node at _nodeIndex_ and its descendants so that
+// each one's dequantized bounds conservatively bound the original node's.
+template <typename T>
+static void QuantizeBVHNodes(const LinearBVHNode *nodes, int nodeIndex,
+                             const Bounds3f &parentBounds, QuantizedBVHNode<T> *qNodes) {
+    const LinearBVHNode &node = nodes[nodeIndex];
+    QuantizedBVHNode<T> &qNode = qNodes[nodeIndex];
+    constexpr int quantMax = std::numeric_limits<T>::max();
+    for (int c = 0; c < 3; ++c) {
+        // Quantize node bounds along dimension _c_, rounding outward
+        Float pMin = parentBounds.pMin[c], pMax = parentBounds.pMax[c];
+        int lo = 0, hi = quantMax;
+        if (pMax > pMin) {
+            Float scale = quantMax / (pMax - pMin);
+            lo = int(std::floor((node.bounds.pMin[c] - pMin) * scale));
+            hi = int(std::ceil((node.bounds.pMax[c] - pMin) * scale));
+            lo = Clamp(lo, 0, quantMax);
+            hi = Clamp(hi, 0, quantMax);
+        }
+        // Fix up rounding error in the dequantized values
+        using Node = QuantizedBVHNode<T>;
+        while (lo > 0 && Node::Dequantize(lo, pMin, pMax) > node.bounds.pMin[c])
+            --lo;
+        while (hi < quantMax && Node::Dequantize(hi, pMin, pMax) < node.bounds.pMax[c])
+            ++hi;
+        qNode.qMin[c] = lo;
+        qNode.qMax[c] = hi;
+    }
+    qNode.nPrimitives = node.nPrimitives;
+    qNode.axis = node.axis;
+    if (node.nPrimitives > 0)
+        qNode.primitivesOffset = node.primitivesOffset;
+    else {
+        // Quantize children relative to this node's dequantized bounds
+        qNode.secondChildOffset = node.secondChildOffset;
+        Bounds3f bounds = qNode.Bounds(parentBounds);
+        DCHECK(Inside(node.bounds.pMin, bounds) && Inside(node.bounds.pMax, bounds));
+        QuantizeBVHNodes(nodes, nodeIndex + 1, bounds, qNodes);
+        QuantizeBVHNodes(nodes, node.secondChildOffset, bounds, qNodes);
+    }
+}
+
+// BVHBuilder Definition
+class BVHBuilder {
+  public:
+    using SplitMethod = BVHAggregate::SplitMethod;
+
+    // BVHBuilder Public Methods
+    BVHBuilder(int maxPrimsInNode, SplitMethod splitMethod)
+        : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod) {}
+
+    // Allows SAH builds to split primitives' references at planes (as in the
+    // SBVH), creating up to _maxDuplication_ times as many additional
+    // references as there are primitives. If provided, _clipPrimitive_ returns
+    // the bounds of the part of a primitive inside the given box.
+    void EnableSpatialSplits(
+        Float maxDuplication,
+        std::function<Bounds3f(size_t, const Bounds3f &)> clipPrimitive = {}) {
+        this->maxDuplication = maxDuplication;
+        this->clipPrimitive = std::move(clipPrimitive);
+    }
+
+    // Makes the SAH cost of a leaf, including the would-be leaves on either
+    // side of a candidate split, proportional to the number of _width_-wide
+    // packets that its primitives fill rather than to the number of
+    // primitives, for leaves that are intersected a packet at a time.
+    void SetLeafPacketWidth(int width) { leafPacketWidth = width; }
+
+    // Runs up to _maxPasses_ passes of treelet restructuring over the built
+    // BVH, stopping early once _maxSeconds_ (if nonzero) have elapsed or a
+    // pass stops improving the tree's SAH cost.
+    void EnableOptimization(int maxPasses, Float maxSeconds) {
+        optimizationPasses = maxPasses;
+        optimizationSeconds = maxSeconds;
+    }
+
+    // Saves built BVHs to files in _directory_, named using a hash of the
+    // primitives' bounds and the build parameters, and maps BVHs from those
+    // files rather than building them again when possible. BVHs built with
+    // spatial splits that clip primitives aren't cached, since they depend on
+    // more than the primitives' bounds, and neither are ones optimized under
+    // a time budget, since they depend on how fast the optimization ran.
+    void EnableCache(std::string directory) { cacheDirectory = std::move(directory); }
+
+    // Returns the flattened BVH nodes; leaves refer to ranges of _orderedPrims_,
+    // which holds the _primitiveIndex_ values of _bvhPrimitives_.
+    LinearBVHNode *Build(std::vector<BVHPrimitive> bvhPrimitives,
+                         std::vector<int> *orderedPrims, int *nNodes);
+
+    // Returns the mapping of the cache file that the nodes returned by Build()
+    // were mapped from, which is empty if they were built and allocated.
+    BVHCacheMapping CacheMapping() const { return cacheMapping; }
+
+  private:
+    // BVHBuilder Private Methods
+    BVHBuildNode *buildRecursive(ThreadLocal<Allocator> &threadAllocators,
+                                 pstd::span<BVHPrimitive> bvhPrimitives,
+                                 std::atomic<int> *totalNodes,
+                                 std::atomic<int> *orderedPrimsOffset,
+                                 std::vector<int> &orderedPrims);
+    BVHBuildNode *buildHLBVH(Allocator alloc,
+                             const std::vector<BVHPrimitive> &primitiveInfo,
+                             std::atomic<int> *totalNodes,
+                             std::vector<int> &orderedPrims);
+    BVHBuildNode *emitLBVH(BVHBuildNode *&buildNodes,
+                           const std::vector<BVHPrimitive> &primitiveInfo,
+                           MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
+                           std::vector<int> &orderedPrims,
+                           std::atomic<int> *orderedPrimsOffset, int bitIndex);
+    BVHBuildNode *buildUpperSAH(Allocator alloc,
+                                std::vector<BVHBuildNode *> &treeletRoots, int start,
+                                int end, std::atomic<int> *totalNodes) const;
+    BVHSpatialSplit findSpatialSplit(pstd::span<const BVHPrimitive> bvhPrimitives,
+                                     const Bounds3f &bounds) const;
+    void splitReferences(pstd::span<const BVHPrimitive> bvhPrimitives,
+                         const BVHSpatialSplit &split, std::vector<BVHPrimitive> *below,
+                         std::vector<BVHPrimitive> *above) const;
+    Bounds3f clipReference(const BVHPrimitive &prim, int axis, Float min,
+                           Float max) const;
+    // Returns the number of packets that a leaf with _nPrimitives_ primitives
+    // is intersected as, which is the SAH cost of testing its primitives
+    int packetCount(int nPrimitives) const {
+        return (nPrimitives + leafPacketWidth - 1) / leafPacketWidth;
+    }
+    // Computes SAH costs for the nodes of a BVH and returns the root's
+    Float computeSAHCost(BVHBuildNode *node) const;
+    void optimize(BVHBuildNode *root);
+    void optimizeRecursive(BVHBuildNode *node, const Timer &timer);
+    void restructureTreelet(BVHBuildNode *root);
+    void flattenBVH(BVHBuildNode *node, int offset);
+    std::string cacheFilename(const std::vector<BVHPrimitive> &bvhPrimitives) const;
+
+    // BVHBuilder Private Members
+    int maxPrimsInNode;
+    SplitMethod splitMethod;
+    LinearBVHNode *nodes = nullptr;
+    Float maxDuplication = 0;
+    std::function<Bounds3f(size_t, const Bounds3f &)> clipPrimitive;
+    // Spatial splits are only considered for nodes where the children from
+    // the best object split overlap by more than this surface area
+    Float minSpatialSplitOverlap = 0;
+    std::atomic<int64_t> spatialSplitBudget{0};
+    int optimizationPasses = 0;
+    Float optimizationSeconds = 0;
+    int leafPacketWidth = 1;
+    std::string cacheDirectory;
+    BVHCacheMapping cacheMapping;
+};
+
+// BVHCacheHeader Definition
+// BVH cache files start with this header, which is followed by the BVH's
+// _nNodes_ nodes and then its _nOrderedPrims_ ordered primitive indices.
+struct alignas(64) BVHCacheHeader {
+    char magic[8];
+    uint32_t version, nodeSize;
+    int64_t nPrimitives, nNodes, nOrderedPrims;
+    // Hash of everything in the file after the header
+    uint64_t contentsHash;
+};
+
+static constexpr char bvhCacheMagic[8] = "pbrtBVH";
+static constexpr uint32_t bvhCacheVersion = 1;
+
+// BVH Cache Functions
+// Hashes a buffer of _size_ bytes, in parallel for large buffers
+static uint64_t HashBVHCacheData(const void *ptr, size_t size) {
+    constexpr size_t chunkBytes = 1024 * 1024;
+    std::vector<uint64_t> chunkHashes((size + chunkBytes - 1) / chunkBytes);
+    ParallelFor(0, chunkHashes.size(), [&](int64_t i) {
+        size_t start = i * chunkBytes;
+        chunkHashes[i] = HashBuffer((const uint8_t *)ptr + start,
+                                    std::min(chunkBytes, size - start));
+    });
+    return HashBuffer(chunkHashes.data(), chunkHashes.size() * sizeof(uint64_t));
+}
+
+// Returns the BVH nodes mapped from the cache file, or nullptr if it doesn't
+// exist or doesn't hold a valid BVH over _nPrimitives_ primitives.
+static LinearBVHNode *LoadCachedBVH(const std::string &filename, size_t nPrimitives,
+                                    std::vector<int> *orderedPrims, int *nNodes,
+                                    BVHCacheMapping *mapping) {
+    size_t length;
+    uint8_t *ptr = (uint8_t *)MapFile(filename, &length);
+    if (!ptr)
+        return nullptr;
+    TRACE_SCOPE("Load cached BVH", "bytes", length);
+
+    // Make sure that the file is complete, uncorrupted, and for this BVH
+    const BVHCacheHeader *header = (const BVHCacheHeader *)ptr;
+    const uint8_t *contents = ptr + sizeof(BVHCacheHeader);
+    bool valid =
+        length >= sizeof(BVHCacheHeader) &&
+        std::memcmp(header->magic, bvhCacheMagic, sizeof(bvhCacheMagic)) == 0 &&
+        header->version == bvhCacheVersion &&
+        header->nodeSize == sizeof(LinearBVHNode) &&
+        header->nPrimitives == int64_t(nPrimitives) && header->nNodes > 0 &&
+        header->nOrderedPrims >= int64_t(nPrimitives) &&
+        length == sizeof(BVHCacheHeader) + header->nNodes * sizeof(LinearBVHNode) +
+                      header->nOrderedPrims * sizeof(int) &&
+        HashBVHCacheData(contents, length - sizeof(BVHCacheHeader)) ==
+            header->contentsHash;
+    if (valid) {
+        const int *prims =
+            (const int *)(contents + header->nNodes * sizeof(LinearBVHNode));
+        orderedPrims->assign(prims, prims + header->nOrderedPrims);
+        for (int index : *orderedPrims)
+            valid &= index >= 0 && index < int64_t(nPrimitives);
+    }
+    if (!valid) {
+        Warning("%s: ignoring invalid BVH cache file.", filename);
+        UnmapFile(ptr, length);
+        return nullptr;
+    }
+
+    ++bvhCacheLoads;
+    LOG_VERBOSE("Mapped BVH with %d nodes from %s", header->nNodes, filename);
+    *nNodes = header->nNodes;
+    *mapping = BVHCacheMapping{ptr, length};
+    return (LinearBVHNode *)contents;
+}
+
+static void WriteCachedBVH(const std::string &filename, size_t nPrimitives,
+                           const LinearBVHNode *nodes, int nNodes,
+                           const std::vector<int> &orderedPrims) {
+    TRACE_SCOPE("Write cached BVH", "nodes", nNodes);
+    size_t nodeBytes = nNodes * sizeof(LinearBVHNode);
+    std::string contents(sizeof(BVHCacheHeader) + nodeBytes +
+                             orderedPrims.size() * sizeof(int),
+                         '\0');
+    BVHCacheHeader header;
+    std::memcpy(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic));
+    header.version = bvhCacheVersion;
+    header.nodeSize = sizeof(LinearBVHNode);
+    header.nPrimitives = nPrimitives;
+    header.nNodes = nNodes;
+    header.nOrderedPrims = orderedPrims.size();
+    char *ptr = contents.data() + sizeof(BVHCacheHeader);
+    std::memcpy(ptr, nodes, nodeBytes);
+    std::memcpy(ptr + nodeBytes, orderedPrims.data(), orderedPrims.size() * sizeof(int));
+    header.contentsHash = HashBVHCacheData(ptr, contents.size() - sizeof(BVHCacheHeader));
+    std::memcpy(contents.data(), &header, sizeof(header));
+
+    // Write to a temporary file first so that other processes never see a
+    // partially written cache file
+    uint64_t threadHash = std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::string tempFilename = StringPrintf(
+        "%s.%d.tmp", filename,
+        Hash(threadHash, std::chrono::steady_clock::now().time_since_epoch().count()) &
+            0xffffff);
+    if (WriteFileContents(tempFilename, contents) &&
+        std::rename(tempFilename.c_str(), filename.c_str()) == 0)
+        ++bvhCacheWrites;
+    else {
+        Warning("%s: unable to write BVH cache file.", filename);
+        RemoveFile(tempFilename);
+    }
+}
+
+// BVHBuilder Method Definitions
+std::string BVHBuilder::cacheFilename(
+    const std::vector<BVHPrimitive> &bvhPrimitives) const {
+    // Hash primitives' bounds along with all of the parameters and cost
+    // constants that affect the BVH
+    uint64_t primitivesHash = HashBVHCacheData(
+        bvhPrimitives.data(), bvhPrimitives.size() * sizeof(BVHPrimitive));
+    uint64_t hash = Hash(primitivesHash, maxPrimsInNode, splitMethod, maxDuplication,
+                         optimizationPasses, optimizationSeconds, leafPacketWidth,
+                         bvhTraversalCost, maxTreeletLeaves);
+    char name[32];
+    std::snprintf(name, sizeof(name), "pbrt-bvh-%016" PRIx64 ".bin", hash);
+    return cacheDirectory + "/" + name;
+}
+
+LinearBVHNode *BVHBuilder::Build(std::vector<BVHPrimitive> bvhPrimitives,
+                                 std::vector<int> *orderedPrims, int *nNodes) {
+    // Map BVH from cache file if it has been built before
+    std::string filename;
+    cacheMapping = BVHCacheMapping();
+    if (!cacheDirectory.empty() && !clipPrimitive &&
+        !(optimizationPasses > 0 && optimizationSeconds > 0)) {
+        filename = cacheFilename(bvhPrimitives);
+        if (LinearBVHNode *cachedNodes = LoadCachedBVH(
+                filename, bvhPrimitives.size(), orderedPrims, nNodes, &cacheMapping))
+            return cachedNodes;
+    }
+
+    Timer timer;
     // Declare _Allocator_s used for BVH construction
     pstd::pmr::monotonic_buffer_resource resource;
     Allocator alloc(&resource);
@@ -161,63 +657,92 @@ BVHAggregate::BVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
         return Allocator(ptr);
     });
 
-    std::vector<Primitive> orderedPrims(primitives.size());
+    // Allocate space for primitive references, including ones added by spatial splits
+    if (maxDuplication > 0 && splitMethod == SplitMethod::SAH) {
+        Bounds3f bounds, centroidBounds;
+        ComputeBVHPrimitiveBounds(bvhPrimitives, &bounds, &centroidBounds);
+        minSpatialSplitOverlap = 1e-5f * bounds.SurfaceArea();
+        spatialSplitBudget = int64_t(maxDuplication * bvhPrimitives.size());
+    }
+    size_t nPrimitives = bvhPrimitives.size();
+    orderedPrims->resize(nPrimitives + spatialSplitBudget);
     BVHBuildNode *root;
     // Build BVH according to selected _splitMethod_
     std::atomic<int> totalNodes{0};
     if (splitMethod == SplitMethod::HLBVH) {
-        root = buildHLBVH(alloc, bvhPrimitives, &totalNodes, orderedPrims);
+        root = buildHLBVH(alloc, bvhPrimitives, &totalNodes, *orderedPrims);
     } else {
         std::atomic<int> orderedPrimsOffset{0};
         root = buildRecursive(threadAllocators, pstd::span<BVHPrimitive>(bvhPrimitives),
-                              &totalNodes, &orderedPrimsOffset, orderedPrims);
-        CHECK_EQ(orderedPrimsOffset.load(), orderedPrims.size());
+                              &totalNodes, &orderedPrimsOffset, *orderedPrims);
+        CHECK_LE(orderedPrimsOffset.load(), orderedPrims->size());
+        orderedPrims->resize(orderedPrimsOffset);
+        spatialSplitReferences += orderedPrims->size() - nPrimitives;
     }
-    primitives.swap(orderedPrims);
+
+    if (optimizationPasses > 0)
+        optimize(root);
 
     // Convert BVH into compact representation in _nodes_ array
     bvhPrimitives.resize(0);
-    LOG_VERBOSE("BVH created with %d nodes for %d primitives (%.2f MB)",
-                totalNodes.load(), (int)primitives.size(),
-                float(totalNodes.load() * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
     nodes = new LinearBVHNode[totalNodes];
-    int offset = 0;
-    flattenBVH(root, &offset);
-    CHECK_EQ(totalNodes.load(), offset);
+    flattenBVH(root, 0);
+    CHECK_EQ(totalNodes.load(), root->nSubtreeNodes);
+    *nNodes = totalNodes;
+    bvhBuildMicroseconds += int64_t(1e6 * timer.ElapsedSeconds());
+    if (!filename.empty())
+        WriteCachedBVH(filename, nPrimitives, nodes, *nNodes, *orderedPrims);
+    return nodes;
 }
 
-BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocators,
-                                           pstd::span<BVHPrimitive> bvhPrimitives,
-                                           std::atomic<int> *totalNodes,
-                                           std::atomic<int> *orderedPrimsOffset,
-                                           std::vector<Primitive> &orderedPrims) {
+BVHBuildNode *BVHBuilder::buildRecursive(ThreadLocal<Allocator> &threadAllocators,
+                                         pstd::span<BVHPrimitive> bvhPrimitives,
+                                         std::atomic<int> *totalNodes,
+                                         std::atomic<int> *orderedPrimsOffset,
+                                         std::vector<int> &orderedPrims) {
     DCHECK_NE(bvhPrimitives.size(), 0);
     Allocator alloc = threadAllocators.Get();
     BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
     // Initialize _BVHBuildNode_ for primitive range
     ++*totalNodes;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (const auto &prim : bvhPrimitives)
-        bounds = Union(bounds, prim.bounds);
+    // Compute bounds of all primitives and of their centroids in BVH node
+    Bounds3f bounds, centroidBounds;
+    ComputeBVHPrimitiveBounds(bvhPrimitives, &bounds, &centroidBounds);
+
+    // Returns the roots of BVHs built for two spans of primitives
+    auto buildChildren = [&](pstd::span<BVHPrimitive> prims0,
+                             pstd::span<BVHPrimitive> prims1) {
+        std::array<BVHBuildNode *, 2> children;
+        if (prims0.size() + prims1.size() > 4 * 1024) {
+            // Recursively build child BVHs in parallel
+            ParallelFor(0, 2, [&](int i) {
+                children[i] =
+                    buildRecursive(threadAllocators, i == 0 ? prims0 : prims1,
+                                   totalNodes, orderedPrimsOffset, orderedPrims);
+            });
+
+        } else {
+            // Recursively build child BVHs sequentially
+            children[0] = buildRecursive(threadAllocators, prims0, totalNodes,
+                                         orderedPrimsOffset, orderedPrims);
+            children[1] = buildRecursive(threadAllocators, prims1, totalNodes,
+                                         orderedPrimsOffset, orderedPrims);
+        }
+        return children;
+    };
 
     if (bounds.SurfaceArea() == 0 || bvhPrimitives.size() == 1) {
         // Create leaf _BVHBuildNode_
         int firstPrimOffset = orderedPrimsOffset->fetch_add(bvhPrimitives.size());
         for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
             int index = bvhPrimitives[i].primitiveIndex;
-            orderedPrims[firstPrimOffset + i] = primitives[index];
+            orderedPrims[firstPrimOffset + i] = index;
         }
         node->InitLeaf(firstPrimOffset, bvhPrimitives.size(), bounds);
         return node;
 
     } else {
-        // Compute bound of primitive centroids and choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (const auto &prim : bvhPrimitives)
-            centroidBounds = Union(centroidBounds, prim.Centroid());
+        // Choose split dimension _dim_ using bound of primitive centroids
         int dim = centroidBounds.MaxDimension();
 
         // Partition primitives into two sets and build children
@@ -226,7 +751,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
             int firstPrimOffset = orderedPrimsOffset->fetch_add(bvhPrimitives.size());
             for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
                 int index = bvhPrimitives[i].primitiveIndex;
-                orderedPrims[firstPrimOffset + i] = primitives[index];
+                orderedPrims[firstPrimOffset + i] = index;
             }
             node->InitLeaf(firstPrimOffset, bvhPrimitives.size(), bounds);
             return node;
@@ -238,15 +763,14 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
             case SplitMethod::Middle: {
                 // Partition primitives through node's midpoint
                 Float pmid = (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
-                auto midIter = std::partition(bvhPrimitives.begin(), bvhPrimitives.end(),
-                                              [dim, pmid](const BVHPrimitive &pi) {
-                                                  return pi.Centroid()[dim] < pmid;
-                                              });
-                mid = midIter - bvhPrimitives.begin();
+                mid = PartitionBVHPrimitives(bvhPrimitives,
+                                             [dim, pmid](const BVHPrimitive &pi) {
+                                                 return pi.Centroid()[dim] < pmid;
+                                             });
                 // For lots of prims with large overlapping bounding boxes, this
                 // may fail to partition; in that case do not break and fall through
                 // to EqualCounts.
-                if (midIter != bvhPrimitives.begin() && midIter != bvhPrimitives.end())
+                if (mid != 0 && mid != int(bvhPrimitives.size()))
                     break;
             }
             case SplitMethod::EqualCounts: {
@@ -278,14 +802,38 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
                     BVHSplitBucket buckets[nBuckets];
 
                     // Initialize _BVHSplitBucket_ for SAH partition buckets
-                    for (const auto &prim : bvhPrimitives) {
-                        int b = nBuckets * centroidBounds.Offset(prim.Centroid())[dim];
-                        if (b == nBuckets)
-                            b = nBuckets - 1;
-                        DCHECK_GE(b, 0);
-                        DCHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds = Union(buckets[b].bounds, prim.bounds);
+                    auto initBuckets = [&](pstd::span<const BVHPrimitive> prims,
+                                           BVHSplitBucket *primBuckets) {
+                        for (const auto &prim : prims) {
+                            int b =
+                                nBuckets * centroidBounds.Offset(prim.Centroid())[dim];
+                            if (b == nBuckets)
+                                b = nBuckets - 1;
+                            DCHECK_GE(b, 0);
+                            DCHECK_LT(b, nBuckets);
+                            primBuckets[b].count++;
+                            primBuckets[b].bounds =
+                                Union(primBuckets[b].bounds, prim.bounds);
+                        }
+                    };
+                    if (bvhPrimitives.size() < minParallelBVHPrimitives)
+                        initBuckets(bvhPrimitives, buckets);
+                    else {
+                        // Bucket chunks of primitives in parallel and merge buckets
+                        std::vector<std::array<BVHSplitBucket, nBuckets>> chunkBuckets(
+                            (bvhPrimitives.size() + bvhChunkSize - 1) / bvhChunkSize);
+                        ParallelForBVHChunks(
+                            bvhPrimitives.size(),
+                            [&](int64_t chunk, size_t start, size_t end) {
+                                initBuckets(bvhPrimitives.subspan(start, end - start),
+                                            chunkBuckets[chunk].data());
+                            });
+                        for (const auto &cb : chunkBuckets)
+                            for (int b = 0; b < nBuckets; ++b) {
+                                buckets[b].count += cb[b].count;
+                                buckets[b].bounds =
+                                    Union(buckets[b].bounds, cb[b].bounds);
+                            }
                     }
 
                     // Compute costs for splitting after each bucket
@@ -297,7 +845,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
                     for (int i = 0; i < nSplits; ++i) {
                         boundBelow = Union(boundBelow, buckets[i].bounds);
                         countBelow += buckets[i].count;
-                        costs[i] += countBelow * boundBelow.SurfaceArea();
+                        costs[i] += packetCount(countBelow) * boundBelow.SurfaceArea();
                     }
 
                     // Finish initializing _costs_ using a backward scan over splits
@@ -306,7 +854,8 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
                     for (int i = nSplits; i >= 1; --i) {
                         boundAbove = Union(boundAbove, buckets[i].bounds);
                         countAbove += buckets[i].count;
-                        costs[i - 1] += countAbove * boundAbove.SurfaceArea();
+                        costs[i - 1] +=
+                            packetCount(countAbove) * boundAbove.SurfaceArea();
                     }
 
                     // Find bucket to split at that minimizes SAH metric
@@ -320,29 +869,63 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
                             minCostSplitBucket = i;
                         }
                     }
+                    // Consider a spatial split if object split's children overlap
+                    BVHSpatialSplit spatialSplit;
+                    if (spatialSplitBudget > 0) {
+                        Bounds3f bounds0, bounds1;
+                        for (int i = 0; i < nBuckets; ++i)
+                            if (i <= minCostSplitBucket)
+                                bounds0 = Union(bounds0, buckets[i].bounds);
+                            else
+                                bounds1 = Union(bounds1, buckets[i].bounds);
+                        Bounds3f overlap = Intersect(bounds0, bounds1);
+                        if (!overlap.IsDegenerate() &&
+                            overlap.SurfaceArea() > minSpatialSplitOverlap)
+                            spatialSplit = findSpatialSplit(bvhPrimitives, bounds);
+                    }
+
                     // Compute leaf cost and SAH split cost for chosen split
-                    Float leafCost = bvhPrimitives.size();
-                    minCost = 1.f / 2.f + minCost / bounds.SurfaceArea();
+                    Float leafCost = packetCount(bvhPrimitives.size());
+                    Float splitCost = std::min(minCost, spatialSplit.cost);
+                    splitCost = bvhTraversalCost + splitCost / bounds.SurfaceArea();
 
                     // Either create leaf or split primitives at selected SAH bucket
-                    if (bvhPrimitives.size() > maxPrimsInNode || minCost < leafCost) {
-                        auto midIter = std::partition(
-                            bvhPrimitives.begin(), bvhPrimitives.end(),
-                            [=](const BVHPrimitive &bp) {
+                    if (bvhPrimitives.size() > maxPrimsInNode || splitCost < leafCost) {
+                        if (spatialSplit.cost < minCost) {
+                            // Split primitive references at spatial split plane
+                            std::vector<BVHPrimitive> below, above;
+                            splitReferences(bvhPrimitives, spatialSplit, &below, &above);
+                            int64_t nAdded =
+                                below.size() + above.size() - bvhPrimitives.size();
+                            if (!below.empty() && !above.empty() &&
+                                spatialSplitBudget.fetch_sub(nAdded) >= nAdded) {
+                                // Build children for spatial split references
+                                std::array<BVHBuildNode *, 2> children =
+                                    buildChildren(pstd::MakeSpan(below),
+                                                  pstd::MakeSpan(above));
+                                node->InitInterior(spatialSplit.axis, children[0],
+                                                   children[1]);
+                                return node;
+                            }
+                            // Fall back to object split if over the reference budget
+                            if (!below.empty() && !above.empty())
+                                spatialSplitBudget += nAdded;
+                        }
+                        mid = PartitionBVHPrimitives(
+                            bvhPrimitives, [=](const BVHPrimitive &bp) {
                                 int b =
                                     nBuckets * centroidBounds.Offset(bp.Centroid())[dim];
                                 if (b == nBuckets)
                                     b = nBuckets - 1;
                                 return b <= minCostSplitBucket;
                             });
-                        mid = midIter - bvhPrimitives.begin();
                     } else {
                         // Create leaf _BVHBuildNode_
                         int firstPrimOffset =
                             orderedPrimsOffset->fetch_add(bvhPrimitives.size());
                         for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
                             int index = bvhPrimitives[i].primitiveIndex;
-                            orderedPrims[firstPrimOffset + i] = primitives[index];
+                            orderedPrims[firstPrimOffset + i] = index;
                         }
                         node->InitLeaf(firstPrimOffset, bvhPrimitives.size(), bounds);
                         return node;
@@ -353,31 +936,9 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
             }
             }
 
-            BVHBuildNode *children[2];
             // Recursively build BVHs for _children_
-            if (bvhPrimitives.size() > 128 * 1024) {
-                // Recursively build child BVHs in parallel
-                ParallelFor(0, 2, [&](int i) {
-                    if (i == 0)
-                        children[0] = buildRecursive(
-                            threadAllocators, bvhPrimitives.subspan(0, mid), totalNodes,
-                            orderedPrimsOffset, orderedPrims);
-                    else
-                        children[1] =
-                            buildRecursive(threadAllocators, bvhPrimitives.subspan(mid),
-                                           totalNodes, orderedPrimsOffset, orderedPrims);
-                });
-
-            } else {
-                // Recursively build child BVHs sequentially
-                children[0] =
-                    buildRecursive(threadAllocators, bvhPrimitives.subspan(0, mid),
-                                   totalNodes, orderedPrimsOffset, orderedPrims);
-                children[1] =
-                    buildRecursive(threadAllocators, bvhPrimitives.subspan(mid),
-                                   totalNodes, orderedPrimsOffset, orderedPrims);
-            }
-
+            std::array<BVHBuildNode *, 2> children = buildChildren(
+                bvhPrimitives.subspan(0, mid), bvhPrimitives.subspan(mid));
             node->InitInterior(dim, children[0], children[1]);
         }
     }
@@ -385,10 +946,146 @@ BVHBuildNode *BVHAggregate::buildRecursive(ThreadLocal<Allocator> &threadAllocat
     return node;
 }
 
-BVHBuildNode *BVHAggregate::buildHLBVH(Allocator alloc,
-                                       const std::vector<BVHPrimitive> &bvhPrimitives,
-                                       std::atomic<int> *totalNodes,
-                                       std::vector<Primitive> &orderedPrims) {
+Bounds3f BVHBuilder::clipReference(const BVHPrimitive &prim, int axis, Float min,
+                                   Float max) const {
+    Bounds3f box = prim.bounds;
+    box.pMin[axis] = std::max(box.pMin[axis], min);
+    box.pMax[axis] = std::min(box.pMax[axis], max);
+    if (box.IsDegenerate() || !clipPrimitive)
+        return box;
+    return clipPrimitive(prim.primitiveIndex, box);
+}
+
+BVHSpatialSplit BVHBuilder::findSpatialSplit(pstd::span<const BVHPrimitive> bvhPrimitives,
+                                             const Bounds3f &bounds) const {
+    // Bin clipped primitive references along node bounds' largest dimension
+    constexpr int nBins = 12;
+    struct SpatialBin {
+        Bounds3f bounds;
+        int nEntries = 0, nExits = 0;
+    };
+    SpatialBin bins[nBins];
+    int axis = bounds.MaxDimension();
+    Float min = bounds.pMin[axis], width = bounds.pMax[axis] - bounds.pMin[axis];
+    auto binIndex = [&](Float v) {
+        return Clamp(int(nBins * (v - min) / width), 0, nBins - 1);
+    };
+    auto binPlane = [&](int b) { return min + width * b / nBins; };
+    auto binPrimitives = [&](pstd::span<const BVHPrimitive> prims, SpatialBin *primBins) {
+        for (const BVHPrimitive &prim : prims) {
+            int b0 = binIndex(prim.bounds.pMin[axis]);
+            int b1 = binIndex(prim.bounds.pMax[axis]);
+            ++primBins[b0].nEntries;
+            ++primBins[b1].nExits;
+            if (b0 == b1) {
+                primBins[b0].bounds = Union(primBins[b0].bounds, prim.bounds);
+                continue;
+            }
+            for (int b = b0; b <= b1; ++b) {
+                Bounds3f clipped =
+                    clipReference(prim, axis, binPlane(b), binPlane(b + 1));
+                if (!clipped.IsDegenerate())
+                    primBins[b].bounds = Union(primBins[b].bounds, clipped);
+            }
+        }
+    };
+    if (bvhPrimitives.size() < minParallelBVHPrimitives)
+        binPrimitives(bvhPrimitives, bins);
+    else {
+        // Bin chunks of primitive references in parallel and merge bins
+        std::vector<std::array<SpatialBin, nBins>> chunkBins(
+            (bvhPrimitives.size() + bvhChunkSize - 1) / bvhChunkSize);
+        ParallelForBVHChunks(bvhPrimitives.size(),
+                             [&](int64_t chunk, size_t start, size_t end) {
+                                 binPrimitives(bvhPrimitives.subspan(start, end - start),
+                                               chunkBins[chunk].data());
+                             });
+        for (const auto &cb : chunkBins)
+            for (int b = 0; b < nBins; ++b) {
+                bins[b].bounds = Union(bins[b].bounds, cb[b].bounds);
+                bins[b].nEntries += cb[b].nEntries;
+                bins[b].nExits += cb[b].nExits;
+            }
+    }
+
+    // Compute SAH costs for splitting after each bin
+    constexpr int nSplits = nBins - 1;
+    Float costs[nSplits] = {};
+    int countBelow[nSplits], countAbove[nSplits];
+    Bounds3f boundBelow, boundAbove;
+    for (int i = 0, count = 0; i < nSplits; ++i) {
+        boundBelow = Union(boundBelow, bins[i].bounds);
+        count += bins[i].nEntries;
+        countBelow[i] = count;
+        costs[i] += packetCount(count) * boundBelow.SurfaceArea();
+    }
+    for (int i = nSplits, count = 0; i >= 1; --i) {
+        boundAbove = Union(boundAbove, bins[i].bounds);
+        count += bins[i].nExits;
+        countAbove[i - 1] = count;
+        costs[i - 1] += packetCount(count) * boundAbove.SurfaceArea();
+    }
+
+    // Return lowest-cost split that reduces the number of references on both sides
+    BVHSpatialSplit split;
+    split.axis = axis;
+    int n = bvhPrimitives.size();
+    for (int i = 0; i < nSplits; ++i)
+        if (countBelow[i] < n && countAbove[i] < n && costs[i] < split.cost) {
+            split.cost = costs[i];
+            split.position = binPlane(i + 1);
+        }
+    return split;
+}
+
+void BVHBuilder::splitReferences(pstd::span<const BVHPrimitive> bvhPrimitives,
+                                 const BVHSpatialSplit &split,
+                                 std::vector<BVHPrimitive> *below,
+                                 std::vector<BVHPrimitive> *above) const {
+    int axis = split.axis;
+    auto splitPrims = [&](pstd::span<const BVHPrimitive> prims,
+                          std::vector<BVHPrimitive> *primsBelow,
+                          std::vector<BVHPrimitive> *primsAbove) {
+        for (const BVHPrimitive &prim : prims) {
+            if (prim.bounds.pMax[axis] <= split.position)
+                primsBelow->push_back(prim);
+            else if (prim.bounds.pMin[axis] >= split.position)
+                primsAbove->push_back(prim);
+            else {
+                // Add clipped references on both sides of the plane that aren't empty
+                Bounds3f b0 = clipReference(prim, axis, -Infinity, split.position);
+                Bounds3f b1 = clipReference(prim, axis, split.position, Infinity);
+                if (!b0.IsDegenerate())
+                    primsBelow->push_back(BVHPrimitive(prim.primitiveIndex, b0));
+                if (!b1.IsDegenerate())
+                    primsAbove->push_back(BVHPrimitive(prim.primitiveIndex, b1));
+                if (b0.IsDegenerate() && b1.IsDegenerate())
+                    primsBelow->push_back(prim);
+            }
+        }
+    };
+    if (bvhPrimitives.size() < minParallelBVHPrimitives) {
+        splitPrims(bvhPrimitives, below, above);
+        return;
+    }
+    // Split chunks of references in parallel and concatenate them in order
+    size_t nChunks = (bvhPrimitives.size() + bvhChunkSize - 1) / bvhChunkSize;
+    std::vector<std::vector<BVHPrimitive>> chunkBelow(nChunks), chunkAbove(nChunks);
+    ParallelForBVHChunks(bvhPrimitives.size(),
+                         [&](int64_t chunk, size_t start, size_t end) {
+                             splitPrims(bvhPrimitives.subspan(start, end - start),
+                                        &chunkBelow[chunk], &chunkAbove[chunk]);
+                         });
+    for (size_t chunk = 0; chunk < nChunks; ++chunk) {
+        below->insert(below->end(), chunkBelow[chunk].begin(), chunkBelow[chunk].end());
+        above->insert(above->end(), chunkAbove[chunk].begin(), chunkAbove[chunk].end());
+    }
+}
+
+BVHBuildNode *BVHBuilder::buildHLBVH(Allocator alloc,
+                                     const std::vector<BVHPrimitive> &bvhPrimitives,
+                                     std::atomic<int> *totalNodes,
+                                     std::vector<int> &orderedPrims) {
     // Compute bounding box of all primitive centroids
     Bounds3f bounds;
     for (const BVHPrimitive &prim : bvhPrimitives)
@@ -447,12 +1144,11 @@ BVHBuildNode *BVHAggregate::buildHLBVH(Allocator alloc,
     return buildUpperSAH(alloc, finishedTreelets, 0, finishedTreelets.size(), totalNodes);
 }
 
-BVHBuildNode *BVHAggregate::emitLBVH(BVHBuildNode *&buildNodes,
-                                     const std::vector<BVHPrimitive> &bvhPrimitives,
-                                     MortonPrimitive *mortonPrims, int nPrimitives,
-                                     int *totalNodes,
-                                     std::vector<Primitive> &orderedPrims,
-                                     std::atomic<int> *orderedPrimsOffset, int bitIndex) {
+BVHBuildNode *BVHBuilder::emitLBVH(BVHBuildNode *&buildNodes,
+                                   const std::vector<BVHPrimitive> &bvhPrimitives,
+                                   MortonPrimitive *mortonPrims, int nPrimitives,
+                                   int *totalNodes, std::vector<int> &orderedPrims,
+                                   std::atomic<int> *orderedPrimsOffset, int bitIndex) {
     CHECK_GT(nPrimitives, 0);
     if (bitIndex == -1 || nPrimitives < maxPrimsInNode) {
         // Create and return leaf node of LBVH treelet
@@ -462,7 +1158,7 @@ BVHBuildNode *BVHAggregate::emitLBVH(BVHBuildNode *&buildNodes,
         int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
         for (int i = 0; i < nPrimitives; ++i) {
             int primitiveIndex = mortonPrims[i].primitiveIndex;
-            orderedPrims[firstPrimOffset + i] = primitives[primitiveIndex];
+            orderedPrims[firstPrimOffset + i] = primitiveIndex;
             bounds = Union(bounds, bvhPrimitives[primitiveIndex].bounds);
         }
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
@@ -501,10 +1197,149 @@ BVHBuildNode *BVHAggregate::emitLBVH(BVHBuildNode *&buildNodes,
     }
 }
 
-int BVHAggregate::flattenBVH(BVHBuildNode *node, int *offset) {
-    LinearBVHNode *linearNode = &nodes[*offset];
+Float BVHBuilder::computeSAHCost(BVHBuildNode *node) const {
+    if (node->nPrimitives > 0)
+        node->cost = node->bounds.SurfaceArea() * packetCount(node->nPrimitives);
+    else
+        node->cost = bvhTraversalCost * node->bounds.SurfaceArea() +
+                     computeSAHCost(node->children[0]) +
+                     computeSAHCost(node->children[1]);
+    return node->cost;
+}
+
+void BVHBuilder::optimize(BVHBuildNode *root) {
+    TRACE_SCOPE("BVH optimization", "nodes", root->nSubtreeNodes);
+    Float rootArea = root->bounds.SurfaceArea();
+    if (rootArea == 0)
+        return;
+    Timer timer;
+    Float initialCost = computeSAHCost(root) / rootArea, cost = initialCost;
+    int pass = 0;
+    while (pass < optimizationPasses &&
+           (optimizationSeconds == 0 || timer.ElapsedSeconds() < optimizationSeconds)) {
+        // Restructure BVH treelets and stop if cost no longer decreases much
+        optimizeRecursive(root, timer);
+        ++pass;
+        Float newCost = root->cost / rootArea;
+        bool converged = newCost > .999f * cost;
+        cost = newCost;
+        if (converged)
+            break;
+    }
+
+    LOG_VERBOSE("BVH optimization: SAH cost %f -> %f after %d passes (%.2fs)",
+                initialCost, cost, pass, timer.ElapsedSeconds());
+    sahCostBeforeOptimization << int64_t(1000 * initialCost);
+    sahCostAfterOptimization << int64_t(1000 * cost);
+}
+
+void BVHBuilder::optimizeRecursive(BVHBuildNode *node, const Timer &timer) {
+    if (node->nPrimitives > 0) {
+        node->cost = node->bounds.SurfaceArea() * packetCount(node->nPrimitives);
+        return;
+    }
+    // Once the time budget is spent, stop restructuring; the children's
+    // costs are still current, so only this node's cost needs updating
+    auto outOfTime = [&]() {
+        return optimizationSeconds > 0 && timer.ElapsedSeconds() >= optimizationSeconds;
+    };
+    if (!outOfTime()) {
+        // Optimize children's subtrees before the treelet rooted at _node_
+        if (node->nSubtreeNodes > 16 * 1024)
+            ParallelFor(0, 2,
+                        [&](int i) { optimizeRecursive(node->children[i], timer); });
+        else {
+            optimizeRecursive(node->children[0], timer);
+            optimizeRecursive(node->children[1], timer);
+        }
+    }
+    node->cost = bvhTraversalCost * node->bounds.SurfaceArea() +
+                 node->children[0]->cost + node->children[1]->cost;
+    if ((node->nSubtreeNodes + 1) / 2 >= maxTreeletLeaves && !outOfTime())
+        restructureTreelet(node);
+}
+
+void BVHBuilder::restructureTreelet(BVHBuildNode *root) {
+    // Form treelet by repeatedly expanding the leaf with the largest area
+    BVHBuildNode *leaves[maxTreeletLeaves], *interiorNodes[maxTreeletLeaves - 1];
+    leaves[0] = root->children[0];
+    leaves[1] = root->children[1];
+    interiorNodes[0] = root;
+    int nLeaves = 2;
+    while (nLeaves < maxTreeletLeaves) {
+        int expand = -1;
+        for (int i = 0; i < nLeaves; ++i)
+            if (leaves[i]->nPrimitives == 0 &&
+                (expand == -1 || leaves[i]->bounds.SurfaceArea() >
+                                     leaves[expand]->bounds.SurfaceArea()))
+                expand = i;
+        if (expand == -1)
+            break;
+        interiorNodes[nLeaves - 1] = leaves[expand];
+        leaves[nLeaves++] = leaves[expand]->children[1];
+        leaves[expand] = leaves[expand]->children[0];
+    }
+    if (nLeaves < 3)
+        return;
+
+    // Find treelet topology with lowest SAH cost over subsets of its leaves
+    // Subsets are represented as bitmasks of leaves. Because every proper
+    // subset of a set has a smaller bitmask, the optimal costs of all of a
+    // subset's partitions are known by the time it is reached.
+    int nSubsets = 1 << nLeaves;
+    Float costs[1 << maxTreeletLeaves];
+    uint8_t partitions[1 << maxTreeletLeaves];
+    for (int s = 1; s < nSubsets; ++s) {
+        if ((s & (s - 1)) == 0) {
+            costs[s] = leaves[Log2Int(uint32_t(s))]->cost;
+            continue;
+        }
+        // Find lowest-cost partition of the subset's leaves
+        // Only partitions where the first part includes the subset's lowest
+        // leaf are considered, since the others are equivalent.
+        costs[s] = Infinity;
+        for (int p = (s - 1) & s; p > 0; p = (p - 1) & s)
+            if ((p & s & -s) && costs[p] + costs[s ^ p] < costs[s]) {
+                costs[s] = costs[p] + costs[s ^ p];
+                partitions[s] = p;
+            }
+        Bounds3f bounds;
+        for (int i = 0; i < nLeaves; ++i)
+            if (s & (1 << i))
+                bounds = Union(bounds, leaves[i]->bounds);
+        costs[s] += bvhTraversalCost * bounds.SurfaceArea();
+    }
+
+    // Rebuild treelet using its interior nodes if that reduces its cost
+    int allLeaves = nSubsets - 1;
+    if (!(costs[allLeaves] < .9999f * root->cost))
+        return;
+    int nextInteriorNode = 0;
+    auto rebuild = [&](auto rebuild, int s) -> BVHBuildNode * {
+        if ((s & (s - 1)) == 0)
+            return leaves[Log2Int(uint32_t(s))];
+        BVHBuildNode *node = interiorNodes[nextInteriorNode++];
+        BVHBuildNode *c0 = rebuild(rebuild, partitions[s]);
+        BVHBuildNode *c1 = rebuild(rebuild, s ^ partitions[s]);
+        // Update interior node for its new children
+        node->children[0] = c0;
+        node->children[1] = c1;
+        node->bounds = Union(c0->bounds, c1->bounds);
+        node->nSubtreeNodes = 1 + c0->nSubtreeNodes + c1->nSubtreeNodes;
+        node->cost = costs[s];
+        Vector3f centroidOffset = (c1->bounds.pMin + c1->bounds.pMax) / 2 -
+                                  (c0->bounds.pMin + c0->bounds.pMax) / 2;
+        node->splitAxis = MaxComponentIndex(Abs(centroidOffset));
+        return node;
+    };
+    // The treelet's root node is used for the root of the new topology
+    // so that its parent still refers to it
+    CHECK_EQ(root, rebuild(rebuild, allLeaves));
+}
+
+void BVHBuilder::flattenBVH(BVHBuildNode *node, int offset) {
+    LinearBVHNode *linearNode = &nodes[offset];
     linearNode->bounds = node->bounds;
-    int nodeOffset = (*offset)++;
     if (node->nPrimitives > 0) {
         CHECK(!node->children[0] && !node->children[1]);
         CHECK_LT(node->nPrimitives, 65536);
@@ -514,50 +1349,65 @@ int BVHAggregate::flattenBVH(BVHBuildNode *node, int *offset) {
         // Create interior flattened BVH node
         linearNode->axis = node->splitAxis;
         linearNode->nPrimitives = 0;
-        flattenBVH(node->children[0], offset);
-        linearNode->secondChildOffset = flattenBVH(node->children[1], offset);
+        // Children are stored after the node in depth-first order, so the
+        // second child's offset follows from the size of the first's subtree
+        int childOffsets[2] = {offset + 1, offset + 1 + node->children[0]->nSubtreeNodes};
+        linearNode->secondChildOffset = childOffsets[1];
+        if (node->nSubtreeNodes > 16 * 1024)
+            ParallelFor(0, 2,
+                        [&](int i) { flattenBVH(node->children[i], childOffsets[i]); });
+        else {
+            flattenBVH(node->children[0], childOffsets[0]);
+            flattenBVH(node->children[1], childOffsets[1]);
+        }
     }
-    return nodeOffset;
 }
 
-Bounds3f BVHAggregate::Bounds() const {
-    CHECK(nodes);
-    return nodes[0].bounds;
-}
+// BVH Traversal Function Definitions
+// Follows _ray_ through the BVH, calling _intersectLeaf(offset, count, &tMax)_
+// for the primitives of each leaf it reaches. _intersectLeaf_ returns true if
+// it found an intersection; in that case traversal ends immediately when
+// _AnyHit_ is set and otherwise continues with the updated _tMax_.
+template <bool AnyHit, typename Node, typename F>
+static bool TraverseBVH(const Node *nodes, const Bounds3f &rootBounds, const Ray &ray,
+                        Float tMax, F intersectLeaf) {
+    // Quantized nodes' bounds are decoded using their parent's bounds, which
+    // are saved along with nodes to visit
+    constexpr bool quantized = !std::is_same_v<Node, LinearBVHNode>;
+    Bounds3f parentBounds = rootBounds;
+    Bounds3f parentBoundsToVisit[quantized ? 64 : 1];
 
-pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
-                                                          Float tMax) const {
-    if (!nodes)
-        return {};
-    pstd::optional<ShapeIntersection> si;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
-    // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
     int nodesVisited = 0;
+    bool hit = false;
     while (true) {
         ++nodesVisited;
-        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        const Node *node = &nodes[currentNodeIndex];
+        auto &&nodeBounds = NodeBounds(*node, parentBounds);
         // Check ray against BVH node
-        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+        if (nodeBounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    // Check for intersection with primitive in BVH node
-                    pstd::optional<ShapeIntersection> primSi =
-                        primitives[node->primitivesOffset + i].Intersect(ray, tMax);
-                    if (primSi) {
-                        si = primSi;
-                        tMax = si->tHit;
-                    }
+                if (intersectLeaf(node->primitivesOffset, node->nPrimitives, &tMax)) {
+                    hit = true;
+                    if (AnyHit)
+                        break;
                 }
                 if (toVisitOffset == 0)
                     break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
+                if constexpr (quantized)
+                    parentBounds = parentBoundsToVisit[toVisitOffset];
 
             } else {
                 // Put far BVH node on _nodesToVisit_ stack, advance to near node
+                if constexpr (quantized) {
+                    parentBoundsToVisit[toVisitOffset] = nodeBounds;
+                    parentBounds = nodeBounds;
+                }
                 if (dirIsNeg[node->axis]) {
                     nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
                     currentNodeIndex = node->secondChildOffset;
@@ -570,62 +1420,274 @@ pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
             if (toVisitOffset == 0)
                 break;
             currentNodeIndex = nodesToVisit[--toVisitOffset];
+            if constexpr (quantized)
+                parentBounds = parentBoundsToVisit[toVisitOffset];
         }
     }
 
     bvhNodesVisited += nodesVisited;
-    return si;
+    return hit;
 }
 
-bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
-    if (!nodes)
+// BVHNodeArray Method Definitions
+BVHNodeArray::BVHNodeArray(LinearBVHNode *fullNodes, int nNodes, BVHNodeFormat format,
+                           BVHCacheMapping mapping)
+    : format(format), bounds(fullNodes[0].bounds), nNodes(nNodes), mapping(mapping) {
+    switch (format) {
+    case BVHNodeFormat::Full:
+        nodes = fullNodes;
+        return;
+    case BVHNodeFormat::Quantized16:
+        nodes16 = new QuantizedBVHNode<uint16_t>[nNodes];
+        QuantizeBVHNodes(fullNodes, 0, bounds, nodes16);
+        break;
+    case BVHNodeFormat::Quantized8:
+        nodes8 = new QuantizedBVHNode<uint8_t>[nNodes];
+        QuantizeBVHNodes(fullNodes, 0, bounds, nodes8);
+        break;
+    }
+    // Free the full-precision nodes now that they have been quantized
+    if (mapping.ptr) {
+        UnmapFile(mapping.ptr, mapping.length);
+        this->mapping = BVHCacheMapping();
+    } else
+        delete[] fullNodes;
+}
+
+size_t BVHNodeArray::BytesUsed() const {
+    switch (format) {
+    case BVHNodeFormat::Quantized16:
+        return nNodes * sizeof(QuantizedBVHNode<uint16_t>);
+    case BVHNodeFormat::Quantized8:
+        return nNodes * sizeof(QuantizedBVHNode<uint8_t>);
+    default:
+        return nNodes * sizeof(LinearBVHNode);
+    }
+}
+
+// Returns the SAH cost of the subtree rooted at _nodeIndex_
+template <typename Node>
+static Float BVHSubtreeSAHCost(const Node *nodes, int nodeIndex,
+                               const Bounds3f &parentBounds) {
+    const Node &node = nodes[nodeIndex];
+    Bounds3f bounds = NodeBounds(node, parentBounds);
+    if (node.nPrimitives > 0)
+        return bounds.SurfaceArea() * node.nPrimitives;
+    return bvhTraversalCost * bounds.SurfaceArea() +
+           BVHSubtreeSAHCost(nodes, nodeIndex + 1, bounds) +
+           BVHSubtreeSAHCost(nodes, node.secondChildOffset, bounds);
+}
+
+Float BVHNodeArray::SAHCost() const {
+    Float cost;
+    switch (format) {
+    case BVHNodeFormat::Quantized16:
+        cost = BVHSubtreeSAHCost(nodes16, 0, bounds);
+        break;
+    case BVHNodeFormat::Quantized8:
+        cost = BVHSubtreeSAHCost(nodes8, 0, bounds);
+        break;
+    default:
+        cost = BVHSubtreeSAHCost(nodes, 0, bounds);
+    }
+    return bounds.SurfaceArea() > 0 ? cost / bounds.SurfaceArea() : 0;
+}
+
+// Refits the subtree of _nNodes_ nodes rooted at _nodeIndex_, returning its bounds
+template <typename F>
+static Bounds3f RefitBVHNodes(LinearBVHNode *nodes, int nodeIndex, int nNodes,
+                              F primitiveBounds) {
+    LinearBVHNode &node = nodes[nodeIndex];
+    if (node.nPrimitives > 0) {
+        Bounds3f bounds;
+        for (int i = 0; i < node.nPrimitives; ++i)
+            bounds = Union(bounds, primitiveBounds(node.primitivesOffset + i));
+        node.bounds = bounds;
+        return bounds;
+    }
+    // Refit children's subtrees, in parallel if they are large
+    int nFirstChildNodes = node.secondChildOffset - nodeIndex - 1;
+    int childIndex[2] = {nodeIndex + 1, node.secondChildOffset};
+    int nChildNodes[2] = {nFirstChildNodes, nNodes - 1 - nFirstChildNodes};
+    Bounds3f childBounds[2];
+    auto refitChild = [&](int c) {
+        childBounds[c] =
+            RefitBVHNodes(nodes, childIndex[c], nChildNodes[c], primitiveBounds);
+    };
+    if (nNodes > 16 * 1024)
+        ParallelFor(0, 2, refitChild);
+    else {
+        refitChild(0);
+        refitChild(1);
+    }
+    node.bounds = Union(childBounds[0], childBounds[1]);
+    return node.bounds;
+}
+
+template <typename F>
+bool BVHNodeArray::Refit(F primitiveBounds) {
+    if (format != BVHNodeFormat::Full)
         return false;
-    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
-    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
-                       static_cast<int>(invDir.z < 0)};
-    int nodesToVisit[64];
-    int toVisitOffset = 0, currentNodeIndex = 0;
-    int nodesVisited = 0;
+    bounds = RefitBVHNodes(nodes, 0, nNodes, primitiveBounds);
+    return true;
+}
 
-    while (true) {
-        ++nodesVisited;
-        const LinearBVHNode *node = &nodes[currentNodeIndex];
-        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
-            // Process BVH node _node_ for traversal
-            if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i].IntersectP(ray, tMax)) {
-                        bvhNodesVisited += nodesVisited;
-                        return true;
-                    }
-                }
-                if (toVisitOffset == 0)
-                    break;
-                currentNodeIndex = nodesToVisit[--toVisitOffset];
-            } else {
-                if (dirIsNeg[node->axis] != 0) {
-                    /// second child first
-                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
-                    currentNodeIndex = node->secondChildOffset;
-                } else {
-                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
-                    currentNodeIndex = currentNodeIndex + 1;
-                }
+void BVHNodeArray::Clear() {
+    if (mapping.ptr)
+        UnmapFile(mapping.ptr, mapping.length);
+    else
+        delete[] nodes;
+    delete[] nodes16;
+    delete[] nodes8;
+    *this = BVHNodeArray();
+}
+
+template <bool AnyHit, typename F>
+bool BVHNodeArray::Traverse(const Ray &ray, Float tMax, F intersectLeaf) const {
+    switch (format) {
+    case BVHNodeFormat::Quantized16:
+        return TraverseBVH<AnyHit>(nodes16, bounds, ray, tMax, intersectLeaf);
+    case BVHNodeFormat::Quantized8:
+        return TraverseBVH<AnyHit>(nodes8, bounds, ray, tMax, intersectLeaf);
+    default:
+        return TraverseBVH<AnyHit>(nodes, bounds, ray, tMax, intersectLeaf);
+    }
+}
+
+static BVHNodeFormat GetBVHNodeFormat(const ParameterDictionary &parameters) {
+    std::string name = parameters.GetOneString("nodeformat", "full");
+    if (name == "full")
+        return BVHNodeFormat::Full;
+    else if (name == "quantized16")
+        return BVHNodeFormat::Quantized16;
+    else if (name == "quantized8")
+        return BVHNodeFormat::Quantized8;
+    Warning(R"(BVH node format "%s" unknown.  Using "full".)", name);
+    return BVHNodeFormat::Full;
+}
+
+// BVHAggregate Method Definitions
+BVHAggregate::BVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
+                           SplitMethod splitMethod, BVHNodeFormat nodeFormat,
+                           bool spatialSplits, int optimizationPasses,
+                           Float optimizationSeconds)
+    : maxPrimsInNode(std::min(255, maxPrimsInNode)),
+      primitives(std::move(prims)),
+      splitMethod(splitMethod),
+      nodeFormat(nodeFormat),
+      spatialSplits(spatialSplits),
+      optimizationPasses(optimizationPasses),
+      optimizationSeconds(optimizationSeconds) {
+    CHECK(!primitives.empty());
+    build();
+    treeBytes += nodes.BytesUsed() + sizeof(*this) +
+                 primitives.size() * sizeof(primitives[0]);
+}
+
+void BVHAggregate::build() {
+    TRACE_SCOPE("BVH build", "primitives", primitives.size());
+    // Build BVH from _primitives_
+    // Initialize _bvhPrimitives_ array for primitives
+    std::vector<BVHPrimitive> bvhPrimitives(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        bvhPrimitives[i] = BVHPrimitive(i, primitives[i].Bounds());
+
+    // Build BVH for primitives using _bvhPrimitives_ and reorder _primitives_
+    BVHBuilder builder(maxPrimsInNode, splitMethod);
+    if (spatialSplits)
+        // Clip triangles exactly when splitting references; other shapes'
+        // references are clipped using their bounds
+        builder.EnableSpatialSplits(
+            maxSpatialSplitDuplication, [&](size_t index, const Bounds3f &box) {
+                Shape shape;
+                if (auto gp = primitives[index].CastOrNullptr<GeometricPrimitive>())
+                    shape = gp->GetShape();
+                else if (auto sp = primitives[index].CastOrNullptr<SimplePrimitive>())
+                    shape = sp->GetShape();
+                const Triangle *tri = shape ? shape.CastOrNullptr<Triangle>() : nullptr;
+                return tri ? ClipTriangleBounds(tri->Mesh(), tri->TriangleIndex(), box)
+                           : box;
+            });
+    if (optimizationPasses > 0)
+        builder.EnableOptimization(optimizationPasses, optimizationSeconds);
+    if (!Options->bvhCacheDirectory.empty())
+        builder.EnableCache(Options->bvhCacheDirectory);
+    std::vector<int> primOrder;
+    int totalNodes;
+    LinearBVHNode *linearNodes =
+        builder.Build(std::move(bvhPrimitives), &primOrder, &totalNodes);
+    nodes = BVHNodeArray(linearNodes, totalNodes, nodeFormat, builder.CacheMapping());
+    // Spatial splits may cause primitives to be referenced by multiple leaves
+    std::vector<Primitive> orderedPrims(primOrder.size());
+    for (size_t i = 0; i < primOrder.size(); ++i)
+        orderedPrims[i] = primitives[primOrder[i]];
+    primitives.swap(orderedPrims);
+
+    builtSAHCost = nodes.SAHCost();
+
+    LOG_VERBOSE("BVH created with %d nodes for %d primitives (%.2f MB)", totalNodes,
+                (int)primitives.size(), float(nodes.BytesUsed()) / (1024.f * 1024.f));
+}
+
+void BVHAggregate::Refit(Float rebuildCostRatio) {
+    TRACE_SCOPE("BVH refit", "primitives", primitives.size());
+    if (nodes.Refit([&](int index) { return primitives[index].Bounds(); }) &&
+        nodes.SAHCost() <= rebuildCostRatio * builtSAHCost) {
+        ++bvhRefits;
+        return;
+    }
+
+    // Rebuild BVH, first removing duplicate references from spatial splits
+    ++bvhRefitRebuilds;
+    if (spatialSplits) {
+        std::unordered_set<const void *> seen;
+        primitives.erase(std::remove_if(primitives.begin(), primitives.end(),
+                                        [&](Primitive p) {
+                                            return !seen.insert(p.ptr()).second;
+                                        }),
+                         primitives.end());
+    }
+    nodes.Clear();
+    build();
+}
+
+Bounds3f BVHAggregate::Bounds() const {
+    return nodes.Bounds();
+}
+
+pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
+                                                          Float tMax) const {
+    pstd::optional<ShapeIntersection> si;
+    nodes.Traverse<false>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        bool hit = false;
+        for (int i = 0; i < count; ++i) {
+            // Check for intersection with primitive in BVH node
+            pstd::optional<ShapeIntersection> primSi =
+                primitives[offset + i].Intersect(ray, *tMax);
+            if (primSi) {
+                si = primSi;
+                *tMax = si->tHit;
+                hit = true;
             }
-        } else {
-            if (toVisitOffset == 0)
-                break;
-            currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
-    }
-    bvhNodesVisited += nodesVisited;
-    return false;
+        return hit;
+    });
+    return si;
 }
 
-BVHBuildNode *BVHAggregate::buildUpperSAH(Allocator alloc,
-                                          std::vector<BVHBuildNode *> &treeletRoots,
-                                          int start, int end,
-                                          std::atomic<int> *totalNodes) const {
+bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    return nodes.Traverse<true>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        for (int i = 0; i < count; ++i)
+            if (primitives[offset + i].IntersectP(ray, *tMax))
+                return true;
+        return false;
+    });
+}
+
+BVHBuildNode *BVHBuilder::buildUpperSAH(Allocator alloc,
+                                        std::vector<BVHBuildNode *> &treeletRoots,
+                                        int start, int end,
+                                        std::atomic<int> *totalNodes) const {
     CHECK_LT(start, end);
     int nNodes = end - start;
     if (nNodes == 1)
@@ -739,7 +1801,545 @@ BVHAggregate *BVHAggregate::Create(std::vector<Primitive> prims,
     }
 
     int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
-    return new BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod);
+    BVHNodeFormat nodeFormat = GetBVHNodeFormat(parameters);
+    bool spatialSplits = parameters.GetOneBool("spatialsplits", false);
+    int optimizationPasses = parameters.GetOneInt("optimizationpasses", 0);
+    Float optimizationSeconds = parameters.GetOneFloat("optimizationtime", 0);
+    return new BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod, nodeFormat,
+                            spatialSplits, optimizationPasses, optimizationSeconds);
+}
+
+// TriangleMeshAggregate Method Definitions
+TriangleMeshAggregate::TriangleMeshAggregate(const TriangleMesh *mesh, Material material,
+                                             pstd::span<const Light> areaLights,
+                                             const MediumInterface &mediumInterface,
+                                             FloatTexture alpha, int maxPrimsInNode,
+                                             bool packVertices, BVHNodeFormat nodeFormat,
+                                             bool spatialSplits, bool trianglePackets)
+    : mesh(mesh),
+      material(material),
+      areaLights(areaLights.begin(), areaLights.end()),
+      mediumInterface(mediumInterface),
+      alpha(alpha),
+      maxPrimsInNode(maxPrimsInNode),
+      usePackedVertices(packVertices),
+      // Packets report only the closest hit, which may be rejected by the alpha test
+      useTrianglePackets(trianglePackets && !alpha),
+      nodeFormat(nodeFormat),
+      spatialSplits(spatialSplits) {
+    CHECK_GT(mesh->nTriangles, 0);
+    CHECK(areaLights.empty() || areaLights.size() == mesh->nTriangles);
+    build();
+
+    size_t bytes = sizeof(*this) + nodes.BytesUsed() +
+                   triangleIndices.size() * sizeof(int) +
+                   packedVertices.size() * sizeof(Point3f) +
+                   this->trianglePackets.size() * sizeof(TrianglePacket) +
+                   packetRanges.size() * sizeof(std::pair<int, int>) +
+                   leafPackets.size() * sizeof(int) +
+                   this->areaLights.size() * sizeof(Light);
+    meshBVHBytes += bytes;
+    meshBVHTriangles += mesh->nTriangles;
+    LOG_VERBOSE("Triangle mesh BVH created for %d triangles (%.1f bytes/triangle)",
+                mesh->nTriangles, Float(bytes) / mesh->nTriangles);
+}
+
+void TriangleMeshAggregate::build() {
+    TRACE_SCOPE("Triangle mesh BVH build", "triangles", mesh->nTriangles);
+    // Build BVH over the mesh's triangles
+    std::vector<BVHPrimitive> bvhPrimitives(mesh->nTriangles);
+    for (int i = 0; i < mesh->nTriangles; ++i) {
+        const int *v = &mesh->vertexIndices[3 * i];
+        Bounds3f bounds = Union(Bounds3f(mesh->p[v[0]], mesh->p[v[1]]), mesh->p[v[2]]);
+        bvhPrimitives[i] = BVHPrimitive(i, bounds);
+    }
+    BVHBuilder builder(maxPrimsInNode, BVHAggregate::SplitMethod::SAH);
+    if (spatialSplits)
+        builder.EnableSpatialSplits(maxSpatialSplitDuplication,
+                                    [&](size_t index, const Bounds3f &box) {
+                                        return ClipTriangleBounds(mesh, index, box);
+                                    });
+    if (useTrianglePackets)
+        builder.SetLeafPacketWidth(TrianglePacket::Width);
+    if (!Options->bvhCacheDirectory.empty())
+        builder.EnableCache(Options->bvhCacheDirectory);
+    int totalNodes;
+    LinearBVHNode *linearNodes =
+        builder.Build(std::move(bvhPrimitives), &triangleIndices, &totalNodes);
+    if (useTrianglePackets)
+        buildTrianglePackets(linearNodes, totalNodes);
+    nodes = BVHNodeArray(linearNodes, totalNodes, nodeFormat, builder.CacheMapping());
+    builtSAHCost = nodes.SAHCost();
+    if (usePackedVertices)
+        packLeafVertices();
+}
+
+void TriangleMeshAggregate::packLeafVertices() {
+    // Copy vertex positions into leaf order
+    packedVertices.resize(3 * triangleIndices.size());
+    ParallelFor(0, triangleIndices.size(), [&](int64_t i) {
+        const int *v = &mesh->vertexIndices[3 * triangleIndices[i]];
+        for (int j = 0; j < 3; ++j)
+            packedVertices[3 * i + j] = mesh->p[v[j]];
+    });
+}
+
+void TriangleMeshAggregate::buildTrianglePackets(const LinearBVHNode *linearNodes,
+                                                 int nNodes) {
+    // Assign each leaf's triangles to consecutive packets
+    packetRanges.clear();
+    leafPackets.assign(triangleIndices.size(), -1);
+    for (int i = 0; i < nNodes; ++i) {
+        const LinearBVHNode &node = linearNodes[i];
+        if (node.nPrimitives == 0)
+            continue;
+        leafPackets[node.primitivesOffset] = packetRanges.size();
+        for (int j = 0; j < node.nPrimitives; j += TrianglePacket::Width)
+            packetRanges.push_back({node.primitivesOffset + j,
+                                    std::min<int>(TrianglePacket::Width,
+                                                  node.nPrimitives - j)});
+    }
+    trianglePackets.resize(packetRanges.size());
+    fillTrianglePackets();
+    packetTriangles += triangleIndices.size();
+    packetLanes += trianglePackets.size() * TrianglePacket::Width;
+}
+
+void TriangleMeshAggregate::fillTrianglePackets() {
+    ParallelFor(0, trianglePackets.size(), [&](int64_t i) {
+        TrianglePacket &packet = trianglePackets[i];
+        packet = TrianglePacket();
+        auto [offset, count] = packetRanges[i];
+        for (int lane = 0; lane < count; ++lane) {
+            const int *v = &mesh->vertexIndices[3 * triangleIndices[offset + lane]];
+            packet.Set(lane, mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]]);
+        }
+    });
+}
+
+void TriangleMeshAggregate::Refit(Float rebuildCostRatio) {
+    TRACE_SCOPE("Triangle mesh BVH refit", "triangles", mesh->nTriangles);
+    auto triangleBounds = [&](int index) {
+        const int *v = &mesh->vertexIndices[3 * triangleIndices[index]];
+        return Union(Bounds3f(mesh->p[v[0]], mesh->p[v[1]]), mesh->p[v[2]]);
+    };
+    if (nodes.Refit(triangleBounds) &&
+        nodes.SAHCost() <= rebuildCostRatio * builtSAHCost) {
+        ++bvhRefits;
+        if (usePackedVertices)
+            packLeafVertices();
+        if (useTrianglePackets)
+            fillTrianglePackets();
+        return;
+    }
+
+    ++bvhRefitRebuilds;
+    nodes.Clear();
+    triangleIndices.clear();
+    build();
+}
+
+TriangleMeshAggregate *TriangleMeshAggregate::Create(
+    pstd::span<const Shape> shapes, Material material,
+    pstd::span<const Light> areaLights, const MediumInterface &mediumInterface,
+    FloatTexture alpha, const ParameterDictionary &parameters) {
+    // Make sure that _shapes_ are all of a mesh's triangles, in order
+    const Triangle *tri = shapes.empty() ? nullptr : shapes[0].CastOrNullptr<Triangle>();
+    if (!tri || shapes.size() != tri->Mesh()->nTriangles)
+        return nullptr;
+    const TriangleMesh *mesh = tri->Mesh();
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        tri = shapes[i].CastOrNullptr<Triangle>();
+        if (!tri || tri->Mesh() != mesh || tri->TriangleIndex() != i)
+            return nullptr;
+    }
+
+    bool trianglePackets = parameters.GetOneBool("trianglepackets", false);
+    // Leaves default to holding a single full packet when packets are used
+    int maxPrimsInNode =
+        parameters.GetOneInt("maxnodeprims", trianglePackets ? TrianglePacket::Width : 4);
+    bool packVertices = parameters.GetOneBool("packmeshvertices", false);
+    BVHNodeFormat nodeFormat = GetBVHNodeFormat(parameters);
+    bool spatialSplits = parameters.GetOneBool("spatialsplits", false);
+    return new TriangleMeshAggregate(mesh, material, areaLights, mediumInterface, alpha,
+                                     maxPrimsInNode, packVertices, nodeFormat,
+                                     spatialSplits, trianglePackets);
+}
+
+Bounds3f TriangleMeshAggregate::Bounds() const {
+    return nodes.Bounds();
+}
+
+Float TriangleMeshAggregate::PacketOccupancy() const {
+    if (trianglePackets.empty())
+        return 0;
+    return Float(triangleIndices.size()) /
+           (trianglePackets.size() * TrianglePacket::Width);
+}
+
+pstd::optional<TriangleIntersection> TriangleMeshAggregate::intersectTriangle(
+    const Ray &ray, Float tMax, int index) const {
+    ++nMeshTriTests;
+    if (!packedVertices.empty()) {
+        const Point3f *p = &packedVertices[3 * index];
+        return IntersectTriangle(ray, tMax, p[0], p[1], p[2]);
+    }
+    const int *v = &mesh->vertexIndices[3 * triangleIndices[index]];
+    return IntersectTriangle(ray, tMax, mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]]);
+}
+
+bool TriangleMeshAggregate::alphaRejects(const Ray &ray, int triIndex,
+                                         const TriangleIntersection &ti) const {
+    SurfaceInteraction intr =
+        Triangle::InteractionFromIntersection(mesh, triIndex, ti, ray.time, -ray.d);
+    Float a = alpha.Evaluate(intr);
+    if (a >= 1)
+        return false;
+    // Ignore intersection based on stochastic alpha test; the triangle index
+    // decorrelates the tests of overlapping triangles along the same ray
+    Float u = (a <= 0) ? 1.f : HashFloat(ray.o, ray.d, triIndex);
+    return u > a;
+}
+
+template <bool AnyHit>
+pstd::optional<TriangleIntersection> TriangleMeshAggregate::intersectLeaf(
+    const Ray &ray, const WatertightRay &wray, int offset, int count, Float tMax,
+    int *triIndex) const {
+    pstd::optional<TriangleIntersection> closest;
+    if (useTrianglePackets) {
+        // Test the ray against the leaf's triangle packets
+        int firstPacket = leafPackets[offset];
+        int nPackets = (count + TrianglePacket::Width - 1) / TrianglePacket::Width;
+        for (int i = firstPacket; i < firstPacket + nPackets; ++i) {
+            nMeshTriTests += packetRanges[i].second;
+            int lane;
+            pstd::optional<TriangleIntersection> ti =
+                IntersectTriangles(wray, tMax, trianglePackets[i], &lane);
+            if (!ti)
+                continue;
+            closest = ti;
+            tMax = ti->t;
+            *triIndex = triangleIndices[packetRanges[i].first + lane];
+            if (AnyHit)
+                break;
+        }
+        return closest;
+    }
+
+    for (int i = offset; i < offset + count; ++i) {
+        pstd::optional<TriangleIntersection> ti = intersectTriangle(ray, tMax, i);
+        if (!ti || (alpha && alphaRejects(ray, triangleIndices[i], *ti)))
+            continue;
+        closest = ti;
+        tMax = ti->t;
+        *triIndex = triangleIndices[i];
+        if (AnyHit)
+            break;
+    }
+    return closest;
+}
+
+pstd::optional<ShapeIntersection> TriangleMeshAggregate::Intersect(const Ray &ray,
+                                                                   Float tMax) const {
+    WatertightRay wray = useTrianglePackets ? WatertightRay(ray) : WatertightRay();
+    pstd::optional<TriangleIntersection> closest;
+    int closestTriIndex = -1;
+    nodes.Traverse<false>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        int triIndex;
+        pstd::optional<TriangleIntersection> ti =
+            intersectLeaf<false>(ray, wray, offset, count, *tMax, &triIndex);
+        if (!ti)
+            return false;
+        closest = ti;
+        closestTriIndex = triIndex;
+        *tMax = ti->t;
+        return true;
+    });
+    if (!closest)
+        return {};
+
+    // Initialize _SurfaceInteraction_ for closest triangle intersection
+    ++nMeshTriHits;
+    SurfaceInteraction intr = Triangle::InteractionFromIntersection(
+        mesh, closestTriIndex, *closest, ray.time, -ray.d);
+    Light areaLight = nullptr;
+    if (!areaLights.empty())
+        areaLight = areaLights[closestTriIndex];
+    intr.SetIntersectionProperties(material, areaLight, &mediumInterface, ray.medium);
+    return ShapeIntersection{intr, closest->t};
+}
+
+bool TriangleMeshAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    WatertightRay wray = useTrianglePackets ? WatertightRay(ray) : WatertightRay();
+    return nodes.Traverse<true>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        int triIndex;
+        if (!intersectLeaf<true>(ray, wray, offset, count, *tMax, &triIndex))
+            return false;
+        ++nMeshTriHits;
+        return true;
+    });
+}
+
+// InstanceArrayAggregate Method Definitions
+InstanceArrayAggregate::InstanceArrayAggregate(std::vector<Primitive> prototypes,
+                                               pstd::span<const Instance> inst,
+                                               int maxPrimsInNode,
+                                               BVHNodeFormat nodeFormat)
+    : prototypes(std::move(prototypes)) {
+    CHECK(!inst.empty());
+    TRACE_SCOPE("Instance array build", "instances", inst.size());
+    // Build BVH over instance bounds
+    std::vector<Bounds3f> prototypeBounds(this->prototypes.size());
+    for (size_t i = 0; i < this->prototypes.size(); ++i)
+        prototypeBounds[i] = this->prototypes[i].Bounds();
+    std::vector<BVHPrimitive> bvhPrimitives(inst.size());
+    ParallelFor(0, inst.size(), [&](int64_t i) {
+        const Transform &renderFromInstance = *inst[i].renderFromInstance;
+        bvhPrimitives[i] =
+            BVHPrimitive(i, renderFromInstance(prototypeBounds[inst[i].prototypeIndex]));
+    });
+    std::vector<int> instanceOrder;
+    int totalNodes;
+    LinearBVHNode *linearNodes =
+        BVHBuilder(maxPrimsInNode, BVHAggregate::SplitMethod::SAH)
+            .Build(std::move(bvhPrimitives), &instanceOrder, &totalNodes);
+    nodes = BVHNodeArray(linearNodes, totalNodes, nodeFormat);
+
+    // Initialize _instances_ in BVH leaf order
+    instances.resize(inst.size());
+    for (size_t i = 0; i < inst.size(); ++i) {
+        const Instance &in = inst[instanceOrder[i]];
+        const SquareMatrix<4> &m = in.renderFromInstance->GetInverseMatrix();
+        CHECK(m[3][0] == 0 && m[3][1] == 0 && m[3][2] == 0 && m[3][3] == 1);
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                instances[i].instanceFromRender[r][c] = m[r][c];
+        instances[i].prototypeIndex = in.prototypeIndex;
+    }
+
+    size_t bytes = sizeof(*this) + nodes.BytesUsed() +
+                   instances.size() * sizeof(CompactInstance) +
+                   this->prototypes.size() * sizeof(Primitive);
+    instanceArrayBytes += bytes;
+    instanceArrayInstances += instances.size();
+    LOG_VERBOSE("Instance array created with %d nodes for %d instances of %d "
+                "prototypes (%.1f bytes/instance)",
+                totalNodes, (int)instances.size(), (int)this->prototypes.size(),
+                Float(bytes) / instances.size());
+}
+
+InstanceArrayAggregate *InstanceArrayAggregate::Create(
+    std::vector<Primitive> prototypes, pstd::span<const Instance> instances,
+    const ParameterDictionary &parameters) {
+    int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
+    BVHNodeFormat nodeFormat = GetBVHNodeFormat(parameters);
+    return new InstanceArrayAggregate(std::move(prototypes), instances, maxPrimsInNode,
+                                      nodeFormat);
+}
+
+// Transforms _r_ by the affine transformation _m_, offsetting its origin to
+// account for rounding error in the same manner as _Transform::ApplyInverse()_.
+static Ray TransformRay(const Float m[3][4], const Ray &r, Float *tMax) {
+    Point3f o;
+    Vector3f oError, d;
+    for (int i = 0; i < 3; ++i) {
+        o[i] = (m[i][0] * r.o.x + m[i][1] * r.o.y) + (m[i][2] * r.o.z + m[i][3]);
+        oError[i] = gamma(3) * (std::abs(m[i][0] * r.o.x) + std::abs(m[i][1] * r.o.y) +
+                                std::abs(m[i][2] * r.o.z));
+        d[i] = m[i][0] * r.d.x + m[i][1] * r.d.y + m[i][2] * r.d.z;
+    }
+    Point3fi oi(o, oError);
+    if (Float lengthSquared = LengthSquared(d); lengthSquared > 0) {
+        Vector3f offsetError(oi.x.Width() / 2, oi.y.Width() / 2, oi.z.Width() / 2);
+        Float dt = Dot(Abs(d), offsetError) / lengthSquared;
+        oi += d * dt;
+        *tMax -= dt;
+    }
+    return Ray(Point3f(oi), d, r.time, r.medium);
+}
+
+pstd::optional<ShapeIntersection> InstanceArrayAggregate::Intersect(const Ray &ray,
+                                                                    Float tMax) const {
+    pstd::optional<ShapeIntersection> si;
+    int hitInstance = -1;
+    nodes.Traverse<false>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        bool hit = false;
+        for (int i = offset; i < offset + count; ++i) {
+            // Intersect ray with instance's prototype in instance space
+            Float instanceTMax = *tMax;
+            Ray instanceRay =
+                TransformRay(instances[i].instanceFromRender, ray, &instanceTMax);
+            pstd::optional<ShapeIntersection> instanceSi =
+                prototypes[instances[i].prototypeIndex].Intersect(instanceRay,
+                                                                  instanceTMax);
+            if (instanceSi) {
+                si = instanceSi;
+                hitInstance = i;
+                *tMax = si->tHit;
+                hit = true;
+            }
+        }
+        return hit;
+    });
+    if (!si)
+        return {};
+
+    // Return closest instance's intersection information in rendering space;
+    // the render-from-instance matrix is only found for the closest hit
+    Float m[4][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 1}};
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            m[r][c] = instances[hitInstance].instanceFromRender[r][c];
+    si->intr = Inverse(Transform(m))(si->intr);
+    return si;
+}
+
+bool InstanceArrayAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    return nodes.Traverse<true>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        for (int i = offset; i < offset + count; ++i) {
+            Float instanceTMax = *tMax;
+            Ray instanceRay =
+                TransformRay(instances[i].instanceFromRender, ray, &instanceTMax);
+            if (prototypes[instances[i].prototypeIndex].IntersectP(instanceRay,
+                                                                   instanceTMax))
+                return true;
+        }
+        return false;
+    });
+}
+
+// MotionBVHAggregate Method Definitions
+MotionBVHAggregate::MotionBVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
+                                       int maxTimeSegments, BVHNodeFormat nodeFormat)
+    : maxPrimsInNode(maxPrimsInNode), nodeFormat(nodeFormat) {
+    CHECK(!prims.empty());
+    TRACE_SCOPE("Motion BVH build", "primitives", prims.size());
+    // Find time range spanned by animated primitives' transformations
+    Float time0 = Infinity, time1 = -Infinity;
+    for (Primitive prim : prims)
+        if (const AnimatedPrimitive *ap = prim.CastOrNullptr<AnimatedPrimitive>()) {
+            time0 = std::min(time0, ap->RenderFromPrimitive().startTime);
+            time1 = std::max(time1, ap->RenderFromPrimitive().endTime);
+        }
+    if (time0 > time1)
+        time0 = time1 = 0;
+
+    // Split time range into segments and build a BVH for each one
+    std::vector<Bounds3f> primBounds = primitiveBounds(prims, time0, time1);
+    for (const Bounds3f &b : primBounds)
+        bounds = Union(bounds, b);
+    segmentTimes.push_back(time0);
+    buildSegments(prims, time0, time1, std::move(primBounds),
+                  Log2Int(std::max(1, maxTimeSegments)));
+
+    size_t bytes = sizeof(*this) + segmentTimes.size() * sizeof(Float);
+    for (const TimeSegment &segment : segments)
+        bytes += sizeof(TimeSegment) + segment.nodes.BytesUsed() +
+                 segment.primitives.size() * sizeof(Primitive);
+    motionBVHBytes += bytes;
+    motionBVHSegments += segments.size();
+    LOG_VERBOSE("Motion BVH created with %d time segments over [%f, %f] for %d "
+                "primitives (%.2f MB)",
+                (int)segments.size(), time0, time1, (int)prims.size(),
+                float(bytes) / (1024.f * 1024.f));
+}
+
+MotionBVHAggregate *MotionBVHAggregate::Create(std::vector<Primitive> prims,
+                                               const ParameterDictionary &parameters) {
+    int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
+    int maxTimeSegments = parameters.GetOneInt("maxtimesegments", 8);
+    BVHNodeFormat nodeFormat = GetBVHNodeFormat(parameters);
+    return new MotionBVHAggregate(std::move(prims), maxPrimsInNode, maxTimeSegments,
+                                  nodeFormat);
+}
+
+std::vector<Bounds3f> MotionBVHAggregate::primitiveBounds(
+    const std::vector<Primitive> &prims, Float time0, Float time1) const {
+    std::vector<Bounds3f> primBounds(prims.size());
+    ParallelFor(0, prims.size(), [&](int64_t i) {
+        if (const AnimatedPrimitive *ap = prims[i].CastOrNullptr<AnimatedPrimitive>())
+            primBounds[i] = ap->MotionBounds(time0, time1);
+        else
+            primBounds[i] = prims[i].Bounds();
+    });
+    return primBounds;
+}
+
+void MotionBVHAggregate::buildSegments(const std::vector<Primitive> &prims, Float time0,
+                                       Float time1, std::vector<Bounds3f> primBounds,
+                                       int depth) {
+    if (depth > 0 && time1 > time0) {
+        // Split time range in half if that sufficiently reduces bounds' area
+        // The summed surface area of the primitives' bounds is proportional
+        // to the expected number of them that a random ray will be tested
+        // against, as with the SAH.
+        Float timeMid = (time0 + time1) / 2;
+        std::vector<Bounds3f> bounds0 = primitiveBounds(prims, time0, timeMid);
+        std::vector<Bounds3f> bounds1 = primitiveBounds(prims, timeMid, time1);
+        auto totalArea = [](const std::vector<Bounds3f> &b) {
+            double area = 0;
+            for (const Bounds3f &pb : b)
+                area += pb.SurfaceArea();
+            return area;
+        };
+        if (totalArea(bounds0) + totalArea(bounds1) < 1.8 * totalArea(primBounds)) {
+            buildSegments(prims, time0, timeMid, std::move(bounds0), depth - 1);
+            buildSegments(prims, timeMid, time1, std::move(bounds1), depth - 1);
+            return;
+        }
+    }
+
+    // Build BVH over primitive bounds for the time segment
+    std::vector<BVHPrimitive> bvhPrimitives(prims.size());
+    for (size_t i = 0; i < prims.size(); ++i)
+        bvhPrimitives[i] = BVHPrimitive(i, primBounds[i]);
+    std::vector<int> primOrder;
+    int totalNodes;
+    LinearBVHNode *linearNodes =
+        BVHBuilder(maxPrimsInNode, BVHAggregate::SplitMethod::SAH)
+            .Build(std::move(bvhPrimitives), &primOrder, &totalNodes);
+
+    TimeSegment segment;
+    segment.nodes = BVHNodeArray(linearNodes, totalNodes, nodeFormat);
+    segment.primitives.resize(prims.size());
+    for (size_t i = 0; i < primOrder.size(); ++i)
+        segment.primitives[i] = prims[primOrder[i]];
+    segments.push_back(std::move(segment));
+    segmentTimes.push_back(time1);
+}
+
+pstd::optional<ShapeIntersection> MotionBVHAggregate::Intersect(const Ray &ray,
+                                                                Float tMax) const {
+    // Find time segment for ray and intersect it with the segment's BVH
+    int s = FindInterval(segmentTimes.size(),
+                         [&](int i) { return segmentTimes[i] <= ray.time; });
+    const std::vector<Primitive> &primitives = segments[s].primitives;
+    pstd::optional<ShapeIntersection> si;
+    segments[s].nodes.Traverse<false>(ray, tMax, [&](int offset, int count, Float *tMax) {
+        bool hit = false;
+        for (int i = offset; i < offset + count; ++i)
+            if (pstd::optional<ShapeIntersection> primSi =
+                    primitives[i].Intersect(ray, *tMax)) {
+                si = primSi;
+                *tMax = si->tHit;
+                hit = true;
+            }
+        return hit;
+    });
+    return si;
+}
+
+bool MotionBVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    int s = FindInterval(segmentTimes.size(),
+                         [&](int i) { return segmentTimes[i] <= ray.time; });
+    const std::vector<Primitive> &primitives = segments[s].primitives;
+    return segments[s].nodes.Traverse<true>(
+        ray, tMax, [&](int offset, int count, Float *tMax) {
+            for (int i = offset; i < offset + count; ++i)
+                if (primitives[i].IntersectP(ray, *tMax))
+                    return true;
+            return false;
+        });
 }
 
 // KdNodeToVisit Definition
@@ -802,6 +2402,7 @@ KdTreeAggregate::KdTreeAggregate(std::vector<Primitive> p, int isectCost,
       maxPrims(maxPrims),
       emptyBonus(emptyBonus),
       primitives(std::move(p)) {
+    TRACE_SCOPE("kd-tree build", "primitives", primitives.size());
     // Build kd-tree aggregate
     nextFreeNode = nAllocedNodes = 0;
     if (maxDepth <= 0)
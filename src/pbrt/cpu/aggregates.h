@@ -8,10 +8,12 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/cpu/primitive.h>
+#include <pbrt/shapes.h>
 #include <pbrt/util/parallel.h>
 
 #include <atomic>
 #include <memory>
+#include <utility>
 #include <vector>
 
 namespace pbrt {
@@ -19,10 +21,61 @@ namespace pbrt {
 Primitive CreateAccelerator(const std::string &name, std::vector<Primitive> prims,
                             const ParameterDictionary &parameters);
 
-struct BVHBuildNode;
-struct BVHPrimitive;
 struct LinearBVHNode;
-struct MortonPrimitive;
+template <typename T>
+struct QuantizedBVHNode;
+
+// BVHNodeFormat Definition
+enum class BVHNodeFormat { Full, Quantized16, Quantized8 };
+
+// BVHCacheMapping Definition
+// Memory mapping of a BVH cache file that a BVH's nodes were loaded from
+struct BVHCacheMapping {
+    void *ptr = nullptr;
+    size_t length = 0;
+};
+
+// BVHNodeArray Definition
+// Holds a flattened BVH's nodes, either with full-precision bounds or with
+// each node's bounds quantized relative to its parent's.
+class BVHNodeArray {
+  public:
+    // BVHNodeArray Public Methods
+    BVHNodeArray() = default;
+    // If _mapping_ is non-empty, _nodes_ are mapped from a BVH cache file,
+    // which is unmapped when the nodes are quantized or the array is cleared;
+    // otherwise the array takes ownership of _nodes_.
+    BVHNodeArray(LinearBVHNode *nodes, int nNodes, BVHNodeFormat format,
+                 BVHCacheMapping mapping = {});
+
+    Bounds3f Bounds() const { return bounds; }
+    size_t BytesUsed() const;
+    // Returns the SAH cost of the BVH, normalized by its root's surface area
+    Float SAHCost() const;
+
+    // Recomputes node bounds bottom-up given a function that returns the
+    // bounds of the primitive at a leaf primitive offset. Returns false if the
+    // nodes are quantized, in which case the BVH must be rebuilt instead.
+    template <typename F>
+    bool Refit(F primitiveBounds);
+
+    // Frees the nodes, leaving the array empty
+    void Clear();
+
+    template <bool AnyHit, typename F>
+    bool Traverse(const Ray &ray, Float tMax, F intersectLeaf) const;
+
+  private:
+    // BVHNodeArray Private Members
+    BVHNodeFormat format = BVHNodeFormat::Full;
+    Bounds3f bounds;
+    int nNodes = 0;
+    BVHCacheMapping mapping;
+    // Only the array for _format_ is allocated
+    LinearBVHNode *nodes = nullptr;
+    QuantizedBVHNode<uint16_t> *nodes16 = nullptr;
+    QuantizedBVHNode<uint8_t> *nodes8 = nullptr;
+};
 
 // BVHAggregate Definition
 class BVHAggregate {
@@ -32,7 +85,10 @@ class BVHAggregate {
 
     // BVHAggregate Public Methods
     BVHAggregate(std::vector<Primitive> p, int maxPrimsInNode = 1,
-                 SplitMethod splitMethod = SplitMethod::SAH);
+                 SplitMethod splitMethod = SplitMethod::SAH,
+                 BVHNodeFormat nodeFormat = BVHNodeFormat::Full,
+                 bool spatialSplits = false, int optimizationPasses = 0,
+                 Float optimizationSeconds = 0);
 
     static BVHAggregate *Create(std::vector<Primitive> prims,
                                 const ParameterDictionary &parameters);
@@ -41,32 +97,187 @@ class BVHAggregate {
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
     bool IntersectP(const Ray &ray, Float tMax) const;
 
+    // Updates the BVH after its primitives' bounds have changed. It is refit
+    // unless its nodes are quantized or refitting would increase its SAH
+    // cost by more than a factor of _rebuildCostRatio_ over the cost when it
+    // was built; the BVH is rebuilt in those cases.
+    void Refit(Float rebuildCostRatio);
+
+    size_t NodeBytes() const { return nodes.BytesUsed(); }
+    Float SAHCost() const { return nodes.SAHCost(); }
+
   private:
     // BVHAggregate Private Methods
-    BVHBuildNode *buildRecursive(ThreadLocal<Allocator> &threadAllocators,
-                                 pstd::span<BVHPrimitive> bvhPrimitives,
-                                 std::atomic<int> *totalNodes,
-                                 std::atomic<int> *orderedPrimsOffset,
-                                 std::vector<Primitive> &orderedPrims);
-    BVHBuildNode *buildHLBVH(Allocator alloc,
-                             const std::vector<BVHPrimitive> &primitiveInfo,
-                             std::atomic<int> *totalNodes,
-                             std::vector<Primitive> &orderedPrims);
-    BVHBuildNode *emitLBVH(BVHBuildNode *&buildNodes,
-                           const std::vector<BVHPrimitive> &primitiveInfo,
-                           MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
-                           std::vector<Primitive> &orderedPrims,
-                           std::atomic<int> *orderedPrimsOffset, int bitIndex);
-    BVHBuildNode *buildUpperSAH(Allocator alloc,
-                                std::vector<BVHBuildNode *> &treeletRoots, int start,
-                                int end, std::atomic<int> *totalNodes) const;
-    int flattenBVH(BVHBuildNode *node, int *offset);
+    void build();
 
     // BVHAggregate Private Members
     int maxPrimsInNode;
     std::vector<Primitive> primitives;
     SplitMethod splitMethod;
-    LinearBVHNode *nodes = nullptr;
+    BVHNodeArray nodes;
+    BVHNodeFormat nodeFormat;
+    bool spatialSplits;
+    int optimizationPasses;
+    Float optimizationSeconds;
+    Float builtSAHCost;
+};
+
+// TriangleMeshAggregate Definition
+// Stores the triangles of a single mesh in a BVH whose leaves refer to
+// triangles by index, sharing the material, area lights, medium interface,
+// and alpha texture across the whole mesh rather than storing a separate
+// _Primitive_ for each triangle.
+class TriangleMeshAggregate {
+  public:
+    // TriangleMeshAggregate Public Methods
+    TriangleMeshAggregate(const TriangleMesh *mesh, Material material,
+                          pstd::span<const Light> areaLights,
+                          const MediumInterface &mediumInterface, FloatTexture alpha,
+                          int maxPrimsInNode = 4, bool packVertices = false,
+                          BVHNodeFormat nodeFormat = BVHNodeFormat::Full,
+                          bool spatialSplits = false, bool trianglePackets = false);
+
+    // Returns nullptr if _shapes_ is not the complete set of triangles of a
+    // single mesh, in which case individual primitives should be used.
+    static TriangleMeshAggregate *Create(pstd::span<const Shape> shapes,
+                                         Material material,
+                                         pstd::span<const Light> areaLights,
+                                         const MediumInterface &mediumInterface,
+                                         FloatTexture alpha,
+                                         const ParameterDictionary &parameters);
+
+    Bounds3f Bounds() const;
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+    // Returns the fraction of the triangle packets' lanes that hold
+    // triangles, or zero if triangle packets aren't used.
+    Float PacketOccupancy() const;
+
+    // Updates the BVH after the mesh's vertex positions have changed; see
+    // BVHAggregate::Refit().
+    void Refit(Float rebuildCostRatio);
+
+  private:
+    // TriangleMeshAggregate Private Methods
+    void build();
+    void packLeafVertices();
+    void buildTrianglePackets(const LinearBVHNode *linearNodes, int nNodes);
+    void fillTrianglePackets();
+    pstd::optional<TriangleIntersection> intersectTriangle(const Ray &ray, Float tMax,
+                                                           int index) const;
+    // Returns the closest intersection with the leaf's triangles, or any of
+    // them if _AnyHit_ is true, setting _*triIndex_ to the triangle's index
+    template <bool AnyHit>
+    pstd::optional<TriangleIntersection> intersectLeaf(const Ray &ray,
+                                                       const WatertightRay &wray,
+                                                       int offset, int count, Float tMax,
+                                                       int *triIndex) const;
+    bool alphaRejects(const Ray &ray, int triIndex,
+                      const TriangleIntersection &ti) const;
+
+    // TriangleMeshAggregate Private Members
+    const TriangleMesh *mesh;
+    Material material;
+    std::vector<Light> areaLights;
+    MediumInterface mediumInterface;
+    FloatTexture alpha;
+    BVHNodeArray nodes;
+    // Triangle indices in the order they are referenced by BVH leaves and, if
+    // requested, a copy of their vertex positions laid out in the same order
+    std::vector<int> triangleIndices;
+    std::vector<Point3f> packedVertices;
+    // Optionally, leaves' triangles in SoA packets; _packetRanges_ holds the
+    // _triangleIndices_ offset and count of each packet's triangles and
+    // _leafPackets_ maps each leaf's offset to the index of its first packet.
+    std::vector<TrianglePacket> trianglePackets;
+    std::vector<std::pair<int, int>> packetRanges;
+    std::vector<int> leafPackets;
+    int maxPrimsInNode;
+    bool usePackedVertices, useTrianglePackets;
+    BVHNodeFormat nodeFormat;
+    bool spatialSplits;
+    Float builtSAHCost;
+};
+
+// InstanceArrayAggregate Definition
+// Stores non-animated object instances compactly, each as an affine
+// transformation and the index of the primitive it instances, with a BVH
+// built directly over the instances' bounds.
+class InstanceArrayAggregate {
+  public:
+    // InstanceArrayAggregate Public Types
+    // Instances' transformations are only used while the aggregate is built.
+    struct Instance {
+        const Transform *renderFromInstance;
+        int prototypeIndex;
+    };
+
+    // InstanceArrayAggregate Public Methods
+    InstanceArrayAggregate(std::vector<Primitive> prototypes,
+                           pstd::span<const Instance> instances, int maxPrimsInNode = 4,
+                           BVHNodeFormat nodeFormat = BVHNodeFormat::Full);
+
+    static InstanceArrayAggregate *Create(std::vector<Primitive> prototypes,
+                                          pstd::span<const Instance> instances,
+                                          const ParameterDictionary &parameters);
+
+    Bounds3f Bounds() const { return nodes.Bounds(); }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+  private:
+    // InstanceArrayAggregate Private Members
+    struct CompactInstance {
+        Float instanceFromRender[3][4];
+        int prototypeIndex;
+    };
+    std::vector<Primitive> prototypes;
+    // Instances are stored in the order they are referenced by BVH leaves
+    std::vector<CompactInstance> instances;
+    BVHNodeArray nodes;
+};
+
+// MotionBVHAggregate Definition
+// Holds primitives that may be moving over the shutter interval. That
+// interval is recursively halved wherever doing so substantially reduces the
+// primitives' motion bounds, and a separate BVH is built over the bounds for
+// each resulting time segment; rays traverse only the BVH for their time.
+class MotionBVHAggregate {
+  public:
+    // MotionBVHAggregate Public Methods
+    MotionBVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode = 4,
+                       int maxTimeSegments = 8,
+                       BVHNodeFormat nodeFormat = BVHNodeFormat::Full);
+
+    static MotionBVHAggregate *Create(std::vector<Primitive> prims,
+                                      const ParameterDictionary &parameters);
+
+    Bounds3f Bounds() const { return bounds; }
+    int TimeSegments() const { return segments.size(); }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+  private:
+    // MotionBVHAggregate Private Methods
+    std::vector<Bounds3f> primitiveBounds(const std::vector<Primitive> &prims,
+                                          Float time0, Float time1) const;
+    void buildSegments(const std::vector<Primitive> &prims, Float time0, Float time1,
+                       std::vector<Bounds3f> primBounds, int depth);
+
+    // MotionBVHAggregate Private Members
+    struct TimeSegment {
+        BVHNodeArray nodes;
+        // Primitives in the order they are referenced by the BVH's leaves
+        std::vector<Primitive> primitives;
+    };
+    int maxPrimsInNode;
+    BVHNodeFormat nodeFormat;
+    Bounds3f bounds;
+    // Segment _i_ spans [segmentTimes[i], segmentTimes[i + 1]]; rays with times
+    // outside of the overall range use the first or last segment.
+    std::vector<Float> segmentTimes;
+    std::vector<TimeSegment> segments;
 };
 
 struct KdTreeNode;
@@ -0,0 +1,449 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/interaction.h>
+#include <pbrt/options.h>
+#include <pbrt/paramdict.h>
+#include <pbrt/pbrt.h>
+#include <pbrt/shapes.h>
+#include <pbrt/testutil.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/transform.h>
+#include <pbrt/util/vecmath.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace pbrt;
+
+// Returns a mesh of randomly placed and possibly overlapping small triangles
+// inside the unit cube.
+static TriangleMesh *RandomTriangleSoup(RNG &rng, int nTriangles) {
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f center(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        for (int j = 0; j < 3; ++j) {
+            Vector3f offset(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                            rng.Uniform<Float>());
+            indices.push_back(p.size());
+            p.push_back(center + .1f * (offset - Vector3f(.5f, .5f, .5f)));
+        }
+    }
+    return new TriangleMesh(Transform(), false, indices, p, {}, {}, {}, {}, Allocator());
+}
+
+// Returns an _n_ by _n_ grid of quads with random heights, split into triangles.
+static TriangleMesh *RandomHeightField(RNG &rng, int n) {
+    std::vector<Point3f> p;
+    for (int y = 0; y <= n; ++y)
+        for (int x = 0; x <= n; ++x)
+            p.push_back(Point3f(Float(x) / n, Float(y) / n, .05f * rng.Uniform<Float>()));
+    std::vector<int> indices;
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            int v00 = y * (n + 1) + x, v10 = v00 + 1, v01 = v00 + n + 1, v11 = v01 + 1;
+            for (int v : {v00, v10, v11, v00, v11, v01})
+                indices.push_back(v);
+        }
+    return new TriangleMesh(Transform(), false, indices, p, {}, {}, {}, {}, Allocator());
+}
+
+static Ray RandomRay(RNG &rng) {
+    Point3f o(3 * rng.Uniform<Float>() - 1, 3 * rng.Uniform<Float>() - 1,
+              3 * rng.Uniform<Float>() - 1);
+    Point3f target(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+    return Ray(o, target - o);
+}
+
+static std::vector<Primitive> TrianglePrimitives(const TriangleMesh *mesh) {
+    std::vector<Primitive> prims;
+    for (Shape tri : Triangle::CreateTriangles(mesh, Allocator()))
+        prims.push_back(new SimplePrimitive(tri, nullptr));
+    return prims;
+}
+
+TEST(BVHAggregate, QuantizedNodesMatchFull) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 5000);
+    BVHAggregate full(TrianglePrimitives(mesh), 4);
+
+    // Each format should be smaller than the one before it
+    size_t previousNodeBytes = full.NodeBytes();
+    for (BVHNodeFormat format : {BVHNodeFormat::Quantized16, BVHNodeFormat::Quantized8}) {
+        BVHAggregate quantized(TrianglePrimitives(mesh), 4,
+                               BVHAggregate::SplitMethod::SAH, format);
+        EXPECT_LT(quantized.NodeBytes(), previousNodeBytes);
+        previousNodeBytes = quantized.NodeBytes();
+        EXPECT_EQ(full.Bounds(), quantized.Bounds());
+
+        for (int i = 0; i < 20000; ++i) {
+            Ray ray = RandomRay(rng);
+            pstd::optional<ShapeIntersection> si = full.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> qsi = quantized.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), qsi.has_value());
+            EXPECT_EQ(full.IntersectP(ray, Infinity),
+                      quantized.IntersectP(ray, Infinity));
+            if (si)
+                EXPECT_EQ(si->tHit, qsi->tHit);
+        }
+    }
+}
+
+// Returns a mesh of small triangles mixed with long, thin ones that lie along
+// the unit cube's diagonal, which are poorly bounded by axis-aligned boxes.
+static TriangleMesh *RandomSlivers(RNG &rng, int nTriangles) {
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f p0(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        Vector3f edge = (i % 10 == 0) ? Vector3f(.5f, .5f, .5f) : Vector3f(.01f, .01f, 0);
+        Vector3f offset(.01f * rng.Uniform<Float>(), .01f * rng.Uniform<Float>(), 0);
+        for (Point3f v : {p0, p0 + edge, p0 + offset}) {
+            indices.push_back(p.size());
+            p.push_back(v);
+        }
+    }
+    return new TriangleMesh(Transform(), false, indices, p, {}, {}, {}, {}, Allocator());
+}
+
+TEST(BVHAggregate, SpatialSplitsMatch) {
+    RNG rng;
+    TriangleMesh *mesh = RandomSlivers(rng, 2000);
+    BVHAggregate bvh(TrianglePrimitives(mesh), 4);
+    BVHAggregate sbvh(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::SAH,
+                      BVHNodeFormat::Full, true);
+    TriangleMeshAggregate meshSBVH(mesh, nullptr, {}, MediumInterface(), nullptr, 4,
+                                   false, BVHNodeFormat::Full, true);
+    EXPECT_EQ(bvh.Bounds(), sbvh.Bounds());
+    EXPECT_EQ(bvh.Bounds(), meshSBVH.Bounds());
+    // Splitting the slivers' references should give a substantially better BVH
+    EXPECT_LT(sbvh.SAHCost(), .8f * bvh.SAHCost());
+
+    for (int i = 0; i < 20000; ++i) {
+        Ray ray = RandomRay(rng);
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, Infinity);
+        for (Primitive aggregate : {Primitive(&sbvh), Primitive(&meshSBVH)}) {
+            pstd::optional<ShapeIntersection> ssi = aggregate.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), ssi.has_value());
+            EXPECT_EQ(si.has_value(), aggregate.IntersectP(ray, Infinity));
+            if (si)
+                EXPECT_EQ(si->tHit, ssi->tHit);
+        }
+    }
+}
+
+TEST(BVHAggregate, OptimizedMatches) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 5000);
+    BVHAggregate bvh(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::HLBVH);
+    BVHAggregate optimized(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::HLBVH,
+                           BVHNodeFormat::Full, false, 4);
+    EXPECT_EQ(bvh.Bounds(), optimized.Bounds());
+    EXPECT_LT(optimized.SAHCost(), bvh.SAHCost());
+
+    for (int i = 0; i < 20000; ++i) {
+        Ray ray = RandomRay(rng);
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, Infinity);
+        pstd::optional<ShapeIntersection> osi = optimized.Intersect(ray, Infinity);
+        ASSERT_EQ(si.has_value(), osi.has_value());
+        EXPECT_EQ(si.has_value(), optimized.IntersectP(ray, Infinity));
+        if (si)
+            EXPECT_EQ(si->tHit, osi->tHit);
+    }
+}
+
+TEST(BVHAggregate, OptimizationReducesSAHCost) {
+    RNG rng;
+    TriangleMesh *soup = RandomTriangleSoup(rng, 5000);
+    TriangleMesh *heightField = RandomHeightField(rng, 100);
+    for (TriangleMesh *mesh : {soup, heightField})
+        for (BVHAggregate::SplitMethod splitMethod :
+             {BVHAggregate::SplitMethod::SAH, BVHAggregate::SplitMethod::HLBVH}) {
+            BVHAggregate bvh(TrianglePrimitives(mesh), 4, splitMethod);
+            BVHAggregate optimized(TrianglePrimitives(mesh), 4, splitMethod,
+                                   BVHNodeFormat::Full, false, 4);
+            EXPECT_LT(optimized.SAHCost(), .99f * bvh.SAHCost());
+        }
+}
+
+TEST(BVHAggregate, RefitMatchesRebuild) {
+    RNG rng;
+    TriangleMesh *mesh = RandomHeightField(rng, 100);
+    BVHAggregate bvh(TrianglePrimitives(mesh), 4);
+    BVHAggregate quantized(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::SAH,
+                           BVHNodeFormat::Quantized16);
+    BVHAggregate split(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::SAH,
+                       BVHNodeFormat::Full, true);
+    TriangleMeshAggregate meshAggregate(mesh, nullptr, {}, MediumInterface(), nullptr, 4,
+                                        true);
+
+    // Deform the height field and update the aggregates for its new shape
+    std::vector<Point3f> p(mesh->p, mesh->p + mesh->nVertices);
+    for (Point3f &pt : p)
+        pt.z += .3f * std::sin(10 * pt.x) * std::cos(7 * pt.y);
+    mesh->UpdateVertices(Transform(), p, {}, Allocator());
+    bvh.Refit(Infinity);
+    quantized.Refit(Infinity);
+    split.Refit(1);
+    meshAggregate.Refit(Infinity);
+
+    BVHAggregate rebuilt(TrianglePrimitives(mesh), 4);
+    for (Primitive aggregate :
+         {Primitive(&bvh), Primitive(&quantized), Primitive(&split),
+          Primitive(&meshAggregate)}) {
+        EXPECT_EQ(rebuilt.Bounds(), aggregate.Bounds());
+        for (int i = 0; i < 5000; ++i) {
+            Ray ray = RandomRay(rng);
+            pstd::optional<ShapeIntersection> si = rebuilt.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> asi = aggregate.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), asi.has_value());
+            EXPECT_EQ(si.has_value(), aggregate.IntersectP(ray, Infinity));
+            if (si)
+                EXPECT_EQ(si->tHit, asi->tHit);
+        }
+    }
+}
+
+#ifndef PBRT_IS_WINDOWS
+
+TEST(BVHAggregate, CachedMatchesBuilt) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 5000);
+    BVHAggregate bvh(TrianglePrimitives(mesh), 4);
+
+    TestDirectory dir;
+    ASSERT_TRUE(dir.Valid());
+    OptionsRestorer optionsRestorer;
+    Options->bvhCacheDirectory = dir.Name();
+
+    // The first build writes the cache file and the second maps it
+    BVHAggregate written(TrianglePrimitives(mesh), 4);
+    std::vector<std::string> cacheFiles = MatchingFilenames(dir.Path("pbrt-bvh-"));
+    ASSERT_EQ(1, cacheFiles.size());
+    BVHAggregate cached(TrianglePrimitives(mesh), 4);
+    // Quantizing nodes mapped from the cache file unmaps it
+    BVHAggregate cachedQuantized(TrianglePrimitives(mesh), 4,
+                                 BVHAggregate::SplitMethod::SAH,
+                                 BVHNodeFormat::Quantized16);
+
+    // A corrupted cache file should be ignored and rewritten
+    std::string contents = ReadFileContents(cacheFiles[0]);
+    contents[contents.size() / 2] ^= 1;
+    ASSERT_TRUE(WriteFileContents(cacheFiles[0], contents));
+    BVHAggregate rebuilt(TrianglePrimitives(mesh), 4);
+    EXPECT_NE(contents, ReadFileContents(cacheFiles[0]));
+
+    // Optimized BVHs get their own cache file, unless optimization was
+    // limited by a time budget, which makes the result nondeterministic
+    BVHAggregate optimized(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::SAH,
+                           BVHNodeFormat::Full, false, 2);
+    EXPECT_EQ(2, MatchingFilenames(dir.Path("pbrt-bvh-")).size());
+    BVHAggregate budgeted(TrianglePrimitives(mesh), 4, BVHAggregate::SplitMethod::SAH,
+                          BVHNodeFormat::Full, false, 2, 10.f);
+    EXPECT_EQ(2, MatchingFilenames(dir.Path("pbrt-bvh-")).size());
+
+    for (const BVHAggregate *aggregate : {&written, &cached, &rebuilt}) {
+        EXPECT_EQ(bvh.Bounds(), aggregate->Bounds());
+        EXPECT_EQ(bvh.SAHCost(), aggregate->SAHCost());
+    }
+    for (int i = 0; i < 5000; ++i) {
+        Ray ray = RandomRay(rng);
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, Infinity);
+        for (const BVHAggregate *aggregate : {&cached, &cachedQuantized, &rebuilt}) {
+            pstd::optional<ShapeIntersection> csi = aggregate->Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), csi.has_value());
+            EXPECT_EQ(si.has_value(), aggregate->IntersectP(ray, Infinity));
+            if (si)
+                EXPECT_EQ(si->tHit, csi->tHit);
+        }
+    }
+}
+
+#endif  // !PBRT_IS_WINDOWS
+
+TEST(TriangleMeshAggregate, MatchesBVHAggregate) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 5000);
+    BVHAggregate bvh(TrianglePrimitives(mesh), 4);
+
+    for (bool packVertices : {false, true}) {
+        TriangleMeshAggregate meshAggregate(mesh, nullptr, {}, MediumInterface(), nullptr,
+                                            4, packVertices);
+        EXPECT_EQ(bvh.Bounds(), meshAggregate.Bounds());
+
+        for (int i = 0; i < 20000; ++i) {
+            Ray ray = RandomRay(rng);
+            Float tMax = (i & 1) ? Infinity : 1.f;
+            pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+            pstd::optional<ShapeIntersection> msi = meshAggregate.Intersect(ray, tMax);
+            ASSERT_EQ(si.has_value(), msi.has_value());
+            EXPECT_EQ(bvh.IntersectP(ray, tMax), meshAggregate.IntersectP(ray, tMax));
+            if (!si)
+                continue;
+            EXPECT_EQ(si->tHit, msi->tHit);
+            EXPECT_EQ(si->intr.p(), msi->intr.p());
+            EXPECT_EQ(si->intr.n, msi->intr.n);
+            EXPECT_EQ(si->intr.uv, msi->intr.uv);
+        }
+    }
+}
+
+TEST(TriangleMeshAggregate, TrianglePacketsMatch) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 5000);
+    TriangleMeshAggregate meshAggregate(mesh, nullptr, {}, MediumInterface(), nullptr);
+    for (int maxPrimsInNode : {1, 4, 11}) {
+        TriangleMeshAggregate packets(mesh, nullptr, {}, MediumInterface(), nullptr,
+                                      maxPrimsInNode, false, BVHNodeFormat::Full, false,
+                                      true);
+        EXPECT_EQ(meshAggregate.Bounds(), packets.Bounds());
+
+        // Packets' vectorized edge functions may be rounded differently
+        int nMismatched = 0, nRays = 20000;
+        for (int i = 0; i < nRays; ++i) {
+            Ray ray = RandomRay(rng);
+            Float tMax = (i & 1) ? Infinity : 1.f;
+            pstd::optional<ShapeIntersection> si = meshAggregate.Intersect(ray, tMax);
+            pstd::optional<ShapeIntersection> psi = packets.Intersect(ray, tMax);
+            if (si.has_value() != psi.has_value() ||
+                si.has_value() != packets.IntersectP(ray, tMax)) {
+                ++nMismatched;
+                continue;
+            }
+            if (si)
+                EXPECT_LT(std::abs(si->tHit - psi->tHit), 1e-3f * si->tHit);
+        }
+        EXPECT_LT(nMismatched, nRays / 10000);
+    }
+}
+
+TEST(TriangleMeshAggregate, CreateRequiresWholeMesh) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 16);
+    pstd::vector<Shape> tris = Triangle::CreateTriangles(mesh, Allocator());
+    ParameterDictionary parameters;
+
+    pstd::span<const Shape> allTris(tris);
+    EXPECT_NE(nullptr, TriangleMeshAggregate::Create(allTris, nullptr, {},
+                                                     MediumInterface(), nullptr,
+                                                     parameters));
+    EXPECT_EQ(nullptr, TriangleMeshAggregate::Create(allTris.subspan(1), nullptr, {},
+                                                     MediumInterface(), nullptr,
+                                                     parameters));
+}
+
+TEST(TriangleMeshAggregate, TrianglePacketOccupancy) {
+    RNG rng;
+    TriangleMesh *mesh = RandomTriangleSoup(rng, 5000);
+    pstd::vector<Shape> tris = Triangle::CreateTriangles(mesh, Allocator());
+    ParsedParameter packets{FileLoc()};
+    packets.type = "bool";
+    packets.name = "trianglepackets";
+    packets.AddBool(true);
+    ParameterDictionary parameters({&packets}, RGBColorSpace::sRGB);
+
+    // With the default parameters, the builder should mostly fill packets
+    std::unique_ptr<TriangleMeshAggregate> meshAggregate(TriangleMeshAggregate::Create(
+        tris, nullptr, {}, MediumInterface(), nullptr, parameters));
+    ASSERT_NE(nullptr, meshAggregate.get());
+    EXPECT_GT(meshAggregate->PacketOccupancy(), .75f);
+    EXPECT_LE(meshAggregate->PacketOccupancy(), 1);
+}
+
+TEST(InstanceArrayAggregate, MatchesTransformedPrimitives) {
+    RNG rng;
+    std::vector<Primitive> prototypes = {
+        new TriangleMeshAggregate(RandomTriangleSoup(rng, 200), nullptr, {},
+                                  MediumInterface(), nullptr),
+        new TriangleMeshAggregate(RandomTriangleSoup(rng, 50), nullptr, {},
+                                  MediumInterface(), nullptr)};
+
+    // Place randomly transformed instances of the prototypes in the unit cube
+    constexpr int nInstances = 500;
+    std::vector<Transform> transforms;
+    std::vector<InstanceArrayAggregate::Instance> instances;
+    std::vector<Primitive> transformedPrims;
+    transforms.reserve(nInstances);
+    for (int i = 0; i < nInstances; ++i) {
+        Vector3f axis = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        transforms.push_back(
+            Translate(Vector3f(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                               rng.Uniform<Float>())) *
+            Rotate(360 * rng.Uniform<Float>(), axis) * Scale(.1f, .1f, .2f));
+        int prototypeIndex = rng.Uniform<uint32_t>() % prototypes.size();
+        instances.push_back({&transforms.back(), prototypeIndex});
+        transformedPrims.push_back(
+            new TransformedPrimitive(prototypes[prototypeIndex], &transforms.back()));
+    }
+    BVHAggregate bvh(transformedPrims, 4);
+    InstanceArrayAggregate instanceArray(prototypes, instances);
+    EXPECT_EQ(bvh.Bounds(), instanceArray.Bounds());
+
+    for (int i = 0; i < 20000; ++i) {
+        Ray ray = RandomRay(rng);
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, Infinity);
+        pstd::optional<ShapeIntersection> asi = instanceArray.Intersect(ray, Infinity);
+        ASSERT_EQ(si.has_value(), asi.has_value());
+        EXPECT_EQ(bvh.IntersectP(ray, Infinity), instanceArray.IntersectP(ray, Infinity));
+        if (!si)
+            continue;
+        EXPECT_EQ(si->tHit, asi->tHit);
+        EXPECT_LT(Distance(si->intr.p(), asi->intr.p()), 1e-4f);
+        EXPECT_GT(Dot(si->intr.n, asi->intr.n), .999f);
+    }
+}
+
+// Returns a mix of static triangles and small meshes that translate and
+// rotate over the [0,1] shutter interval; _motion_ scales the distance moved.
+static std::vector<Primitive> MovingPrimitives(RNG &rng, int nMoving, Float motion) {
+    std::vector<Primitive> prims = TrianglePrimitives(RandomTriangleSoup(rng, 1000));
+    Primitive mesh = new TriangleMeshAggregate(RandomTriangleSoup(rng, 50), nullptr, {},
+                                               MediumInterface(), nullptr);
+    for (int i = 0; i < nMoving; ++i) {
+        Vector3f p0(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        Vector3f axis = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Vector3f dir = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Vector3f p1 = p0 + motion * dir;
+        Transform start = Translate(p0) * Scale(.1f, .1f, .1f);
+        Transform end = Translate(p1) * Rotate(90 * rng.Uniform<Float>(), axis) *
+                        Scale(.1f, .1f, .1f);
+        prims.push_back(new AnimatedPrimitive(mesh, AnimatedTransform(start, 0, end, 1)));
+    }
+    return prims;
+}
+
+TEST(MotionBVHAggregate, MatchesBVHAggregate) {
+    RNG rng;
+    std::vector<Primitive> prims = MovingPrimitives(rng, 200, 1.f);
+    BVHAggregate bvh(prims, 4);
+    MotionBVHAggregate motionBVH(prims, 4, 8);
+    EXPECT_GT(motionBVH.TimeSegments(), 1);
+    EXPECT_EQ(bvh.Bounds(), motionBVH.Bounds());
+
+    for (int i = 0; i < 20000; ++i) {
+        Ray ray = RandomRay(rng);
+        // Include some rays with times outside of the shutter interval
+        ray.time = 1.5f * rng.Uniform<Float>() - .25f;
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, Infinity);
+        pstd::optional<ShapeIntersection> msi = motionBVH.Intersect(ray, Infinity);
+        ASSERT_EQ(si.has_value(), msi.has_value());
+        EXPECT_EQ(bvh.IntersectP(ray, Infinity), motionBVH.IntersectP(ray, Infinity));
+        if (si)
+            EXPECT_EQ(si->tHit, msi->tHit);
+    }
+
+    // Primitives that don't move shouldn't lead to time segments
+    MotionBVHAggregate staticBVH(TrianglePrimitives(RandomTriangleSoup(rng, 100)));
+    EXPECT_EQ(1, staticBVH.TimeSegments());
+}
@@ -0,0 +1,241 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/guiding.h>
+
+#include <pbrt/paramdict.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Path guiding field", guidingFieldBytes);
+STAT_PERCENT("Integrator/Guiding cells with learned distributions", nValidGuidingCells,
+             nGuidingCells);
+STAT_MEMORY_COUNTER("Memory/Path contribution estimates", contributionEstimatorBytes);
+STAT_PERCENT("Integrator/Radiance estimate cells with samples", nValidRadianceCells,
+             nRadianceCells);
+
+// SpatialGrid Method Definitions
+SpatialGrid::SpatialGrid(const Bounds3f &bounds, int maxResolution) : bounds(bounds) {
+    // Compute grid resolution proportional to the bounds' extent
+    Vector3f diag = bounds.Diagonal();
+    Float maxExtent = std::max({diag.x, diag.y, diag.z});
+    for (int c = 0; c < 3; ++c)
+        resolution[c] =
+            maxExtent > 0 ? Clamp(int(std::round(maxResolution * diag[c] / maxExtent)),
+                                  1, maxResolution)
+                          : 1;
+}
+
+std::string SpatialGrid::ToString() const {
+    return StringPrintf("[ SpatialGrid bounds: %s resolution: %s ]", bounds, resolution);
+}
+
+// GuidingField Method Definitions
+GuidingField::GuidingField(const Bounds3f &bounds, int spatialResolution,
+                           int directionalResolution, Float bsdfSamplingFraction,
+                           int trainingSpp)
+    : spatialResolution(spatialResolution),
+      directionalResolution(directionalResolution),
+      bsdfSamplingFraction(bsdfSamplingFraction),
+      trainingSpp(trainingSpp) {
+    Reset(bounds);
+    size_t nCells = grid.NumCells();
+    guidingFieldBytes +=
+        nCells * (Sqr(directionalResolution) * sizeof(AtomicFloat) + sizeof(uint8_t));
+}
+
+void GuidingField::Reset(const Bounds3f &bounds) {
+    // Allocate training bins and per-cell directional distributions
+    grid = SpatialGrid(bounds, spatialResolution);
+    size_t nCells = grid.NumCells();
+    trainingBins = std::make_unique<AtomicFloat[]>(nCells * Sqr(directionalResolution));
+    cellDistributions.assign(nCells, PiecewiseConstant1D());
+    cellValid.assign(nCells, 0);
+    training = true;
+}
+
+void GuidingField::Update(int spp) {
+    if (!training)
+        return;
+    // Rebuild each cell's directional distribution from its training bins
+    int nBinsPerCell = Sqr(directionalResolution);
+    ParallelFor(0, cellDistributions.size(), [&](int64_t cell) {
+        std::vector<Float> func(nBinsPerCell);
+        for (int i = 0; i < nBinsPerCell; ++i)
+            func[i] = trainingBins[cell * nBinsPerCell + i];
+        cellDistributions[cell] = PiecewiseConstant1D(func);
+        cellValid[cell] = cellDistributions[cell].Integral() > 0;
+    });
+
+    // Stop training once _trainingSpp_ samples per pixel have been taken
+    if (spp >= trainingSpp) {
+        training = false;
+        nGuidingCells += cellValid.size();
+        nValidGuidingCells += std::count(cellValid.begin(), cellValid.end(), 1);
+        // Release training bins, which are no longer needed
+        trainingBins.reset();
+    }
+}
+
+std::string GuidingField::ToString() const {
+    return StringPrintf("[ GuidingField grid: %s directionalResolution: %d "
+                        "bsdfSamplingFraction: %f trainingSpp: %d training: %s ]",
+                        grid, directionalResolution,
+                        bsdfSamplingFraction, trainingSpp, training);
+}
+
+std::unique_ptr<GuidingField> GuidingField::Create(const ParameterDictionary &parameters,
+                                                   const Bounds3f &bounds,
+                                                   const FileLoc *loc) {
+    bool guiding = parameters.GetOneBool("guiding", false);
+    int spatialResolution = parameters.GetOneInt("guidingspatialresolution", 16);
+    int directionalResolution = parameters.GetOneInt("guidingdirectionalresolution", 16);
+    Float bsdfSamplingFraction = parameters.GetOneFloat("guidingbsdffraction", 0.5f);
+    int trainingSpp = parameters.GetOneInt("guidingtrainingspp", 16);
+    if (spatialResolution < 1 || directionalResolution < 1)
+        ErrorExit(loc, "Guiding field resolutions must be at least 1.");
+    if (bsdfSamplingFraction <= 0 || bsdfSamplingFraction > 1)
+        ErrorExit(loc, "%f: \"guidingbsdffraction\" must be in (0,1].",
+                  bsdfSamplingFraction);
+    if (!guiding || bounds.IsDegenerate())
+        return nullptr;
+    return std::make_unique<GuidingField>(bounds, spatialResolution,
+                                          directionalResolution, bsdfSamplingFraction,
+                                          trainingSpp);
+}
+
+// ContributionEstimator Method Definitions
+ContributionEstimator::ContributionEstimator(const Bounds2i &pixelBounds,
+                                             const Bounds3f &sceneBounds,
+                                             int spatialResolution, Float windowWidth,
+                                             int maxSplits, int trainingSpp)
+    : pixelBounds(pixelBounds),
+      windowWidth(windowWidth),
+      spatialResolution(spatialResolution),
+      maxSplits(maxSplits),
+      trainingSpp(trainingSpp),
+      pixelSums(pixelBounds, 0.f),
+      pixelEstimates(pixelBounds, 0.f) {
+    Reset(sceneBounds);
+    size_t nCells = grid.NumCells();
+    contributionEstimatorBytes +=
+        2 * pixelBounds.Area() * sizeof(Float) +
+        nCells * (sizeof(AtomicFloat) + sizeof(std::atomic<int>) + sizeof(Float));
+}
+
+void ContributionEstimator::Reset(const Bounds3f &sceneBounds) {
+    // Clear pixel estimates, which would otherwise accumulate across resets
+    for (Point2i p : pixelBounds) {
+        pixelSums[p] = 0;
+        pixelEstimates[p] = 0;
+    }
+
+    // Allocate per-cell radiance sums and estimates; estimates start out unknown
+    grid = SpatialGrid(sceneBounds, spatialResolution);
+    size_t nCells = grid.NumCells();
+    radianceSums = std::make_unique<AtomicFloat[]>(nCells);
+    radianceCounts = std::make_unique<std::atomic<int>[]>(nCells);
+    for (size_t i = 0; i < nCells; ++i)
+        radianceCounts[i] = 0;
+    radianceEstimates.assign(nCells, -1);
+    training = true;
+}
+
+pstd::optional<int> ContributionEstimator::RouletteAndSplit(Point2i pPixel, Point3f p,
+                                                            Float throughput, Float u,
+                                                            bool allowSplit,
+                                                            Float *scale) const {
+    // Find pixel and reflected radiance estimates; give up if either is unknown
+    if (!InsideExclusive(pPixel, pixelBounds))
+        return {};
+    Float I = pixelEstimates[pPixel], Lr = radianceEstimates[grid.CellIndex(p)];
+    if (!(I > 0) || Lr < 0)
+        return {};
+
+    // Compare path's expected contribution to the pixel estimate's weight window
+    Float ratio = throughput * Lr / I;
+    Float windowMin = 2 / (1 + windowWidth), windowMax = windowWidth * windowMin;
+    if (ratio < windowMin) {
+        // Play Russian roulette, surviving paths continue at the window's center.
+        // Survival probability is bounded below since _Lr_ is only an estimate.
+        Float q = std::max<Float>(ratio, 0.05f);
+        if (u >= q)
+            return 0;
+        *scale = 1 / q;
+        return 1;
+    }
+    if (allowSplit && ratio > windowMax) {
+        // Split path into copies whose contributions are at the window's center
+        int n = std::min(int(ratio), maxSplits);
+        *scale = Float(1) / n;
+        return n;
+    }
+    *scale = 1;
+    return 1;
+}
+
+void ContributionEstimator::Update(int spp) {
+    // Update per-pixel radiance estimates with all samples taken so far
+    for (Point2i p : pixelBounds)
+        pixelEstimates[p] = pixelSums[p] / spp;
+
+    if (!training)
+        return;
+    // Update per-cell reflected radiance estimates
+    for (size_t cell = 0; cell < radianceEstimates.size(); ++cell) {
+        int count = radianceCounts[cell].load(std::memory_order_relaxed);
+        if (count > 0)
+            radianceEstimates[cell] = radianceSums[cell] / count;
+    }
+
+    // Stop training the radiance estimates after _trainingSpp_ samples per pixel
+    if (spp >= trainingSpp) {
+        training = false;
+        nRadianceCells += radianceEstimates.size();
+        nValidRadianceCells += std::count_if(radianceEstimates.begin(),
+                                             radianceEstimates.end(),
+                                             [](Float Lr) { return Lr >= 0; });
+        radianceSums.reset();
+        radianceCounts.reset();
+    }
+}
+
+std::string ContributionEstimator::ToString() const {
+    return StringPrintf("[ ContributionEstimator pixelBounds: %s grid: %s "
+                        "windowWidth: %f maxSplits: %d trainingSpp: %d training: %s ]",
+                        pixelBounds, grid, windowWidth, maxSplits, trainingSpp,
+                        training);
+}
+
+std::unique_ptr<ContributionEstimator> ContributionEstimator::Create(
+    const ParameterDictionary &parameters, const Bounds2i &pixelBounds,
+    const Bounds3f &sceneBounds, const FileLoc *loc) {
+    bool adrrs = parameters.GetOneBool("adrrs", false);
+    Float windowWidth = parameters.GetOneFloat("adrrswindow", 5.f);
+    int maxSplits = parameters.GetOneInt("adrrsmaxsplits", 8);
+    int trainingSpp = parameters.GetOneInt("adrrstrainingspp", 16);
+    int spatialResolution = parameters.GetOneInt("adrrsspatialresolution", 16);
+    if (windowWidth <= 1)
+        ErrorExit(loc, "%f: \"adrrswindow\" must be greater than 1.", windowWidth);
+    if (maxSplits < 1)
+        ErrorExit(loc, "%d value supplied for \"adrrsmaxsplits\". Must be at least 1.",
+                  maxSplits);
+    if (spatialResolution < 1)
+        ErrorExit(loc,
+                  "%d value supplied for \"adrrsspatialresolution\". Must be at least 1.",
+                  spatialResolution);
+    if (!adrrs || sceneBounds.IsDegenerate() || pixelBounds.IsEmpty())
+        return nullptr;
+    return std::make_unique<ContributionEstimator>(pixelBounds, sceneBounds,
+                                                   spatialResolution, windowWidth,
+                                                   maxSplits, trainingSpp);
+}
+
+}  // namespace pbrt
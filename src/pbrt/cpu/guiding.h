@@ -0,0 +1,202 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_GUIDING_H
+#define PBRT_CPU_GUIDING_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/containers.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/vecmath.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// SpatialGrid Definition
+class SpatialGrid {
+  public:
+    // SpatialGrid Public Methods
+    SpatialGrid() = default;
+    SpatialGrid(const Bounds3f &bounds, int maxResolution);
+
+    size_t NumCells() const {
+        return size_t(resolution.x) * resolution.y * resolution.z;
+    }
+
+    int CellIndex(Point3f p) const {
+        Vector3f o = bounds.Offset(p);
+        Point3i pi;
+        for (int c = 0; c < 3; ++c)
+            pi[c] = Clamp(int(o[c] * resolution[c]), 0, resolution[c] - 1);
+        return (pi.z * resolution.y + pi.y) * resolution.x + pi.x;
+    }
+
+    std::string ToString() const;
+
+  private:
+    // SpatialGrid Private Members
+    Bounds3f bounds;
+    Point3i resolution;
+};
+
+// GuidingDistribution Definition
+class GuidingDistribution {
+  public:
+    // GuidingDistribution Public Methods
+    GuidingDistribution() = default;
+    GuidingDistribution(const PiecewiseConstant1D *distrib, int resolution,
+                        Float bsdfSamplingFraction)
+        : distrib(distrib),
+          resolution(resolution),
+          bsdfSamplingFraction(bsdfSamplingFraction) {}
+
+    operator bool() const { return distrib != nullptr; }
+
+    Float BSDFSamplingFraction() const { return bsdfSamplingFraction; }
+
+    Vector3f Sample(Point2f u, Float *pdf) const {
+        // Sample directional bin and position inside it
+        int offset;
+        Float pdf1D;
+        Float x = distrib->Sample(u[0], &pdf1D, &offset);
+        int n = resolution;
+        Float dx = x * (n * n) - offset;
+        Point2f pSquare(Clamp((offset % n + dx) / n, 0, 1), (offset / n + u[1]) / n);
+
+        // Map sample to the sphere and return direction and its PDF
+        *pdf = pdf1D / (4 * Pi);
+        return EqualAreaSquareToSphere(pSquare);
+    }
+
+    Float PDF(Vector3f w) const {
+        Point2f pSquare = EqualAreaSphereToSquare(w);
+        int n = resolution;
+        int offset = Clamp(int(pSquare[0] * n), 0, n - 1) +
+                     n * Clamp(int(pSquare[1] * n), 0, n - 1);
+        return distrib->func[offset] / (distrib->Integral() * 4 * Pi);
+    }
+
+  private:
+    // GuidingDistribution Private Members
+    const PiecewiseConstant1D *distrib = nullptr;
+    int resolution = 0;
+    Float bsdfSamplingFraction = 1;
+};
+
+// GuidingField Definition
+class GuidingField {
+  public:
+    // GuidingField Public Methods
+    GuidingField(const Bounds3f &bounds, int spatialResolution,
+                 int directionalResolution, Float bsdfSamplingFraction, int trainingSpp);
+
+    static std::unique_ptr<GuidingField> Create(const ParameterDictionary &parameters,
+                                                const Bounds3f &bounds,
+                                                const FileLoc *loc);
+
+    bool Training() const { return training; }
+
+    GuidingDistribution Lookup(Point3f p) const {
+        int cell = grid.CellIndex(p);
+        if (!cellValid[cell])
+            return {};
+        return GuidingDistribution(&cellDistributions[cell], directionalResolution,
+                                   bsdfSamplingFraction);
+    }
+
+    void Add(Point3f p, Vector3f w, Float value) {
+        // Accumulate radiance estimate in directional bin of _p_'s cell
+        if (!training || !(value > 0) || IsInf(value))
+            return;
+        Point2f pSquare = EqualAreaSphereToSquare(w);
+        int n = directionalResolution;
+        int bin = Clamp(int(pSquare[0] * n), 0, n - 1) +
+                  n * Clamp(int(pSquare[1] * n), 0, n - 1);
+        trainingBins[size_t(grid.CellIndex(p)) * n * n + bin].Add(value);
+    }
+
+    void Update(int spp);
+
+    // Discards the learned distributions and starts training again over a
+    // grid fit to _bounds_, for when the scene has changed.
+    void Reset(const Bounds3f &bounds);
+
+    std::string ToString() const;
+
+  private:
+    // GuidingField Private Members
+    SpatialGrid grid;
+    int spatialResolution, directionalResolution;
+    Float bsdfSamplingFraction;
+    int trainingSpp;
+    bool training = true;
+    std::unique_ptr<AtomicFloat[]> trainingBins;
+    std::vector<PiecewiseConstant1D> cellDistributions;
+    std::vector<uint8_t> cellValid;
+};
+
+// ContributionEstimator Definition
+class ContributionEstimator {
+  public:
+    // ContributionEstimator Public Methods
+    ContributionEstimator(const Bounds2i &pixelBounds, const Bounds3f &sceneBounds,
+                          int spatialResolution, Float windowWidth, int maxSplits,
+                          int trainingSpp);
+
+    static std::unique_ptr<ContributionEstimator> Create(
+        const ParameterDictionary &parameters, const Bounds2i &pixelBounds,
+        const Bounds3f &sceneBounds, const FileLoc *loc);
+
+    bool Training() const { return training; }
+
+    void AddPixelSample(Point2i pPixel, Float L) {
+        // Each pixel is only rendered by a single thread during a wave
+        if (InsideExclusive(pPixel, pixelBounds) && L >= 0 && !IsInf(L))
+            pixelSums[pPixel] += L;
+    }
+
+    void AddRadianceSample(Point3f p, Float Lr) {
+        if (!training || !(Lr >= 0) || IsInf(Lr))
+            return;
+        int cell = grid.CellIndex(p);
+        radianceSums[cell].Add(Lr);
+        radianceCounts[cell].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    pstd::optional<int> RouletteAndSplit(Point2i pPixel, Point3f p, Float throughput,
+                                         Float u, bool allowSplit, Float *scale) const;
+
+    void Update(int spp);
+
+    // Discards the pixel and radiance estimates and starts training again
+    // over a grid fit to _sceneBounds_, for when the scene has changed.
+    void Reset(const Bounds3f &sceneBounds);
+
+    std::string ToString() const;
+
+  private:
+    // ContributionEstimator Private Members
+    Bounds2i pixelBounds;
+    SpatialGrid grid;
+    Float windowWidth;
+    int spatialResolution, maxSplits, trainingSpp;
+    bool training = true;
+    Array2D<Float> pixelSums, pixelEstimates;
+    std::unique_ptr<AtomicFloat[]> radianceSums;
+    std::unique_ptr<std::atomic<int>[]> radianceCounts;
+    std::vector<Float> radianceEstimates;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_GUIDING_H
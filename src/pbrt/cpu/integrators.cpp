@@ -39,6 +39,7 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 
 #include <algorithm>
 
@@ -62,6 +63,18 @@ std::string RandomWalkIntegrator::ToString() const {
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
+void Integrator::StartFrame() {
+    // Distant and infinite lights depend on the scene's bounds, which may
+    // have changed along with the scene's geometry
+    Bounds3f sceneBounds = aggregate ? aggregate.Bounds() : Bounds3f();
+    for (Light light : lights)
+        light.Preprocess(sceneBounds);
+}
+
+// Pixel and sample index currently being rendered by each thread
+static thread_local Point2i threadPixel;
+static thread_local int threadSampleIndex;
+
 // ImageTileIntegrator Method Definitions
 void ImageTileIntegrator::Render() {
     // Handle debugStart, if set
@@ -80,14 +93,14 @@ void ImageTileIntegrator::Render() {
         ScratchBuffer scratchBuffer(65536);
         Sampler tileSampler = samplerPrototype.Clone(Allocator());
         tileSampler.StartPixelSample(pPixel, sampleIndex);
+        threadPixel = pPixel;
+        threadSampleIndex = sampleIndex;
 
         EvaluatePixelSample(pPixel, sampleIndex, tileSampler, scratchBuffer);
 
         return;
     }
 
-    thread_local Point2i threadPixel;
-    thread_local int threadSampleIndex;
     CheckCallbackScope _([&]() {
         return StringPrintf("Rendering failed at pixel (%d, %d) sample %d. Debug with "
                             "\"--debugstart %d,%d,%d\"\n",
@@ -160,31 +173,23 @@ void ImageTileIntegrator::Render() {
 
     // Render image in waves
     while (waveStart < spp) {
+        TRACE_SCOPE("Render wave", "waveStart", waveStart, "waveEnd", waveEnd);
         // Render current wave's image tiles in parallel
         ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
             // Render image tile given by _tileBounds_
+            TRACE_SCOPE("Render tile", "x", tileBounds.pMin.x, "y", tileBounds.pMin.y);
+            ProfilerScope _(ProfilePhase::IntegratorRender);
             ScratchBuffer &scratchBuffer = scratchBuffers.Get();
             Sampler &sampler = samplers.Get();
             PBRT_DBG("Starting image tile (%d,%d)-(%d,%d) waveStart %d, waveEnd %d\n",
                      tileBounds.pMin.x, tileBounds.pMin.y, tileBounds.pMax.x,
                      tileBounds.pMax.y, waveStart, waveEnd);
-            for (Point2i pPixel : tileBounds) {
-                StatsReportPixelStart(pPixel);
-                threadPixel = pPixel;
-                // Render samples in pixel _pPixel_
-                for (int sampleIndex = waveStart; sampleIndex < waveEnd; ++sampleIndex) {
-                    threadSampleIndex = sampleIndex;
-                    sampler.StartPixelSample(pPixel, sampleIndex);
-                    EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
-                    scratchBuffer.Reset();
-                }
-
-                StatsReportPixelEnd(pPixel);
-            }
+            EvaluateTileSamples(tileBounds, waveStart, waveEnd, sampler, scratchBuffer);
             PBRT_DBG("Finished image tile (%d,%d)-(%d,%d)\n", tileBounds.pMin.x,
                      tileBounds.pMin.y, tileBounds.pMax.x, tileBounds.pMax.y);
             progress.Update((waveEnd - waveStart) * tileBounds.Area());
         });
+        FinishWave(waveEnd);
 
         // Update start and end wave
         waveStart = waveEnd;
@@ -206,7 +211,11 @@ void ImageTileIntegrator::Render() {
                     camera.GetFilm().GetImage(&filmMetadata, 1.f / waveStart);
                 ImageChannelValues mse =
                     filmImage.MSE(filmImage.AllChannelsDesc(), *referenceImage);
-                fprintf(mseOutFile, "%d, %.9g\n", waveStart, mse.Average());
+                if (Options->mseReferenceTimes)
+                    fprintf(mseOutFile, "%d, %.9g, %.3f\n", waveStart, mse.Average(),
+                            metadata.renderTimeSeconds);
+                else
+                    fprintf(mseOutFile, "%d, %.9g\n", waveStart, mse.Average());
                 metadata.MSE = mse.Average();
                 fflush(mseOutFile);
             }
@@ -223,54 +232,42 @@ void ImageTileIntegrator::Render() {
     LOG_VERBOSE("Rendering finished");
 }
 
+void ImageTileIntegrator::EvaluateTileSamples(Bounds2i tileBounds, int waveStart,
+                                              int waveEnd, Sampler sampler,
+                                              ScratchBuffer &scratchBuffer) {
+    for (Point2i pPixel : tileBounds) {
+        StatsReportPixelStart(pPixel);
+        threadPixel = pPixel;
+        // Render samples in pixel _pPixel_
+        for (int sampleIndex = waveStart; sampleIndex < waveEnd; ++sampleIndex) {
+            threadSampleIndex = sampleIndex;
+            sampler.StartPixelSample(pPixel, sampleIndex);
+            EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
+            scratchBuffer.Reset();
+        }
+
+        StatsReportPixelEnd(pPixel);
+    }
+}
+
 // RayIntegrator Method Definitions
 void RayIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex, Sampler sampler,
                                         ScratchBuffer &scratchBuffer) {
-    // Sample wavelengths for the ray
-    Float lu = sampler.Get1D();
-    if (Options->disableWavelengthJitter)
-        lu = 0.5;
-    SampledWavelengths lambda = camera.GetFilm().SampleWavelengths(lu);
-
-    // Initialize _CameraSample_ for current sample
-    Filter filter = camera.GetFilm().GetFilter();
-    CameraSample cameraSample = GetCameraSample(sampler, pPixel, filter);
-
-    // Generate camera ray for current sample
+    // Generate camera ray and wavelengths for current sample
+    SampledWavelengths lambda;
+    CameraSample cameraSample;
     pstd::optional<CameraRayDifferential> cameraRay =
-        camera.GenerateRayDifferential(cameraSample, lambda);
+        GenerateCameraRay(pPixel, sampler, &lambda, &cameraSample);
 
     // Trace _cameraRay_ if valid
     SampledSpectrum L(0.);
     VisibleSurface visibleSurface;
     if (cameraRay) {
-        // Double check that the ray's direction is normalized.
-        DCHECK_GT(Length(cameraRay->ray.d), .999f);
-        DCHECK_LT(Length(cameraRay->ray.d), 1.001f);
-        // Scale camera ray differentials based on image sampling rate
-        Float rayDiffScale =
-            std::max<Float>(.125f, 1 / std::sqrt((Float)sampler.SamplesPerPixel()));
-        if (!Options->disablePixelJitter)
-            cameraRay->ray.ScaleDifferentials(rayDiffScale);
-
-        ++nCameraRays;
         // Evaluate radiance along camera ray
         bool initializeVisibleSurface = camera.GetFilm().UsesVisibleSurface();
         L = cameraRay->weight * Li(cameraRay->ray, lambda, sampler, scratchBuffer,
                                    initializeVisibleSurface ? &visibleSurface : nullptr);
-
-        // Issue warning if unexpected radiance value is returned
-        if (L.HasNaNs()) {
-            LOG_ERROR("Not-a-number radiance value returned for pixel (%d, "
-                      "%d), sample %d. Setting to black.",
-                      pPixel.x, pPixel.y, sampleIndex);
-            L = SampledSpectrum(0.f);
-        } else if (IsInf(L.y(lambda))) {
-            LOG_ERROR("Infinite radiance value returned for pixel (%d, %d), "
-                      "sample %d. Setting to black.",
-                      pPixel.x, pPixel.y, sampleIndex);
-            L = SampledSpectrum(0.f);
-        }
+        L = CheckRadiance(L, lambda, pPixel, sampleIndex);
 
         PBRT_DBG(
             "%s\n",
@@ -288,6 +285,62 @@ void RayIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex, Sampler
                                cameraSample.filterWeight);
 }
 
+pstd::optional<CameraRayDifferential> RayIntegrator::GenerateCameraRay(
+    Point2i pPixel, Sampler sampler, SampledWavelengths *lambda,
+    CameraSample *cameraSample) const {
+    *cameraSample = SampleCamera(pPixel, sampler, lambda);
+    // Generate camera ray for current sample
+    pstd::optional<CameraRayDifferential> cameraRay =
+        camera.GenerateRayDifferential(*cameraSample, *lambda);
+    if (cameraRay)
+        FinishCameraRay(*cameraRay, sampler);
+    return cameraRay;
+}
+
+CameraSample RayIntegrator::SampleCamera(Point2i pPixel, Sampler sampler,
+                                         SampledWavelengths *lambda) const {
+    // Sample wavelengths for the ray
+    Float lu = sampler.Get1D();
+    if (Options->disableWavelengthJitter)
+        lu = 0.5;
+    *lambda = camera.GetFilm().SampleWavelengths(lu);
+
+    // Initialize _CameraSample_ for current sample
+    Filter filter = camera.GetFilm().GetFilter();
+    return GetCameraSample(sampler, pPixel, filter);
+}
+
+void RayIntegrator::FinishCameraRay(CameraRayDifferential &cameraRay,
+                                    Sampler sampler) const {
+    // Double check that the ray's direction is normalized.
+    DCHECK_GT(Length(cameraRay.ray.d), .999f);
+    DCHECK_LT(Length(cameraRay.ray.d), 1.001f);
+    // Scale camera ray differentials based on image sampling rate
+    Float rayDiffScale =
+        std::max<Float>(.125f, 1 / std::sqrt((Float)sampler.SamplesPerPixel()));
+    if (!Options->disablePixelJitter)
+        cameraRay.ray.ScaleDifferentials(rayDiffScale);
+    ++nCameraRays;
+}
+
+SampledSpectrum RayIntegrator::CheckRadiance(SampledSpectrum L,
+                                             const SampledWavelengths &lambda,
+                                             Point2i pPixel, int sampleIndex) {
+    // Issue warning if unexpected radiance value is returned
+    if (L.HasNaNs()) {
+        LOG_ERROR("Not-a-number radiance value returned for pixel (%d, "
+                  "%d), sample %d. Setting to black.",
+                  pPixel.x, pPixel.y, sampleIndex);
+        return SampledSpectrum(0.f);
+    } else if (IsInf(L.y(lambda))) {
+        LOG_ERROR("Infinite radiance value returned for pixel (%d, %d), "
+                  "sample %d. Setting to black.",
+                  pPixel.x, pPixel.y, sampleIndex);
+        return SampledSpectrum(0.f);
+    }
+    return L;
+}
+
 // Integrator Utility Functions
 STAT_COUNTER("Intersections/Regular ray intersection tests", nIntersectionTests);
 STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
@@ -295,6 +348,7 @@ STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
 // Integrator Method Definitions
 pstd::optional<ShapeIntersection> Integrator::Intersect(const Ray &ray,
                                                         Float tMax) const {
+    ProfilerScope _(ProfilePhase::Intersect);
     ++nIntersectionTests;
     DCHECK_NE(ray.d, Vector3f(0, 0, 0));
     if (aggregate)
@@ -304,6 +358,7 @@ pstd::optional<ShapeIntersection> Integrator::Intersect(const Ray &ray,
 }
 
 bool Integrator::IntersectP(const Ray &ray, Float tMax) const {
+    ProfilerScope _(ProfilePhase::IntersectShadow);
     ++nShadowTests;
     DCHECK_NE(ray.d, Vector3f(0, 0, 0));
     if (aggregate)
@@ -612,29 +667,263 @@ std::unique_ptr<LightPathIntegrator> LightPathIntegrator::Create(
                                                  lights);
 }
 
+// LightSampleBatch Definition
+static constexpr int LightSampleBatchSize = 8;
+
+struct LightSampleBatch {
+    // LightSampleBatch::Entry Definition
+    struct Entry {
+        Light light;
+        Float p_l;
+        LightLiSample ls;
+        // Ratio of the sample's unbiased contribution weight to $1/p_l$; this
+        // is one unless the sample was chosen with resampled importance sampling
+        Float scale;
+        // Scattering function value and PDF for the light sample's direction
+        SampledSpectrum f;
+        Float p_b;
+    };
+
+    // LightSampleBatch Public Methods
+    void Add(Light light, Float p_l, const LightLiSample &ls, Float scale = 1) {
+        DCHECK_LT(size, LightSampleBatchSize);
+        entries[size++] = Entry{light, p_l, ls, scale, SampledSpectrum(0.f), 0};
+    }
+
+    // LightSampleBatch Public Members
+    Entry entries[LightSampleBatchSize];
+    int size = 0;
+};
+
+// Resampled Importance Sampling Utility Functions
+template <typename F>
+void SampleLightRIS(LightSampler lightSampler, const LightSampleContext &ctx,
+                    int nCandidates, Point2f u, SampledWavelengths &lambda, F eval_f,
+                    LightSampleBatch *batch) {
+    // Stream _nCandidates_ light samples through a weighted reservoir
+    RNG rng(Hash(u[0]), Hash(u[1]));
+    WeightedReservoirSampler<LightSampleBatch::Entry> reservoir(rng.Uniform<uint64_t>());
+    for (int start = 0; start < nCandidates; start += LightSampleBatchSize) {
+        // Generate up to _LightSampleBatchSize_ candidates using _rng_
+        LightSampleBatch candidates;
+        Vector3f wi[LightSampleBatchSize];
+        for (int i = start; i < std::min(nCandidates, start + LightSampleBatchSize);
+             ++i) {
+            // Sample candidate light and point on it using _rng_
+            Float uc = rng.Uniform<Float>();
+            Point2f uLight(rng.Uniform<Float>(), rng.Uniform<Float>());
+            pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, uc);
+            if (!sampledLight)
+                continue;
+            Light light = sampledLight->light;
+            pstd::optional<LightLiSample> ls = light.SampleLi(ctx, uLight, lambda, true);
+            if (!ls || !ls->L || ls->pdf == 0)
+                continue;
+            wi[candidates.size] = ls->wi;
+            candidates.Add(light, sampledLight->p * ls->pdf, *ls);
+        }
+
+        // Evaluate the candidates' scattering functions together
+        SampledSpectrum f[LightSampleBatchSize];
+        eval_f(pstd::span<const Vector3f>(wi, candidates.size),
+               pstd::span<SampledSpectrum>(f, candidates.size));
+
+        // Add candidates to reservoir using their unshadowed contributions as targets
+        for (int i = 0; i < candidates.size; ++i) {
+            LightSampleBatch::Entry &e = candidates.entries[i];
+            Float pHat = (f[i] * e.ls.L).Average();
+            if (pHat == 0)
+                continue;
+            e.f = f[i];
+            reservoir.Add(e, pHat / e.p_l);
+        }
+    }
+    if (!reservoir.HasSample())
+        return;
+
+    // Add reservoir's sample to _batch_ with its RIS contribution weight
+    const LightSampleBatch::Entry &e = reservoir.GetSample();
+    batch->Add(e.light, e.p_l, e.ls, 1 / (nCandidates * reservoir.SampleProbability()));
+}
+
+// GuidedPathVertex Definition
+struct GuidedPathVertex {
+    Point3f p;
+    Vector3f wi;
+    Float pdf;
+    // Path throughput after scattering at the vertex and radiance gathered before it
+    SampledSpectrum beta, L;
+};
+
+// Path Guiding Utility Functions
+GuidingDistribution LookupGuide(const GuidingField *guidingField,
+                                const SurfaceInteraction &intr, const BSDF &bsdf) {
+    // Only guide non-specular, purely reflective BSDFs
+    BxDFFlags flags = bsdf.Flags();
+    if (!guidingField || !IsNonSpecular(flags) || IsSpecular(flags) ||
+        IsTransmissive(flags))
+        return {};
+    return guidingField->Lookup(intr.p());
+}
+
+pstd::optional<BSDFSample> SampleGuidedBSDF(const BSDF &bsdf, Vector3f wo, Float u,
+                                            Point2f u2, GuidingDistribution guide) {
+    if (!guide)
+        return bsdf.Sample_f(wo, u, u2);
+    Float bsdfFraction = guide.BSDFSamplingFraction();
+    if (u < bsdfFraction) {
+        // Sample BSDF and compute guided mixture PDF for its direction
+        u = std::min<Float>(u / bsdfFraction, OneMinusEpsilon);
+        pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, u2);
+        if (!bs || bs->IsSpecular())
+            return bs;
+        Float bsdfPDF = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
+        bs->pdf = bsdfFraction * bsdfPDF + (1 - bsdfFraction) * guide.PDF(bs->wi);
+        bs->pdfIsProportional = false;
+        return bs;
+    }
+
+    // Sample guiding distribution and evaluate BSDF for the sampled direction
+    Float guidePDF;
+    Vector3f wi = guide.Sample(u2, &guidePDF);
+    SampledSpectrum f = bsdf.f(wo, wi);
+    if (!f)
+        return {};
+    Float pdf = bsdfFraction * bsdf.PDF(wo, wi) + (1 - bsdfFraction) * guidePDF;
+    BxDFFlags flags = IsGlossy(bsdf.Flags()) ? BxDFFlags::GlossyReflection
+                                             : BxDFFlags::DiffuseReflection;
+    return BSDFSample(f, wi, pdf, flags);
+}
+
+Float GuidedBSDFPDF(const BSDF &bsdf, Vector3f wo, Vector3f wi,
+                    GuidingDistribution guide) {
+    Float bsdfPDF = bsdf.PDF(wo, wi);
+    if (!guide)
+        return bsdfPDF;
+    Float bsdfFraction = guide.BSDFSamplingFraction();
+    return bsdfFraction * bsdfPDF + (1 - bsdfFraction) * guide.PDF(wi);
+}
+
+void GuidedBSDFPDF(const BSDF &bsdf, Vector3f wo, pstd::span<const Vector3f> wi,
+                   GuidingDistribution guide, pstd::span<Float> pdf) {
+    bsdf.PDF(wo, wi, pdf);
+    if (!guide)
+        return;
+    Float bsdfFraction = guide.BSDFSamplingFraction();
+    for (size_t i = 0; i < wi.size(); ++i)
+        pdf[i] = bsdfFraction * pdf[i] + (1 - bsdfFraction) * guide.PDF(wi[i]);
+}
+
+void AddGuidedPathVertices(GuidingField *guidingField,
+                           pstd::span<const GuidedPathVertex> vertices,
+                           const SampledSpectrum &L) {
+    // Splat incident radiance estimates along sampled directions into _guidingField_
+    for (const GuidedPathVertex &v : vertices) {
+        Float Li = SafeDiv(L - v.L, v.beta).Average();
+        guidingField->Add(v.p, v.wi, Li / v.pdf);
+    }
+}
+
+// ContributionVertex Definition
+struct ContributionVertex {
+    Point3f p;
+    // Path throughput at the vertex and radiance gathered up to its direct lighting
+    SampledSpectrum beta, L;
+};
+
+// Russian Roulette and Splitting Utility Functions
+void AddContributionVertices(ContributionEstimator *contributionEstimator,
+                             pstd::span<const ContributionVertex> vertices,
+                             const SampledSpectrum &L) {
+    // Record estimates of indirect radiance reflected at each vertex
+    for (const ContributionVertex &v : vertices)
+        contributionEstimator->AddRadianceSample(v.p, SafeDiv(L - v.L, v.beta).Average());
+}
+
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_PERCENT("Integrator/Regularized BSDFs", regularizedBSDFs, totalBSDFs);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_PERCENT("Integrator/Paths terminated by contribution-driven roulette",
+             nRouletteTerminations, nRouletteDecisions);
+STAT_COUNTER("Integrator/Split paths", nSplitPaths);
+
+// Estimates the albedo of _bsdf_ for the visible surface at a camera ray's
+// first intersection
+static SampledSpectrum EstimateAlbedo(const BSDF &bsdf, Vector3f wo) {
+    // Define sample arrays _ucRho_ and _uRho_ for reflectance estimate
+    constexpr int nRhoSamples = 16;
+    const Float ucRho[nRhoSamples] = {
+        0.75741637, 0.37870818, 0.7083487, 0.18935409, 0.9149363, 0.35417435,
+        0.5990858,  0.09467703, 0.8578725, 0.45746812, 0.686759,  0.17708716,
+        0.9674518,  0.2995429,  0.5083201, 0.047338516};
+    const Point2f uRho[nRhoSamples] = {
+        Point2f(0.855985, 0.570367), Point2f(0.381823, 0.851844),
+        Point2f(0.285328, 0.764262), Point2f(0.733380, 0.114073),
+        Point2f(0.542663, 0.344465), Point2f(0.127274, 0.414848),
+        Point2f(0.964700, 0.947162), Point2f(0.594089, 0.643463),
+        Point2f(0.095109, 0.170369), Point2f(0.825444, 0.263359),
+        Point2f(0.429467, 0.454469), Point2f(0.244460, 0.816459),
+        Point2f(0.756135, 0.731258), Point2f(0.516165, 0.152852),
+        Point2f(0.180888, 0.214174), Point2f(0.898579, 0.503897)};
+
+    return bsdf.rho(wo, ucRho, uRho);
+}
 
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth, Camera camera, Sampler sampler,
                                Primitive aggregate, std::vector<Light> lights,
-                               const std::string &lightSampleStrategy, bool regularize)
+                               const std::string &lightSampleStrategy, bool regularize,
+                               int nLightSamples, int nRISCandidates,
+                               std::unique_ptr<GuidingField> guidingField,
+                               std::unique_ptr<ContributionEstimator> estimator,
+                               bool sortMaterials)
     : RayIntegrator(camera, sampler, aggregate, lights),
       maxDepth(maxDepth),
       lightSampler(LightSampler::Create(lightSampleStrategy, lights, Allocator())),
-      regularize(regularize) {}
+      regularize(regularize),
+      nLightSamples(nLightSamples),
+      nRISCandidates(nRISCandidates),
+      guidingField(std::move(guidingField)),
+      contributionEstimator(std::move(estimator)),
+      sortMaterials(sortMaterials) {
+    if (sortMaterials)
+        pathSamplers = std::make_unique<ThreadLocal<std::vector<Sampler>>>();
+}
 
 SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                    Sampler sampler, ScratchBuffer &scratchBuffer,
                                    VisibleSurface *visibleSurf) const {
-    // Declare local variables for _PathIntegrator::Li()_
-    SampledSpectrum L(0.f), beta(1.f);
-    int depth = 0;
+    SampledSpectrum L =
+        TracePath(ray, lambda, sampler, scratchBuffer, visibleSurf, PathState());
+    if (contributionEstimator)
+        contributionEstimator->AddPixelSample(threadPixel, L.Average());
+    return L;
+}
 
-    Float p_b, etaScale = 1;
-    bool specularBounce = false, anyNonSpecularBounces = false;
-    LightSampleContext prevIntrCtx;
+SampledSpectrum PathIntegrator::TracePath(RayDifferential ray, SampledWavelengths &lambda,
+                                          Sampler sampler, ScratchBuffer &scratchBuffer,
+                                          VisibleSurface *visibleSurf,
+                                          PathState state) const {
+    // Declare local variables for _PathIntegrator::TracePath()_
+    SampledSpectrum L(0.f), beta = state.beta;
+    int depth = state.depth;
+
+    Float p_b = state.p_b, etaScale = state.etaScale;
+    bool specularBounce = state.specularBounce;
+    bool anyNonSpecularBounces = state.anyNonSpecularBounces, split = state.split;
+    LightSampleContext prevIntrCtx = state.prevIntrCtx;
+
+    // Allocate vertices for training the guiding field, if needed
+    GuidedPathVertex *guidedVertices = nullptr;
+    int nGuidedVertices = 0;
+    if (guidingField && guidingField->Training())
+        guidedVertices = scratchBuffer.Alloc<GuidedPathVertex[]>(maxDepth + 1);
+
+    // Allocate vertices for training the contribution estimator, if needed
+    ContributionVertex *contributionVertices = nullptr;
+    int nContributionVertices = 0;
+    if (contributionEstimator && contributionEstimator->Training())
+        contributionVertices = scratchBuffer.Alloc<ContributionVertex[]>(maxDepth + 1);
 
     // Sample path from camera and accumulate radiance estimate
     while (true) {
@@ -651,7 +940,7 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
                     // Compute MIS weight for infinite light
                     Float p_l = lightSampler.PMF(prevIntrCtx, light) *
                                 light.PDF_Li(prevIntrCtx, ray.d, true);
-                    Float w_b = PowerHeuristic(1, p_b, 1, p_l);
+                    Float w_b = PowerHeuristic(1, p_b, nLightSamples, p_l);
 
                     L += beta * w_b * Le;
                 }
@@ -669,7 +958,7 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
                 Light areaLight(si->intr.areaLight);
                 Float p_l = lightSampler.PMF(prevIntrCtx, areaLight) *
                             areaLight.PDF_Li(prevIntrCtx, ray.d, true);
-                Float w_l = PowerHeuristic(1, p_b, 1, p_l);
+                Float w_l = PowerHeuristic(1, p_b, nLightSamples, p_l);
 
                 L += beta * w_l * Le;
             }
@@ -685,28 +974,8 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         }
 
         // Initialize _visibleSurf_ at first intersection
-        if (depth == 0 && visibleSurf) {
-            // Estimate BSDF's albedo
-            // Define sample arrays _ucRho_ and _uRho_ for reflectance estimate
-            constexpr int nRhoSamples = 16;
-            const Float ucRho[nRhoSamples] = {
-                0.75741637, 0.37870818, 0.7083487, 0.18935409, 0.9149363, 0.35417435,
-                0.5990858,  0.09467703, 0.8578725, 0.45746812, 0.686759,  0.17708716,
-                0.9674518,  0.2995429,  0.5083201, 0.047338516};
-            const Point2f uRho[nRhoSamples] = {
-                Point2f(0.855985, 0.570367), Point2f(0.381823, 0.851844),
-                Point2f(0.285328, 0.764262), Point2f(0.733380, 0.114073),
-                Point2f(0.542663, 0.344465), Point2f(0.127274, 0.414848),
-                Point2f(0.964700, 0.947162), Point2f(0.594089, 0.643463),
-                Point2f(0.095109, 0.170369), Point2f(0.825444, 0.263359),
-                Point2f(0.429467, 0.454469), Point2f(0.244460, 0.816459),
-                Point2f(0.756135, 0.731258), Point2f(0.516165, 0.152852),
-                Point2f(0.180888, 0.214174), Point2f(0.898579, 0.503897)};
-
-            SampledSpectrum albedo = bsdf.rho(isect.wo, ucRho, uRho);
-
-            *visibleSurf = VisibleSurface(isect, albedo, lambda);
-        }
+        if (depth == 0 && visibleSurf)
+            *visibleSurf = VisibleSurface(isect, EstimateAlbedo(bsdf, isect.wo), lambda);
 
         // Possibly regularize the BSDF
         if (regularize && anyNonSpecularBounces) {
@@ -720,25 +989,64 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         if (depth++ == maxDepth)
             break;
 
+        // Find guiding distribution for the path vertex, if available
+        GuidingDistribution guide = LookupGuide(guidingField.get(), isect, bsdf);
+
         // Sample direct illumination from the light sources
         if (IsNonSpecular(bsdf.Flags())) {
             ++totalPaths;
-            SampledSpectrum Ld = SampleLd(isect, &bsdf, lambda, sampler);
+            SampledSpectrum Ld = SampleLd(isect, &bsdf, lambda, sampler, guide);
             if (!Ld)
                 ++zeroRadiancePaths;
-            L += beta * Ld;
+            L.AddProduct(beta, Ld);
+        }
+
+        // Play Russian roulette and split based on the path's expected contribution
+        bool contributionRoulette = false;
+        if (contributionEstimator && IsNonSpecular(bsdf.Flags())) {
+            if (contributionVertices)
+                contributionVertices[nContributionVertices++] =
+                    ContributionVertex{isect.p(), beta, L};
+            bool allowSplit = !split && !anyNonSpecularBounces;
+            Float scale;
+            pstd::optional<int> nPaths = contributionEstimator->RouletteAndSplit(
+                threadPixel, isect.p(), beta.Average(), sampler.Get1D(), allowSplit,
+                &scale);
+            if (nPaths) {
+                contributionRoulette = true;
+                ++nRouletteDecisions;
+                if (*nPaths == 0) {
+                    ++nRouletteTerminations;
+                    break;
+                }
+                beta *= scale;
+                if (*nPaths > 1) {
+                    // Trace additional copies of the path from the current vertex
+                    split = true;
+                    PathState splitState{beta, depth, p_b, etaScale, specularBounce,
+                                         anyNonSpecularBounces, true, prevIntrCtx};
+                    for (int i = 1; i < *nPaths; ++i)
+                        L += SplitPath(isect, bsdf, guide, ray, lambda, sampler,
+                                       scratchBuffer, splitState);
+                    nSplitPaths += *nPaths - 1;
+                }
+            }
         }
 
         // Sample BSDF to get new path direction
         Vector3f wo = -ray.d;
         Float u = sampler.Get1D();
-        pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, sampler.Get2D());
+        pstd::optional<BSDFSample> bs =
+            SampleGuidedBSDF(bsdf, wo, u, sampler.Get2D(), guide);
         if (!bs)
             break;
         // Update path state variables after surface scattering
-        beta *= bs->f * AbsDot(bs->wi, isect.shading.n) / bs->pdf;
+        beta.MulScaled(bs->f, AbsDot(bs->wi, isect.shading.n) / bs->pdf);
         p_b = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
         DCHECK(!IsInf(beta.y(lambda)));
+        if (guidedVertices && !bs->IsSpecular())
+            guidedVertices[nGuidedVertices++] =
+                GuidedPathVertex{isect.p(), bs->wi, p_b, beta, L};
         specularBounce = bs->IsSpecular();
         anyNonSpecularBounces |= !bs->IsSpecular();
         if (bs->IsTransmission())
@@ -749,7 +1057,7 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
 
         // Possibly terminate the path with Russian roulette
         SampledSpectrum rrBeta = beta * etaScale;
-        if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+        if (!contributionRoulette && rrBeta.MaxComponentValue() < 1 && depth > 1) {
             Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
             if (sampler.Get1D() < q)
                 break;
@@ -758,12 +1066,44 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         }
     }
     pathLength << depth;
+    if (guidedVertices)
+        AddGuidedPathVertices(guidingField.get(),
+                              {guidedVertices, size_t(nGuidedVertices)}, L);
+    if (contributionVertices)
+        AddContributionVertices(contributionEstimator.get(),
+                                {contributionVertices, size_t(nContributionVertices)}, L);
     return L;
 }
 
+SampledSpectrum PathIntegrator::SplitPath(const SurfaceInteraction &isect,
+                                          const BSDF &bsdf, GuidingDistribution guide,
+                                          const RayDifferential &ray,
+                                          SampledWavelengths &lambda, Sampler sampler,
+                                          ScratchBuffer &scratchBuffer,
+                                          PathState state) const {
+    // Sample BSDF to get the split path's direction
+    Vector3f wo = -ray.d;
+    Float u = sampler.Get1D();
+    pstd::optional<BSDFSample> bs = SampleGuidedBSDF(bsdf, wo, u, sampler.Get2D(), guide);
+    if (!bs)
+        return SampledSpectrum(0.f);
+
+    // Update split path's state and trace the rest of it
+    state.beta.MulScaled(bs->f, AbsDot(bs->wi, isect.shading.n) / bs->pdf);
+    state.p_b = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
+    state.specularBounce = bs->IsSpecular();
+    state.anyNonSpecularBounces |= !bs->IsSpecular();
+    if (bs->IsTransmission())
+        state.etaScale *= Sqr(bs->eta);
+    state.prevIntrCtx = LightSampleContext(isect);
+    RayDifferential splitRay = isect.SpawnRay(ray, bsdf, bs->wi, bs->flags, bs->eta);
+    return TracePath(splitRay, lambda, sampler, scratchBuffer, nullptr, state);
+}
+
 SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const BSDF *bsdf,
-                                         SampledWavelengths &lambda,
-                                         Sampler sampler) const {
+                                         SampledWavelengths &lambda, Sampler sampler,
+                                         GuidingDistribution guide) const {
+    ProfilerScope _(ProfilePhase::DirectLighting);
     // Initialize _LightSampleContext_ for light sampling
     LightSampleContext ctx(intr);
     // Try to nudge the light sampling position to correct side of the surface
@@ -773,40 +1113,387 @@ SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const B
     else if (IsTransmissive(flags) && !IsReflective(flags))
         ctx.pi = intr.OffsetRayOrigin(-intr.wo);
 
-    // Choose a light source for the direct lighting calculation
-    Float u = sampler.Get1D();
-    pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, u);
-    Point2f uLight = sampler.Get2D();
-    if (!sampledLight)
-        return {};
+    // Take _nLightSamples_ light samples in batches of _LightSampleBatchSize_
+    SampledSpectrum Ld(0.f);
+    Vector3f wo = intr.wo;
+    for (int batchStart = 0; batchStart < nLightSamples;
+         batchStart += LightSampleBatchSize) {
+        int batchEnd = std::min(nLightSamples, batchStart + LightSampleBatchSize);
+        LightSampleBatch batch;
+        // Sample light sources and points on them for the batch
+        for (int i = batchStart; i < batchEnd; ++i) {
+            if (nRISCandidates > 1) {
+                // Choose light sample from candidates using RIS
+                auto eval_f = [&](pstd::span<const Vector3f> wi,
+                                  pstd::span<SampledSpectrum> f) {
+                    bsdf->f(wo, wi, f);
+                    for (size_t j = 0; j < wi.size(); ++j)
+                        f[j] *= AbsDot(wi[j], intr.shading.n);
+                };
+                SampleLightRIS(lightSampler, ctx, nRISCandidates, sampler.Get2D(),
+                               lambda, eval_f, &batch);
+                continue;
+            }
+            // Choose a light source for the direct lighting calculation
+            Float u = sampler.Get1D();
+            pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, u);
+            Point2f uLight = sampler.Get2D();
+            if (!sampledLight)
+                continue;
 
-    // Sample a point on the light source for direct lighting
-    Light light = sampledLight->light;
-    DCHECK(light && sampledLight->p > 0);
-    pstd::optional<LightLiSample> ls = light.SampleLi(ctx, uLight, lambda, true);
-    if (!ls || !ls->L || ls->pdf == 0)
-        return {};
+            // Sample a point on the light source for direct lighting
+            Light light = sampledLight->light;
+            DCHECK(light && sampledLight->p > 0);
+            pstd::optional<LightLiSample> ls = light.SampleLi(ctx, uLight, lambda, true);
+            if (!ls || !ls->L || ls->pdf == 0)
+                continue;
+            batch.Add(light, sampledLight->p * ls->pdf, *ls);
+        }
 
-    // Evaluate BSDF for light sample and check light visibility
-    Vector3f wo = intr.wo, wi = ls->wi;
-    SampledSpectrum f = bsdf->f(wo, wi) * AbsDot(wi, intr.shading.n);
-    if (!f || !Unoccluded(intr, ls->pLight))
-        return {};
+        // Evaluate BSDF for all light samples in the batch
+        Vector3f wi[LightSampleBatchSize];
+        SampledSpectrum f[LightSampleBatchSize];
+        Float p_b[LightSampleBatchSize];
+        for (int i = 0; i < batch.size; ++i)
+            wi[i] = batch.entries[i].ls.wi;
+        pstd::span<const Vector3f> wiSpan(wi, batch.size);
+        bsdf->f(wo, wiSpan, pstd::span<SampledSpectrum>(f, batch.size));
+        GuidedBSDFPDF(*bsdf, wo, wiSpan, guide, pstd::span<Float>(p_b, batch.size));
+        for (int i = 0; i < batch.size; ++i) {
+            LightSampleBatch::Entry &e = batch.entries[i];
+            e.f = f[i] * AbsDot(wi[i], intr.shading.n);
+            if (e.f && !IsDeltaLight(e.light.Type()))
+                e.p_b = p_b[i];
+        }
 
-    // Return light's contribution to reflected radiance
-    Float p_l = sampledLight->p * ls->pdf;
-    if (IsDeltaLight(light.Type()))
-        return ls->L * f / p_l;
+        // Trace shadow rays for the light samples with nonzero contributions
+        for (int i = 0; i < batch.size; ++i) {
+            const LightSampleBatch::Entry &e = batch.entries[i];
+            if (!e.f || !Unoccluded(intr, e.ls.pLight))
+                continue;
+            // Add light sample's contribution to reflected radiance
+            Float w_l = IsDeltaLight(e.light.Type())
+                            ? 1
+                            : PowerHeuristic(nLightSamples, e.p_l, 1, e.p_b);
+            Ld += w_l * e.scale * e.ls.L * e.f / (nLightSamples * e.p_l);
+        }
+    }
+    return Ld;
+}
+
+// SortedPathPixelStats Definition
+// Attributes the work done for a sorted path during its lifetime to the path's
+// pixel; per-pixel times and counters accumulate over all of a pixel's scopes.
+class SortedPathPixelStats {
+  public:
+    explicit SortedPathPixelStats(Point2i p) : p(p) { StatsReportPixelStart(p); }
+    ~SortedPathPixelStats() { StatsReportPixelEnd(p); }
+
+    SortedPathPixelStats(const SortedPathPixelStats &) = delete;
+    SortedPathPixelStats &operator=(const SortedPathPixelStats &) = delete;
+
+  private:
+    Point2i p;
+};
+
+// Returns the BSDF at _isect_ for a material whose type is known at compile time;
+// this is equivalent to _SurfaceInteraction::GetBSDF()_ after differentials have
+// been computed and _MixMaterial_s have been resolved.
+template <typename ConcreteMaterial>
+static BSDF GetSortedBSDF(const ConcreteMaterial *material, SurfaceInteraction &isect,
+                          SampledWavelengths &lambda, ScratchBuffer &scratchBuffer,
+                          Sampler sampler) {
+    ProfilerScope _(ProfilePhase::GetBSDF);
+    using ConcreteBxDF = typename ConcreteMaterial::BxDF;
+    if constexpr (std::is_same_v<ConcreteBxDF, void>)
+        return BSDF();
     else {
-        Float p_b = bsdf->PDF(wo, wi);
-        Float w_l = PowerHeuristic(1, p_l, 1, p_b);
-        return w_l * ls->L * f / p_l;
+        // Evaluate normal or bump map, if present
+        FloatTexture displacement = material->GetDisplacement();
+        const Image *normalMap = material->GetNormalMap();
+        if (displacement || normalMap) {
+            Vector3f dpdu, dpdv;
+            if (normalMap)
+                NormalMap(*normalMap, isect, &dpdu, &dpdv);
+            else
+                BumpMap(UniversalTextureEvaluator(), displacement, isect, &dpdu, &dpdv);
+            Normal3f ns(Normalize(Cross(dpdu, dpdv)));
+            isect.SetShadingGeometry(ns, dpdu, dpdv, isect.shading.dndu,
+                                     isect.shading.dndv, false);
+        }
+
+        // Allocate memory for _ConcreteBxDF_ and return _BSDF_ for material
+        ConcreteBxDF *bxdf = scratchBuffer.Alloc<ConcreteBxDF>();
+        *bxdf = material->GetBxDF(UniversalTextureEvaluator(), isect, lambda);
+        BSDF bsdf(isect.shading.n, isect.shading.dpdu, bxdf);
+        if (GetOptions().forceDiffuse) {
+            // Override _bsdf_ with diffuse equivalent
+            SampledSpectrum r = bsdf.rho(isect.wo, {sampler.Get1D()}, {sampler.Get2D()});
+            bsdf = BSDF(isect.shading.n, isect.shading.dpdu,
+                        scratchBuffer.Alloc<DiffuseBxDF>(r));
+        }
+        return bsdf;
+    }
+}
+
+void PathIntegrator::EvaluateTileSamples(Bounds2i tileBounds, int waveStart,
+                                         int waveEnd, Sampler sampler,
+                                         ScratchBuffer &scratchBuffer) {
+    if (!sortMaterials) {
+        ImageTileIntegrator::EvaluateTileSamples(tileBounds, waveStart, waveEnd, sampler,
+                                                 scratchBuffer);
+        return;
+    }
+    // Ensure that the thread has a sampler for each of the tile's pixels
+    std::vector<Sampler> &samplers = pathSamplers->Get();
+    while (samplers.size() < size_t(tileBounds.Area()))
+        samplers.push_back(samplerPrototype.Clone());
+
+    for (int sampleIndex = waveStart; sampleIndex < waveEnd; ++sampleIndex) {
+        TraceSortedPaths(tileBounds, sampleIndex, samplers, scratchBuffer);
+        scratchBuffer.Reset();
+    }
+}
+
+void PathIntegrator::TraceSortedPaths(Bounds2i tileBounds, int sampleIndex,
+                                      pstd::span<Sampler> samplers,
+                                      ScratchBuffer &scratchBuffer) {
+    // Generate camera rays for all of the tile's pixels
+    int nPaths = tileBounds.Area();
+    SortedPath *paths = scratchBuffer.Alloc<SortedPath[]>(nPaths);
+    int *order = scratchBuffer.Alloc<int[]>(nPaths);
+    bool initializeVisibleSurface = camera.GetFilm().UsesVisibleSurface();
+    threadSampleIndex = sampleIndex;
+    CameraSample *cameraSamples = scratchBuffer.Alloc<CameraSample[]>(nPaths);
+    SampledWavelengths *lambdas = scratchBuffer.Alloc<SampledWavelengths[]>(nPaths);
+    int pathIndex = 0;
+    for (Point2i pPixel : tileBounds) {
+        SortedPath &path = paths[pathIndex];
+        SortedPathPixelStats pixelStats(pPixel);
+        path.pPixel = threadPixel = pPixel;
+        path.sampler = samplers[pathIndex];
+        path.sampler.StartPixelSample(pPixel, sampleIndex);
+        cameraSamples[pathIndex] =
+            SampleCamera(pPixel, path.sampler, &lambdas[pathIndex]);
+        ++pathIndex;
+    }
+    pstd::optional<CameraRayDifferential> *cameraRays =
+        scratchBuffer.Alloc<pstd::optional<CameraRayDifferential>[]>(nPaths);
+    camera.GenerateRayDifferentials(
+        pstd::span<const CameraSample>(cameraSamples, nPaths),
+        pstd::span<SampledWavelengths>(lambdas, nPaths),
+        pstd::span<pstd::optional<CameraRayDifferential>>(cameraRays, nPaths));
+
+    int nActive = 0;
+    for (int i = 0; i < nPaths; ++i) {
+        SortedPath &path = paths[i];
+        path.cameraSample = cameraSamples[i];
+        path.lambda = lambdas[i];
+        if (cameraRays[i]) {
+            SortedPathPixelStats pixelStats(path.pPixel);
+            FinishCameraRay(*cameraRays[i], path.sampler);
+            path.ray = cameraRays[i]->ray;
+            path.cameraWeight = cameraRays[i]->weight;
+            path.active = true;
+            ++nActive;
+        }
+    }
+
+    // Extend all active paths by one vertex at a time until they terminate
+    constexpr int nMaterialTypes = Material::NumTags();
+    while (nActive > 0) {
+        // Find intersections and add emitted light for the active paths' rays
+        int materialCounts[nMaterialTypes] = {};
+        int nShaded = 0;
+        for (int i = 0; i < nPaths; ++i) {
+            SortedPath &path = paths[i];
+            if (!path.active)
+                continue;
+            SortedPathPixelStats pixelStats(path.pPixel);
+            threadPixel = path.pPixel;
+            PathState &state = path.state;
+            path.si = Intersect(path.ray);
+            if (!path.si) {
+                // Incorporate emission from infinite lights for escaped ray
+                for (const auto &light : infiniteLights) {
+                    SampledSpectrum Le = light.Le(path.ray, path.lambda);
+                    if (state.depth == 0 || state.specularBounce)
+                        path.L += state.beta * Le;
+                    else {
+                        // Compute MIS weight for infinite light
+                        Float p_l = lightSampler.PMF(state.prevIntrCtx, light) *
+                                    light.PDF_Li(state.prevIntrCtx, path.ray.d, true);
+                        Float w_b = PowerHeuristic(1, state.p_b, nLightSamples, p_l);
+                        path.L += state.beta * w_b * Le;
+                    }
+                }
+                path.active = false;
+                --nActive;
+                continue;
+            }
+
+            // Incorporate emission from surface hit by ray
+            SurfaceInteraction &isect = path.si->intr;
+            SampledSpectrum Le = isect.Le(-path.ray.d, path.lambda);
+            if (Le) {
+                if (state.depth == 0 || state.specularBounce)
+                    path.L += state.beta * Le;
+                else {
+                    // Compute MIS weight for area light
+                    Light areaLight(isect.areaLight);
+                    Float p_l = lightSampler.PMF(state.prevIntrCtx, areaLight) *
+                                areaLight.PDF_Li(state.prevIntrCtx, path.ray.d, true);
+                    Float w_l = PowerHeuristic(1, state.p_b, nLightSamples, p_l);
+                    path.L += state.beta * w_l * Le;
+                }
+            }
+
+            // Resolve the hit point's material so that it can be sorted by type
+            isect.ComputeDifferentials(path.ray, camera, path.sampler.SamplesPerPixel());
+            while (isect.material.Is<MixMaterial>()) {
+                MixMaterial *mix = isect.material.Cast<MixMaterial>();
+                isect.material = mix->ChooseMaterial(UniversalTextureEvaluator(), isect);
+            }
+            if (!isect.material) {
+                // Skip over medium boundary
+                state.specularBounce = true;
+                isect.SkipIntersection(&path.ray, path.si->tHit);
+                continue;
+            }
+            path.needsShading = true;
+            ++materialCounts[isect.material.Tag()];
+            ++nShaded;
+        }
+
+        // Sort paths to be shaded by their materials' types
+        int materialOffsets[nMaterialTypes];
+        for (int t = 0, offset = 0; t < nMaterialTypes; ++t) {
+            materialOffsets[t] = offset;
+            offset += materialCounts[t];
+        }
+        for (int i = 0; i < nPaths; ++i)
+            if (paths[i].needsShading)
+                order[materialOffsets[paths[i].si->intr.material.Tag()]++] = i;
+
+        // Get BSDFs for each material type's hit points with the type known
+        for (int start = 0; start < nShaded;) {
+            Material material = paths[order[start]].si->intr.material;
+            int end = start + materialCounts[material.Tag()];
+            auto shade = [&](auto mtl) {
+                using ConcreteMaterial =
+                    std::remove_cv_t<std::remove_pointer_t<decltype(mtl)>>;
+                for (int j = start; j < end; ++j) {
+                    SortedPath &path = paths[order[j]];
+                    SurfaceInteraction &isect = path.si->intr;
+                    SortedPathPixelStats pixelStats(path.pPixel);
+                    threadPixel = path.pPixel;
+                    path.bsdf =
+                        GetSortedBSDF(isect.material.Cast<ConcreteMaterial>(), isect,
+                                      path.lambda, scratchBuffer, path.sampler);
+                }
+            };
+            material.DispatchCPU(shade);
+            start = end;
+        }
+
+        // Sample lights and scattered directions at the shaded path vertices
+        for (int i = 0; i < nPaths; ++i) {
+            SortedPath &path = paths[i];
+            if (!path.needsShading)
+                continue;
+            path.needsShading = false;
+            SortedPathPixelStats pixelStats(path.pPixel);
+            threadPixel = path.pPixel;
+            PathState &state = path.state;
+            SurfaceInteraction &isect = path.si->intr;
+            BSDF &bsdf = path.bsdf;
+            Sampler sampler = path.sampler;
+            if (!bsdf) {
+                state.specularBounce = true;
+                isect.SkipIntersection(&path.ray, path.si->tHit);
+                continue;
+            }
+
+            // Initialize visible surface at first intersection
+            if (state.depth == 0 && initializeVisibleSurface)
+                path.visibleSurface =
+                    VisibleSurface(isect, EstimateAlbedo(bsdf, isect.wo), path.lambda);
+
+            // Possibly regularize the BSDF
+            if (regularize && state.anyNonSpecularBounces) {
+                ++regularizedBSDFs;
+                bsdf.Regularize();
+            }
+            ++totalBSDFs;
+
+            // End path if maximum depth reached
+            if (state.depth++ == maxDepth) {
+                path.active = false;
+                --nActive;
+                continue;
+            }
+
+            // Sample direct illumination from the light sources
+            if (IsNonSpecular(bsdf.Flags())) {
+                ++totalPaths;
+                SampledSpectrum Ld = SampleLd(isect, &bsdf, path.lambda, sampler, {});
+                if (!Ld)
+                    ++zeroRadiancePaths;
+                path.L.AddProduct(state.beta, Ld);
+            }
+
+            // Sample BSDF to get new path direction
+            Vector3f wo = -path.ray.d;
+            Float u = sampler.Get1D();
+            pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, sampler.Get2D());
+            if (!bs) {
+                path.active = false;
+                --nActive;
+                continue;
+            }
+            // Update path state variables after surface scattering
+            state.beta.MulScaled(bs->f, AbsDot(bs->wi, isect.shading.n) / bs->pdf);
+            state.p_b = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
+            state.specularBounce = bs->IsSpecular();
+            state.anyNonSpecularBounces |= !bs->IsSpecular();
+            if (bs->IsTransmission())
+                state.etaScale *= Sqr(bs->eta);
+            state.prevIntrCtx = isect;
+            path.ray = isect.SpawnRay(path.ray, bsdf, bs->wi, bs->flags, bs->eta);
+
+            // Possibly terminate the path with Russian roulette
+            SampledSpectrum rrBeta = state.beta * state.etaScale;
+            if (rrBeta.MaxComponentValue() < 1 && state.depth > 1) {
+                Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
+                if (sampler.Get1D() < q) {
+                    path.active = false;
+                    --nActive;
+                    continue;
+                }
+                state.beta /= 1 - q;
+            }
+        }
+    }
+
+    // Add the paths' radiance estimates to the image
+    for (int i = 0; i < nPaths; ++i) {
+        const SortedPath &path = paths[i];
+        SortedPathPixelStats pixelStats(path.pPixel);
+        pathLength << path.state.depth;
+        SampledSpectrum L(0.f);
+        if (path.cameraWeight)
+            L = CheckRadiance(path.cameraWeight * path.L, path.lambda, path.pPixel,
+                              sampleIndex);
+        camera.GetFilm().AddSample(path.pPixel, L, path.lambda, &path.visibleSurface,
+                                   path.cameraSample.filterWeight);
     }
 }
 
 std::string PathIntegrator::ToString() const {
-    return StringPrintf("[ PathIntegrator maxDepth: %d lightSampler: %s regularize: %s ]",
-                        maxDepth, lightSampler, regularize);
+    return StringPrintf("[ PathIntegrator maxDepth: %d lightSampler: %s regularize: %s "
+                        "nLightSamples: %d nRISCandidates: %d ]",
+                        maxDepth, lightSampler, regularize, nLightSamples,
+                        nRISCandidates);
 }
 
 std::unique_ptr<PathIntegrator> PathIntegrator::Create(
@@ -815,8 +1502,30 @@ std::unique_ptr<PathIntegrator> PathIntegrator::Create(
     int maxDepth = parameters.GetOneInt("maxdepth", 5);
     std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
     bool regularize = parameters.GetOneBool("regularize", false);
-    return std::make_unique<PathIntegrator>(maxDepth, camera, sampler, aggregate, lights,
-                                            lightStrategy, regularize);
+    int nLightSamples = parameters.GetOneInt("lightsamples", 1);
+    if (nLightSamples < 1)
+        ErrorExit(loc, "%d value supplied for \"lightsamples\". Must be at least 1.",
+                  nLightSamples);
+    int nRISCandidates = parameters.GetOneInt("riscandidates", 1);
+    if (nRISCandidates < 1)
+        ErrorExit(loc, "%d value supplied for \"riscandidates\". Must be at least 1.",
+                  nRISCandidates);
+    Bounds3f sceneBounds = aggregate ? aggregate.Bounds() : Bounds3f();
+    std::unique_ptr<GuidingField> guidingField =
+        GuidingField::Create(parameters, sceneBounds, loc);
+    std::unique_ptr<ContributionEstimator> contributionEstimator =
+        ContributionEstimator::Create(parameters, camera.GetFilm().PixelBounds(),
+                                      sceneBounds, loc);
+    bool sortMaterials = parameters.GetOneBool("sortmaterials", false);
+    if (sortMaterials && (guidingField || contributionEstimator)) {
+        Warning(loc, "\"sortmaterials\" is not supported with path guiding or "
+                     "contribution-driven roulette. Disabling it.");
+        sortMaterials = false;
+    }
+    return std::make_unique<PathIntegrator>(
+        maxDepth, camera, sampler, aggregate, lights, lightStrategy, regularize,
+        nLightSamples, nRISCandidates, std::move(guidingField),
+        std::move(contributionEstimator), sortMaterials);
 }
 
 // SimpleVolPathIntegrator Method Definitions
@@ -961,6 +1670,18 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
 
     LightSampleContext prevIntrContext;
 
+    // Allocate vertices for training the guiding field, if needed
+    GuidedPathVertex *guidedVertices = nullptr;
+    int nGuidedVertices = 0;
+    if (guidingField && guidingField->Training())
+        guidedVertices = scratchBuffer.Alloc<GuidedPathVertex[]>(maxDepth + 1);
+
+    // Allocate vertices for training the contribution estimator, if needed
+    ContributionVertex *contributionVertices = nullptr;
+    int nContributionVertices = 0;
+    if (contributionEstimator && contributionEstimator->Training())
+        contributionVertices = scratchBuffer.Alloc<ContributionVertex[]>(maxDepth + 1);
+
     while (true) {
         // Sample segment of volumetric scattering path
         PBRT_DBG("%s\n", StringPrintf("Path tracer depth %d, current L = %s, beta = %s\n",
@@ -1068,7 +1789,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                 });
             // Handle terminated, scattered, and unscattered medium rays
             if (terminated || !beta || !r_u)
-                return L;
+                break;
             if (scattered)
                 continue;
 
@@ -1088,7 +1809,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                         // Add infinite light contribution using both PDFs with MIS
                         Float p_l = lightSampler.PMF(prevIntrContext, light) *
                                     light.PDF_Li(prevIntrContext, ray.d, true);
-                        r_l *= p_l;
+                        r_l *= nLightSamples * p_l;
                         L += beta * Le / (r_u + r_l).Average();
                     }
                 }
@@ -1106,7 +1827,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                 Light areaLight(isect.areaLight);
                 Float p_l = lightSampler.PMF(prevIntrContext, areaLight) *
                             areaLight.PDF_Li(prevIntrContext, ray.d, true);
-                r_l *= p_l;
+                r_l *= nLightSamples * p_l;
                 L += beta * Le / (r_u + r_l).Average();
             }
         }
@@ -1120,31 +1841,12 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
 
         // Initialize _visibleSurf_ at first intersection
         if (depth == 0 && visibleSurf) {
-            // Estimate BSDF's albedo
-            // Define sample arrays _ucRho_ and _uRho_ for reflectance estimate
-            constexpr int nRhoSamples = 16;
-            const Float ucRho[nRhoSamples] = {
-                0.75741637, 0.37870818, 0.7083487, 0.18935409, 0.9149363, 0.35417435,
-                0.5990858,  0.09467703, 0.8578725, 0.45746812, 0.686759,  0.17708716,
-                0.9674518,  0.2995429,  0.5083201, 0.047338516};
-            const Point2f uRho[nRhoSamples] = {
-                Point2f(0.855985, 0.570367), Point2f(0.381823, 0.851844),
-                Point2f(0.285328, 0.764262), Point2f(0.733380, 0.114073),
-                Point2f(0.542663, 0.344465), Point2f(0.127274, 0.414848),
-                Point2f(0.964700, 0.947162), Point2f(0.594089, 0.643463),
-                Point2f(0.095109, 0.170369), Point2f(0.825444, 0.263359),
-                Point2f(0.429467, 0.454469), Point2f(0.244460, 0.816459),
-                Point2f(0.756135, 0.731258), Point2f(0.516165, 0.152852),
-                Point2f(0.180888, 0.214174), Point2f(0.898579, 0.503897)};
-
-            SampledSpectrum albedo = bsdf.rho(isect.wo, ucRho, uRho);
-
-            *visibleSurf = VisibleSurface(isect, albedo, lambda);
+            *visibleSurf = VisibleSurface(isect, EstimateAlbedo(bsdf, isect.wo), lambda);
         }
 
         // Terminate path if maximum depth reached
         if (depth++ >= maxDepth)
-            return L;
+            break;
 
         ++surfaceInteractions;
         // Possibly regularize the BSDF
@@ -1153,25 +1855,52 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
             bsdf.Regularize();
         }
 
+        // Find guiding distribution for the path vertex, if available
+        GuidingDistribution guide = LookupGuide(guidingField.get(), isect, bsdf);
+
         // Sample illumination from lights to find attenuated path contribution
         if (IsNonSpecular(bsdf.Flags())) {
-            L += SampleLd(isect, &bsdf, lambda, sampler, beta, r_u);
+            L += SampleLd(isect, &bsdf, lambda, sampler, beta, r_u, guide);
             DCHECK(IsInf(L.y(lambda)) == false);
         }
         prevIntrContext = LightSampleContext(isect);
 
+        // Play Russian roulette based on the path's expected contribution
+        bool contributionRoulette = false;
+        if (contributionEstimator && IsNonSpecular(bsdf.Flags())) {
+            SampledSpectrum throughput = beta / r_u.Average();
+            if (contributionVertices)
+                contributionVertices[nContributionVertices++] =
+                    ContributionVertex{isect.p(), throughput, L};
+            Float scale;
+            pstd::optional<int> nPaths = contributionEstimator->RouletteAndSplit(
+                threadPixel, isect.p(), throughput.Average(), sampler.Get1D(), false,
+                &scale);
+            if (nPaths) {
+                contributionRoulette = true;
+                ++nRouletteDecisions;
+                if (*nPaths == 0) {
+                    ++nRouletteTerminations;
+                    break;
+                }
+                beta *= scale;
+            }
+        }
+
         // Sample BSDF to get new volumetric path direction
         Vector3f wo = isect.wo;
         Float u = sampler.Get1D();
-        pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, sampler.Get2D());
+        pstd::optional<BSDFSample> bs =
+            SampleGuidedBSDF(bsdf, wo, u, sampler.Get2D(), guide);
         if (!bs)
             break;
         // Update _beta_ and rescaled path probabilities for BSDF scattering
-        beta *= bs->f * AbsDot(bs->wi, isect.shading.n) / bs->pdf;
-        if (bs->pdfIsProportional)
-            r_l = r_u / bsdf.PDF(wo, bs->wi);
-        else
-            r_l = r_u / bs->pdf;
+        beta.MulScaled(bs->f, AbsDot(bs->wi, isect.shading.n) / bs->pdf);
+        Float p_b = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
+        r_l = r_u / p_b;
+        if (guidedVertices && !bs->IsSpecular())
+            guidedVertices[nGuidedVertices++] =
+                GuidedPathVertex{isect.p(), bs->wi, p_b, beta / r_u.Average(), L};
 
         PBRT_DBG("%s\n", StringPrintf("Sampled BSDF, f = %s, pdf = %f -> beta = %s",
                                       bs->f, bs->pdf, beta)
@@ -1245,7 +1974,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
             pstd::optional<BSDFSample> bs = Sw.Sample_f(pi.wo, u, sampler.Get2D());
             if (!bs)
                 break;
-            beta *= bs->f * AbsDot(bs->wi, pi.shading.n) / bs->pdf;
+            beta.MulScaled(bs->f, AbsDot(bs->wi, pi.shading.n) / bs->pdf);
             r_l = r_u / bs->pdf;
             // Don't increment depth this time...
             DCHECK(!IsInf(beta.y(lambda)));
@@ -1260,20 +1989,31 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
         Float uRR = sampler.Get1D();
         PBRT_DBG("%s\n",
                  StringPrintf("etaScale %f -> rrBeta %s", etaScale, rrBeta).c_str());
-        if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+        if (!contributionRoulette && rrBeta.MaxComponentValue() < 1 && depth > 1) {
             Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
             if (uRR < q)
                 break;
             beta /= 1 - q;
         }
     }
+    if (guidedVertices)
+        AddGuidedPathVertices(guidingField.get(),
+                              {guidedVertices, size_t(nGuidedVertices)}, L);
+    if (contributionEstimator) {
+        if (contributionVertices)
+            AddContributionVertices(
+                contributionEstimator.get(),
+                {contributionVertices, size_t(nContributionVertices)}, L);
+        contributionEstimator->AddPixelSample(threadPixel, L.Average());
+    }
     return L;
 }
 
 SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF *bsdf,
                                             SampledWavelengths &lambda, Sampler sampler,
-                                            SampledSpectrum beta,
-                                            SampledSpectrum r_p) const {
+                                            SampledSpectrum beta, SampledSpectrum r_p,
+                                            GuidingDistribution guide) const {
+    ProfilerScope _(ProfilePhase::DirectLighting);
     // Estimate light-sampled direct illumination at _intr_
     // Initialize _LightSampleContext_ for volumetric light sampling
     LightSampleContext ctx;
@@ -1289,110 +2029,158 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
     } else
         ctx = LightSampleContext(intr);
 
-    // Sample a light source using _lightSampler_
-    Float u = sampler.Get1D();
-    pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, u);
-    Point2f uLight = sampler.Get2D();
-    if (!sampledLight)
-        return SampledSpectrum(0.f);
-    Light light = sampledLight->light;
-    DCHECK(light && sampledLight->p != 0);
+    // Take _nLightSamples_ light samples in batches of _LightSampleBatchSize_
+    SampledSpectrum Ld(0.f);
+    Vector3f wo = intr.wo;
+    for (int batchStart = 0; batchStart < nLightSamples;
+         batchStart += LightSampleBatchSize) {
+        int batchEnd = std::min(nLightSamples, batchStart + LightSampleBatchSize);
+        LightSampleBatch batch;
+        // Sample light sources and points on them for the batch
+        for (int i = batchStart; i < batchEnd; ++i) {
+            if (nRISCandidates > 1) {
+                // Choose light sample from candidates using RIS
+                auto eval_f = [&](pstd::span<const Vector3f> wi,
+                                  pstd::span<SampledSpectrum> f) {
+                    if (bsdf) {
+                        bsdf->f(wo, wi, f);
+                        for (size_t j = 0; j < wi.size(); ++j)
+                            f[j] *= AbsDot(wi[j], intr.AsSurface().shading.n);
+                    } else
+                        for (size_t j = 0; j < wi.size(); ++j)
+                            f[j] = SampledSpectrum(intr.AsMedium().phase.p(wo, wi[j]));
+                };
+                SampleLightRIS(lightSampler, ctx, nRISCandidates, sampler.Get2D(),
+                               lambda, eval_f, &batch);
+                continue;
+            }
+            // Sample a light source using _lightSampler_
+            Float u = sampler.Get1D();
+            pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, u);
+            Point2f uLight = sampler.Get2D();
+            if (!sampledLight)
+                continue;
+            Light light = sampledLight->light;
+            DCHECK(light && sampledLight->p != 0);
 
-    // Sample a point on the light source
-    pstd::optional<LightLiSample> ls = light.SampleLi(ctx, uLight, lambda, true);
-    if (!ls || !ls->L || ls->pdf == 0)
-        return SampledSpectrum(0.f);
-    Float p_l = sampledLight->p * ls->pdf;
+            // Sample a point on the light source
+            pstd::optional<LightLiSample> ls = light.SampleLi(ctx, uLight, lambda, true);
+            if (!ls || !ls->L || ls->pdf == 0)
+                continue;
+            batch.Add(light, sampledLight->p * ls->pdf, *ls);
+        }
 
-    // Evaluate BSDF or phase function for light sample direction
-    Float scatterPDF;
-    SampledSpectrum f_hat;
-    Vector3f wo = intr.wo, wi = ls->wi;
-    if (bsdf) {
-        // Update _f_hat_ and _scatterPDF_ accounting for the BSDF
-        f_hat = bsdf->f(wo, wi) * AbsDot(wi, intr.AsSurface().shading.n);
-        scatterPDF = bsdf->PDF(wo, wi);
+        // Evaluate BSDF or phase function for all light samples in the batch
+        if (bsdf) {
+            // Update _f_ and _p_b_ accounting for the BSDF
+            Vector3f wi[LightSampleBatchSize];
+            SampledSpectrum f[LightSampleBatchSize];
+            Float p_b[LightSampleBatchSize];
+            for (int i = 0; i < batch.size; ++i)
+                wi[i] = batch.entries[i].ls.wi;
+            pstd::span<const Vector3f> wiSpan(wi, batch.size);
+            bsdf->f(wo, wiSpan, pstd::span<SampledSpectrum>(f, batch.size));
+            GuidedBSDFPDF(*bsdf, wo, wiSpan, guide, pstd::span<Float>(p_b, batch.size));
+            for (int i = 0; i < batch.size; ++i) {
+                LightSampleBatch::Entry &e = batch.entries[i];
+                e.f = f[i] * AbsDot(wi[i], intr.AsSurface().shading.n);
+                e.p_b = p_b[i];
+            }
 
-    } else {
-        // Update _f_hat_ and _scatterPDF_ accounting for the phase function
-        CHECK(intr.IsMediumInteraction());
-        PhaseFunction phase = intr.AsMedium().phase;
-        f_hat = SampledSpectrum(phase.p(wo, wi));
-        scatterPDF = phase.PDF(wo, wi);
-    }
-    if (!f_hat)
-        return SampledSpectrum(0.f);
+        } else {
+            // Update _f_ and _p_b_ accounting for the phase function
+            CHECK(intr.IsMediumInteraction());
+            PhaseFunction phase = intr.AsMedium().phase;
+            for (int i = 0; i < batch.size; ++i) {
+                LightSampleBatch::Entry &e = batch.entries[i];
+                e.f = SampledSpectrum(phase.p(wo, e.ls.wi));
+                e.p_b = phase.PDF(wo, e.ls.wi);
+            }
+        }
 
-    // Declare path state variables for ray to light source
-    Ray lightRay = intr.SpawnRayTo(ls->pLight);
-    SampledSpectrum T_ray(1.f), r_l(1.f), r_u(1.f);
-    RNG rng(Hash(lightRay.o), Hash(lightRay.d));
+        // Estimate transmittance for light samples with nonzero contributions
+        for (int i = 0; i < batch.size; ++i) {
+            const LightSampleBatch::Entry &e = batch.entries[i];
+            if (!e.f)
+                continue;
+            // Declare path state variables for ray to light source
+            Ray lightRay = intr.SpawnRayTo(e.ls.pLight);
+            SampledSpectrum T_ray(1.f), r_l(1.f), r_u(1.f);
+            RNG rng(Hash(lightRay.o), Hash(lightRay.d));
+
+            while (lightRay.d != Vector3f(0, 0, 0)) {
+                // Trace ray through media to estimate transmittance
+                pstd::optional<ShapeIntersection> si =
+                    Intersect(lightRay, 1 - ShadowEpsilon);
+                // Handle opaque surface along ray's path
+                if (si && si->intr.material) {
+                    T_ray = SampledSpectrum(0.f);
+                    break;
+                }
 
-    while (lightRay.d != Vector3f(0, 0, 0)) {
-        // Trace ray through media to estimate transmittance
-        pstd::optional<ShapeIntersection> si = Intersect(lightRay, 1 - ShadowEpsilon);
-        // Handle opaque surface along ray's path
-        if (si && si->intr.material)
-            return SampledSpectrum(0.f);
+                // Update transmittance for current ray segment
+                if (lightRay.medium) {
+                    Float tMax = si ? si->tHit : (1 - ShadowEpsilon);
+                    Float u = rng.Uniform<Float>();
+                    SampledSpectrum T_maj = SampleT_maj(
+                        lightRay, tMax, u, rng, lambda,
+                        [&](Point3f p, MediumProperties mp, SampledSpectrum sigma_maj,
+                            SampledSpectrum T_maj) {
+                            // Update ray transmittance estimate at sampled point
+                            // Update _T_ray_ and PDFs using ratio-tracking estimator
+                            SampledSpectrum sigma_n =
+                                ClampZero(sigma_maj - mp.sigma_a - mp.sigma_s);
+                            Float pdf = T_maj[0] * sigma_maj[0];
+                            T_ray *= T_maj * sigma_n / pdf;
+                            r_l *= T_maj * sigma_maj / pdf;
+                            r_u *= T_maj * sigma_n / pdf;
+
+                            // Possibly terminate transmittance computation using
+                            // Russian roulette
+                            SampledSpectrum Tr = T_ray / (r_l + r_u).Average();
+                            if (Tr.MaxComponentValue() < 0.05f) {
+                                Float q = 0.75f;
+                                if (rng.Uniform<Float>() < q)
+                                    T_ray = SampledSpectrum(0.);
+                                else
+                                    T_ray /= 1 - q;
+                            }
 
-        // Update transmittance for current ray segment
-        if (lightRay.medium) {
-            Float tMax = si ? si->tHit : (1 - ShadowEpsilon);
-            Float u = rng.Uniform<Float>();
-            SampledSpectrum T_maj =
-                SampleT_maj(lightRay, tMax, u, rng, lambda,
-                            [&](Point3f p, MediumProperties mp, SampledSpectrum sigma_maj,
-                                SampledSpectrum T_maj) {
-                                // Update ray transmittance estimate at sampled point
-                                // Update _T_ray_ and PDFs using ratio-tracking estimator
-                                SampledSpectrum sigma_n =
-                                    ClampZero(sigma_maj - mp.sigma_a - mp.sigma_s);
-                                Float pdf = T_maj[0] * sigma_maj[0];
-                                T_ray *= T_maj * sigma_n / pdf;
-                                r_l *= T_maj * sigma_maj / pdf;
-                                r_u *= T_maj * sigma_n / pdf;
-
-                                // Possibly terminate transmittance computation using
-                                // Russian roulette
-                                SampledSpectrum Tr = T_ray / (r_l + r_u).Average();
-                                if (Tr.MaxComponentValue() < 0.05f) {
-                                    Float q = 0.75f;
-                                    if (rng.Uniform<Float>() < q)
-                                        T_ray = SampledSpectrum(0.);
-                                    else
-                                        T_ray /= 1 - q;
-                                }
+                            if (!T_ray)
+                                return false;
+                            return true;
+                        });
+                    // Update transmittance estimate for final segment
+                    T_ray *= T_maj / T_maj[0];
+                    r_l *= T_maj / T_maj[0];
+                    r_u *= T_maj / T_maj[0];
+                }
 
-                                if (!T_ray)
-                                    return false;
-                                return true;
-                            });
-            // Update transmittance estimate for final segment
-            T_ray *= T_maj / T_maj[0];
-            r_l *= T_maj / T_maj[0];
-            r_u *= T_maj / T_maj[0];
-        }
+                // Generate next ray segment or finish transmittance estimate
+                if (!T_ray || !si)
+                    break;
+                lightRay = si->intr.SpawnRayTo(e.ls.pLight);
+            }
+            if (!T_ray)
+                continue;
 
-        // Generate next ray segment or return final transmittance
-        if (!T_ray)
-            return SampledSpectrum(0.f);
-        if (!si)
-            break;
-        lightRay = si->intr.SpawnRayTo(ls->pLight);
+            // Add light sample's contribution to the direct lighting estimate
+            r_l *= r_p * nLightSamples * e.p_l;
+            r_u *= r_p * e.p_b;
+            if (IsDeltaLight(e.light.Type()))
+                Ld += e.scale * beta * e.f * T_ray * e.ls.L / r_l.Average();
+            else
+                Ld += e.scale * beta * e.f * T_ray * e.ls.L / (r_l + r_u).Average();
+        }
     }
-    // Return path contribution function estimate for direct lighting
-    r_l *= r_p * p_l;
-    r_u *= r_p * scatterPDF;
-    if (IsDeltaLight(light.Type()))
-        return beta * f_hat * T_ray * ls->L / r_l.Average();
-    else
-        return beta * f_hat * T_ray * ls->L / (r_l + r_u).Average();
+    return Ld;
 }
 
 std::string VolPathIntegrator::ToString() const {
-    return StringPrintf(
-        "[ VolPathIntegrator maxDepth: %d lightSampler: %s regularize: %s ]", maxDepth,
-        lightSampler, regularize);
+    return StringPrintf("[ VolPathIntegrator maxDepth: %d lightSampler: %s regularize: %s "
+                        "nLightSamples: %d nRISCandidates: %d ]",
+                        maxDepth, lightSampler, regularize, nLightSamples,
+                        nRISCandidates);
 }
 
 std::unique_ptr<VolPathIntegrator> VolPathIntegrator::Create(
@@ -1401,8 +2189,24 @@ std::unique_ptr<VolPathIntegrator> VolPathIntegrator::Create(
     int maxDepth = parameters.GetOneInt("maxdepth", 5);
     std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
     bool regularize = parameters.GetOneBool("regularize", false);
-    return std::make_unique<VolPathIntegrator>(maxDepth, camera, sampler, aggregate,
-                                               lights, lightStrategy, regularize);
+    int nLightSamples = parameters.GetOneInt("lightsamples", 1);
+    if (nLightSamples < 1)
+        ErrorExit(loc, "%d value supplied for \"lightsamples\". Must be at least 1.",
+                  nLightSamples);
+    int nRISCandidates = parameters.GetOneInt("riscandidates", 1);
+    if (nRISCandidates < 1)
+        ErrorExit(loc, "%d value supplied for \"riscandidates\". Must be at least 1.",
+                  nRISCandidates);
+    Bounds3f sceneBounds = aggregate ? aggregate.Bounds() : Bounds3f();
+    std::unique_ptr<GuidingField> guidingField =
+        GuidingField::Create(parameters, sceneBounds, loc);
+    std::unique_ptr<ContributionEstimator> contributionEstimator =
+        ContributionEstimator::Create(parameters, camera.GetFilm().PixelBounds(),
+                                      sceneBounds, loc);
+    return std::make_unique<VolPathIntegrator>(
+        maxDepth, camera, sampler, aggregate, lights, lightStrategy, regularize,
+        nLightSamples, nRISCandidates, std::move(guidingField),
+        std::move(contributionEstimator));
 }
 
 // AOIntegrator Method Definitions
@@ -1486,7 +2290,8 @@ SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &la
                             Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
                             LightSampler lightSampler, Camera camera, Sampler sampler,
                             pstd::optional<Point2f> *pRaster,
-                            Float *misWeightPtr = nullptr);
+                            Float *misWeightPtr = nullptr,
+                            const SampledSpectrum *ptf = nullptr);
 
 Float InfiniteLightDensity(const std::vector<Light> &infiniteLights,
                            LightSampler lightSampler, Vector3f w);
@@ -1642,6 +2447,31 @@ struct Vertex {
         }
     }
 
+    void f(pstd::span<const Vertex> next, TransportMode mode,
+           pstd::span<SampledSpectrum> result) const {
+        if (type != VertexType::Surface) {
+            for (size_t i = 0; i < next.size(); ++i)
+                result[i] = f(next[i], mode);
+            return;
+        }
+        // Evaluate the BSDF for the directions to all of the _next_ vertices
+        constexpr int ChunkSize = 16;
+        Vector3f wi[ChunkSize];
+        for (size_t start = 0; start < next.size(); start += ChunkSize) {
+            size_t n = std::min<size_t>(ChunkSize, next.size() - start);
+            for (size_t i = 0; i < n; ++i) {
+                wi[i] = next[start + i].p() - p();
+                if (LengthSquared(wi[i]) > 0)
+                    wi[i] = Normalize(wi[i]);
+            }
+            pstd::span<SampledSpectrum> fChunk = result.subspan(start, n);
+            bsdf.f(si.wo, pstd::span<const Vector3f>(wi, n), fChunk, mode);
+            for (size_t i = 0; i < n; ++i)
+                if (LengthSquared(wi[i]) == 0)
+                    fChunk[i] = SampledSpectrum(0.f);
+        }
+    }
+
     bool IsConnectible() const {
         switch (type) {
         case VertexType::Medium:
@@ -2259,8 +3089,18 @@ SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
                                       lightSampler, lightVertices, regularize);
 
     SampledSpectrum L(0.f);
+    SampledSpectrum *connectionF = scratchBuffer.Alloc<SampledSpectrum[]>(maxDepth + 1);
     // Execute all BDPT connection strategies
     for (int t = 1; t <= nCamera; ++t) {
+        // Evaluate camera vertex's BSDF toward all light subpath vertices at once
+        const Vertex &pt = cameraVertices[t - 1];
+        bool batchedF = t > 1 && nLight > 1 && pt.type == VertexType::Surface &&
+                        pt.IsConnectible();
+        if (batchedF)
+            pt.f(pstd::span<const Vertex>(lightVertices + 1, nLight - 1),
+                 TransportMode::Radiance,
+                 pstd::span<SampledSpectrum>(connectionF, nLight - 1));
+
         for (int s = 0; s <= nLight; ++s) {
             int depth = t + s - 2;
             if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth)
@@ -2268,9 +3108,11 @@ SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
             // Execute the $(s, t)$ connection strategy and update _L_
             pstd::optional<Point2f> pFilmNew;
             Float misWeight = 0.f;
+            const SampledSpectrum *ptf =
+                (batchedF && s > 1) ? &connectionF[s - 2] : nullptr;
             SampledSpectrum Lpath =
                 ConnectBDPT(*this, lambda, lightVertices, cameraVertices, s, t,
-                            lightSampler, camera, sampler, &pFilmNew, &misWeight);
+                            lightSampler, camera, sampler, &pFilmNew, &misWeight, ptf);
             PBRT_DBG("%s\n",
                      StringPrintf("Connect bdpt s: %d, t: %d, Lpath: %s, misWeight: %f\n",
                                   s, t, Lpath, misWeight)
@@ -2316,7 +3158,8 @@ SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
 SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &lambda,
                             Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
                             LightSampler lightSampler, Camera camera, Sampler sampler,
-                            pstd::optional<Point2f> *pRaster, Float *misWeightPtr) {
+                            pstd::optional<Point2f> *pRaster, Float *misWeightPtr,
+                            const SampledSpectrum *ptf) {
     SampledSpectrum L(0.f);
     // Ignore invalid connections related to infinite area lights
     if (t > 1 && s != 0 && cameraVertices[t - 1].type == VertexType::Light)
@@ -2397,8 +3240,10 @@ SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &la
         // Handle all other bidirectional connection cases
         const Vertex &qs = lightVertices[s - 1], &pt = cameraVertices[t - 1];
         if (qs.IsConnectible() && pt.IsConnectible()) {
+            // Use the camera vertex's scattering function value if it was
+            // evaluated together with the other connections to the light subpath
             L = qs.beta * qs.f(pt, TransportMode::Importance) *
-                pt.f(qs, TransportMode::Radiance) * pt.beta;
+                (ptf ? *ptf : pt.f(qs, TransportMode::Radiance)) * pt.beta;
             PBRT_DBG("%s\n",
                      StringPrintf(
                          "General connect s: %d, t: %d, qs: %s, pt: %s, qs.f(pt): %s, "
@@ -2744,6 +3589,8 @@ STAT_INT_DISTRIBUTION(
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
 STAT_MEMORY_COUNTER("Memory/SPPM BSDF and Grid Memory", sppmMemoryArenaBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM visible point grid", sppmGridBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM per-thread photon sums", sppmPhotonSumBytes);
 
 // SPPMPixel Definition
 struct SPPMPixel {
@@ -2775,22 +3622,148 @@ struct SPPMPixel {
     Float n = 0;
 };
 
-// SPPMPixelListNode Definition
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
+// SPPMPhotonSum Definition
+struct SPPMPhotonSum {
+    int pixelIndex = -1;
+    int m = 0;
+    RGB Phi;
 };
 
-// SPPM Utility Functions
-static bool ToGrid(Point3f p, const Bounds3f &bounds, const int gridRes[3], Point3i *pi) {
-    bool inBounds = true;
-    Vector3f pg = bounds.Offset(p);
-    for (int i = 0; i < 3; ++i) {
-        (*pi)[i] = (int)(gridRes[i] * pg[i]);
-        inBounds &= (*pi)[i] >= 0 && (*pi)[i] < gridRes[i];
-        (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
+// SPPMPhotonSumCache Definition
+// Direct-mapped cache of a thread's photon contributions to recently updated
+// pixels; a pixel's atomic sums are only updated when its entry is evicted, which
+// keeps threads from contending for them on each photon.
+class SPPMPhotonSumCache {
+  public:
+    // SPPMPhotonSumCache Public Methods
+    SPPMPhotonSumCache() : sums(Capacity) {}
+
+    void Add(SPPMPixel *pixels, int pixelIndex, const RGB &Phi) {
+        SPPMPhotonSum &sum = sums[pixelIndex % Capacity];
+        if (sum.pixelIndex != pixelIndex) {
+            Flush(pixels, sum);
+            sum.pixelIndex = pixelIndex;
+        }
+        sum.Phi += Phi;
+        ++sum.m;
+    }
+
+    void FlushAll(SPPMPixel *pixels) {
+        for (SPPMPhotonSum &sum : sums)
+            Flush(pixels, sum);
     }
-    return inBounds;
+
+    static constexpr int Capacity = 4096;
+
+  private:
+    // SPPMPhotonSumCache Private Methods
+    static void Flush(SPPMPixel *pixels, SPPMPhotonSum &sum) {
+        if (sum.m == 0)
+            return;
+        SPPMPixel &pixel = pixels[sum.pixelIndex];
+        for (int i = 0; i < 3; ++i)
+            pixel.Phi_i[i].Add(sum.Phi[i]);
+        pixel.m.fetch_add(sum.m, std::memory_order_relaxed);
+        sum = SPPMPhotonSum();
+    }
+
+    // SPPMPhotonSumCache Private Members
+    std::vector<SPPMPhotonSum> sums;
+};
+
+// SPPMVisiblePointGrid Method Definitions
+int SPPMVisiblePointGrid::OverlappedCells(Point3f p, Float r, int cells[27]) const {
+    // Find grid cell bounds for visible point, _pMin_ and _pMax_
+    Point3i pMin, pMax;
+    ToGrid(p - Vector3f(r, r, r), &pMin);
+    ToGrid(p + Vector3f(r, r, r), &pMax);
+
+    // Record each hashed cell once, even if several grid cells hash to it
+    int nCells = 0;
+    for (int z = pMin.z; z <= pMax.z; ++z)
+        for (int y = pMin.y; y <= pMax.y; ++y)
+            for (int x = pMin.x; x <= pMax.x; ++x) {
+                int h = Hash(Point3i(x, y, z)) % hashSize;
+                if (std::find(cells, cells + nCells, h) == cells + nCells) {
+                    CHECK_LT(nCells, 27);
+                    cells[nCells++] = h;
+                }
+            }
+    return nCells;
+}
+
+void SPPMVisiblePointGrid::Build(
+    int64_t n, std::function<bool(int64_t, Point3f *, Float *)> getVisiblePoint) {
+    // Compute grid bounds for SPPM visible points
+    bounds = Bounds3f();
+    Float maxRadius = 0;
+    for (int64_t i = 0; i < n; ++i) {
+        Point3f p;
+        Float r;
+        if (!getVisiblePoint(i, &p, &r))
+            continue;
+        bounds = Union(bounds, Expand(Bounds3f(p), r));
+        maxRadius = std::max(maxRadius, r);
+    }
+    if (maxRadius == 0) {
+        hashSize = 0;
+        return;
+    }
+
+    // Compute resolution of SPPM grid in each dimension
+    Vector3f diag = bounds.Diagonal();
+    Float maxDiag = MaxComponentValue(diag);
+    int baseGridRes = int(maxDiag / maxRadius);
+    for (int i = 0; i < 3; ++i)
+        gridRes[i] = std::max<int>(baseGridRes * diag[i] / maxDiag, 1);
+
+    // Reset per-cell visible point counts, growing their storage if needed
+    hashSize = NextPrime(n);
+    if (cellCountsCapacity < size_t(hashSize)) {
+        cellCounts = std::make_unique<std::atomic<int>[]>(hashSize);
+        cellCountsCapacity = hashSize;
+    }
+    for (int h = 0; h < hashSize; ++h)
+        cellCounts[h].store(0, std::memory_order_relaxed);
+
+    // Count visible points overlapping each grid cell
+    ParallelFor(0, n, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            Point3f p;
+            Float r;
+            if (!getVisiblePoint(i, &p, &r))
+                continue;
+            int cells[27];
+            int nCells = OverlappedCells(p, r, cells);
+            for (int c = 0; c < nCells; ++c)
+                cellCounts[cells[c]].fetch_add(1, std::memory_order_relaxed);
+            gridCellsPerVisiblePoint << nCells;
+        }
+    });
+
+    // Compute each cell's starting offset and reuse counts as insertion cursors
+    cellStart.resize(hashSize + 1);
+    cellStart[0] = 0;
+    for (int h = 0; h < hashSize; ++h) {
+        cellStart[h + 1] = cellStart[h] + cellCounts[h].load(std::memory_order_relaxed);
+        cellCounts[h].store(cellStart[h], std::memory_order_relaxed);
+    }
+    entries.resize(cellStart[hashSize]);
+
+    // Scatter visible points into their cells' contiguous ranges of _entries_
+    ParallelFor(0, n, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            Point3f p;
+            Float r;
+            if (!getVisiblePoint(i, &p, &r))
+                continue;
+            int cells[27];
+            int nCells = OverlappedCells(p, r, cells);
+            for (int c = 0; c < nCells; ++c)
+                entries[cellCounts[cells[c]].fetch_add(1, std::memory_order_relaxed)] =
+                    SPPMGridEntry{p, Sqr(r), int(i)};
+        }
+    });
 }
 
 // SPPM Method Definitions
@@ -2828,6 +3801,13 @@ void SPPMIntegrator::Render() {
     pstd::vector<DigitPermutation> *digitPermutations(
         ComputeRadicalInversePermutations(digitPermutationsSeed));
 
+    // Allocate SPPM visible point grid and per-thread photon sums
+    SPPMVisiblePointGrid grid;
+    ThreadLocal<SPPMPhotonSumCache> threadPhotonSums([]() {
+        sppmPhotonSumBytes += SPPMPhotonSumCache::Capacity * sizeof(SPPMPhotonSum);
+        return SPPMPhotonSumCache();
+    });
+
     for (int iter = 0; iter < nIterations; ++iter) {
         // Connect to display server for SPPM if requested
         if (iter == 0 && !Options->displayServer.empty()) {
@@ -2978,63 +3958,13 @@ void SPPMIntegrator::Render() {
         });
         progress.Update();
         // Create grid of all SPPM visible points
-        // Allocate grid for SPPM visible points
-        int hashSize = NextPrime(nPixels);
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
-
-        // Compute grid bounds for SPPM visible points
-        Bounds3f gridBounds;
-        Float maxRadius = 0;
-        for (const SPPMPixel &pixel : pixels) {
-            if (!pixel.vp.beta)
-                continue;
-            Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
-            gridBounds = Union(gridBounds, vpBound);
-            maxRadius = std::max(maxRadius, pixel.radius);
-        }
-
-        // Compute resolution of SPPM grid in each dimension
-        int gridRes[3];
-        Vector3f diag = gridBounds.Diagonal();
-        Float maxDiag = MaxComponentValue(diag);
-        int baseGridRes = int(maxDiag / maxRadius);
-        for (int i = 0; i < 3; ++i)
-            gridRes[i] = std::max<int>(baseGridRes * diag[i] / maxDiag, 1);
-
-        // Add visible points to SPPM grid
-        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
-            ScratchBuffer &scratchBuffer = threadScratchBuffers.Get();
-            for (Point2i pPixel : tileBounds) {
-                SPPMPixel &pixel = pixels[pPixel];
-                if (pixel.vp.beta) {
-                    // Add pixel's visible point to applicable grid cells
-                    // Find grid cell bounds for pixel's visible point, _pMin_ and _pMax_
-                    Float r = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(r, r, r), gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(r, r, r), gridBounds, gridRes, &pMax);
-
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = Hash(Point3i(x, y, z)) % hashSize;
-                                CHECK_GE(h, 0);
-                                SPPMPixelListNode *node =
-                                    scratchBuffer.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of _grid[h]_'s
-                                // linked list
-                                node->next = grid[h];
-                                while (!grid[h].compare_exchange_weak(node->next, node))
-                                    ;
-                            }
-                    gridCellsPerVisiblePoint << (1 + pMax.x - pMin.x) *
-                                                    (1 + pMax.y - pMin.y) *
-                                                    (1 + pMax.z - pMin.z);
-                }
-            }
+        SPPMPixel *pixelArray = pixels.begin();
+        grid.Build(nPixels, [&](int64_t i, Point3f *p, Float *radius) {
+            if (!pixelArray[i].vp.beta)
+                return false;
+            *p = pixelArray[i].vp.p;
+            *radius = pixelArray[i].radius;
+            return true;
         });
 
         // Trace photons and accumulate contributions
@@ -3042,10 +3972,12 @@ void SPPMIntegrator::Render() {
         ThreadLocal<ScratchBuffer> photonShootScratchBuffers(
             []() { return ScratchBuffer(); });
 
+        Timer photonTimer;
         ParallelFor(0, photonsPerIteration, [&](int64_t start, int64_t end) {
             // Follow photon paths for photon index range _start_ - _end_
             ScratchBuffer &scratchBuffer = photonShootScratchBuffers.Get();
             Sampler sampler = threadSamplers.Get();
+            SPPMPhotonSumCache &photonSums = threadPhotonSums.Get();
             for (int64_t photonIndex = start; photonIndex < end; ++photonIndex) {
                 // Follow photon path for _photonIndex_
                 // Define sampling lambda functions for photon shooting
@@ -3106,35 +4038,21 @@ void SPPMIntegrator::Render() {
                     ++totalPhotonSurfaceInteractions;
                     if (depth > 0) {
                         // Add photon contribution to nearby visible points
-                        Point3i photonGridIndex;
-                        if (ToGrid(isect.p(), gridBounds, gridRes, &photonGridIndex)) {
-                            int h = Hash(photonGridIndex) % hashSize;
-                            CHECK_GE(h, 0);
-                            // Add photon contribution to visible points in _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node; node = node->next) {
-                                ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                if (DistanceSquared(pixel.vp.p, isect.p()) >
-                                    Sqr(pixel.radius))
-                                    continue;
+                        visiblePointsChecked += grid.ForEachVisiblePoint(
+                            isect.p(), [&](int pixelIndex) {
                                 // Update _pixel_ $\Phi$ and $m$ for nearby photon
+                                const SPPMPixel &pixel = pixelArray[pixelIndex];
                                 Vector3f wi = -photonRay.d;
                                 SampledSpectrum Phi =
                                     beta * pixel.vp.bsdf.f(pixel.vp.wo, wi);
-                                // Update _Phi_i_ for photon contribution
+                                // Accumulate photon contribution in thread's cache
                                 SampledWavelengths photonLambda = lambda;
                                 if (pixel.vp.secondaryLambdaTerminated)
                                     photonLambda.TerminateSecondary();
-                                RGB Phi_i =
-                                    film.ToOutputRGB(pixel.vp.beta * Phi, photonLambda);
-                                for (int i = 0; i < 3; ++i)
-                                    pixel.Phi_i[i].Add(Phi_i[i]);
-
-                                ++pixel.m;
-                            }
-                        }
+                                photonSums.Add(
+                                    pixelArray, pixelIndex,
+                                    film.ToOutputRGB(pixel.vp.beta * Phi, photonLambda));
+                            });
                     }
                     // Sample new photon ray direction
                     // Compute BSDF at photon intersection point
@@ -3173,8 +4091,12 @@ void SPPMIntegrator::Render() {
 
         progress.Update();
         photonPaths += photonsPerIteration;
+        LOG_VERBOSE("SPPM iteration %d: %.3f M photons/sec", iter,
+                    photonsPerIteration / (1e6 * photonTimer.ElapsedSeconds()));
 
         // Update pixel values from this pass's photons
+        threadPhotonSums.ForAll(
+            [&](SPPMPhotonSumCache &photonSums) { photonSums.FlushAll(pixelArray); });
         ParallelFor2D(pixelBounds, [&](Point2i pPixel) {
             SPPMPixel &p = pixels[pPixel];
             if (int m = p.m.load(std::memory_order_relaxed); m > 0) {
@@ -3248,6 +4170,7 @@ void SPPMIntegrator::Render() {
             }
         }
     }
+    sppmGridBytes += grid.BytesAllocated();
 #if 0
     // FIXME
     sppmMemoryArenaBytes += std::accumulate(perThreadArenas.begin(), perThreadArenas.end(),
@@ -11,17 +11,21 @@
 #include <pbrt/base/sampler.h>
 #include <pbrt/bsdf.h>
 #include <pbrt/cameras.h>
+#include <pbrt/cpu/guiding.h>
 #include <pbrt/cpu/primitive.h>
 #include <pbrt/film.h>
 #include <pbrt/interaction.h>
 #include <pbrt/lights.h>
 #include <pbrt/lightsamplers.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <ostream>
@@ -45,6 +49,11 @@ class Integrator {
 
     virtual void Render() = 0;
 
+    // Called before each frame of a sequence other than the first, once the
+    // scene has been updated for the frame; integrators reset any state that
+    // was learned from the previous frame.
+    virtual void StartFrame();
+
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray,
                                                 Float tMax = Infinity) const;
     bool IntersectP(const Ray &ray, Float tMax = Infinity) const;
@@ -90,6 +99,16 @@ class ImageTileIntegrator : public Integrator {
                                      ScratchBuffer &scratchBuffer) = 0;
 
   protected:
+    // ImageTileIntegrator Protected Methods
+    // Called after each wave of pixel samples; _spp_ is the number of samples
+    // per pixel that have been taken so far.
+    virtual void FinishWave(int spp) {}
+
+    // Evaluates the samples from _waveStart_ up to _waveEnd_ for all of the pixels
+    // in _tileBounds_; by default, each pixel sample is evaluated independently.
+    virtual void EvaluateTileSamples(Bounds2i tileBounds, int waveStart, int waveEnd,
+                                     Sampler sampler, ScratchBuffer &scratchBuffer);
+
     // ImageTileIntegrator Protected Members
     Camera camera;
     Sampler samplerPrototype;
@@ -109,6 +128,19 @@ class RayIntegrator : public ImageTileIntegrator {
     virtual SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda,
                                Sampler sampler, ScratchBuffer &scratchBuffer,
                                VisibleSurface *visibleSurface) const = 0;
+
+  protected:
+    // RayIntegrator Protected Methods
+    pstd::optional<CameraRayDifferential> GenerateCameraRay(
+        Point2i pPixel, Sampler sampler, SampledWavelengths *lambda,
+        CameraSample *cameraSample) const;
+    CameraSample SampleCamera(Point2i pPixel, Sampler sampler,
+                              SampledWavelengths *lambda) const;
+    void FinishCameraRay(CameraRayDifferential &cameraRay, Sampler sampler) const;
+
+    static SampledSpectrum CheckRadiance(SampledSpectrum L,
+                                         const SampledWavelengths &lambda,
+                                         Point2i pPixel, int sampleIndex);
 };
 
 // RandomWalkIntegrator Definition
@@ -210,7 +242,11 @@ class PathIntegrator : public RayIntegrator {
     PathIntegrator(int maxDepth, Camera camera, Sampler sampler, Primitive aggregate,
                    std::vector<Light> lights,
                    const std::string &lightSampleStrategy = "bvh",
-                   bool regularize = false);
+                   bool regularize = false, int nLightSamples = 1,
+                   int nRISCandidates = 1,
+                   std::unique_ptr<GuidingField> guidingField = nullptr,
+                   std::unique_ptr<ContributionEstimator> estimator = nullptr,
+                   bool sortMaterials = false);
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
@@ -224,15 +260,77 @@ class PathIntegrator : public RayIntegrator {
 
     std::string ToString() const;
 
+    void StartFrame() {
+        Integrator::StartFrame();
+        Bounds3f sceneBounds = aggregate ? aggregate.Bounds() : Bounds3f();
+        if (guidingField)
+            guidingField->Reset(sceneBounds);
+        if (contributionEstimator)
+            contributionEstimator->Reset(sceneBounds);
+    }
+
+  protected:
+    // PathIntegrator Protected Methods
+    void FinishWave(int spp) {
+        if (guidingField)
+            guidingField->Update(spp);
+        if (contributionEstimator)
+            contributionEstimator->Update(spp);
+    }
+
+    void EvaluateTileSamples(Bounds2i tileBounds, int waveStart, int waveEnd,
+                             Sampler sampler, ScratchBuffer &scratchBuffer);
+
   private:
+    // PathIntegrator::PathState Definition
+    struct PathState {
+        SampledSpectrum beta = SampledSpectrum(1.f);
+        int depth = 0;
+        Float p_b = 0, etaScale = 1;
+        bool specularBounce = false, anyNonSpecularBounces = false, split = false;
+        LightSampleContext prevIntrCtx;
+    };
+
+    // PathIntegrator::SortedPath Definition
+    struct SortedPath {
+        Point2i pPixel;
+        Sampler sampler;
+        SampledWavelengths lambda;
+        CameraSample cameraSample;
+        SampledSpectrum cameraWeight = SampledSpectrum(0.f), L = SampledSpectrum(0.f);
+        RayDifferential ray;
+        PathState state;
+        pstd::optional<ShapeIntersection> si;
+        BSDF bsdf;
+        VisibleSurface visibleSurface;
+        bool active = false, needsShading = false;
+    };
+
     // PathIntegrator Private Methods
+    SampledSpectrum TracePath(RayDifferential ray, SampledWavelengths &lambda,
+                              Sampler sampler, ScratchBuffer &scratchBuffer,
+                              VisibleSurface *visibleSurf, PathState state) const;
+    SampledSpectrum SplitPath(const SurfaceInteraction &isect, const BSDF &bsdf,
+                              GuidingDistribution guide, const RayDifferential &ray,
+                              SampledWavelengths &lambda, Sampler sampler,
+                              ScratchBuffer &scratchBuffer, PathState state) const;
+
     SampledSpectrum SampleLd(const SurfaceInteraction &intr, const BSDF *bsdf,
-                             SampledWavelengths &lambda, Sampler sampler) const;
+                             SampledWavelengths &lambda, Sampler sampler,
+                             GuidingDistribution guide) const;
+
+    void TraceSortedPaths(Bounds2i tileBounds, int sampleIndex,
+                          pstd::span<Sampler> samplers, ScratchBuffer &scratchBuffer);
 
     // PathIntegrator Private Members
     int maxDepth;
     LightSampler lightSampler;
     bool regularize;
+    int nLightSamples, nRISCandidates;
+    std::unique_ptr<GuidingField> guidingField;
+    std::unique_ptr<ContributionEstimator> contributionEstimator;
+    bool sortMaterials;
+    std::unique_ptr<ThreadLocal<std::vector<Sampler>>> pathSamplers;
 };
 
 // SimpleVolPathIntegrator Definition
@@ -264,11 +362,19 @@ class VolPathIntegrator : public RayIntegrator {
     VolPathIntegrator(int maxDepth, Camera camera, Sampler sampler, Primitive aggregate,
                       std::vector<Light> lights,
                       const std::string &lightSampleStrategy = "bvh",
-                      bool regularize = false)
+                      bool regularize = false, int nLightSamples = 1,
+                      int nRISCandidates = 1,
+                      std::unique_ptr<GuidingField> guidingField = nullptr,
+                      std::unique_ptr<ContributionEstimator> contributionEstimator =
+                          nullptr)
         : RayIntegrator(camera, sampler, aggregate, lights),
           maxDepth(maxDepth),
           lightSampler(LightSampler::Create(lightSampleStrategy, lights, Allocator())),
-          regularize(regularize) {}
+          regularize(regularize),
+          nLightSamples(nLightSamples),
+          nRISCandidates(nRISCandidates),
+          guidingField(std::move(guidingField)),
+          contributionEstimator(std::move(contributionEstimator)) {}
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
@@ -280,16 +386,38 @@ class VolPathIntegrator : public RayIntegrator {
 
     std::string ToString() const;
 
+    void StartFrame() {
+        Integrator::StartFrame();
+        Bounds3f sceneBounds = aggregate ? aggregate.Bounds() : Bounds3f();
+        if (guidingField)
+            guidingField->Reset(sceneBounds);
+        if (contributionEstimator)
+            contributionEstimator->Reset(sceneBounds);
+    }
+
+  protected:
+    // VolPathIntegrator Protected Methods
+    void FinishWave(int spp) {
+        if (guidingField)
+            guidingField->Update(spp);
+        if (contributionEstimator)
+            contributionEstimator->Update(spp);
+    }
+
   private:
     // VolPathIntegrator Private Methods
     SampledSpectrum SampleLd(const Interaction &intr, const BSDF *bsdf,
                              SampledWavelengths &lambda, Sampler sampler,
-                             SampledSpectrum beta, SampledSpectrum inv_w_u) const;
+                             SampledSpectrum beta, SampledSpectrum inv_w_u,
+                             GuidingDistribution guide = {}) const;
 
     // VolPathIntegrator Private Members
     int maxDepth;
     LightSampler lightSampler;
     bool regularize;
+    int nLightSamples, nRISCandidates;
+    std::unique_ptr<GuidingField> guidingField;
+    std::unique_ptr<ContributionEstimator> contributionEstimator;
 };
 
 // AOIntegrator Definition
@@ -432,6 +560,71 @@ class MLTIntegrator : public Integrator {
     int nChains;
 };
 
+// SPPMGridEntry Definition
+struct SPPMGridEntry {
+    Point3f p;
+    Float radius2;
+    int index;
+};
+
+// SPPMVisiblePointGrid Definition
+// Hashed uniform grid over SPPM visible points. It is built by counting sort so
+// that the visible points overlapping each cell are stored contiguously, and it
+// keeps its storage across builds.
+class SPPMVisiblePointGrid {
+  public:
+    // SPPMVisiblePointGrid Public Methods
+    // Builds the grid over visible points with indices in $[0,n)$;
+    // _getVisiblePoint_ returns false for indices without a visible point and
+    // otherwise returns its position and radius.
+    void Build(int64_t n,
+               std::function<bool(int64_t, Point3f *, Float *)> getVisiblePoint);
+
+    // Calls _func_ with the index of each visible point whose radius includes _p_
+    // and returns the number of visible points that were checked.
+    template <typename F>
+    int ForEachVisiblePoint(Point3f p, F func) const {
+        Point3i pi;
+        if (hashSize == 0 || !ToGrid(p, &pi))
+            return 0;
+        int h = Hash(pi) % hashSize;
+        for (int i = cellStart[h]; i < cellStart[h + 1]; ++i)
+            if (DistanceSquared(entries[i].p, p) <= entries[i].radius2)
+                func(entries[i].index);
+        return cellStart[h + 1] - cellStart[h];
+    }
+
+    size_t BytesAllocated() const {
+        return cellCountsCapacity * sizeof(std::atomic<int>) +
+               cellStart.capacity() * sizeof(int) +
+               entries.capacity() * sizeof(SPPMGridEntry);
+    }
+
+  private:
+    // SPPMVisiblePointGrid Private Methods
+    bool ToGrid(Point3f p, Point3i *pi) const {
+        bool inBounds = true;
+        Vector3f pg = bounds.Offset(p);
+        for (int i = 0; i < 3; ++i) {
+            (*pi)[i] = (int)(gridRes[i] * pg[i]);
+            inBounds &= (*pi)[i] >= 0 && (*pi)[i] < gridRes[i];
+            (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
+        }
+        return inBounds;
+    }
+
+    int OverlappedCells(Point3f p, Float r, int cells[27]) const;
+
+    // SPPMVisiblePointGrid Private Members
+    Bounds3f bounds;
+    int gridRes[3];
+    int hashSize = 0;
+    std::unique_ptr<std::atomic<int>[]> cellCounts;
+    size_t cellCountsCapacity = 0;
+    std::vector<int> cellStart;
+    std::vector<SPPMGridEntry> entries;
+};
+
 // SPPMIntegrator Definition
 class SPPMIntegrator : public Integrator {
   public:
@@ -18,10 +18,13 @@
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/image.h>
+#include <pbrt/util/rng.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 using namespace pbrt;
 
@@ -318,6 +321,122 @@ std::vector<TestIntegrator> GetIntegrators() {
                  scene});
         }
 
+        // Path tracing integrators with multiple light samples per vertex
+        for (auto &sampler : GetSamplers(resolution)) {
+            Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                  1., PixelSensor::CreateDefault(),
+                                  inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {},
+                                     nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+
+            const Film filmp = camera->GetFilm();
+            Integrator *integrator =
+                new PathIntegrator(8, camera, sampler.first, scene.aggregate,
+                                   scene.lights, "bvh", false, 4 /* light samples */);
+            integrators.push_back({integrator, filmp,
+                                   "Path, depth 8, 4 light samples, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        // Path tracing integrators with resampled direct lighting
+        for (auto &sampler : GetSamplers(resolution)) {
+            Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                  1., PixelSensor::CreateDefault(),
+                                  inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {},
+                                     nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+
+            const Film filmp = camera->GetFilm();
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false,
+                1 /* light samples */, 8 /* RIS candidates */);
+            integrators.push_back({integrator, filmp,
+                                   "Path, depth 8, 8 RIS candidates, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        // Path tracing integrators with path guiding
+        for (auto &sampler : GetSamplers(resolution)) {
+            Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                  1., PixelSensor::CreateDefault(),
+                                  inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {},
+                                     nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+
+            const Film filmp = camera->GetFilm();
+            auto guidingField = std::make_unique<GuidingField>(
+                scene.aggregate.Bounds(), 4 /* spatial res */, 8 /* directional res */,
+                0.5 /* BSDF sampling fraction */, 16 /* training spp */);
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false, 1,
+                1, std::move(guidingField));
+            integrators.push_back({integrator, filmp,
+                                   "Path, depth 8, guided, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        // Path tracing integrators with contribution-driven roulette and splitting
+        for (auto &sampler : GetSamplers(resolution)) {
+            Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                  1., PixelSensor::CreateDefault(),
+                                  inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {},
+                                     nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+
+            const Film filmp = camera->GetFilm();
+            auto contributionEstimator = std::make_unique<ContributionEstimator>(
+                filmp.PixelBounds(), scene.aggregate.Bounds(), 4 /* spatial res */,
+                5 /* window width */, 8 /* max splits */, 16 /* training spp */);
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false, 1,
+                1, nullptr, std::move(contributionEstimator));
+            integrators.push_back({integrator, filmp,
+                                   "Path, depth 8, ADRRS, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        // Path tracing integrators with hit points shaded in material-sorted batches
+        for (auto &sampler : GetSamplers(resolution)) {
+            Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                  1., PixelSensor::CreateDefault(),
+                                  inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {},
+                                     nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+
+            const Film filmp = camera->GetFilm();
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false, 1,
+                1, nullptr, nullptr, true /* sort materials */);
+            integrators.push_back({integrator, filmp,
+                                   "Path, depth 8, sorted materials, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
         // Volume path tracing integrators
         for (auto &sampler : GetSamplers(resolution)) {
             Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
@@ -358,6 +477,27 @@ std::vector<TestIntegrator> GetIntegrators() {
                  scene});
         }
 
+        for (auto &sampler : GetSamplers(resolution)) {
+            Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                  1., PixelSensor::CreateDefault(),
+                                  inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {},
+                                     nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const Film filmp = camera->GetFilm();
+
+            Integrator *integrator =
+                new VolPathIntegrator(8, camera, sampler.first, scene.aggregate,
+                                      scene.lights, "bvh", false, 4 /* light samples */);
+            integrators.push_back({integrator, filmp,
+                                   "VolPath, depth 8, 4 light samples, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
         // Simple path (perspective only, still sample light and BSDFs). Yolo
         for (auto &sampler : GetSamplers(resolution)) {
             Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
@@ -445,3 +585,110 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+TEST(PathIntegrator, SortedMaterialsMatchUnsorted) {
+    // Diffuse emissive sphere around the camera with a glass sphere in
+    // front of it, so that paths hit two material types.
+    Allocator alloc;
+    static Transform identity;
+    static Transform glassFromWorld = Translate(Vector3f(0, 0, -.6));
+    static Transform worldFromGlass = Inverse(glassFromWorld);
+    Shape sphere = new Sphere(&identity, &identity, true /* reverse orientation */, 1,
+                              -1, 1, 360);
+    Shape glassSphere =
+        new Sphere(&worldFromGlass, &glassFromWorld, false, .25, -.25, .25, 360);
+
+    static ConstantSpectrum cs(0.5);
+    SpectrumTexture Kd = alloc.new_object<SpectrumConstantTexture>(&cs);
+    Material diffuse = new DiffuseMaterial(Kd, nullptr, nullptr);
+    FloatTexture zero = alloc.new_object<FloatConstantTexture>(0.f);
+    static ConstantSpectrum eta(1.5);
+    Material glass = new DielectricMaterial(zero, zero, &eta, nullptr, nullptr, false);
+
+    ConstantSpectrum Le(1);
+    Float scale = 0.5 / SpectrumToPhotometric(&Le);
+    std::vector<Light> lights;
+    lights.push_back(new DiffuseAreaLight(identity, MediumInterface(), &Le, scale,
+                                          sphere, nullptr, Image(), nullptr, false));
+
+    std::vector<Primitive> prims;
+    prims.push_back(
+        Primitive(new GeometricPrimitive(sphere, diffuse, lights.back(), {})));
+    prims.push_back(Primitive(new GeometricPrimitive(glassSphere, glass, nullptr, {})));
+    Primitive bvh(new BVHAggregate(std::move(prims)));
+
+    // Render the scene with and without material sorting
+    Point2i resolution(20, 20);
+    AnimatedTransform cameraTransform(identity);
+    const char *filenames[2] = {"unsorted.exr", "sorted.exr"};
+    for (int sorted = 0; sorted < 2; ++sorted) {
+        Filter filter = new BoxFilter(Vector2f(0.5, 0.5));
+        FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                              1., PixelSensor::CreateDefault(),
+                              inTestDir(filenames[sorted]));
+        RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+        CameraBaseParameters cbp(CameraTransform(cameraTransform), film, nullptr, {},
+                                 nullptr);
+        PerspectiveCamera *camera = new PerspectiveCamera(
+            cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+        Sampler sampler = new ZSobolSampler(16, resolution, RandomizeStrategy::FastOwen);
+        Integrator *integrator =
+            new PathIntegrator(8, camera, sampler, bvh, lights, "bvh", false, 1, 1,
+                               nullptr, nullptr, sorted == 1);
+        integrator->Render();
+        delete integrator;
+    }
+
+    // Compare the two images
+    pstd::optional<ImageAndMetadata> unsorted = Image::Read(inTestDir(filenames[0]));
+    pstd::optional<ImageAndMetadata> sorted = Image::Read(inTestDir(filenames[1]));
+    for (const char *filename : filenames)
+        EXPECT_EQ(0, remove(inTestDir(filename).c_str()));
+    ASSERT_TRUE(unsorted && sorted);
+    ASSERT_EQ(unsorted->image.Resolution(), sorted->image.Resolution());
+    for (Point2i p : Bounds2i(Point2i(0, 0), resolution))
+        for (int c = 0; c < 3; ++c) {
+            Float u = unsorted->image.GetChannel(p, c);
+            Float s = sorted->image.GetChannel(p, c);
+            EXPECT_NEAR(u, s, 1e-4f * std::max<Float>(1, u)) << p << ", channel " << c;
+        }
+}
+
+TEST(SPPMVisiblePointGrid, MatchesBruteForce) {
+    RNG rng;
+    SPPMVisiblePointGrid grid;
+    // Rebuild the grid with different numbers of visible points to exercise
+    // its reuse of storage
+    for (int n : {2000, 100, 5000}) {
+        // Create random visible points, leaving some indices without one
+        std::vector<Point3f> p(n);
+        std::vector<Float> radius(n);
+        for (int i = 0; i < n; ++i) {
+            p[i] = Point3f(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                           .5f * rng.Uniform<Float>());
+            radius[i] = (i % 7 == 0) ? 0 : Lerp(rng.Uniform<Float>(), .005f, .1f);
+        }
+        grid.Build(n, [&](int64_t i, Point3f *pv, Float *r) {
+            if (radius[i] == 0)
+                return false;
+            *pv = p[i];
+            *r = radius[i];
+            return true;
+        });
+
+        for (int j = 0; j < 1000; ++j) {
+            // Look up points near visible points or anywhere around them
+            Point3f pq(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+            if (j & 1)
+                pq = p[rng.Uniform<uint32_t>(n)] + .1f * (pq - Point3f(.5, .5, .5));
+
+            std::vector<int> found, expected;
+            grid.ForEachVisiblePoint(pq, [&](int i) { found.push_back(i); });
+            for (int i = 0; i < n; ++i)
+                if (radius[i] > 0 && DistanceSquared(p[i], pq) <= Sqr(radius[i]))
+                    expected.push_back(i);
+            std::sort(found.begin(), found.end());
+            EXPECT_EQ(expected, found) << pq;
+        }
+    }
+}
@@ -28,11 +28,16 @@ class TransformedPrimitive;
 class AnimatedPrimitive;
 class BVHAggregate;
 class KdTreeAggregate;
+class TriangleMeshAggregate;
+class InstanceArrayAggregate;
+class MotionBVHAggregate;
 
 // Primitive Definition
 class Primitive
     : public TaggedPointer<SimplePrimitive, GeometricPrimitive, TransformedPrimitive,
-                           AnimatedPrimitive, BVHAggregate, KdTreeAggregate> {
+                           AnimatedPrimitive, BVHAggregate, KdTreeAggregate,
+                           TriangleMeshAggregate, InstanceArrayAggregate,
+                           MotionBVHAggregate> {
   public:
     // Primitive Interface
     using TaggedPointer::TaggedPointer;
@@ -52,6 +57,7 @@ class GeometricPrimitive {
                        const MediumInterface &mediumInterface,
                        FloatTexture alpha = nullptr);
     Bounds3f Bounds() const;
+    Shape GetShape() const { return shape; }
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
 
@@ -72,6 +78,7 @@ class SimplePrimitive {
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
     SimplePrimitive(Shape shape, Material material);
+    Shape GetShape() const { return shape; }
 
   private:
     // SimplePrimitive Private Members
@@ -106,6 +113,10 @@ class AnimatedPrimitive {
     Bounds3f Bounds() const {
         return renderFromPrimitive.MotionBounds(primitive.Bounds());
     }
+    Bounds3f MotionBounds(Float time0, Float time1) const {
+        return renderFromPrimitive.MotionBounds(primitive.Bounds(), time0, time1);
+    }
+    const AnimatedTransform &RenderFromPrimitive() const { return renderFromPrimitive; }
 
     AnimatedPrimitive(Primitive primitive, const AnimatedTransform &renderFromPrimitive);
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
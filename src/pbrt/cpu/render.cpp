@@ -17,6 +17,7 @@
 #include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/parallel.h>
 
 namespace pbrt {
@@ -156,7 +157,24 @@ void RenderCPU(BasicScene &parsedScene) {
     }
 
     // Render!
-    integrator->Render();
+    if (!Options->frame)
+        integrator->Render();
+    else {
+        // Render sequence of frames, reusing everything other than deforming
+        // meshes from one frame to the next
+        std::string filenamePattern = film.GetFilename();
+        for (int frame = *Options->frame; frame <= Options->lastFrame; ++frame) {
+            if (frame != *Options->frame) {
+                Options->frame = frame;
+                parsedScene.UpdateDeformingMeshes(frame);
+                integrator->StartFrame();
+                ParallelFor2D(film.PixelBounds(), [&](Point2i p) { film.ResetPixel(p); });
+            }
+            film.SetFilename(ExpandFrameNumber(filenamePattern, frame));
+            LOG_VERBOSE("Starting to render frame %d", frame);
+            integrator->Render();
+        }
+    }
 
     LOG_VERBOSE("Memory used after rendering: %s", GetCurrentRSS());
 
@@ -0,0 +1,142 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/cpu/render.h>
+#include <pbrt/options.h>
+#include <pbrt/parser.h>
+#include <pbrt/pbrt.h>
+#include <pbrt/scene.h>
+#include <pbrt/testutil.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/vecmath.h>
+
+#include <string>
+#include <vector>
+
+using namespace pbrt;
+
+#ifndef PBRT_IS_WINDOWS
+
+static Float AverageValue(const std::string &filename) {
+    pstd::optional<ImageAndMetadata> im = Image::Read(filename);
+    if (!im)
+        return -1;
+    return im->image.Average(im->image.AllChannelsDesc()).Average();
+}
+
+// Writes "square_<frame>.ply" files to _dir_ holding a square of the given
+// half-width for each of the frames from one up to _halfWidths.size()_.
+static bool WriteSquares(const TestDirectory &dir, std::vector<Float> halfWidths) {
+    std::vector<int> indices = {0, 1, 2, 0, 2, 3};
+    for (size_t i = 0; i < halfWidths.size(); ++i) {
+        Float s = halfWidths[i];
+        std::vector<Point3f> p = {Point3f(-s, -s, 0), Point3f(s, -s, 0),
+                                  Point3f(s, s, 0), Point3f(-s, s, 0)};
+        if (!WritePLY(dir.Path(StringPrintf("square_%d.ply", i + 1)), indices, {}, p,
+                      {}, {}, {}))
+            return false;
+    }
+    return true;
+}
+
+TEST(RenderCPU, DeformingMeshFrames) {
+    TestDirectory dir;
+    ASSERT_TRUE(dir.Valid());
+    OptionsRestorer optionsRestorer;
+
+    // Write two frames of a square that grows from one to the next
+    ASSERT_TRUE(WriteSquares(dir, {.5f, 1.f}));
+
+    std::string filmFilename = dir.Path("frame_##.exr");
+    std::string meshFilename = dir.Path("square_#.ply");
+    std::string sceneDescription = StringPrintf(R"(
+Film "rgb" "integer xresolution" 16 "integer yresolution" 16
+    "string filename" "%s"
+Sampler "independent" "integer pixelsamples" 4
+LookAt 0 0 -3  0 0 0  0 1 0
+Camera "perspective" "float fov" 45
+WorldBegin
+LightSource "distant" "point3 from" [0 0 -1] "point3 to" [0 0 0]
+Shape "plymesh" "string filename" "%s"
+)", filmFilename, meshFilename);
+
+    Options->frame = 1;
+    Options->lastFrame = 2;
+    BasicScene scene;
+    BasicSceneBuilder builder(&scene);
+    ParseString(&builder, sceneDescription);
+    RenderCPU(scene);
+
+    // Each frame should be written to its own file, with the larger square
+    // in the second frame covering more of the image
+    EXPECT_FALSE(FileExists(dir.Path("frame_##.exr")));
+    ASSERT_TRUE(FileExists(dir.Path("frame_01.exr")));
+    ASSERT_TRUE(FileExists(dir.Path("frame_02.exr")));
+    Float average1 = AverageValue(dir.Path("frame_01.exr"));
+    Float average2 = AverageValue(dir.Path("frame_02.exr"));
+    EXPECT_GT(average1, 0);
+    EXPECT_GT(average2, 1.5f * average1);
+}
+
+TEST(RenderCPU, FramesDontShareIntegratorState) {
+    TestDirectory dir;
+    ASSERT_TRUE(dir.Valid());
+    OptionsRestorer optionsRestorer;
+
+    // Both frames have the same geometry, so with the integrator's learned
+    // state reset between frames, they should be rendered the same way.
+    ASSERT_TRUE(WriteSquares(dir, {.5f, .5f}));
+    std::string filmFilename = dir.Path("frame_##.exr");
+    std::string meshFilename = dir.Path("square_#.ply");
+    std::string sceneDescription = StringPrintf(R"(
+Film "rgb" "integer xresolution" 16 "integer yresolution" 16
+    "string filename" "%s"
+Sampler "independent" "integer pixelsamples" 16
+Integrator "path" "bool guiding" true "integer guidingtrainingspp" 4
+    "bool adrrs" true "integer adrrstrainingspp" 4
+LookAt 0 -2 -3  0 0 0  0 1 0
+Camera "perspective" "float fov" 60
+WorldBegin
+LightSource "distant" "point3 from" [0 -1 -2] "point3 to" [0 0 0]
+Shape "plymesh" "string filename" "%s"
+Shape "trianglemesh" "integer indices" [0 1 2 0 2 3]
+    "point3 P" [-2 -2 .5  2 -2 .5  2 2 .5  -2 2 .5]
+)", filmFilename, meshFilename);
+
+    Options->frame = 1;
+    Options->lastFrame = 2;
+    BasicScene scene;
+    BasicSceneBuilder builder(&scene);
+    ParseString(&builder, sceneDescription);
+    RenderCPU(scene);
+
+    pstd::optional<ImageAndMetadata> frame1 = Image::Read(dir.Path("frame_01.exr"));
+    pstd::optional<ImageAndMetadata> frame2 = Image::Read(dir.Path("frame_02.exr"));
+    ASSERT_TRUE(frame1 && frame2);
+    Point2i res = frame1->image.Resolution();
+    ASSERT_EQ(res, frame2->image.Resolution());
+
+    // Learned estimates are accumulated with atomics, so allow a few pixels'
+    // sampling decisions to differ from rounding alone
+    int nDiffering = 0;
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < frame1->image.NChannels(); ++c) {
+                Float v1 = frame1->image.GetChannel({x, y}, c);
+                Float v2 = frame2->image.GetChannel({x, y}, c);
+                if (std::abs(v1 - v2) > 1e-3f * std::max(v1, v2) + 1e-5f) {
+                    ++nDiffering;
+                    break;
+                }
+            }
+    EXPECT_GT(AverageValue(dir.Path("frame_01.exr")), 0);
+    EXPECT_LT(nDiffering, res.x * res.y / 20);
+}
+
+#endif  // !PBRT_IS_WINDOWS
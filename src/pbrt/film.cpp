@@ -62,6 +62,11 @@ std::string Film::GetFilename() const {
     return DispatchCPU(get);
 }
 
+void Film::SetFilename(const std::string &filename) {
+    auto set = [&](auto ptr) { ptr->SetFilename(filename); };
+    DispatchCPU(set);
+}
+
 // FilmBaseParameters Method Definitions
 FilmBaseParameters::FilmBaseParameters(const ParameterDictionary &parameters,
                                        Filter filter, const PixelSensor *sensor,
@@ -78,6 +83,12 @@ FilmBaseParameters::FilmBaseParameters(const ParameterDictionary &parameters,
         filename = Options->imageFile;
     } else if (filename.empty())
         filename = "pbrt.exr";
+    // Use a pattern for the filename that includes the frame number when
+    // rendering a sequence of frames; it is expanded for each one
+    if (Options->frame && filename.find('#') == std::string::npos) {
+        std::string base = RemoveExtension(filename);
+        filename = base + "_####" + filename.substr(base.size());
+    }
 
     if (Options->fullscreen) {
         fullResolution = GUI::GetResolution();
@@ -207,6 +207,7 @@ class FilmBase {
     PBRT_CPU_GPU
     const PixelSensor *GetPixelSensor() const { return sensor; }
     std::string GetFilename() const { return filename; }
+    void SetFilename(const std::string &filename) { this->filename = filename; }
 
     PBRT_CPU_GPU
     SampledWavelengths SampleWavelengths(Float u) const {
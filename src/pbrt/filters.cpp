@@ -8,6 +8,8 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/rng.h>
 
+#include <numeric>
+
 namespace pbrt {
 
 std::string Filter::ToString() const {
@@ -132,23 +134,73 @@ Filter Filter::Create(const std::string &name, const ParameterDictionary &parame
 // FilterSampler Method Definitions
 FilterSampler::FilterSampler(Filter filter, Allocator alloc)
     : domain(Point2f(-filter.Radius()), Point2f(filter.Radius())),
-      f(int(32 * filter.Radius().x), int(32 * filter.Radius().y), alloc),
-      distrib(alloc) {
+      nx(int(32 * filter.Radius().x)),
+      ny(int(32 * filter.Radius().y)),
+      marginalCDF(ny + 1, alloc),
+      conditionalCDF(size_t(ny) * (nx + 1), alloc),
+      marginalGuide(ny, alloc),
+      conditionalGuide(size_t(ny) * nx, alloc),
+      weights(nx, ny, alloc) {
     // Tabularize unnormalized filter function in _f_
-    for (int y = 0; y < f.YSize(); ++y)
-        for (int x = 0; x < f.XSize(); ++x) {
-            Point2f p =
-                domain.Lerp(Point2f((x + 0.5f) / f.XSize(), (y + 0.5f) / f.YSize()));
+    Array2D<Float> f(nx, ny);
+    for (int y = 0; y < ny; ++y)
+        for (int x = 0; x < nx; ++x) {
+            Point2f p = domain.Lerp(Point2f((x + 0.5f) / nx, (y + 0.5f) / ny));
             f(x, y) = filter.Evaluate(p);
         }
 
-    // Compute sampling distribution for filter
-    distrib = PiecewiseConstant2D(f, domain, alloc);
+    // Compute conditional CDFs and guide tables for each row of _f_
+    std::vector<Float> rowSums(ny, Float(0));
+    for (int y = 0; y < ny; ++y) {
+        pstd::span<const Float> row(&f(0, y), nx);
+        for (Float v : row)
+            rowSums[y] += std::abs(v);
+        ComputeCDF(row, pstd::span<Float>(&conditionalCDF[y * (nx + 1)], nx + 1),
+                   pstd::span<int>(&conditionalGuide[y * nx], nx));
+    }
+
+    // Compute marginal CDF and guide table over rows
+    ComputeCDF(rowSums, pstd::span<Float>(marginalCDF.data(), ny + 1),
+               pstd::span<int>(marginalGuide.data(), ny));
+
+    // Precompute sample weights $f/p$ for each cell
+    Float total = std::accumulate(rowSums.begin(), rowSums.end(), Float(0));
+    Float cellArea = domain.Area() / (nx * ny);
+    for (int y = 0; y < ny; ++y) {
+        Float py = (total > 0) ? rowSums[y] / total : Float(1) / ny;
+        for (int x = 0; x < nx; ++x) {
+            Float px = (rowSums[y] > 0) ? std::abs(f(x, y)) / rowSums[y] : Float(1) / nx;
+            Float pdf = px * py / cellArea;
+            weights(x, y) = (pdf > 0) ? f(x, y) / pdf : 0;
+        }
+    }
+}
+
+void FilterSampler::ComputeCDF(pstd::span<const Float> func, pstd::span<Float> cdf,
+                               pstd::span<int> guide) {
+    // Compute normalized CDF of $|\roman{func}|$, falling back to uniform if zero
+    size_t n = func.size();
+    cdf[0] = 0;
+    for (size_t i = 1; i <= n; ++i)
+        cdf[i] = cdf[i - 1] + std::abs(func[i - 1]);
+    Float funcInt = cdf[n];
+    for (size_t i = 1; i <= n; ++i)
+        cdf[i] = (funcInt == 0) ? Float(i) / Float(n) : cdf[i] / funcInt;
+
+    // Compute guide table of starting intervals for uniform ranges of $u$
+    int o = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Float u = Float(i) / Float(n);
+        while (o < int(n) - 1 && cdf[o + 1] <= u)
+            ++o;
+        guide[i] = o;
+    }
 }
 
 std::string FilterSampler::ToString() const {
-    return StringPrintf("[ FilterSampler domain: %s f: %s distrib: %s ]", domain, f,
-                        distrib);
+    return StringPrintf("[ FilterSampler domain: %s nx: %d ny: %d marginalCDF: %s "
+                        "weights: %s ]",
+                        domain, nx, ny, marginalCDF, weights);
 }
 
 }  // namespace pbrt
@@ -31,17 +31,39 @@ class FilterSampler {
 
     PBRT_CPU_GPU
     FilterSample Sample(Point2f u) const {
-        Float pdf;
-        Point2i pi;
-        Point2f p = distrib.Sample(u, &pdf, &pi);
-        return FilterSample{p, f[pi] / pdf};
+        // Invert marginal and conditional CDFs to find filter table cell
+        Float dy, dx;
+        int y = InvertCDF(&marginalCDF[0], &marginalGuide[0], ny, u[1], &dy);
+        int x = InvertCDF(&conditionalCDF[y * (nx + 1)], &conditionalGuide[y * nx], nx,
+                          u[0], &dx);
+
+        // Return point in cell and its precomputed weight
+        Point2f p = domain.Lerp(Point2f((x + dx) / nx, (y + dy) / ny));
+        return FilterSample{p, weights(x, y)};
     }
 
   private:
+    // FilterSampler Private Methods
+    static void ComputeCDF(pstd::span<const Float> func, pstd::span<Float> cdf,
+                           pstd::span<int> guide);
+
+    PBRT_CPU_GPU
+    static int InvertCDF(const Float *cdf, const int *guide, int n, Float u, Float *du) {
+        // Start at guide table entry for _u_ and step forward to its interval
+        int o = guide[std::min<int>(u * n, n - 1)];
+        while (o < n - 1 && cdf[o + 1] <= u)
+            ++o;
+        Float width = cdf[o + 1] - cdf[o];
+        *du = (width > 0) ? (u - cdf[o]) / width : 0;
+        return o;
+    }
+
     // FilterSampler Private Members
     Bounds2f domain;
-    Array2D<Float> f;
-    PiecewiseConstant2D distrib;
+    int nx, ny;
+    pstd::vector<Float> marginalCDF, conditionalCDF;
+    pstd::vector<int> marginalGuide, conditionalGuide;
+    Array2D<Float> weights;
 };
 
 // BoxFilter Definition
@@ -98,3 +98,25 @@ TEST(Filter, Integral) {
     for (Filter f : makeFilters(Vector2f(3.4, 2.5)))
         EXPECT_TRUE(approxEqual(f.Integral(), integrateFilter(f))) << f;
 }
+
+TEST(Filter, SamplerWeights) {
+    for (Vector2f radius : {Vector2f(1, 1), Vector2f(2.5, 1), Vector2f(3.4, 2.5)}) {
+        std::vector<Filter> filters = {
+            new BoxFilter(radius), new GaussianFilter(radius), new MitchellFilter(radius),
+            new LanczosSincFilter(radius), new TriangleFilter(radius)};
+        for (Filter f : filters) {
+            // Sampled estimate of the filter's integral should match its value
+            FilterSampler sampler(f);
+            Float sum = 0;
+            int sqrtSamples = 256;
+            for (Point2f u : Stratified2D(sqrtSamples, sqrtSamples)) {
+                FilterSample fs = sampler.Sample(u);
+                EXPECT_LE(std::abs(fs.p.x), radius.x) << f;
+                EXPECT_LE(std::abs(fs.p.y), radius.y) << f;
+                sum += fs.weight;
+            }
+            Float estimate = sum / Sqr(sqrtSamples);
+            EXPECT_LT(std::abs(estimate - f.Integral()), 1e-2 * f.Integral()) << f;
+        }
+    }
+}
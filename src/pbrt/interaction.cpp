@@ -15,6 +15,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/rng.h>
+#include <pbrt/util/stats.h>
 
 #include <cmath>
 
@@ -159,6 +160,9 @@ RayDifferential SurfaceInteraction::SpawnRay(const RayDifferential &rayi,
 BSDF SurfaceInteraction::GetBSDF(const RayDifferential &ray, SampledWavelengths &lambda,
                                  Camera camera, ScratchBuffer &scratchBuffer,
                                  Sampler sampler) {
+#ifndef PBRT_IS_GPU_CODE
+    ProfilerScope _(ProfilePhase::GetBSDF);
+#endif
     // Estimate $(u,v)$ and position differentials at intersection point
     ComputeDifferentials(ray, camera, sampler.SamplesPerPixel());
 
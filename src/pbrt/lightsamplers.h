@@ -440,6 +440,9 @@ class ExhaustiveLightSampler {
 
 inline pstd::optional<SampledLight> LightSampler::Sample(const LightSampleContext &ctx,
                                                          Float u) const {
+#ifndef PBRT_IS_GPU_CODE
+    ProfilerScope _(ProfilePhase::LightSampling);
+#endif
     auto s = [&](auto ptr) { return ptr->Sample(ctx, u); };
     return Dispatch(s);
 }
@@ -450,6 +453,9 @@ inline Float LightSampler::PMF(const LightSampleContext &ctx, Light light) const
 }
 
 inline pstd::optional<SampledLight> LightSampler::Sample(Float u) const {
+#ifndef PBRT_IS_GPU_CODE
+    ProfilerScope _(ProfilePhase::LightSampling);
+#endif
     auto sample = [&](auto ptr) { return ptr->Sample(u); };
     return Dispatch(sample);
 }
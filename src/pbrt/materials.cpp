@@ -250,6 +250,28 @@ ConductorMaterial *ConductorMaterial::Create(const TextureParameterDictionary &p
                                                remapRoughness);
 }
 
+// Layered Material Helper Functions
+// Number of independent estimates averaged for each layered BSDF table entry
+static constexpr int LayeredTableEstimates = 64;
+
+// Layered BSDFs can only be tabulated if they are the same everywhere and
+// isotropic, so that the table only needs to be 3D for each wavelength.
+static bool CanTabulateLayers(
+    std::initializer_list<FloatTexture> ftex, std::initializer_list<SpectrumTexture> stex,
+    std::initializer_list<std::pair<FloatTexture, FloatTexture>> roughness) {
+    for (FloatTexture f : ftex)
+        if (f && !f.Is<FloatConstantTexture>())
+            return false;
+    for (SpectrumTexture s : stex)
+        if (s && !s.Is<SpectrumConstantTexture>())
+            return false;
+    for (const auto &uv : roughness)
+        if (BasicTextureEvaluator()(uv.first, MaterialEvalContext()) !=
+            BasicTextureEvaluator()(uv.second, MaterialEvalContext()))
+            return false;
+    return true;
+}
+
 // CoatedDiffuseMaterial Method Definitions
 template <typename TextureEvaluator>
 CoatedDiffuseBxDF CoatedDiffuseMaterial::GetBxDF(TextureEvaluator texEval,
@@ -278,8 +300,11 @@ CoatedDiffuseBxDF CoatedDiffuseMaterial::GetBxDF(TextureEvaluator texEval,
     SampledSpectrum a = Clamp(texEval(albedo, ctx, lambda), 0, 1);
     Float gg = Clamp(texEval(g, ctx), -1, 1);
 
-    return CoatedDiffuseBxDF(DielectricBxDF(sampledEta, distrib), DiffuseBxDF(r), thick,
-                             a, gg, maxDepth, nSamples);
+    CoatedDiffuseBxDF bxdf(DielectricBxDF(sampledEta, distrib), DiffuseBxDF(r), thick, a,
+                           gg, maxDepth, nSamples);
+    if (table)
+        bxdf.SetTable(table, lambda);
+    return bxdf;
 }
 
 // Explicit template instantiation
@@ -336,10 +361,28 @@ CoatedDiffuseMaterial *CoatedDiffuseMaterial::Create(
 
     FloatTexture displacement = parameters.GetFloatTextureOrNull("displacement", alloc);
     bool remapRoughness = parameters.GetOneBool("remaproughness", true);
+    bool tabulate = parameters.GetOneBool("tabulate", false);
 
-    return alloc.new_object<CoatedDiffuseMaterial>(
+    CoatedDiffuseMaterial *material = alloc.new_object<CoatedDiffuseMaterial>(
         reflectance, uRoughness, vRoughness, thickness, albedo, g, eta, displacement,
         normalMap, remapRoughness, maxDepth, nSamples);
+
+    // Precompute layered BSDF table if requested and possible
+    if (tabulate) {
+        if (!CanTabulateLayers({uRoughness, vRoughness, thickness, g},
+                               {reflectance, albedo}, {{uRoughness, vRoughness}}))
+            Warning(loc, "\"tabulate\" requires untextured parameters and isotropic "
+                         "roughness. Using stochastic evaluation.");
+        else
+            material->table = LayeredBxDFTable::Create<CoatedDiffuseBxDF>(
+                [&](SampledWavelengths &lambda) {
+                    return material->GetBxDF(BasicTextureEvaluator(),
+                                             MaterialEvalContext(), lambda);
+                },
+                LayeredTableEstimates, alloc);
+    }
+
+    return material;
 }
 
 template <typename TextureEvaluator>
@@ -386,9 +429,12 @@ CoatedConductorBxDF CoatedConductorMaterial::GetBxDF(TextureEvaluator texEval,
     SampledSpectrum a = Clamp(texEval(albedo, ctx, lambda), 0, 1);
     Float gg = Clamp(texEval(g, ctx), -1, 1);
 
-    return CoatedConductorBxDF(DielectricBxDF(ieta, interfaceDistrib),
-                               ConductorBxDF(conductorDistrib, ce, ck), thick, a, gg,
-                               maxDepth, nSamples);
+    CoatedConductorBxDF bxdf(DielectricBxDF(ieta, interfaceDistrib),
+                             ConductorBxDF(conductorDistrib, ce, ck), thick, a, gg,
+                             maxDepth, nSamples);
+    if (table)
+        bxdf.SetTable(table, lambda);
+    return bxdf;
 }
 
 template CoatedConductorBxDF CoatedConductorMaterial::GetBxDF(
@@ -479,11 +525,32 @@ CoatedConductorMaterial *CoatedConductorMaterial::Create(
 
     FloatTexture displacement = parameters.GetFloatTextureOrNull("displacement", alloc);
     bool remapRoughness = parameters.GetOneBool("remaproughness", true);
+    bool tabulate = parameters.GetOneBool("tabulate", false);
 
-    return alloc.new_object<CoatedConductorMaterial>(
+    CoatedConductorMaterial *material = alloc.new_object<CoatedConductorMaterial>(
         interfaceURoughness, interfaceVRoughness, thickness, interfaceEta, g, albedo,
         conductorURoughness, conductorVRoughness, conductorEta, k, reflectance,
         displacement, normalMap, remapRoughness, maxDepth, nSamples);
+
+    // Precompute layered BSDF table if requested and possible
+    if (tabulate) {
+        if (!CanTabulateLayers({interfaceURoughness, interfaceVRoughness, thickness, g,
+                                conductorURoughness, conductorVRoughness},
+                               {conductorEta, k, reflectance, albedo},
+                               {{interfaceURoughness, interfaceVRoughness},
+                                {conductorURoughness, conductorVRoughness}}))
+            Warning(loc, "\"tabulate\" requires untextured parameters and isotropic "
+                         "roughness. Using stochastic evaluation.");
+        else
+            material->table = LayeredBxDFTable::Create<CoatedConductorBxDF>(
+                [&](SampledWavelengths &lambda) {
+                    return material->GetBxDF(BasicTextureEvaluator(),
+                                             MaterialEvalContext(), lambda);
+                },
+                LayeredTableEstimates, alloc);
+    }
+
+    return material;
 }
 
 // SubsurfaceMaterial Method Definitions
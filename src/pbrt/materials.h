@@ -613,6 +613,7 @@ class CoatedDiffuseMaterial {
     Spectrum eta;
     bool remapRoughness;
     int maxDepth, nSamples;
+    const LayeredBxDFTable *table = nullptr;
 };
 
 // CoatedConductorMaterial Definition
@@ -690,6 +691,7 @@ class CoatedConductorMaterial {
     SpectrumTexture conductorEta, k, reflectance;
     bool remapRoughness;
     int maxDepth, nSamples;
+    const LayeredBxDFTable *table = nullptr;
 };
 
 // SubsurfaceMaterial Definition
@@ -19,6 +19,7 @@
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/scattering.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 
 #include <nanovdb/NanoVDB.h>
@@ -734,6 +735,9 @@ PBRT_CPU_GPU SampledSpectrum SampleT_maj(Ray ray, Float tMax, Float u, RNG &rng,
 template <typename ConcreteMedium, typename F>
 PBRT_CPU_GPU SampledSpectrum SampleT_maj(Ray ray, Float tMax, Float u, RNG &rng,
                                          const SampledWavelengths &lambda, F callback) {
+#ifndef PBRT_IS_GPU_CODE
+    ProfilerScope _(ProfilePhase::SampleMedium);
+#endif
     // Normalize ray direction and update _tMax_ accordingly
     tMax *= Length(ray.d);
     ray.d = Normalize(ray.d);
@@ -38,17 +38,22 @@ std::string PBRTOptions::ToString() const {
         "disableWavelengthJitter: %s disableTextureFiltering: %s disableImageTextures: %s "
         "forceDiffuse: %s useGPU: %s wavefront: %s interactive: %s fullscreen %s "
         "renderingSpace: %s nThreads: %s logLevel: %s logFile: %s logUtilization: %s "
-        "writePartialImages: %s recordPixelStatistics: %s "
+        "traceFile: %s writePartialImages: %s recordPixelStatistics: %s "
         "printStatistics: %s pixelSamples: %s gpuDevice: %s quickRender: %s upgrade: %s "
-        "imageFile: %s mseReferenceImage: %s mseReferenceOutput: %s debugStart: %s "
-        "displayServer: %s cropWindow: %s pixelBounds: %s pixelMaterial: %s "
-        "displacementEdgeScale: %f ]",
+        "imageFile: %s mseReferenceImage: %s mseReferenceOutput: %s "
+        "mseReferenceTimes: %s debugStart: %s displayServer: %s cropWindow: %s "
+        "pixelBounds: %s pixelMaterial: %s "
+        "displacementEdgeScale: %f frame: %s lastFrame: %d "
+        "bvhCacheDirectory: %s ]",
         seed, quiet, disablePixelJitter, disableWavelengthJitter, disableTextureFiltering,
         disableImageTextures, forceDiffuse, useGPU, wavefront, interactive, fullscreen,
-        renderingSpace, nThreads, logLevel, logFile, logUtilization, writePartialImages,
-        recordPixelStatistics, printStatistics, pixelSamples, gpuDevice, quickRender, upgrade,
-        imageFile, mseReferenceImage, mseReferenceOutput, debugStart, displayServer, cropWindow,
-        pixelBounds, pixelMaterial, displacementEdgeScale);
+        renderingSpace, nThreads, logLevel, logFile, logUtilization, traceFile,
+        writePartialImages, recordPixelStatistics, printStatistics, pixelSamples, gpuDevice,
+        quickRender, upgrade,
+        imageFile, mseReferenceImage, mseReferenceOutput, mseReferenceTimes, debugStart,
+        displayServer, cropWindow, pixelBounds, pixelMaterial, displacementEdgeScale,
+        frame, lastFrame,
+        bvhCacheDirectory);
 }
 
 }  // namespace pbrt
@@ -39,6 +39,7 @@ struct PBRTOptions : BasicPBRTOptions {
     LogLevel logLevel = LogLevel::Error;
     std::string logFile;
     bool logUtilization = false;
+    std::string traceFile;
     bool writePartialImages = false;
     bool recordPixelStatistics = false;
     bool printStatistics = false;
@@ -48,12 +49,18 @@ struct PBRTOptions : BasicPBRTOptions {
     bool upgrade = false;
     std::string imageFile;
     std::string mseReferenceImage, mseReferenceOutput;
+    bool mseReferenceTimes = false;
     std::string debugStart;
     std::string displayServer;
     pstd::optional<Bounds2f> cropWindow;
     pstd::optional<Bounds2i> pixelBounds;
     pstd::optional<Point2i> pixelMaterial;
     Float displacementEdgeScale = 1;
+    // Frame being rendered when rendering a sequence of frames, which
+    // continues through _lastFrame_
+    pstd::optional<int> frame;
+    int lastFrame = 0;
+    std::string bvhCacheDirectory;
 
     std::string ToString() const;
 };
@@ -17,6 +17,7 @@
 #include <pbrt/util/progressreporter.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 
 #include <double-conversion/double-conversion.h>
 
@@ -997,6 +998,7 @@ void parse(ParserTarget *target, std::unique_ptr<Tokenizer> t) {
 }
 
 void ParseFiles(ParserTarget *target, pstd::span<const std::string> filenames) {
+    TRACE_SCOPE("Parse scene");
     auto tokError = [](const char *msg, const FileLoc *loc) {
         ErrorExit(loc, "%s", msg);
     };
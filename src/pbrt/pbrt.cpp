@@ -21,6 +21,7 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
 #include <ImfThreading.h>
 
@@ -84,11 +85,15 @@ void InitPBRT(const PBRTOptions &opt) {
         SuppressErrorMessages();
 
     InitLogging(opt.logLevel, opt.logFile, opt.logUtilization, Options->useGPU);
+    if (!Options->traceFile.empty())
+        TraceInit(Options->traceFile);
 
     // General \pbrt Initialization
     int nThreads = Options->nThreads != 0 ? Options->nThreads : AvailableCores();
     ParallelInit(nThreads);  // Threads must be launched before the
                              // profiler is initialized.
+    if (!Options->useGPU && (Options->printStatistics || Options->recordPixelStatistics))
+        InitProfiler();
 
     if (Options->useGPU) {
 #ifdef PBRT_BUILD_GPU_RENDERER
@@ -133,6 +138,7 @@ void InitPBRT(const PBRTOptions &opt) {
 }
 
 void CleanupPBRT() {
+    CleanupProfiler();
     ForEachThread(ReportThreadStats);
 
     if (Options->recordPixelStatistics)
@@ -151,6 +157,8 @@ void CleanupPBRT() {
     // API Cleanup
     ParallelCleanup();
 
+    TraceCleanup();
+
     ShutdownLogging();
 
     Options = nullptr;
@@ -24,6 +24,7 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/util/transform.h>
 
 #include <iostream>
@@ -229,6 +230,11 @@ void BasicSceneBuilder::WorldBegin(FileLoc loc) {
     graphicsState.activeTransformBits = AllTransformsBits;
     namedCoordinateSystems["world"] = graphicsState.ctm;
 
+    // Non-animated affine instances are collected into an
+    // _InstanceArrayAggregate_ by default on the CPU
+    useInstanceArrays =
+        !Options->useGPU && accelerator.parameters.GetOneBool("instancearray", true);
+
     // Pass pre-_WorldBegin_ entities to _scene_
     scene->SetOptions(filter, film, camera, sampler, integrator, accelerator);
 }
@@ -389,9 +395,18 @@ void BasicSceneBuilder::ObjectInstance(const std::string &origName, FileLoc loc)
         }
     }
 
-    const class Transform *renderFromInstance =
-        transformCache.Lookup(RenderFromObject(0) * worldFromRender);
-    instanceUses.push_back(InstanceSceneEntity(name, loc, renderFromInstance));
+    class Transform renderFromInstance = RenderFromObject(0) * worldFromRender;
+    const SquareMatrix<4> &m = renderFromInstance.GetMatrix();
+    if (useInstanceArrays && m[3][0] == 0 && m[3][1] == 0 && m[3][2] == 0 &&
+        m[3][3] == 1) {
+        // Instance arrays store their own compact copy of the transformation,
+        // so don't keep it in the transform cache
+        instanceUses.push_back(InstanceSceneEntity(
+            name, loc, new class Transform(renderFromInstance), true));
+        return;
+    }
+    instanceUses.push_back(
+        InstanceSceneEntity(name, loc, transformCache.Lookup(renderFromInstance)));
 }
 
 void BasicSceneBuilder::EndOfFiles() {
@@ -833,6 +848,7 @@ Medium BasicScene::GetMedium(const std::string &name, const FileLoc *loc) {
 }
 
 std::map<std::string, Medium> BasicScene::CreateMedia() {
+    TRACE_SCOPE("BasicScene::CreateMedia");
     mediaMutex.lock();
     if (!mediumJobs.empty()) {
         // Consume results for asynchronously-created _Medium_ objects
@@ -942,6 +958,7 @@ void BasicScene::AddFloatTexture(std::string name, TextureSceneEntity texture) {
     loadingTextureFilenames.insert(filename);
 
     auto create = [=](TextureSceneEntity texture) {
+        TRACE_SCOPE("Create image texture");
         Allocator alloc = threadAllocators.Get();
 
         pbrt::Transform renderFromTexture = texture.renderFromObject.startTransform;
@@ -986,6 +1003,7 @@ void BasicScene::AddSpectrumTexture(std::string name, TextureSceneEntity texture
     asyncSpectrumTextures.push_back(std::make_pair(name, texture));
 
     auto create = [=](TextureSceneEntity texture) {
+        TRACE_SCOPE("Create image texture");
         Allocator alloc = threadAllocators.Get();
 
         pbrt::Transform renderFromTexture = texture.renderFromObject.startTransform;
@@ -1110,6 +1128,7 @@ void BasicScene::Done() {
 void BasicScene::CreateMaterials(const NamedTextures &textures,
                                  std::map<std::string, pbrt::Material> *namedMaterialsOut,
                                  std::vector<pbrt::Material> *materialsOut) {
+    TRACE_SCOPE("BasicScene::CreateMaterials");
     LOG_VERBOSE("Starting to consume %d normal map futures", normalMapJobs.size());
     std::lock_guard<std::mutex> lock(materialMutex);
     for (auto &job : normalMapJobs) {
@@ -1171,6 +1190,7 @@ void BasicScene::CreateMaterials(const NamedTextures &textures,
 }
 
 NamedTextures BasicScene::CreateTextures() {
+    TRACE_SCOPE("BasicScene::CreateTextures");
     NamedTextures textures;
 
     if (nMissingTextures > 0)
@@ -1254,6 +1274,7 @@ NamedTextures BasicScene::CreateTextures() {
 std::vector<Light> BasicScene::CreateLights(
     const NamedTextures &textures,
     std::map<int, pstd::vector<Light> *> *shapeIndexToAreaLights) {
+    TRACE_SCOPE("BasicScene::CreateLights");
     auto findMedium = [this](const std::string &s, const FileLoc *loc) -> Medium {
         if (s.empty())
             return nullptr;
@@ -1355,6 +1376,7 @@ Primitive BasicScene::CreateAggregate(
     const std::map<std::string, Medium> &media,
     const std::map<std::string, pbrt::Material> &namedMaterials,
     const std::vector<pbrt::Material> &materials) {
+    TRACE_SCOPE("BasicScene::CreateAggregate");
     Allocator alloc;
     auto findMedium = [&media](const std::string &s, const FileLoc *loc) -> Medium {
         if (s.empty())
@@ -1384,12 +1406,26 @@ Primitive BasicScene::CreateAggregate(
     };
 
     // Non-animated shapes
+    // Triangle meshes are optionally stored using a single primitive for the
+    // entire mesh rather than one for each triangle.
+    bool compactMeshes = accelerator.parameters.GetOneBool("compactmeshes", false);
+    // When rendering multiple frames, "plymesh" shapes with '#' characters in
+    // their filename have their vertices reloaded for each frame and the
+    // BVHs over them are refit or, if their quality has degraded too much,
+    // rebuilt. Only such meshes outside of object instances are updated.
+    rebuildCostRatio = accelerator.parameters.GetOneFloat("rebuildthreshold", 1.5f);
+    auto isDeformingMesh = [](const ShapeSceneEntity &sh) {
+        return Options->frame && sh.name == "plymesh" &&
+               sh.parameters.GetOneString("filename", "").find('#') != std::string::npos;
+    };
     auto CreatePrimitivesForShapes =
-        [&](std::vector<ShapeSceneEntity> &shapes) -> std::vector<Primitive> {
+        [&](std::vector<ShapeSceneEntity> &shapes,
+            std::vector<DeformingMesh> *deformingMeshes) -> std::vector<Primitive> {
         // Parallelize Shape::Create calls, which will in turn
         // parallelize PLY file loading, etc...
         pstd::vector<pstd::vector<pbrt::Shape>> shapeVectors(shapes.size());
         ParallelFor(0, shapes.size(), [&](int64_t i) {
+            TRACE_SCOPE("Shape::Create");
             const auto &sh = shapes[i];
             shapeVectors[i] = Shape::Create(
                 sh.name, sh.renderFromObject, sh.objectFromRender, sh.reverseOrientation,
@@ -1420,7 +1456,44 @@ Primitive BasicScene::CreateAggregate(
             pbrt::MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                      findMedium(sh.outsideMedium, &sh.loc));
 
+            TriangleMesh *deformingMesh = nullptr;
+            if (isDeformingMesh(sh)) {
+                const Triangle *tri = shapes[0].CastOrNullptr<Triangle>();
+                if (!deformingMeshes)
+                    Warning(&sh.loc, "Meshes in object instances are not updated for "
+                                     "each frame.");
+                else if (sh.lightIndex != -1)
+                    Warning(&sh.loc, "Emissive meshes are not updated for each frame.");
+                else if (!tri || tri->Mesh()->nTriangles != shapes.size() ||
+                         !sh.parameters.GetTexture("displacement").empty())
+                    Warning(&sh.loc, "Only triangle meshes without displacement are "
+                                     "updated for each frame.");
+                else
+                    // Meshes are only modified between frames, when nothing
+                    // else is accessing them
+                    deformingMesh = const_cast<TriangleMesh *>(tri->Mesh());
+            }
+            auto addDeformingMesh = [&](TriangleMeshAggregate *meshAggregate) {
+                std::string filename = sh.parameters.GetOneString("filename", "");
+                deformingMeshes->push_back({filename, sh.renderFromObject, sh.loc,
+                                            deformingMesh, meshAggregate});
+            };
+
             auto iter = shapeIndexToAreaLights.find(i);
+            if (compactMeshes) {
+                pstd::span<const Light> areaLights;
+                if (sh.lightIndex != -1 && iter != shapeIndexToAreaLights.end())
+                    areaLights = *iter->second;
+                if (TriangleMeshAggregate *meshAggregate = TriangleMeshAggregate::Create(
+                        shapes, mtl, areaLights, mi, alphaTex, accelerator.parameters)) {
+                    if (deformingMesh)
+                        addDeformingMesh(meshAggregate);
+                    primitives.push_back(meshAggregate);
+                    sh.parameters.FreeParameters();
+                    sh = ShapeSceneEntity();
+                    continue;
+                }
+            }
             for (size_t j = 0; j < shapes.size(); ++j) {
                 // Possibly create area light for shape
                 Light area = nullptr;
@@ -1435,6 +1508,8 @@ Primitive BasicScene::CreateAggregate(
                     primitives.push_back(
                         new GeometricPrimitive(shapes[j], mtl, area, mi, alphaTex));
             }
+            if (deformingMesh)
+                addDeformingMesh(nullptr);
             sh.parameters.FreeParameters();
             sh = ShapeSceneEntity();
         }
@@ -1442,7 +1517,8 @@ Primitive BasicScene::CreateAggregate(
     };
 
     LOG_VERBOSE("Starting shapes");
-    std::vector<Primitive> primitives = CreatePrimitivesForShapes(shapes);
+    std::vector<Primitive> primitives =
+        CreatePrimitivesForShapes(shapes, &deformingMeshes);
 
     shapes.clear();
     shapes.shrink_to_fit();
@@ -1509,10 +1585,19 @@ Primitive BasicScene::CreateAggregate(
         }
         return primitives;
     };
+    // Moving primitives are stored in a separate _MotionBVHAggregate_ so that
+    // their motion bounds don't degrade the BVH over the static geometry.
+    bool useMotionBVH = accelerator.parameters.GetOneBool("motionbvh", true);
+    auto AddMovingPrimitives = [&](std::vector<Primitive> &prims,
+                                   std::vector<Primitive> movingPrims) {
+        if (useMotionBVH && movingPrims.size() > 1)
+            prims.push_back(MotionBVHAggregate::Create(std::move(movingPrims),
+                                                       accelerator.parameters));
+        else
+            prims.insert(prims.end(), movingPrims.begin(), movingPrims.end());
+    };
     std::vector<Primitive> animatedPrimitives =
         CreatePrimitivesForAnimatedShapes(animatedShapes);
-    primitives.insert(primitives.end(), animatedPrimitives.begin(),
-                      animatedPrimitives.end());
 
     animatedShapes.clear();
     animatedShapes.shrink_to_fit();
@@ -1528,15 +1613,14 @@ Primitive BasicScene::CreateAggregate(
          iter != this->instanceDefinitions.end(); ++iter)
         instanceDefinitionIterators.push_back(iter);
     ParallelFor(0, instanceDefinitionIterators.size(), [&](int64_t i) {
+        TRACE_SCOPE("Create instance definition");
         auto &inst = *instanceDefinitionIterators[i];
 
         std::vector<Primitive> instancePrimitives =
-            CreatePrimitivesForShapes(inst.second->shapes);
+            CreatePrimitivesForShapes(inst.second->shapes, nullptr);
         std::vector<Primitive> movingInstancePrimitives =
             CreatePrimitivesForAnimatedShapes(inst.second->animatedShapes);
-        instancePrimitives.insert(instancePrimitives.end(),
-                                  movingInstancePrimitives.begin(),
-                                  movingInstancePrimitives.end());
+        AddMovingPrimitives(instancePrimitives, std::move(movingInstancePrimitives));
 
         if (instancePrimitives.size() > 1) {
             Primitive bvh = new BVHAggregate(std::move(instancePrimitives));
@@ -1557,6 +1641,11 @@ Primitive BasicScene::CreateAggregate(
     this->instanceDefinitions.clear();
 
     // Instances
+    // Non-animated instances with affine transformations are collected into
+    // a single _InstanceArrayAggregate_ unless that has been disabled.
+    std::vector<Primitive> instancePrototypes;
+    std::map<InternedString, int> prototypeIndices;
+    std::vector<InstanceArrayAggregate::Instance> arrayInstances;
     for (const auto &inst : instances) {
         auto iter = instanceDefinitions.find(inst.name);
         if (iter == instanceDefinitions.end())
@@ -1566,15 +1655,28 @@ Primitive BasicScene::CreateAggregate(
             // empty instance
             continue;
 
-        if (inst.renderFromInstance)
+        if (inst.inInstanceArray) {
+            auto [protoIter, inserted] =
+                prototypeIndices.insert({inst.name, int(instancePrototypes.size())});
+            if (inserted)
+                instancePrototypes.push_back(iter->second);
+            arrayInstances.push_back({inst.renderFromInstance, protoIter->second});
+        } else if (inst.renderFromInstance)
             primitives.push_back(
                 new TransformedPrimitive(iter->second, inst.renderFromInstance));
         else {
-            primitives.push_back(
+            animatedPrimitives.push_back(
                 new AnimatedPrimitive(iter->second, *inst.renderFromInstanceAnim));
             delete inst.renderFromInstanceAnim;
         }
     }
+    if (!arrayInstances.empty())
+        primitives.push_back(InstanceArrayAggregate::Create(
+            std::move(instancePrototypes), arrayInstances, accelerator.parameters));
+    for (const auto &inst : instances)
+        if (inst.inInstanceArray)
+            delete inst.renderFromInstance;
+    AddMovingPrimitives(primitives, std::move(animatedPrimitives));
 
     instances.clear();
     instances.shrink_to_fit();
@@ -1587,7 +1689,42 @@ Primitive BasicScene::CreateAggregate(
         aggregate = CreateAccelerator(accelerator.name, std::move(primitives),
                                       accelerator.parameters);
     LOG_VERBOSE("Finished top-level accelerator");
+
+    if (!deformingMeshes.empty()) {
+        deformingMeshAggregate = aggregate.CastOrNullptr<BVHAggregate>();
+        if (!deformingMeshAggregate)
+            ErrorExit(&accelerator.loc, "Deforming meshes are only supported with "
+                                        "the \"bvh\" accelerator.");
+    }
     return aggregate;
 }
 
+void BasicScene::UpdateDeformingMeshes(int frame) {
+    if (deformingMeshes.empty())
+        return;
+    TRACE_SCOPE("BasicScene::UpdateDeformingMeshes", "frame", frame);
+    // Reload deforming meshes' vertices and refit their BVHs
+    ParallelFor(0, deformingMeshes.size(), [&](int64_t i) {
+        const DeformingMesh &dm = deformingMeshes[i];
+        std::string filename = ResolveFilename(ExpandFrameNumber(dm.filename, frame));
+        TriQuadMesh plyMesh = TriQuadMesh::ReadPLY(filename);
+
+        // Make sure that the mesh's topology hasn't changed
+        const TriangleMesh *mesh = dm.mesh;
+        if (plyMesh.triIndices.size() != 3 * mesh->nTriangles ||
+            !plyMesh.quadIndices.empty() || plyMesh.p.size() != mesh->nVertices ||
+            !std::equal(plyMesh.triIndices.begin(), plyMesh.triIndices.end(),
+                        mesh->vertexIndices) ||
+            plyMesh.n.empty() != (mesh->n == nullptr))
+            ErrorExit(&dm.loc, "%s: mesh topology differs from the first frame's.",
+                      filename);
+
+        dm.mesh->UpdateVertices(*dm.renderFromObject, std::move(plyMesh.p),
+                                std::move(plyMesh.n), threadAllocators.Get());
+        if (dm.meshAggregate)
+            dm.meshAggregate->Refit(rebuildCostRatio);
+    });
+    deformingMeshAggregate->Refit(rebuildCostRatio);
+}
+
 }  // namespace pbrt
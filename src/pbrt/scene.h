@@ -202,10 +202,11 @@ struct InstanceSceneEntity {
         CHECK(this->renderFromInstanceAnim->IsAnimated());
     }
     InstanceSceneEntity(const std::string &n, FileLoc loc,
-                        const Transform *renderFromInstance)
+                        const Transform *renderFromInstance, bool inInstanceArray = false)
         : name(SceneEntity::internedStrings.Lookup(n)),
           loc(loc),
-          renderFromInstance(renderFromInstance) {}
+          renderFromInstance(renderFromInstance),
+          inInstanceArray(inInstanceArray) {}
 
     std::string ToString() const {
         return StringPrintf(
@@ -221,6 +222,9 @@ struct InstanceSceneEntity {
     FileLoc loc;
     AnimatedTransform *renderFromInstanceAnim = nullptr;
     const Transform *renderFromInstance = nullptr;
+    // Instances stored in an _InstanceArrayAggregate_ own their
+    // _renderFromInstance_, which is freed once the aggregate is built.
+    bool inInstanceArray = false;
 };
 
 // MaxTransforms Definition
@@ -326,6 +330,11 @@ class BasicScene {
 
     NamedTextures CreateTextures();
 
+    // Reloads the vertices of meshes that deform over a multi-frame sequence
+    // for the given frame and updates the aggregate created by
+    // CreateAggregate() for them.
+    void UpdateDeformingMeshes(int frame);
+
     // BasicScene Public Members
     SceneEntity integrator, accelerator;
     const RGBColorSpace *filmColorSpace;
@@ -376,6 +385,18 @@ class BasicScene {
 
     std::mutex shapeMutex, animatedShapeMutex;
     std::mutex instanceDefinitionMutex, instanceUseMutex;
+
+    // DeformingMesh Definition
+    struct DeformingMesh {
+        std::string filename;
+        const Transform *renderFromObject;
+        FileLoc loc;
+        TriangleMesh *mesh;
+        TriangleMeshAggregate *meshAggregate;
+    };
+    std::vector<DeformingMesh> deformingMeshes;
+    BVHAggregate *deformingMeshAggregate = nullptr;
+    Float rebuildCostRatio;
 };
 
 // BasicSceneBuilder Definition
@@ -494,6 +515,7 @@ class BasicSceneBuilder : public ParserTarget {
     std::map<std::string, TransformSet> namedCoordinateSystems;
     class Transform renderFromWorld;
     InternCache<class Transform> transformCache;
+    bool useInstanceArrays = false;
     std::vector<GraphicsState> pushedGraphicsStates;
     std::vector<std::pair<char, FileLoc>> pushStack;  // 'a': attribute, 'o': object
     struct ActiveInstanceDefinition {
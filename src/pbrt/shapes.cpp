@@ -272,6 +272,98 @@ pstd::optional<TriangleIntersection> IntersectTriangle(const Ray &ray, Float tMa
     return TriangleIntersection{b0, b1, b2, t};
 }
 
+pstd::optional<TriangleIntersection> IntersectTriangles(const WatertightRay &ray,
+                                                        Float tMax,
+                                                        const TrianglePacket &tris,
+                                                        int *lane) {
+    constexpr int Width = TrianglePacket::Width;
+    using Packet = FloatPacket<FloatPacketWidth(Width)>;
+    // Compute all triangles' edge function coefficients, determinants, and
+    // scaled hit distances in ray coordinate space
+    Float e[3][Width], det[Width], tScaled[Width];
+    const int k[3] = {ray.kx, ray.ky, ray.kz};
+    for (int j = 0; j < Width; j += Packet::Width) {
+        Packet x[3], y[3], z[3];
+        for (int v = 0; v < 3; ++v) {
+            // Translate, permute, and shear vertex _v_ of the triangles
+            x[v] = Packet::Load(&tris.p[v][k[0]][j]) - Packet(ray.o[k[0]]);
+            y[v] = Packet::Load(&tris.p[v][k[1]][j]) - Packet(ray.o[k[1]]);
+            z[v] = Packet::Load(&tris.p[v][k[2]][j]) - Packet(ray.o[k[2]]);
+            x[v] = x[v] + Packet(ray.Sx) * z[v];
+            y[v] = y[v] + Packet(ray.Sy) * z[v];
+            z[v] = z[v] * Packet(ray.Sz);
+        }
+        Packet e0 = DifferenceOfProducts(x[1], y[2], y[1], x[2]);
+        Packet e1 = DifferenceOfProducts(x[2], y[0], y[2], x[0]);
+        Packet e2 = DifferenceOfProducts(x[0], y[1], y[0], x[1]);
+        e0.Store(&e[0][j]);
+        e1.Store(&e[1][j]);
+        e2.Store(&e[2][j]);
+        (e0 + e1 + e2).Store(&det[j]);
+        (e0 * z[0] + e1 * z[1] + e2 * z[2]).Store(&tScaled[j]);
+    }
+
+    // Find the closest intersection with the triangles that pass the edge tests
+    pstd::optional<TriangleIntersection> closest;
+    for (int i = 0; i < Width; ++i) {
+        if (!(tris.validLanes & (1u << i)))
+            continue;
+        Float e0 = e[0][i], e1 = e[1][i], e2 = e[2][i];
+        if (sizeof(Float) == sizeof(float) && (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
+            // Use the scalar test for its double-precision fallback at edges
+            pstd::optional<TriangleIntersection> ti =
+                IntersectTriangle(Ray(ray.o, ray.d), tMax, tris.P(0, i), tris.P(1, i),
+                                  tris.P(2, i));
+            if (ti) {
+                closest = ti;
+                tMax = ti->t;
+                *lane = i;
+            }
+            continue;
+        }
+
+        // Perform triangle edge and determinant tests
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+            continue;
+        if (det[i] == 0)
+            continue;
+        if (det[i] < 0 && (tScaled[i] >= 0 || tScaled[i] < tMax * det[i]))
+            continue;
+        else if (det[i] > 0 && (tScaled[i] <= 0 || tScaled[i] > tMax * det[i]))
+            continue;
+
+        // Recompute the triangle's transformed vertices to bound the error in $t$
+        Vector3f pt[3];
+        for (int v = 0; v < 3; ++v) {
+            pt[v] = Permute(tris.P(v, i) - ray.o, {ray.kx, ray.ky, ray.kz});
+            pt[v].x += ray.Sx * pt[v].z;
+            pt[v].y += ray.Sy * pt[v].z;
+            pt[v].z *= ray.Sz;
+        }
+        Float maxXt = MaxComponentValue(Abs(Vector3f(pt[0].x, pt[1].x, pt[2].x)));
+        Float maxYt = MaxComponentValue(Abs(Vector3f(pt[0].y, pt[1].y, pt[2].y)));
+        Float maxZt = MaxComponentValue(Abs(Vector3f(pt[0].z, pt[1].z, pt[2].z)));
+
+        // Compute $t$ and reject it if it isn't conservatively greater than zero
+        Float invDet = 1 / det[i];
+        Float t = tScaled[i] * invDet;
+        Float deltaZ = gamma(3) * maxZt;
+        Float deltaX = gamma(5) * (maxXt + maxZt);
+        Float deltaY = gamma(5) * (maxYt + maxZt);
+        Float deltaE = 2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+        Float maxE = MaxComponentValue(Abs(Vector3f(e0, e1, e2)));
+        Float deltaT = 3 * (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+                       std::abs(invDet);
+        if (t <= deltaT)
+            continue;
+
+        closest = TriangleIntersection{e0 * invDet, e1 * invDet, e2 * invDet, t};
+        tMax = t;
+        *lane = i;
+    }
+    return closest;
+}
+
 // Triangle Method Definitions
 pstd::vector<Shape> Triangle::CreateTriangles(const TriangleMesh *mesh, Allocator alloc) {
     static std::mutex allMeshesLock;
@@ -445,6 +537,7 @@ STAT_MEMORY_COUNTER("Memory/Curves", curveBytes);
 STAT_PERCENT("Intersections/Ray-curve intersection tests", nCurveHits, nCurveTests);
 STAT_COUNTER("Geometry/Curves", nCurves);
 STAT_COUNTER("Geometry/Split curves", nSplitCurves);
+STAT_INT_DISTRIBUTION("Geometry/Curve split depth", curveSplitDepth);
 
 std::string ToString(CurveType type) {
     switch (type) {
@@ -495,6 +588,43 @@ std::string CurveCommon::ToString() const {
         reverseOrientation, transformSwapsHandedness);
 }
 
+// Returns the number of refinement steps after which a cubic Bezier segment
+// whose control points' second differences have magnitude at most _L0_ is
+// well approximated by a line for a curve with maximum width _width_.
+static int CurveRefinementDepth(Float L0, Float width) {
+    if (L0 == 0)
+        return 0;
+    Float eps = width * .05f;  // width / 20
+    // Compute log base 4 by dividing log2 in half.
+    int r0 = Log2Int(1.41421356237f * 6.f * L0 / (8.f * eps)) / 2;
+    return Clamp(r0, 0, 10);
+}
+
+// Returns the number of times to split the curve segment in half before
+// building the acceleration structure. Splitting until no further refinement
+// is needed at intersection time means that rays need only test the few
+// segments whose bounds they pass through, and splitting long segments gives
+// boxes that fit diagonal curves more tightly.
+static int CurveSplitDepth(pstd::span<const Point3f> cp, Float w0, Float w1,
+                           int maxSplitDepth) {
+    // Split enough that no refinement is needed for any ray direction; the
+    // full lengths of the second differences bound their components in any
+    // ray's coordinate system.
+    Float width = std::max(w0, w1);
+    Float L0 = 0;
+    for (int i = 0; i < 2; ++i)
+        L0 = std::max(L0, Length(Vector3f(cp[i]) - 2 * Vector3f(cp[i + 1]) +
+                                 Vector3f(cp[i + 2])));
+    int depth = CurveRefinementDepth(L0, width);
+
+    // Split segments that are long compared to their width
+    Float length = Distance(cp[0], cp[1]) + Distance(cp[1], cp[2]) +
+                   Distance(cp[2], cp[3]);
+    if (width > 0 && length > 16 * width)
+        depth = std::max(depth, Log2Int(length / (16 * width)) + 1);
+    return std::min(depth, maxSplitDepth);
+}
+
 pstd::vector<Shape> CreateCurve(const Transform *renderFromObject,
                                 const Transform *objectFromRender,
                                 bool reverseOrientation, pstd::span<const Point3f> c,
@@ -504,6 +634,7 @@ pstd::vector<Shape> CreateCurve(const Transform *renderFromObject,
     CurveCommon *common = alloc.new_object<CurveCommon>(
         c, w0, w1, type, norm, renderFromObject, objectFromRender, reverseOrientation);
 
+    curveSplitDepth << splitDepth;
     const int nSegments = 1 << splitDepth;
     pstd::vector<Shape> segments(nSegments, alloc);
     Curve *curves = alloc.allocate_object<Curve>(nSegments);
@@ -520,26 +651,38 @@ pstd::vector<Shape> CreateCurve(const Transform *renderFromObject,
 }
 
 // Curve Method Definitions
+Curve::Curve(const CurveCommon *common, Float uMin, Float uMax)
+    : common(common), uMin(uMin), uMax(uMax) {
+    // Compute and store control points for the curve segment
+    pstd::array<Point3f, 4> cp =
+        CubicBezierControlPoints(pstd::MakeConstSpan(common->cpObj), uMin, uMax);
+    for (int i = 0; i < 4; ++i)
+        for (int c = 0; c < 3; ++c)
+            cpObj[c][i] = cp[i][c];
+}
+
 Bounds3f Curve::Bounds() const {
-    pstd::span<const Point3f> cpSpan(common->cpObj);
-    Bounds3f objBounds = BoundCubicBezier(cpSpan, uMin, uMax);
-    // Expand _objBounds_ by maximum curve width over $u$ range
+    // Compute maximum curve width over $u$ range
     Float width[2] = {Lerp(uMin, common->width[0], common->width[1]),
                       Lerp(uMax, common->width[0], common->width[1])};
-    objBounds = Expand(objBounds, std::max(width[0], width[1]) * 0.5f);
+    Float maxWidth = std::max(width[0], width[1]);
 
-    return (*common->renderFromObject)(objBounds);
+    // Bound expanded control points individually in rendering space
+    Bounds3f bounds;
+    for (int i = 0; i < 4; ++i) {
+        Bounds3f cpBounds = Expand(Bounds3f(ControlPoint(i)), 0.5f * maxWidth);
+        bounds = Union(bounds, (*common->renderFromObject)(cpBounds));
+    }
+    return bounds;
 }
 
 Float Curve::Area() const {
-    pstd::array<Point3f, 4> cpObj =
-        CubicBezierControlPoints(pstd::MakeConstSpan(common->cpObj), uMin, uMax);
     Float width0 = Lerp(uMin, common->width[0], common->width[1]);
     Float width1 = Lerp(uMax, common->width[0], common->width[1]);
     Float avgWidth = (width0 + width1) * 0.5f;
     Float approxLength = 0.f;
     for (int i = 0; i < 3; ++i)
-        approxLength += Distance(cpObj[i], cpObj[i + 1]);
+        approxLength += Distance(ControlPoint(i), ControlPoint(i + 1));
     return approxLength * avgWidth;
 }
 
@@ -561,19 +704,33 @@ bool Curve::IntersectRay(const Ray &r, Float tMax,
     // Transform _Ray_ to curve's object space
     Ray ray = (*common->objectFromRender)(r);
 
-    // Get object-space control points for curve segment, _cpObj_
-    pstd::array<Point3f, 4> cpObj =
-        CubicBezierControlPoints(pstd::span<const Point3f>(common->cpObj), uMin, uMax);
-
     // Project curve control points to plane perpendicular to ray
-    Vector3f dx = Cross(ray.d, cpObj[3] - cpObj[0]);
+    Vector3f dx = Cross(ray.d, ControlPoint(3) - ControlPoint(0));
     if (LengthSquared(dx) == 0) {
         Vector3f dy;
         CoordinateSystem(ray.d, &dx, &dy);
     }
-    Transform rayFromObject = LookAt(ray.o, ray.o + ray.d, dx);
-    pstd::array<Point3f, 4> cp = {rayFromObject(cpObj[0]), rayFromObject(cpObj[1]),
-                                  rayFromObject(cpObj[2]), rayFromObject(cpObj[3])};
+    // Compute ray coordinate system axes as in LookAt()
+    Vector3f dir = Normalize(ray.d);
+    Vector3f right = Normalize(Cross(Normalize(dx), dir));
+    Vector3f up = Cross(dir, right);
+    Vector3f axes[3] = {right, up, dir};
+
+    // Transform control points to ray space, four coordinates at a time
+    using Packet = FloatPacket<FloatPacketWidth(4)>;
+    alignas(16) Float cpRay[3][4];
+    for (int i = 0; i < 4; i += Packet::Width) {
+        Packet px = Packet::Load(&cpObj[0][i]) - Packet(ray.o.x);
+        Packet py = Packet::Load(&cpObj[1][i]) - Packet(ray.o.y);
+        Packet pz = Packet::Load(&cpObj[2][i]) - Packet(ray.o.z);
+        for (int c = 0; c < 3; ++c)
+            FMA(Packet(axes[c].x), px,
+                FMA(Packet(axes[c].y), py, Packet(axes[c].z) * pz))
+                .Store(&cpRay[c][i]);
+    }
+    pstd::array<Point3f, 4> cp;
+    for (int i = 0; i < 4; ++i)
+        cp[i] = Point3f(cpRay[0][i], cpRay[1][i], cpRay[2][i]);
 
     // Test ray against bound of projected control points
     Float maxWidth = std::max(Lerp(uMin, common->width[0], common->width[1]),
@@ -591,18 +748,25 @@ bool Curve::IntersectRay(const Ray &r, Float tMax,
             L0, std::max(std::max(std::abs(cp[i].x - 2 * cp[i + 1].x + cp[i + 2].x),
                                   std::abs(cp[i].y - 2 * cp[i + 1].y + cp[i + 2].y)),
                          std::abs(cp[i].z - 2 * cp[i + 1].z + cp[i + 2].z)));
-    int maxDepth = 0;
-    if (L0 > 0) {
-        Float eps = std::max(common->width[0], common->width[1]) * .05f;  // width / 20
-        // Compute log base 4 by dividing log2 in half.
-        int r0 = Log2Int(1.41421356237f * 6.f * L0 / (8.f * eps)) / 2;
-        maxDepth = Clamp(r0, 0, 10);
-    }
+    int maxDepth =
+        CurveRefinementDepth(L0, std::max(common->width[0], common->width[1]));
 
     // Recursively test for ray--curve intersection
+    // The ray coordinate system is orthonormal, so its inverse is its transpose.
+    Vector3f o(ray.o);
+    // clang-format off
+    SquareMatrix<4> objectFromRay(right.x, up.x, dir.x, ray.o.x,
+                                  right.y, up.y, dir.y, ray.o.y,
+                                  right.z, up.z, dir.z, ray.o.z,
+                                  0,       0,    0,     1);
+    SquareMatrix<4> rayFromObject(right.x, right.y, right.z, -Dot(right, o),
+                                  up.x,    up.y,    up.z,    -Dot(up, o),
+                                  dir.x,   dir.y,   dir.z,   -Dot(dir, o),
+                                  0,       0,       0,       1);
+    // clang-format on
     pstd::span<const Point3f> cpSpan(cp);
-    return RecursiveIntersect(ray, tMax, cpSpan, Inverse(rayFromObject), uMin, uMax,
-                              maxDepth, si);
+    return RecursiveIntersect(ray, tMax, cpSpan, Transform(objectFromRay, rayFromObject),
+                              uMin, uMax, maxDepth, si);
 }
 
 bool Curve::RecursiveIntersect(const Ray &ray, Float tMax, pstd::span<const Point3f> cp,
@@ -844,9 +1008,11 @@ pstd::vector<Shape> Curve::Create(const Transform *renderFromObject,
         return {};
     }
 
+    // Curve segments are split adaptively unless a fixed split depth is given.
     // This is kind of a hack, but since we dice curves on the GPU we
     // really don't want to have them split here.
-    int sd = Options->useGPU ? 0 : parameters.GetOneInt("splitdepth", 3);
+    int sd = Options->useGPU ? 0 : parameters.GetOneInt("splitdepth", -1);
+    int maxSplitDepth = parameters.GetOneInt("maxsplitdepth", 5);
 
     if (type == CurveType::Ribbon && n.empty()) {
         Error(loc, "Must provide normals \"N\" at curve endpoints with ribbon "
@@ -893,11 +1059,12 @@ pstd::vector<Shape> Curve::Create(const Transform *renderFromObject,
         pstd::span<const Normal3f> nspan;
         if (!n.empty())
             nspan = pstd::MakeSpan(&n[seg], 2);
-        auto c =
-            CreateCurve(renderFromObject, objectFromRender, reverseOrientation,
-                        segCpBezier, Lerp(Float(seg) / Float(nSegments), width0, width1),
-                        Lerp(Float(seg + 1) / Float(nSegments), width0, width1), type,
-                        nspan, sd, alloc);
+        Float w0 = Lerp(Float(seg) / Float(nSegments), width0, width1);
+        Float w1 = Lerp(Float(seg + 1) / Float(nSegments), width0, width1);
+        int splitDepth =
+            sd >= 0 ? sd : CurveSplitDepth(segCpBezier, w0, w1, maxSplitDepth);
+        auto c = CreateCurve(renderFromObject, objectFromRender, reverseOrientation,
+                             segCpBezier, w0, w1, type, nspan, splitDepth, alloc);
         curves.insert(curves.end(), c.begin(), c.end());
     }
     return curves;
@@ -1416,7 +1583,10 @@ pstd::vector<Shape> Shape::Create(
                                                   parameters, loc, alloc);
         shapes = Triangle::CreateTriangles(mesh, alloc);
     } else if (name == "plymesh") {
-        std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+        std::string filename = parameters.GetOneString("filename", "");
+        if (Options->frame)
+            filename = ExpandFrameNumber(filename, *Options->frame);
+        filename = ResolveFilename(filename);
         TriQuadMesh plyMesh = TriQuadMesh::ReadPLY(filename);
 
         Float edgeLength = parameters.GetOneFloat("edgelength", 1.f);
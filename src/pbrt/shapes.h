@@ -14,6 +14,7 @@
 #include <pbrt/util/mesh.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/transform.h>
 #include <pbrt/util/vecmath.h>
 
@@ -829,6 +830,66 @@ pstd::optional<TriangleIntersection> IntersectTriangle(const Ray &ray, Float tMa
                                                        Point3f p0, Point3f p1,
                                                        Point3f p2);
 
+// WatertightRay Definition
+// Holds the permutation and shear that take a ray to the ray coordinate space
+// used by the watertight triangle test, so that they can be computed once
+// and reused for many triangles.
+struct WatertightRay {
+    // WatertightRay Public Methods
+    WatertightRay() = default;
+    PBRT_CPU_GPU
+    explicit WatertightRay(const Ray &ray) : o(ray.o), d(ray.d) {
+        kz = MaxComponentIndex(Abs(ray.d));
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        Vector3f dp = Permute(ray.d, {kx, ky, kz});
+        Sx = -dp.x / dp.z;
+        Sy = -dp.y / dp.z;
+        Sz = 1 / dp.z;
+    }
+
+    // WatertightRay Public Members
+    Point3f o;
+    Vector3f d;
+    int kx, ky, kz;
+    Float Sx, Sy, Sz;
+};
+
+// TrianglePacket Definition
+// Stores the vertex positions of up to _Width_ triangles in SoA form so that
+// IntersectTriangles() can test a ray against all of them at once.
+struct TrianglePacket {
+    // TrianglePacket Public Methods
+    void Set(int lane, Point3f p0, Point3f p1, Point3f p2) {
+        DCHECK(lane >= 0 && lane < Width);
+        Point3f pv[3] = {p0, p1, p2};
+        for (int v = 0; v < 3; ++v)
+            for (int c = 0; c < 3; ++c)
+                p[v][c][lane] = pv[v][c];
+        // Degenerate triangles are never intersected, so leave their lanes unset
+        if (LengthSquared(Cross(p2 - p0, p1 - p0)) > 0)
+            validLanes |= 1u << lane;
+        else
+            validLanes &= ~(1u << lane);
+    }
+    Point3f P(int vertex, int lane) const {
+        return Point3f(p[vertex][0][lane], p[vertex][1][lane], p[vertex][2][lane]);
+    }
+
+    // TrianglePacket Public Members
+    static constexpr int Width = MaxFloatPacketWidth == 8 ? 8 : 4;
+    // Vertex positions, indexed by vertex, coordinate, and then lane
+    alignas(32) Float p[3][3][Width] = {};
+    uint32_t validLanes = 0;
+};
+
+// Returns the closest intersection with the packet's triangles, setting
+// _*lane_ to the intersected triangle's lane.
+pstd::optional<TriangleIntersection> IntersectTriangles(const WatertightRay &ray,
+                                                        Float tMax,
+                                                        const TrianglePacket &tris,
+                                                        int *lane);
+
 // Triangle Definition
 class Triangle {
   public:
@@ -840,6 +901,11 @@ class Triangle {
 
     static void Init(Allocator alloc);
 
+    PBRT_CPU_GPU
+    const TriangleMesh *Mesh() const { return GetMesh(); }
+    PBRT_CPU_GPU
+    int TriangleIndex() const { return triIndex; }
+
     PBRT_CPU_GPU
     Bounds3f Bounds() const;
 
@@ -1244,8 +1310,7 @@ class Curve {
 
     std::string ToString() const;
 
-    Curve(const CurveCommon *common, Float uMin, Float uMax)
-        : common(common), uMin(uMin), uMax(uMax) {}
+    Curve(const CurveCommon *common, Float uMin, Float uMax);
 
     PBRT_CPU_GPU
     DirectionCone NormalBounds() const { return DirectionCone::EntireSphere(); }
@@ -1258,9 +1323,16 @@ class Curve {
                             const Transform &ObjectFromRay, Float u0, Float u1, int depth,
                             pstd::optional<ShapeIntersection> *si) const;
 
+    PBRT_CPU_GPU
+    Point3f ControlPoint(int i) const {
+        return Point3f(cpObj[0][i], cpObj[1][i], cpObj[2][i]);
+    }
+
     // Curve Private Members
     const CurveCommon *common;
     Float uMin, uMax;
+    // Segment's object-space control points, stored by coordinate
+    alignas(16) Float cpObj[3][4];
 };
 
 // BilinearPatch Declarations
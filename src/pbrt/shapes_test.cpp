@@ -13,9 +13,12 @@
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/splines.h>
 
+#include <array>
 #include <cmath>
 #include <functional>
+#include <vector>
 
 using namespace pbrt;
 
@@ -448,6 +451,235 @@ TEST(Triangle, BadCases) {
     EXPECT_FALSE(tris[0].Intersect(ray).has_value());
 }
 
+static Point3f RandomPoint(RNG &rng) {
+    return Point3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1));
+}
+
+TEST(Triangle, PacketMatchesScalar) {
+    RNG rng;
+    constexpr int Width = TrianglePacket::Width;
+    for (int i = 0; i < 100000; ++i) {
+        // Fill a packet with random triangles, leaving some lanes unused or
+        // degenerate
+        TrianglePacket packet;
+        std::vector<std::array<Point3f, 3>> tris;
+        int nTriangles = 1 + rng.Uniform<uint32_t>(Width);
+        for (int lane = 0; lane < nTriangles; ++lane) {
+            std::array<Point3f, 3> p = {RandomPoint(rng), RandomPoint(rng),
+                                        RandomPoint(rng)};
+            if (rng.Uniform<Float>() < .05f)
+                p[2] = p[1];
+            packet.Set(lane, p[0], p[1], p[2]);
+            tris.push_back(p);
+        }
+
+        Point3f o = 3 * RandomPoint(rng);
+        Ray ray(o, .5f * RandomPoint(rng) - o);
+        Float tMax = (i & 1) ? Infinity : 1.f;
+        pstd::optional<TriangleIntersection> closest;
+        int closestLane = -1;
+        for (int lane = 0; lane < nTriangles; ++lane) {
+            const std::array<Point3f, 3> &p = tris[lane];
+            Float t = closest ? closest->t : tMax;
+            if (pstd::optional<TriangleIntersection> ti =
+                    IntersectTriangle(ray, t, p[0], p[1], p[2])) {
+                closest = ti;
+                closestLane = lane;
+            }
+        }
+
+        int lane;
+        pstd::optional<TriangleIntersection> pti =
+            IntersectTriangles(WatertightRay(ray), tMax, packet, &lane);
+        ASSERT_EQ(closest.has_value(), pti.has_value()) << i;
+        if (!closest)
+            continue;
+        EXPECT_EQ(closestLane, lane);
+        EXPECT_LT(std::abs(closest->t - pti->t), 1e-3f * closest->t);
+        EXPECT_LT(std::abs(closest->b0 - pti->b0), 1e-3f);
+        EXPECT_LT(std::abs(closest->b1 - pti->b1), 1e-3f);
+    }
+}
+
+TEST(Triangle, PacketWatertight) {
+    // Triangulate a grid of random heights and store its triangles in packets
+    RNG rng;
+    constexpr int Width = TrianglePacket::Width;
+    constexpr int n = 4;
+    Point3f p[n + 1][n + 1];
+    for (int y = 0; y <= n; ++y)
+        for (int x = 0; x <= n; ++x)
+            p[y][x] = Point3f(x, y, .5f * rng.Uniform<Float>());
+    std::vector<TrianglePacket> packets(2 * n * n / Width);
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            int i = 2 * (y * n + x);
+            packets[i / Width].Set(i % Width, p[y][x], p[y][x + 1], p[y + 1][x + 1]);
+            packets[i / Width].Set(i % Width + 1, p[y][x], p[y + 1][x + 1], p[y + 1][x]);
+        }
+
+    // Rays aimed at interior vertices and edges must hit some triangle
+    for (int i = 0; i < 10000; ++i) {
+        int x = 1 + rng.Uniform<uint32_t>(n - 1), y = 1 + rng.Uniform<uint32_t>(n - 1);
+        Point3f target = p[y][x];
+        if (i & 1)
+            target = Lerp(rng.Uniform<Float>(), target,
+                          (i & 2) ? p[y][x + 1] : p[y + 1][x + 1]);
+        Point3f o(pUnif(rng, 5), pUnif(rng, 5), 10 + pUnif(rng, 5));
+        WatertightRay ray(Ray(o, target - o));
+        bool hit = false;
+        for (const TrianglePacket &packet : packets) {
+            int lane;
+            hit |= IntersectTriangles(ray, Infinity, packet, &lane).has_value();
+        }
+        EXPECT_TRUE(hit) << target;
+    }
+}
+
+// Returns a random similarity transformation
+static Transform RandomSimilarity(RNG &rng) {
+    Point2f u{rng.Uniform<Float>(), rng.Uniform<Float>()};
+    Float s = pExp(rng, 1);
+    return Translate(Vector3f(10 * RandomPoint(rng))) *
+           Rotate(360 * rng.Uniform<Float>(), SampleUniformSphere(u)) *
+           Scale(s, s, s);
+}
+
+// Returns a cubic Bezier curve with random control points and widths
+static CurveCommon *RandomCurve(RNG &rng, const Transform *renderFromObject,
+                                const Transform *objectFromRender) {
+    Point3f cp[4];
+    for (Point3f &p : cp)
+        p = RandomPoint(rng);
+    Float width0 = Lerp(rng.Uniform<Float>(), .01f, .2f);
+    Float width1 = Lerp(rng.Uniform<Float>(), .01f, .2f);
+    CurveType type = rng.Uniform<Float>() < .5f ? CurveType::Flat : CurveType::Cylinder;
+    return new CurveCommon(cp, width0, width1, type, {}, renderFromObject,
+                           objectFromRender, false);
+}
+
+TEST(Curve, SplitMatchesUnsplit) {
+    RNG rng;
+    int nMismatched = 0, nHits = 0, nRays = 0;
+    for (int i = 0; i < 500; ++i) {
+        Transform *renderFromObject = new Transform(RandomSimilarity(rng));
+        Transform *objectFromRender = new Transform(Inverse(*renderFromObject));
+        CurveCommon *common = RandomCurve(rng, renderFromObject, objectFromRender);
+        Curve curve(common, 0, 1);
+        std::vector<Curve> segments;
+        int nSegments = 1 << (1 + rng.Uniform<uint32_t>(5));
+        for (int j = 0; j < nSegments; ++j)
+            segments.push_back(Curve(common, Float(j) / nSegments,
+                                     Float(j + 1) / nSegments));
+
+        for (int j = 0; j < 200; ++j) {
+            // Aim ray close to a random point on the curve
+            Float u = rng.Uniform<Float>();
+            Point3f pCurve =
+                EvaluateCubicBezier(pstd::MakeConstSpan(common->cpObj), u) +
+                .1f * Vector3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1));
+            Point3f o = 4 * RandomPoint(rng);
+            Ray ray((*renderFromObject)(o), (*renderFromObject)(pCurve - o));
+            ++nRays;
+
+            pstd::optional<ShapeIntersection> si = curve.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> siSplit;
+            for (const Curve &seg : segments)
+                if (pstd::optional<ShapeIntersection> s = seg.Intersect(
+                        ray, siSplit ? siSplit->tHit : Infinity))
+                    siSplit = s;
+            EXPECT_EQ(si.has_value(), curve.IntersectP(ray, Infinity));
+
+            if (si)
+                ++nHits;
+            // Allow rays that graze the curve or hit it nearly edge-on to
+            // give different results
+            Float width = std::max(common->width[0], common->width[1]);
+            if (si.has_value() != siSplit.has_value() ||
+                (si && std::abs(si->tHit - siSplit->tHit) * Length(pCurve - o) > width))
+                ++nMismatched;
+        }
+    }
+    EXPECT_GT(nHits, nRays / 10);
+    EXPECT_LT(nMismatched, nRays / 100);
+}
+
+TEST(Curve, SegmentBounds) {
+    RNG rng;
+    for (int i = 0; i < 1000; ++i) {
+        Transform *renderFromObject = new Transform(RandomSimilarity(rng));
+        Transform *objectFromRender = new Transform(Inverse(*renderFromObject));
+        CurveCommon *common = RandomCurve(rng, renderFromObject, objectFromRender);
+        Float uMin = rng.Uniform<Float>(), uMax = rng.Uniform<Float>();
+        if (uMin > uMax)
+            pstd::swap(uMin, uMax);
+        Curve curve(common, uMin, uMax);
+
+        // Points on the curve segment must be inside its bounds
+        Bounds3f bounds = curve.Bounds();
+        for (int j = 0; j < 100; ++j) {
+            Float u = Lerp(rng.Uniform<Float>(), uMin, uMax);
+            Point3f p = (*renderFromObject)(
+                EvaluateCubicBezier(pstd::MakeConstSpan(common->cpObj), u));
+            EXPECT_TRUE(Inside(p, bounds)) << p << " " << bounds;
+        }
+    }
+}
+
+TEST(Curve, SplitSegmentsReduceTests) {
+    // Create hair-like curves that wander through the unit cube
+    RNG rng;
+    Transform *identity = new Transform;
+    std::vector<CurveCommon *> curves;
+    for (int i = 0; i < 1000; ++i) {
+        Point3f cp[4] = {RandomPoint(rng)};
+        Vector3f d = Normalize(Vector3f(RandomPoint(rng)));
+        for (int j = 1; j < 4; ++j) {
+            d = Normalize(d + .5f * Vector3f(RandomPoint(rng)));
+            cp[j] = cp[j - 1] + .1f * d;
+        }
+        curves.push_back(new CurveCommon(cp, .005f, .003f, CurveType::Cylinder, {},
+                                         identity, identity, false));
+    }
+    // Aim rays near points on the curves
+    std::vector<Ray> rays(2000);
+    for (Ray &ray : rays) {
+        const CurveCommon *common = curves[rng.Uniform<uint32_t>(curves.size())];
+        Point3f p = EvaluateCubicBezier(pstd::MakeConstSpan(common->cpObj),
+                                        rng.Uniform<Float>()) +
+                    .01f * Vector3f(RandomPoint(rng));
+        Point3f o = 3 * RandomPoint(rng);
+        ray = Ray(o, p - o);
+    }
+
+    // Count the segments whose bounds rays pass through, as a BVH would test
+    // them, and the hits among them
+    auto countTests = [&](int splitDepth, int *nHits) {
+        int nTests = 0, nSegments = 1 << splitDepth;
+        *nHits = 0;
+        for (CurveCommon *common : curves)
+            for (int i = 0; i < nSegments; ++i) {
+                Curve segment(common, Float(i) / nSegments, Float(i + 1) / nSegments);
+                Bounds3f bounds = segment.Bounds();
+                for (const Ray &ray : rays)
+                    if (bounds.IntersectP(ray.o, ray.d)) {
+                        ++nTests;
+                        *nHits += segment.IntersectP(ray, Infinity);
+                    }
+            }
+        return nTests;
+    };
+    // Pre-split segments' tighter bounds should cut the number of tests
+    // while finding the same hits, up to rays that graze the curves or hit
+    // adjacent segments at their shared endpoint
+    int nWholeHits, nSplitHits;
+    int nWholeTests = countTests(0, &nWholeHits);
+    int nSplitTests = countTests(3, &nSplitHits);
+    EXPECT_GT(nWholeHits, int(rays.size()) / 4);
+    EXPECT_LT(nSplitTests, nWholeTests / 2);
+    EXPECT_LE(std::abs(nSplitHits - nWholeHits), nWholeHits / 50);
+}
+
 TEST(BilinearPatch, Offset) {
     RNG rng;
     for (int i = 0; i < 100; ++i) {
@@ -0,0 +1,77 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_TESTUTIL_H
+#define PBRT_TESTUTIL_H
+
+// Helpers shared by the pbrt_test unit tests.
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/options.h>
+#include <pbrt/util/file.h>
+
+#include <string>
+
+#ifndef PBRT_IS_WINDOWS
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+namespace pbrt {
+
+#ifndef PBRT_IS_WINDOWS
+// TestDirectory Definition
+// Creates a temporary directory that is removed, along with any files written
+// to it, when the TestDirectory goes out of scope.
+class TestDirectory {
+  public:
+    TestDirectory() {
+        char name[] = "/tmp/pbrt_test_XXXXXX";
+        if (mkdtemp(name))
+            path = name;
+    }
+    ~TestDirectory() {
+        if (path.empty())
+            return;
+        if (DIR *dir = opendir(path.c_str())) {
+            while (struct dirent *ent = readdir(dir))
+                if (ent->d_type == DT_REG)
+                    RemoveFile(Path(ent->d_name));
+            closedir(dir);
+        }
+        rmdir(path.c_str());
+    }
+
+    TestDirectory(const TestDirectory &) = delete;
+    TestDirectory &operator=(const TestDirectory &) = delete;
+
+    bool Valid() const { return !path.empty(); }
+    const std::string &Name() const { return path; }
+    std::string Path(const std::string &filename) const { return path + "/" + filename; }
+
+  private:
+    std::string path;
+};
+#endif  // !PBRT_IS_WINDOWS
+
+// OptionsRestorer Definition
+// Saves the global PBRTOptions and restores them when it goes out of scope,
+// so that tests can modify *Options however they exit.
+class OptionsRestorer {
+  public:
+    OptionsRestorer() : saved(*Options) {}
+    ~OptionsRestorer() { *Options = saved; }
+
+    OptionsRestorer(const OptionsRestorer &) = delete;
+    OptionsRestorer &operator=(const OptionsRestorer &) = delete;
+
+  private:
+    PBRTOptions saved;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_TESTUTIL_H
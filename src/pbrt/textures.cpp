@@ -361,6 +361,25 @@ SampledSpectrum SpectrumImageTexture::Evaluate(TextureEvalContext ctx,
     TexCoord2D c = mapping.Map(ctx);
     c.st[1] = 1 - c.st[1];
 
+    // Evaluate spectrum using precomputed sigmoid coefficients if possible
+    // Albedo coefficients were fit to unscaled texels; unbounded ones are
+    // invariant to positive scale factors.
+    if (coefficients && !invert &&
+        (spectrumType == SpectrumType::Albedo ? scale == 1 : scale > 0)) {
+        Float texelScale;
+        RGBSigmoidPolynomial rsp = coefficients->Filter(
+            c.st, {c.dsdx, c.dtdx}, {c.dsdy, c.dtdy}, &texelScale);
+        SampledSpectrum s;
+        for (int i = 0; i < NSpectrumSamples; ++i)
+            s[i] = rsp(lambda[i]);
+        if (spectrumType == SpectrumType::Albedo)
+            return s;
+        s *= scale * texelScale;
+        if (spectrumType == SpectrumType::Illuminant)
+            s *= mipmap->GetRGBColorSpace()->illuminant.Sample(lambda);
+        return s;
+    }
+
     // Lookup filtered RGB value in _MIPMap_
     RGB rgb = scale * mipmap->Filter<RGB>(c.st, {c.dsdx, c.dtdx}, {c.dsdy, c.dtdy});
     rgb = ClampZero(invert ? (RGB(1, 1, 1) - rgb) : rgb);
@@ -383,8 +402,9 @@ SampledSpectrum SpectrumImageTexture::Evaluate(TextureEvalContext ctx,
 
 std::string SpectrumImageTexture::ToString() const {
     return StringPrintf("[ SpectrumImageTexture filename: %s mapping: %s scale: %f "
-                        "invert: %s mipmap: %s ]",
-                        filename, mapping, scale, invert, *mipmap);
+                        "invert: %s mipmap: %s precomputedSpectra: %s ]",
+                        filename, mapping, scale, invert, *mipmap,
+                        coefficients != nullptr);
 }
 
 std::string FloatImageTexture::ToString() const {
@@ -401,6 +421,23 @@ std::string TexInfo::ToString() const {
 
 std::mutex ImageTextureBase::textureCacheMutex;
 std::map<TexInfo, MIPMap *> ImageTextureBase::textureCache;
+std::map<std::pair<const MIPMap *, bool>, RGBCoefficientMIPMap *>
+    ImageTextureBase::coefficientCache;
+
+const RGBCoefficientMIPMap *ImageTextureBase::GetRGBCoefficients(bool unbounded,
+                                                                 Allocator alloc) {
+    // Return cached coefficients for _mipmap_ if they have already been computed
+    std::pair<const MIPMap *, bool> key(mipmap, unbounded);
+    std::lock_guard<std::mutex> lock(textureCacheMutex);
+    if (auto iter = coefficientCache.find(key); iter != coefficientCache.end())
+        return iter->second;
+
+    // Convert _mipmap_'s texels to sigmoid polynomial coefficients
+    RGBCoefficientMIPMap *coeffs =
+        alloc.new_object<RGBCoefficientMIPMap>(*mipmap, unbounded, alloc);
+    coefficientCache[key] = coeffs;
+    return coeffs;
+}
 
 FloatImageTexture *FloatImageTexture::Create(const Transform &renderFromTexture,
                                              const TextureParameterDictionary &parameters,
@@ -465,10 +502,11 @@ SpectrumImageTexture *SpectrumImageTexture::Create(
     const char *defaultEncoding = HasExtension(filename, "png") ? "sRGB" : "linear";
     std::string encodingString = parameters.GetOneString("encoding", defaultEncoding);
     ColorEncoding encoding = ColorEncoding::Get(encodingString, alloc);
+    bool precomputeSpectra = parameters.GetOneBool("precomputespectra", false);
 
     return alloc.new_object<SpectrumImageTexture>(map, filename, filterOptions, *wrapMode,
                                                   scale, invert, encoding, spectrumType,
-                                                  alloc);
+                                                  precomputeSpectra, alloc);
 }
 
 // MarbleTexture Method Definitions
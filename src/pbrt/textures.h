@@ -549,11 +549,17 @@ class ImageTextureBase {
         textureCache[texInfo] = mipmap;
     }
 
-    static void ClearCache() { textureCache.clear(); }
+    static void ClearCache() {
+        textureCache.clear();
+        coefficientCache.clear();
+    }
 
     void MultiplyScale(Float s) { scale *= s; }
 
   protected:
+    // ImageTextureBase Protected Methods
+    const RGBCoefficientMIPMap *GetRGBCoefficients(bool unbounded, Allocator alloc);
+
     // ImageTextureBase Protected Members
     TextureMapping2D mapping;
     std::string filename;
@@ -565,6 +571,8 @@ class ImageTextureBase {
     // ImageTextureBase Private Members
     static std::mutex textureCacheMutex;
     static std::map<TexInfo, MIPMap *> textureCache;
+    static std::map<std::pair<const MIPMap *, bool>, RGBCoefficientMIPMap *>
+        coefficientCache;
 };
 
 // FloatImageTexture Definition
@@ -604,10 +612,15 @@ class SpectrumImageTexture : public ImageTextureBase {
     SpectrumImageTexture(TextureMapping2D mapping, std::string filename,
                          MIPMapFilterOptions filterOptions, WrapMode wrapMode,
                          Float scale, bool invert, ColorEncoding encoding,
-                         SpectrumType spectrumType, Allocator alloc)
+                         SpectrumType spectrumType, bool precomputeSpectra,
+                         Allocator alloc)
         : ImageTextureBase(mapping, filename, filterOptions, wrapMode, scale, invert,
                            encoding, alloc),
-          spectrumType(spectrumType) {}
+          spectrumType(spectrumType) {
+        if (precomputeSpectra && mipmap->GetRGBColorSpace())
+            coefficients =
+                GetRGBCoefficients(spectrumType != SpectrumType::Albedo, alloc);
+    }
 
     PBRT_CPU_GPU
     SampledSpectrum Evaluate(TextureEvalContext ctx, SampledWavelengths lambda) const;
@@ -622,6 +635,7 @@ class SpectrumImageTexture : public ImageTextureBase {
   private:
     // SpectrumImageTexture Private Members
     SpectrumType spectrumType;
+    const RGBCoefficientMIPMap *coefficients = nullptr;
 };
 
 #if defined(PBRT_BUILD_GPU_RENDERER) && defined(__NVCC__)
@@ -351,6 +351,9 @@ class RGBSigmoidPolynomial {
         return result;
     }
 
+    PBRT_CPU_GPU
+    pstd::array<Float, 3> Coefficients() const { return {c0, c1, c2}; }
+
   private:
     // RGBSigmoidPolynomial Private Methods
     PBRT_CPU_GPU
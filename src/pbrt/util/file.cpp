@@ -27,6 +27,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 #endif
+#ifdef PBRT_HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <new>
 
 namespace pbrt {
 
@@ -66,6 +70,19 @@ std::string RemoveExtension(std::string filename) {
     return f;
 }
 
+std::string ExpandFrameNumber(std::string filename, int frame) {
+    size_t end = filename.find_last_of('#');
+    if (end == std::string::npos)
+        return filename;
+    size_t start = end;
+    while (start > 0 && filename[start - 1] == '#')
+        --start;
+    std::string number = std::to_string(frame);
+    if (number.size() < end - start + 1)
+        number.insert(0, end - start + 1 - number.size(), '0');
+    return filename.replace(start, end - start + 1, number);
+}
+
 std::string ResolveFilename(std::string filename) {
     if (searchDirectory.empty() || filename.empty() || IsAbsolutePath(filename))
         return filename;
@@ -121,6 +138,42 @@ bool RemoveFile(std::string filename) {
 #endif
 }
 
+void *MapFile(std::string filename, size_t *length) {
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat stat;
+    if (fstat(fd, &stat) != 0 || stat.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    *length = stat.st_size;
+    void *ptr = mmap(nullptr, *length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+#else
+    if (!FileExists(filename))
+        return nullptr;
+    std::string contents = ReadFileContents(filename);
+    if (contents.empty())
+        return nullptr;
+    // Match the page alignment of memory-mapped files
+    *length = contents.size();
+    void *ptr = ::operator new(*length, std::align_val_t(4096));
+    std::memcpy(ptr, contents.data(), *length);
+    return ptr;
+#endif
+}
+
+void UnmapFile(void *ptr, size_t length) {
+#ifdef PBRT_HAVE_MMAP
+    munmap(ptr, length);
+#else
+    ::operator delete(ptr, std::align_val_t(4096));
+#endif
+}
+
 std::string ReadFileContents(std::string filename) {
 #ifdef PBRT_IS_WINDOWS
     std::ifstream ifs(WStringFromUTF8(filename).c_str(), std::ios::binary);
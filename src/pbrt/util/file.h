@@ -24,11 +24,20 @@ std::vector<Float> ReadFloatFile(std::string filename);
 bool FileExists(std::string filename);
 bool RemoveFile(std::string filename);
 
+// Returns a private, copy-on-write mapping of the file's contents or nullptr
+// if it can't be read. Where memory-mapped files aren't supported, the file
+// is read into allocated memory instead.
+void *MapFile(std::string filename, size_t *length);
+void UnmapFile(void *ptr, size_t length);
+
 std::string ResolveFilename(std::string filename);
 void SetSearchDirectory(std::string filename);
 
 bool HasExtension(std::string filename, std::string ext);
 std::string RemoveExtension(std::string filename);
+// Replaces the last run of '#' characters in _filename_ with _frame_,
+// zero-padded to the length of the run.
+std::string ExpandFrameNumber(std::string filename, int frame);
 
 std::vector<std::string> MatchingFilenames(std::string filename);
 
@@ -28,6 +28,13 @@ TEST(File, RemoveExtension) {
     EXPECT_EQ(RemoveExtension("foo.exr.png"), "foo.exr");
 }
 
+TEST(File, ExpandFrameNumber) {
+    EXPECT_EQ(ExpandFrameNumber("foo_####.ply", 7), "foo_0007.ply");
+    EXPECT_EQ(ExpandFrameNumber("foo_#.ply", 123), "foo_123.ply");
+    EXPECT_EQ(ExpandFrameNumber("##/foo.##.exr", 5), "##/foo.05.exr");
+    EXPECT_EQ(ExpandFrameNumber("foo.ply", 5), "foo.ply");
+}
+
 TEST(File, ReadWriteFile) {
     std::string fn = inTestDir("readwrite.txt");
     std::string str = "this is a test.";
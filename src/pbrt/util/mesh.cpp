@@ -76,6 +76,31 @@ TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrient
     CHECK_LE(indices.size(), std::numeric_limits<int>::max());
 }
 
+void TriangleMesh::UpdateVertices(const Transform &renderFromObject,
+                                  std::vector<Point3f> p, std::vector<Normal3f> n,
+                                  Allocator alloc) {
+    CHECK_EQ(nVertices, p.size());
+    if (!updatedP) {
+        updatedP = alloc.allocate_object<Point3f>(nVertices);
+        triangleBytes += nVertices * sizeof(Point3f);
+    }
+    for (int i = 0; i < nVertices; ++i)
+        updatedP[i] = renderFromObject(p[i]);
+    this->p = updatedP;
+
+    if (!n.empty()) {
+        CHECK_EQ(nVertices, n.size());
+        if (!updatedN) {
+            updatedN = alloc.allocate_object<Normal3f>(nVertices);
+            triangleBytes += nVertices * sizeof(Normal3f);
+        }
+        for (int i = 0; i < nVertices; ++i)
+            updatedN[i] = reverseOrientation ? -renderFromObject(n[i])
+                                             : renderFromObject(n[i]);
+        this->n = updatedN;
+    }
+}
+
 std::string TriangleMesh::ToString() const {
     std::string np = "(nullptr)";
     return StringPrintf(
@@ -33,6 +33,13 @@ class TriangleMesh {
 
     bool WritePLY(std::string filename) const;
 
+    // Replaces the mesh's vertex positions and, if provided, normals with new
+    // object-space values, as for a mesh that deforms over an animation.
+    // They are stored in buffers that belong to the mesh rather than in the
+    // shared buffer caches, so other meshes are unaffected.
+    void UpdateVertices(const Transform &renderFromObject, std::vector<Point3f> p,
+                        std::vector<Normal3f> n, Allocator alloc);
+
     static void Init(Allocator alloc);
 
     // TriangleMesh Public Members
@@ -44,6 +51,9 @@ class TriangleMesh {
     const Point2f *uv = nullptr;
     const int *faceIndices = nullptr;
     bool reverseOrientation, transformSwapsHandedness;
+    // Vertex buffers allocated by the first call to UpdateVertices()
+    Point3f *updatedP = nullptr;
+    Normal3f *updatedN = nullptr;
 };
 
 // BilinearPatchMesh Definition
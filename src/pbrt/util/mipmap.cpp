@@ -12,6 +12,7 @@
 #include <pbrt/util/file.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
 
@@ -205,6 +206,18 @@ MIPMap::MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
                   [](const Image &im) { imageMapBytes += im.BytesUsed(); });
 }
 
+MIPMap::MIPMap(pstd::vector<Image> pyramid, const RGBColorSpace *colorSpace,
+               WrapMode wrapMode, const MIPMapFilterOptions &options)
+    : pyramid(std::move(pyramid)),
+      colorSpace(colorSpace),
+      wrapMode(wrapMode),
+      options(options) {
+    CHECK(colorSpace);
+    CHECK(!this->pyramid.empty());
+    std::for_each(this->pyramid.begin(), this->pyramid.end(),
+                  [](const Image &im) { imageMapBytes += im.BytesUsed(); });
+}
+
 template <>
 Float MIPMap::Texel(int level, Point2i st) const {
     DCHECK(level >= 0 && level < pyramid.size());
@@ -227,6 +240,7 @@ RGB MIPMap::Texel(int level, Point2i st) const {
 
 template <typename T>
 T MIPMap::Filter(Point2f st, Vector2f dst0, Vector2f dst1) const {
+    ProfilerScope _(ProfilePhase::TextureFiltering);
     if (options.filter != FilterFunction::EWA) {
         // Handle non-EWA MIP Map filter
         Float width = 2 * std::max({std::abs(dst0[0]), std::abs(dst0[1]),
@@ -414,6 +428,79 @@ std::string MIPMap::ToString() const {
                         pyramid, colorSpace->ToString(), wrapMode, options);
 }
 
+// RGBCoefficientMIPMap Helper Functions
+static RGB TexelRGB(const Image &image, Point2i p) {
+    if (image.NChannels() == 1) {
+        Float v = image.GetChannel(p, 0);
+        return RGB(v, v, v);
+    }
+    return RGB(image.GetChannel(p, 0), image.GetChannel(p, 1), image.GetChannel(p, 2));
+}
+
+static pstd::vector<Image> RGBCoefficientPyramid(const MIPMap &mipmap, bool unbounded,
+                                                 Allocator alloc) {
+    const RGBColorSpace &cs = *mipmap.GetRGBColorSpace();
+    pstd::vector<Image> pyramid(alloc);
+    for (int level = 0; level < mipmap.Levels(); ++level) {
+        const Image &image = mipmap.GetLevel(level);
+        Point2i res = image.Resolution();
+        Image coeffs(PixelFormat::Float, res, {"c0", "c1", "c2"}, nullptr, alloc);
+        ParallelFor(0, res.y, [&](int64_t y0, int64_t y1) {
+            for (int y = y0; y < y1; ++y)
+                for (int x = 0; x < res.x; ++x) {
+                    // Convert texel to the RGB value that the spectrum is fit to
+                    RGB rgb = ClampZero(TexelRGB(image, {x, y}));
+                    if (unbounded) {
+                        Float m = std::max({rgb.r, rgb.g, rgb.b});
+                        rgb = m > 0 ? rgb / (2 * m) : RGB(0, 0, 0);
+                    } else
+                        rgb = Clamp(rgb, 0, 1);
+
+                    // Store sigmoid polynomial coefficients for texel
+                    pstd::array<Float, 3> c = cs.ToRGBCoeffs(rgb).Coefficients();
+                    // Uniform black and white texels have infinite constant
+                    // terms; clamp them so that they can be filtered.
+                    if (c[0] == 0 && c[1] == 0)
+                        c[2] = Clamp(c[2], -64, 64);
+                    for (int i = 0; i < 3; ++i)
+                        coeffs.SetChannel({x, y}, i, c[i]);
+                }
+        });
+        pyramid.push_back(std::move(coeffs));
+    }
+    return pyramid;
+}
+
+// RGBCoefficientMIPMap Method Definitions
+RGBCoefficientMIPMap::RGBCoefficientMIPMap(const MIPMap &mipmap, bool unbounded,
+                                           Allocator alloc)
+    : coefficients(RGBCoefficientPyramid(mipmap, unbounded, alloc),
+                   mipmap.GetRGBColorSpace(), mipmap.GetWrapMode(),
+                   mipmap.GetFilterOptions()) {
+    if (!unbounded)
+        return;
+    // Compute per-texel scale factors for unbounded spectra
+    pstd::vector<Image> scalePyramid(alloc);
+    for (int level = 0; level < mipmap.Levels(); ++level) {
+        const Image &image = mipmap.GetLevel(level);
+        Point2i res = image.Resolution();
+        Image scale(PixelFormat::Float, res, {"Y"}, nullptr, alloc);
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x) {
+                RGB rgb = ClampZero(TexelRGB(image, {x, y}));
+                scale.SetChannel({x, y}, 0, 2 * std::max({rgb.r, rgb.g, rgb.b}));
+            }
+        scalePyramid.push_back(std::move(scale));
+    }
+    scales = MIPMap(std::move(scalePyramid), mipmap.GetRGBColorSpace(),
+                    mipmap.GetWrapMode(), mipmap.GetFilterOptions());
+}
+
+std::string RGBCoefficientMIPMap::ToString() const {
+    return StringPrintf("[ RGBCoefficientMIPMap coefficients: %s scales: %s ]",
+                        coefficients, scales ? scales->ToString() : "(nullopt)");
+}
+
 // Explicit template instantiation..
 template Float MIPMap::Filter(Point2f st, Vector2f, Vector2f) const;
 template RGB MIPMap::Filter(Point2f st, Vector2f, Vector2f) const;
@@ -7,6 +7,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/color.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/vecmath.h>
@@ -51,6 +52,8 @@ class MIPMap {
     // MIPMap Public Methods
     MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
            Allocator alloc, const MIPMapFilterOptions &options);
+    MIPMap(pstd::vector<Image> pyramid, const RGBColorSpace *colorSpace,
+           WrapMode wrapMode, const MIPMapFilterOptions &options);
     static MIPMap *CreateFromFile(const std::string &filename,
                                   const MIPMapFilterOptions &options, WrapMode wrapMode,
                                   ColorEncoding encoding, Allocator alloc);
@@ -67,6 +70,8 @@ class MIPMap {
     int Levels() const { return int(pyramid.size()); }
     const RGBColorSpace *GetRGBColorSpace() const { return colorSpace; }
     const Image &GetLevel(int level) const { return pyramid[level]; }
+    WrapMode GetWrapMode() const { return wrapMode; }
+    const MIPMapFilterOptions &GetFilterOptions() const { return options; }
 
   private:
     // MIPMap Private Methods
@@ -84,6 +89,29 @@ class MIPMap {
     MIPMapFilterOptions options;
 };
 
+// RGBCoefficientMIPMap Definition
+class RGBCoefficientMIPMap {
+  public:
+    // RGBCoefficientMIPMap Public Methods
+    RGBCoefficientMIPMap(const MIPMap &mipmap, bool unbounded, Allocator alloc);
+
+    bool Unbounded() const { return scales.has_value(); }
+
+    RGBSigmoidPolynomial Filter(Point2f st, Vector2f dst0, Vector2f dst1,
+                                Float *scale) const {
+        RGB c = coefficients.Filter<RGB>(st, dst0, dst1);
+        *scale = scales ? scales->Filter<Float>(st, dst0, dst1) : 1;
+        return RGBSigmoidPolynomial(c.r, c.g, c.b);
+    }
+
+    std::string ToString() const;
+
+  private:
+    // RGBCoefficientMIPMap Private Members
+    MIPMap coefficients;
+    pstd::optional<MIPMap> scales;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_MIPMAP_H
@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/util/math.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/util/vecmath.h>
@@ -159,6 +160,36 @@ class TrowbridgeReitzDistribution {
     PBRT_CPU_GPU
     Float PDF(Vector3f w, Vector3f wm) const { return D(w, wm); }
 
+    // Packet versions of $D$ and $\Lambda$ take directions as separate $x$, $y$,
+    // and $z$ components; they avoid the scalar versions' trigonometric terms so
+    // that they are branch free.
+    template <int N>
+    PBRT_CPU_GPU FloatPacket<N> D(FloatPacket<N> x, FloatPacket<N> y,
+                                  FloatPacket<N> z) const {
+        using P = FloatPacket<N>;
+        // $\cos^4\theta\,(1 + e)^2$ simplifies to the square of _s_ for unit _wm_
+        P s = FMA(x * x, P(1 / Sqr(alpha_x)), FMA(y * y, P(1 / Sqr(alpha_y)), z * z));
+        return P(1.f) / (P(Pi * alpha_x * alpha_y) * s * s);
+    }
+
+    template <int N>
+    PBRT_CPU_GPU FloatPacket<N> Lambda(FloatPacket<N> x, FloatPacket<N> y,
+                                       FloatPacket<N> z) const {
+        using P = FloatPacket<N>;
+        // Directions with $\cos\theta=0$ get $\Lambda=0$, as in the scalar case
+        P a = FMA(x * x, P(Sqr(alpha_x)), y * y * P(Sqr(alpha_y)));
+        P alpha2Tan2Theta = SafeDiv(a, z * z);
+        return (Sqrt(P(1.f) + alpha2Tan2Theta) - P(1.f)) * P(0.5f);
+    }
+
+    template <int N>
+    PBRT_CPU_GPU FloatPacket<N> PDF(Vector3f w, FloatPacket<N> x, FloatPacket<N> y,
+                                    FloatPacket<N> z) const {
+        using P = FloatPacket<N>;
+        P cosTheta_m = FMA(P(w.x), x, FMA(P(w.y), y, P(w.z) * z));
+        return P(G1(w) / AbsCosTheta(w)) * D(x, y, z) * Abs(cosTheta_m);
+    }
+
     PBRT_CPU_GPU
     Vector3f Sample_wm(Vector3f w, Point2f u) const {
         // Transform _w_ to hemispherical configuration
@@ -0,0 +1,221 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_SIMD_H
+#define PBRT_UTIL_SIMD_H
+
+#include <pbrt/pbrt.h>
+
+#include <algorithm>
+#include <cmath>
+
+// SIMD instruction sets are only used for single-precision CPU code
+#if !defined(__CUDACC__) && !defined(PBRT_FLOAT_AS_DOUBLE) && !defined(PBRT_DISABLE_SIMD)
+#if defined(__AVX__)
+#define PBRT_HAVE_AVX
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define PBRT_HAVE_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define PBRT_HAVE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace pbrt {
+
+// FloatPacket Definition
+template <int N>
+struct FloatPacket;
+
+#if defined(PBRT_HAVE_AVX)
+static constexpr int MaxFloatPacketWidth = 8;
+#elif defined(PBRT_HAVE_SSE) || defined(PBRT_HAVE_NEON)
+static constexpr int MaxFloatPacketWidth = 4;
+#else
+static constexpr int MaxFloatPacketWidth = 1;
+#endif
+
+template <>
+struct FloatPacket<1> {
+    // FloatPacket<1> Public Methods
+    static constexpr int Width = 1;
+    FloatPacket() = default;
+    PBRT_CPU_GPU
+    explicit FloatPacket(Float v) : v(v) {}
+
+    PBRT_CPU_GPU
+    static FloatPacket Load(const Float *p) { return FloatPacket(*p); }
+    PBRT_CPU_GPU
+    void Store(Float *p) const { *p = v; }
+
+    PBRT_CPU_GPU
+    FloatPacket operator-() const { return FloatPacket(-v); }
+    PBRT_CPU_GPU
+    FloatPacket operator+(FloatPacket b) const { return FloatPacket(v + b.v); }
+    PBRT_CPU_GPU
+    FloatPacket operator-(FloatPacket b) const { return FloatPacket(v - b.v); }
+    PBRT_CPU_GPU
+    FloatPacket operator*(FloatPacket b) const { return FloatPacket(v * b.v); }
+    PBRT_CPU_GPU
+    FloatPacket operator/(FloatPacket b) const { return FloatPacket(v / b.v); }
+
+    PBRT_CPU_GPU
+    friend FloatPacket Min(FloatPacket a, FloatPacket b) {
+        return FloatPacket(a.v < b.v ? a.v : b.v);
+    }
+    PBRT_CPU_GPU
+    friend FloatPacket Max(FloatPacket a, FloatPacket b) {
+        return FloatPacket(a.v > b.v ? a.v : b.v);
+    }
+    PBRT_CPU_GPU
+    friend FloatPacket Sqrt(FloatPacket a) { return FloatPacket(std::sqrt(a.v)); }
+    PBRT_CPU_GPU
+    friend FloatPacket SafeDiv(FloatPacket a, FloatPacket b) {
+        return FloatPacket(b.v != 0 ? a.v / b.v : 0);
+    }
+    PBRT_CPU_GPU
+    friend FloatPacket FMA(FloatPacket a, FloatPacket b, FloatPacket c) {
+        return FloatPacket(a.v * b.v + c.v);
+    }
+
+    // FloatPacket<1> Public Members
+    Float v;
+};
+
+#if defined(PBRT_HAVE_SSE)
+template <>
+struct FloatPacket<4> {
+    // FloatPacket<4> Public Methods
+    static constexpr int Width = 4;
+    FloatPacket() = default;
+    FloatPacket(__m128 v) : v(v) {}
+    explicit FloatPacket(float f) : v(_mm_set1_ps(f)) {}
+
+    static FloatPacket Load(const float *p) { return _mm_loadu_ps(p); }
+    void Store(float *p) const { _mm_storeu_ps(p, v); }
+
+    FloatPacket operator-() const { return _mm_xor_ps(v, _mm_set1_ps(-0.f)); }
+    FloatPacket operator+(FloatPacket b) const { return _mm_add_ps(v, b.v); }
+    FloatPacket operator-(FloatPacket b) const { return _mm_sub_ps(v, b.v); }
+    FloatPacket operator*(FloatPacket b) const { return _mm_mul_ps(v, b.v); }
+    FloatPacket operator/(FloatPacket b) const { return _mm_div_ps(v, b.v); }
+
+    friend FloatPacket Min(FloatPacket a, FloatPacket b) { return _mm_min_ps(a.v, b.v); }
+    friend FloatPacket Max(FloatPacket a, FloatPacket b) { return _mm_max_ps(a.v, b.v); }
+    friend FloatPacket Sqrt(FloatPacket a) { return _mm_sqrt_ps(a.v); }
+    friend FloatPacket SafeDiv(FloatPacket a, FloatPacket b) {
+        // Zero out lanes with zero denominators after dividing all of them
+        __m128 nonZero = _mm_cmpneq_ps(b.v, _mm_setzero_ps());
+        return _mm_and_ps(nonZero, _mm_div_ps(a.v, b.v));
+    }
+    friend FloatPacket FMA(FloatPacket a, FloatPacket b, FloatPacket c) {
+#ifdef __FMA__
+        return _mm_fmadd_ps(a.v, b.v, c.v);
+#else
+        return _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v);
+#endif
+    }
+
+    // FloatPacket<4> Public Members
+    __m128 v;
+};
+
+#elif defined(PBRT_HAVE_NEON)
+template <>
+struct FloatPacket<4> {
+    // FloatPacket<4> Public Methods
+    static constexpr int Width = 4;
+    FloatPacket() = default;
+    FloatPacket(float32x4_t v) : v(v) {}
+    explicit FloatPacket(float f) : v(vdupq_n_f32(f)) {}
+
+    static FloatPacket Load(const float *p) { return vld1q_f32(p); }
+    void Store(float *p) const { vst1q_f32(p, v); }
+
+    FloatPacket operator-() const { return vnegq_f32(v); }
+    FloatPacket operator+(FloatPacket b) const { return vaddq_f32(v, b.v); }
+    FloatPacket operator-(FloatPacket b) const { return vsubq_f32(v, b.v); }
+    FloatPacket operator*(FloatPacket b) const { return vmulq_f32(v, b.v); }
+    FloatPacket operator/(FloatPacket b) const { return vdivq_f32(v, b.v); }
+
+    friend FloatPacket Min(FloatPacket a, FloatPacket b) { return vminq_f32(a.v, b.v); }
+    friend FloatPacket Max(FloatPacket a, FloatPacket b) { return vmaxq_f32(a.v, b.v); }
+    friend FloatPacket Sqrt(FloatPacket a) { return vsqrtq_f32(a.v); }
+    friend FloatPacket SafeDiv(FloatPacket a, FloatPacket b) {
+        // Zero out lanes with zero denominators after dividing all of them
+        uint32x4_t zero = vceqq_f32(b.v, vdupq_n_f32(0));
+        return vreinterpretq_f32_u32(
+            vbicq_u32(vreinterpretq_u32_f32(vdivq_f32(a.v, b.v)), zero));
+    }
+    friend FloatPacket FMA(FloatPacket a, FloatPacket b, FloatPacket c) {
+        return vfmaq_f32(c.v, a.v, b.v);
+    }
+
+    // FloatPacket<4> Public Members
+    float32x4_t v;
+};
+#endif
+
+#if defined(PBRT_HAVE_AVX)
+template <>
+struct FloatPacket<8> {
+    // FloatPacket<8> Public Methods
+    static constexpr int Width = 8;
+    FloatPacket() = default;
+    FloatPacket(__m256 v) : v(v) {}
+    explicit FloatPacket(float f) : v(_mm256_set1_ps(f)) {}
+
+    static FloatPacket Load(const float *p) { return _mm256_loadu_ps(p); }
+    void Store(float *p) const { _mm256_storeu_ps(p, v); }
+
+    FloatPacket operator-() const { return _mm256_xor_ps(v, _mm256_set1_ps(-0.f)); }
+    FloatPacket operator+(FloatPacket b) const { return _mm256_add_ps(v, b.v); }
+    FloatPacket operator-(FloatPacket b) const { return _mm256_sub_ps(v, b.v); }
+    FloatPacket operator*(FloatPacket b) const { return _mm256_mul_ps(v, b.v); }
+    FloatPacket operator/(FloatPacket b) const { return _mm256_div_ps(v, b.v); }
+
+    friend FloatPacket Min(FloatPacket a, FloatPacket b) {
+        return _mm256_min_ps(a.v, b.v);
+    }
+    friend FloatPacket Max(FloatPacket a, FloatPacket b) {
+        return _mm256_max_ps(a.v, b.v);
+    }
+    friend FloatPacket Sqrt(FloatPacket a) { return _mm256_sqrt_ps(a.v); }
+    friend FloatPacket SafeDiv(FloatPacket a, FloatPacket b) {
+        // Zero out lanes with zero denominators after dividing all of them
+        __m256 nonZero = _mm256_cmp_ps(b.v, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+        return _mm256_and_ps(nonZero, _mm256_div_ps(a.v, b.v));
+    }
+    friend FloatPacket FMA(FloatPacket a, FloatPacket b, FloatPacket c) {
+#ifdef __FMA__
+        return _mm256_fmadd_ps(a.v, b.v, c.v);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v);
+#endif
+    }
+
+    // FloatPacket<8> Public Members
+    __m256 v;
+};
+#endif
+
+// FloatPacket Inline Functions
+template <int N>
+PBRT_CPU_GPU inline FloatPacket<N> Abs(FloatPacket<N> a) {
+    return Max(a, FloatPacket<N>(0.f) - a);
+}
+
+// Returns the widest available packet width that evenly divides _n_
+PBRT_CPU_GPU constexpr int FloatPacketWidth(int n) {
+    return (MaxFloatPacketWidth >= 8 && n % 8 == 0)   ? 8
+           : (MaxFloatPacketWidth >= 4 && n % 4 == 0) ? 4
+                                                      : 1;
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_SIMD_H
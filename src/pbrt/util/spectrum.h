@@ -18,6 +18,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/taggedptr.h>
 
 #include <algorithm>
@@ -35,6 +36,9 @@ constexpr Float Lambda_min = 360, Lambda_max = 830;
 
 static constexpr int NSpectrumSamples = 4;
 
+// SampledSpectrum arithmetic is performed in packets of this many wavelengths
+using SpectrumPacket = FloatPacket<FloatPacketWidth(NSpectrumSamples)>;
+
 static constexpr Float CIE_Y_integral = 106.856895;
 
 // Spectrum Definition
@@ -100,8 +104,8 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator-=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] -= s.values[i];
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) - s.Load(i));
         return *this;
     }
     PBRT_CPU_GPU
@@ -113,15 +117,15 @@ class SampledSpectrum {
     friend SampledSpectrum operator-(Float a, const SampledSpectrum &s) {
         DCHECK(!IsNaN(a));
         SampledSpectrum ret;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] = a - s.values[i];
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            ret.Store(i, SpectrumPacket(a) - s.Load(i));
         return ret;
     }
 
     PBRT_CPU_GPU
     SampledSpectrum &operator*=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] *= s.values[i];
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) * s.Load(i));
         return *this;
     }
     PBRT_CPU_GPU
@@ -133,15 +137,14 @@ class SampledSpectrum {
     SampledSpectrum operator*(Float a) const {
         DCHECK(!IsNaN(a));
         SampledSpectrum ret = *this;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] *= a;
-        return ret;
+        return ret *= a;
     }
     PBRT_CPU_GPU
     SampledSpectrum &operator*=(Float a) {
         DCHECK(!IsNaN(a));
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] *= a;
+        SpectrumPacket pa(a);
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) * pa);
         return *this;
     }
     PBRT_CPU_GPU
@@ -149,10 +152,10 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator/=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i) {
+        for (int i = 0; i < NSpectrumSamples; ++i)
             DCHECK_NE(0, s.values[i]);
-            values[i] /= s.values[i];
-        }
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) / s.Load(i));
         return *this;
     }
     PBRT_CPU_GPU
@@ -164,8 +167,9 @@ class SampledSpectrum {
     SampledSpectrum &operator/=(Float a) {
         DCHECK_NE(a, 0);
         DCHECK(!IsNaN(a));
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] /= a;
+        SpectrumPacket pa(a);
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) / pa);
         return *this;
     }
     PBRT_CPU_GPU
@@ -177,8 +181,8 @@ class SampledSpectrum {
     PBRT_CPU_GPU
     SampledSpectrum operator-() const {
         SampledSpectrum ret;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] = -values[i];
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            ret.Store(i, -Load(i));
         return ret;
     }
     PBRT_CPU_GPU
@@ -234,8 +238,24 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator+=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] += s.values[i];
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) + s.Load(i));
+        return *this;
+    }
+
+    // Fused updates that avoid temporaries in path throughput computations
+    PBRT_CPU_GPU
+    SampledSpectrum &MulScaled(const SampledSpectrum &s, Float a) {
+        DCHECK(!IsNaN(a));
+        SpectrumPacket pa(a);
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, Load(i) * (s.Load(i) * pa));
+        return *this;
+    }
+    PBRT_CPU_GPU
+    SampledSpectrum &AddProduct(const SampledSpectrum &a, const SampledSpectrum &b) {
+        for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+            Store(i, FMA(a.Load(i), b.Load(i), Load(i)));
         return *this;
     }
 
@@ -263,6 +283,23 @@ class SampledSpectrum {
 
   private:
     friend struct SOA<SampledSpectrum>;
+    template <typename U, typename V>
+    PBRT_CPU_GPU friend SampledSpectrum Clamp(const SampledSpectrum &s, U low, V high);
+    PBRT_CPU_GPU
+    friend SampledSpectrum SafeDiv(SampledSpectrum a, SampledSpectrum b);
+    PBRT_CPU_GPU
+    friend SampledSpectrum ClampZero(const SampledSpectrum &s);
+    PBRT_CPU_GPU
+    friend SampledSpectrum Sqrt(const SampledSpectrum &s);
+    PBRT_CPU_GPU
+    friend SampledSpectrum SafeSqrt(const SampledSpectrum &s);
+
+    // SampledSpectrum Private Methods
+    PBRT_CPU_GPU
+    SpectrumPacket Load(int i) const { return SpectrumPacket::Load(&values[i]); }
+    PBRT_CPU_GPU
+    void Store(int i, SpectrumPacket p) { p.Store(&values[i]); }
+
     pstd::array<Float, NSpectrumSamples> values;
 };
 
@@ -631,16 +668,17 @@ class RGBIlluminantSpectrum {
 // SampledSpectrum Inline Functions
 PBRT_CPU_GPU inline SampledSpectrum SafeDiv(SampledSpectrum a, SampledSpectrum b) {
     SampledSpectrum r;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        r[i] = (b[i] != 0) ? a[i] / b[i] : 0.;
+    for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+        r.Store(i, SafeDiv(a.Load(i), b.Load(i)));
     return r;
 }
 
 template <typename U, typename V>
 PBRT_CPU_GPU inline SampledSpectrum Clamp(const SampledSpectrum &s, U low, V high) {
     SampledSpectrum ret;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        ret[i] = pbrt::Clamp(s[i], low, high);
+    SpectrumPacket pLow(static_cast<Float>(low)), pHigh(static_cast<Float>(high));
+    for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+        ret.Store(i, Min(Max(s.Load(i), pLow), pHigh));
     DCHECK(!ret.HasNaNs());
     return ret;
 }
@@ -648,8 +686,8 @@ PBRT_CPU_GPU inline SampledSpectrum Clamp(const SampledSpectrum &s, U low, V hig
 PBRT_CPU_GPU
 inline SampledSpectrum ClampZero(const SampledSpectrum &s) {
     SampledSpectrum ret;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        ret[i] = std::max<Float>(0, s[i]);
+    for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+        ret.Store(i, Max(s.Load(i), SpectrumPacket(0.f)));
     DCHECK(!ret.HasNaNs());
     return ret;
 }
@@ -657,8 +695,8 @@ inline SampledSpectrum ClampZero(const SampledSpectrum &s) {
 PBRT_CPU_GPU
 inline SampledSpectrum Sqrt(const SampledSpectrum &s) {
     SampledSpectrum ret;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        ret[i] = std::sqrt(s[i]);
+    for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+        ret.Store(i, Sqrt(s.Load(i)));
     DCHECK(!ret.HasNaNs());
     return ret;
 }
@@ -666,12 +704,19 @@ inline SampledSpectrum Sqrt(const SampledSpectrum &s) {
 PBRT_CPU_GPU
 inline SampledSpectrum SafeSqrt(const SampledSpectrum &s) {
     SampledSpectrum ret;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        ret[i] = SafeSqrt(s[i]);
+    for (int i = 0; i < NSpectrumSamples; i += SpectrumPacket::Width)
+        ret.Store(i, Sqrt(Max(s.Load(i), SpectrumPacket(0.f))));
     DCHECK(!ret.HasNaNs());
     return ret;
 }
 
+PBRT_CPU_GPU
+inline SampledSpectrum FMA(const SampledSpectrum &a, const SampledSpectrum &b,
+                           const SampledSpectrum &c) {
+    SampledSpectrum ret = c;
+    return ret.AddProduct(a, b);
+}
+
 PBRT_CPU_GPU
 inline SampledSpectrum Pow(const SampledSpectrum &s, Float e) {
     SampledSpectrum ret;
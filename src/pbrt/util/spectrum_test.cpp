@@ -8,11 +8,15 @@
 
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/mipmap.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
 
 #include <array>
+#include <functional>
+#include <vector>
 
 using namespace pbrt;
 
@@ -162,3 +166,123 @@ TEST(Spectrum, SamplingPdfXYZ) {
     EXPECT_LT(std::abs((impInt - unifInt) / unifInt), 1e-3)
         << impInt << " vs. " << unifInt;
 }
+
+static SampledSpectrum RandomSpectrum(RNG &rng, bool allowZero) {
+    SampledSpectrum s;
+    for (int i = 0; i < NSpectrumSamples; ++i) {
+        s[i] = Lerp(rng.Uniform<Float>(), -2, 2);
+        if (allowZero && rng.Uniform<Float>() < .25f)
+            s[i] = 0;
+    }
+    return s;
+}
+
+TEST(SampledSpectrum, PacketArithmetic) {
+    RNG rng;
+    for (int trial = 0; trial < 1000; ++trial) {
+        SampledSpectrum a = RandomSpectrum(rng, false), b = RandomSpectrum(rng, true);
+        SampledSpectrum c = RandomSpectrum(rng, false);
+        Float f = Lerp(rng.Uniform<Float>(), .5, 2);
+
+        SampledSpectrum sum = a + b, diff = f - a, prod = a * b, scaled = a / f;
+        SampledSpectrum neg = -a;
+        SampledSpectrum safeDiv = SafeDiv(a, b), clampZero = ClampZero(a);
+        SampledSpectrum clamp = Clamp(a, -1, 1), sqrtAbs = SafeSqrt(a);
+        SampledSpectrum fma = FMA(a, b, c);
+        SampledSpectrum mulScaled = c;
+        mulScaled.MulScaled(a, f);
+        SampledSpectrum addProduct = c;
+        addProduct.AddProduct(a, b);
+
+        for (int i = 0; i < NSpectrumSamples; ++i) {
+            EXPECT_EQ(a[i] + b[i], sum[i]);
+            EXPECT_EQ(f - a[i], diff[i]);
+            EXPECT_EQ(-a[i], neg[i]);
+            EXPECT_EQ(a[i] * b[i], prod[i]);
+            EXPECT_FLOAT_EQ(a[i] / f, scaled[i]);
+            EXPECT_EQ(b[i] != 0 ? a[i] / b[i] : 0, safeDiv[i]);
+            EXPECT_EQ(std::max<Float>(0, a[i]), clampZero[i]);
+            EXPECT_EQ(pbrt::Clamp(a[i], -1, 1), clamp[i]);
+            EXPECT_EQ(std::sqrt(std::max<Float>(0, a[i])), sqrtAbs[i]);
+            // Fused multiply-adds round once, so allow for rounding error
+            // relative to the operands rather than to their sum
+            Float fmaError = 1e-6f * (std::abs(a[i] * b[i]) + std::abs(c[i]));
+            EXPECT_NEAR(a[i] * b[i] + c[i], fma[i], fmaError);
+            EXPECT_FLOAT_EQ(c[i] * a[i] * f, mulScaled[i]);
+            EXPECT_NEAR(c[i] + a[i] * b[i], addProduct[i], fmaError);
+        }
+    }
+}
+
+// Returns the RGB color of the reflectance _r_ under _cs_'s illuminant.
+static RGB ReflectanceToRGB(const RGBColorSpace &cs, std::function<Float(Float)> r) {
+    XYZ xyz(0, 0, 0);
+    Float yIntegral = 0;
+    for (Float lambda = Lambda_min; lambda <= Lambda_max; ++lambda) {
+        Float illum = cs.illuminant(lambda);
+        xyz += r(lambda) * illum *
+               XYZ(Spectra::X()(lambda), Spectra::Y()(lambda), Spectra::Z()(lambda));
+        yIntegral += illum * Spectra::Y()(lambda);
+    }
+    return cs.ToRGB(xyz / yIntegral);
+}
+
+TEST(RGBCoefficientMIPMap, ColorAccuracy) {
+    // Create smoothly-varying RGB image, including black and white texels
+    const RGBColorSpace &cs = *RGBColorSpace::sRGB;
+    Point2i res(16, 16);
+    Image image(PixelFormat::Float, res, {"R", "G", "B"});
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < 3; ++c) {
+                Float v = .5f + .45f * std::sin(.3f * x + .2f * y + 2 * c);
+                image.SetChannel({x, y}, c, (x + y == 0) ? 0 : v);
+            }
+    image.SetChannel({res.x - 1, res.y - 1}, 0, 1);
+    image.SetChannel({res.x - 1, res.y - 1}, 1, 1);
+    image.SetChannel({res.x - 1, res.y - 1}, 2, 1);
+
+    for (FilterFunction filter : {FilterFunction::Point, FilterFunction::Bilinear}) {
+        MIPMapFilterOptions options;
+        options.filter = filter;
+        MIPMap mipmap(image, &cs, WrapMode::Clamp, {}, options);
+
+        for (bool unbounded : {false, true}) {
+            RGBCoefficientMIPMap coeffs(mipmap, unbounded, {});
+            RNG rng;
+            for (int i = 0; i < 100; ++i) {
+                Point2f st(rng.Uniform<Float>(), rng.Uniform<Float>());
+                if (filter == FilterFunction::Point) {
+                    // Point lookups should exactly reproduce per-texel spectra
+                    st = Point2f((int(st[0] * res.x) + .5f) / res.x,
+                                 (int(st[1] * res.y) + .5f) / res.y);
+                } else {
+                    // Filtering coefficients across the step to black or
+                    // white isn't accurate; stay in the smooth interior.
+                    st = Point2f(Lerp(st[0], .1f, .9f), Lerp(st[1], .1f, .9f));
+                }
+                // Compare RGB of precomputed spectrum with that of the
+                // spectrum computed from the filtered RGB value
+                RGB rgb = mipmap.Filter<RGB>(st, {0, 0}, {0, 0});
+                Float scale;
+                RGBSigmoidPolynomial rsp = coeffs.Filter(st, {0, 0}, {0, 0}, &scale);
+                RGB approx = ReflectanceToRGB(
+                    cs, [&](Float lambda) { return scale * rsp(lambda); });
+                RGB exact;
+                if (unbounded) {
+                    RGBUnboundedSpectrum s(cs, rgb);
+                    exact = ReflectanceToRGB(cs, [&](Float lambda) { return s(lambda); });
+                } else {
+                    RGBAlbedoSpectrum s(cs, rgb);
+                    exact = ReflectanceToRGB(cs, [&](Float lambda) { return s(lambda); });
+                }
+
+                Float tolerance = (filter == FilterFunction::Point) ? 1e-4f : 2e-2f;
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_LT(std::abs(approx[c] - exact[c]), tolerance)
+                        << "filter " << ToString(filter) << " unbounded " << unbounded
+                        << " rgb " << rgb << " approx " << approx << " exact " << exact;
+            }
+        }
+    }
+}
@@ -5,6 +5,7 @@
 #include <pbrt/util/stats.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
@@ -13,14 +14,20 @@
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cinttypes>
 #include <csignal>
+#include <cstring>
 #include <functional>
 #include <map>
 #include <mutex>
 #include <string>
 
+#if !defined(PBRT_IS_WINDOWS)
+#include <sys/time.h>
+#endif
+
 namespace pbrt {
 
 // ThreadStatsState Definition
@@ -44,6 +51,27 @@ static StatsAccumulator statsAccumulator;
 static Bounds2i imageBounds;
 std::string pixelStatsBaseName;
 
+// Profiler Local Variables
+static constexpr int NumProfilePhases = int(ProfilePhase::NumPhases);
+static constexpr int ProfileSamplingRate = 1000;
+
+static const char *profilePhaseNames[] = {
+    "Profile/Integrator rendering", "Profile/Medium sampling",
+    "Profile/Direct lighting",      "Profile/Light sampling",
+    "Profile/Material GetBSDF",     "Profile/Texture filtering",
+    "Profile/Intersect",            "Profile/IntersectP"};
+static_assert(PBRT_ARRAYSIZE(profilePhaseNames) == NumProfilePhases,
+              "Profile phase names don't match ProfilePhase");
+
+thread_local uint32_t profilerState;
+thread_local int profilerPhase = NumProfilePhases;
+std::atomic<bool> profilerEnabled{false};
+static bool profilerRunning = false;
+// The number of samples taken for each possible combination of active phases
+static std::atomic<uint64_t> profileSamples[1 << NumProfilePhases];
+static std::atomic<uint64_t> exclusiveProfileSamples[NumProfilePhases];
+static thread_local uint64_t pixelProfileSamples[NumProfilePhases];
+
 // Statistics Function Definitions
 void ReportThreadStats() {
     static std::mutex mutex;
@@ -62,6 +90,8 @@ void StatsReportPixelStart(Point2i p) {
     threadStatsState.active = true;
     threadStatsState.p = p;
     threadStatsState.start = std::chrono::steady_clock::now();
+    for (uint64_t &count : pixelProfileSamples)
+        count = 0;
 }
 
 void StatsReportPixelEnd(Point2i p) {
@@ -78,6 +108,14 @@ void StatsReportPixelEnd(Point2i p) {
     tss.accum.ReportPixelMS(p, deltaMS);
 
     StatRegisterer::CallPixelCallbacks(p, tss.accum);
+
+    if (profilerRunning) {
+        // Report profile samples for the pixel after the registered counters
+        int firstIndex = pixelStatFuncs->size();
+        for (int i = 0; i < NumProfilePhases; ++i)
+            tss.accum.ReportCounter(p, firstIndex + i, profilePhaseNames[i],
+                                    pixelProfileSamples[i]);
+    }
 }
 
 void StatsEnablePixelStats(const Bounds2i &b, const std::string &baseName) {
@@ -323,6 +361,7 @@ void StatsAccumulator::AccumulatePixelStats(const PixelStatsAccumulator &accum)
 
 void PrintStats(FILE *dest) {
     statsAccumulator.Print(dest);
+    ReportProfilerResults(dest);
 }
 
 bool PrintCheckRare(FILE *dest) {
@@ -501,6 +540,97 @@ bool StatsAccumulator::PrintCheckRare(FILE *dest) {
     return anyFailed;
 }
 
+// Profiler Function Definitions
+#if !defined(PBRT_IS_WINDOWS)
+static void ReportProfileSample(int, siginfo_t *, void *) {
+    // Only touch lock-free atomics and trivially-initialized thread-local
+    // variables here, since this runs in a signal handler
+    uint32_t state = profilerState;
+    profileSamples[state].fetch_add(1, std::memory_order_relaxed);
+    int phase = profilerPhase;
+    if (phase < NumProfilePhases)
+        exclusiveProfileSamples[phase].fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < NumProfilePhases; ++i)
+        if (state & (1u << i))
+            ++pixelProfileSamples[i];
+}
+#endif
+
+void InitProfiler() {
+#if defined(PBRT_IS_WINDOWS)
+    Warning("The sampling profiler is not supported on Windows.");
+#else
+    CHECK(!profilerRunning);
+    for (std::atomic<uint64_t> &count : profileSamples)
+        count = 0;
+    for (std::atomic<uint64_t> &count : exclusiveProfileSamples)
+        count = 0;
+
+    // Set up signal handler for profiling samples
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = ReportProfileSample;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, nullptr);
+
+    // Start the timer that generates profiling samples
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / ProfileSamplingRate;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0)
+        ErrorExit("Timer could not be initialized: %s", ErrorString());
+    profilerRunning = true;
+    profilerEnabled = true;
+#endif
+}
+
+void CleanupProfiler() {
+#if !defined(PBRT_IS_WINDOWS)
+    if (!profilerRunning)
+        return;
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 0;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    profilerRunning = false;
+    profilerEnabled = false;
+#endif
+}
+
+void ReportProfilerResults(FILE *dest) {
+    uint64_t total = 0;
+    for (const std::atomic<uint64_t> &count : profileSamples)
+        total += count;
+    if (total == 0)
+        return;
+
+    // Compute inclusive sample counts for each phase
+    uint64_t inclusive[NumProfilePhases] = {};
+    for (uint32_t state = 1; state < PBRT_ARRAYSIZE(profileSamples); ++state) {
+        uint64_t count = profileSamples[state];
+        for (int i = 0; i < NumProfilePhases; ++i)
+            if (state & (1u << i))
+                inclusive[i] += count;
+    }
+
+    fprintf(dest, "  Profile\n");
+    for (int i = 0; i < NumProfilePhases; ++i) {
+        if (inclusive[i] == 0)
+            continue;
+        std::string category, title;
+        getCategoryAndTitle(profilePhaseNames[i], &category, &title);
+        uint64_t exclusive = exclusiveProfileSamples[i];
+        fprintf(dest, "    %-42s%8.2f%% inclusive %8.2f%% exclusive  %9.2fs\n",
+                title.c_str(), 100. * inclusive[i] / total, 100. * exclusive / total,
+                double(inclusive[i]) / ProfileSamplingRate);
+    }
+    fprintf(dest, "    %-42s%8.2f%% (%" PRIu64 " samples total)\n",
+            "Outside profiled phases", 100. * profileSamples[0] / total, total);
+}
+
 void StatsAccumulator::Clear() {
     stats->counters.clear();
     stats->memoryCounters.clear();
@@ -7,12 +7,77 @@
 
 #include <pbrt/pbrt.h>
 
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <limits>
 #include <string>
 
 namespace pbrt {
 
+// ProfilePhase Definition
+enum class ProfilePhase {
+    IntegratorRender,
+    SampleMedium,
+    DirectLighting,
+    LightSampling,
+    GetBSDF,
+    TextureFiltering,
+    Intersect,
+    IntersectShadow,
+    NumPhases
+};
+
+extern thread_local uint32_t profilerState;
+extern thread_local int profilerPhase;
+// Set while the sampling profiler is running; profiler scopes don't touch
+// the thread-local profiler state otherwise.
+extern std::atomic<bool> profilerEnabled;
+
+// ProfilerScope Definition
+class ProfilerScope {
+  public:
+    // ProfilerScope Public Methods
+    explicit ProfilerScope(ProfilePhase phase) {
+        if (!profilerEnabled.load(std::memory_order_relaxed))
+            return;
+        active = true;
+        phaseBit = 1u << int(phase);
+        reset = (profilerState & phaseBit) == 0;
+        profilerState |= phaseBit;
+        // Make _phase_ the innermost phase, which is charged for exclusive time
+        prevPhase = profilerPhase;
+        profilerPhase = int(phase);
+    }
+    ~ProfilerScope() {
+        if (!active)
+            return;
+        if (reset)
+            profilerState &= ~phaseBit;
+        profilerPhase = prevPhase;
+    }
+
+    ProfilerScope(const ProfilerScope &) = delete;
+    ProfilerScope &operator=(const ProfilerScope &) = delete;
+
+  private:
+    // ProfilerScope Private Members
+    bool active = false;
+    uint32_t phaseBit;
+    int prevPhase;
+    bool reset;
+};
+
+// Returns the phase that the current thread's profile samples are exclusively
+// attributed to, or _ProfilePhase::NumPhases_ outside of all phases.
+inline ProfilePhase CurrentProfilePhase() {
+    return ProfilePhase(profilerPhase);
+}
+
+void InitProfiler();
+void CleanupProfiler();
+void ReportProfilerResults(FILE *dest);
+
 class StatsAccumulator;
 class PixelStatsAccumulator;
 // StatRegisterer Definition
@@ -0,0 +1,73 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/util/stats.h>
+
+using namespace pbrt;
+
+static bool PhaseActive(ProfilePhase phase) {
+    return (profilerState & (1u << int(phase))) != 0;
+}
+
+// Enables profiler scopes without starting the sampling profiler's timer.
+struct ProfilerScopesEnabler {
+    ProfilerScopesEnabler() : wasEnabled(profilerEnabled.exchange(true)) {}
+    ~ProfilerScopesEnabler() { profilerEnabled = wasEnabled; }
+    bool wasEnabled;
+};
+
+TEST(Profiler, DisabledScopes) {
+    // Scopes shouldn't touch the thread-local state unless profiling
+    ASSERT_FALSE(profilerEnabled);
+    ProfilerScope render(ProfilePhase::IntegratorRender);
+    EXPECT_EQ(ProfilePhase::NumPhases, CurrentProfilePhase());
+    EXPECT_EQ(0, profilerState);
+}
+
+TEST(Profiler, NestedScopeExclusivePhase) {
+    ProfilerScopesEnabler enabler;
+    EXPECT_EQ(ProfilePhase::NumPhases, CurrentProfilePhase());
+    {
+        ProfilerScope render(ProfilePhase::IntegratorRender);
+        EXPECT_EQ(ProfilePhase::IntegratorRender, CurrentProfilePhase());
+        {
+            // Majorant sampling during a transmittance estimate is charged
+            // to medium sampling, even though it comes earlier in the enum
+            ProfilerScope lighting(ProfilePhase::DirectLighting);
+            {
+                ProfilerScope medium(ProfilePhase::SampleMedium);
+                EXPECT_EQ(ProfilePhase::SampleMedium, CurrentProfilePhase());
+                EXPECT_TRUE(PhaseActive(ProfilePhase::DirectLighting));
+            }
+            EXPECT_EQ(ProfilePhase::DirectLighting, CurrentProfilePhase());
+            EXPECT_FALSE(PhaseActive(ProfilePhase::SampleMedium));
+
+            ProfilerScope lightSampling(ProfilePhase::LightSampling);
+            EXPECT_EQ(ProfilePhase::LightSampling, CurrentProfilePhase());
+        }
+        EXPECT_EQ(ProfilePhase::IntegratorRender, CurrentProfilePhase());
+        EXPECT_FALSE(PhaseActive(ProfilePhase::DirectLighting));
+        EXPECT_FALSE(PhaseActive(ProfilePhase::LightSampling));
+    }
+    EXPECT_EQ(ProfilePhase::NumPhases, CurrentProfilePhase());
+    EXPECT_EQ(0, profilerState);
+}
+
+TEST(Profiler, ReenteredPhase) {
+    ProfilerScopesEnabler enabler;
+    ProfilerScope bsdf(ProfilePhase::GetBSDF);
+    {
+        ProfilerScope filtering(ProfilePhase::TextureFiltering);
+        {
+            ProfilerScope nestedBSDF(ProfilePhase::GetBSDF);
+            EXPECT_EQ(ProfilePhase::GetBSDF, CurrentProfilePhase());
+        }
+        // The outer GetBSDF scope is still active but not innermost
+        EXPECT_EQ(ProfilePhase::TextureFiltering, CurrentProfilePhase());
+        EXPECT_TRUE(PhaseActive(ProfilePhase::GetBSDF));
+    }
+    EXPECT_EQ(ProfilePhase::GetBSDF, CurrentProfilePhase());
+}
@@ -0,0 +1,194 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/trace.h>
+
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/print.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pbrt {
+
+// TraceEvent Definition
+struct TraceEvent {
+    const char *name;
+    const char *argNames[2];
+    int64_t args[2];
+    int64_t startNS, endNS;
+};
+
+// ThreadTraceBuffer Definition
+// Only a buffer's own thread modifies it. Events are stored in chunks that
+// are allocated as needed; once all of them are full, later events are
+// counted and dropped so that the earliest ones, which cover scene
+// construction, are kept.
+struct ThreadTraceBuffer {
+    static constexpr int ChunkSize = 1024, MaxChunks = 128;
+    std::unique_ptr<TraceEvent[]> chunks[MaxChunks];
+    // _nEvents_ is updated with release semantics once an event has been
+    // stored so that TraceToJSON() can read the events before it.
+    std::atomic<int64_t> nEvents{0}, nDropped{0};
+    // Value of _traceGeneration_ when the buffer's events were recorded
+    std::atomic<int> generation{0};
+    int threadIndex;
+    bool isMainThread;
+};
+
+// Trace Local Variables
+static std::string traceFilename;
+static std::chrono::steady_clock::time_point traceEpoch;
+static std::thread::id traceMainThread;
+// Incremented by each call to TraceInit() so that threads discard the events
+// in their buffers from earlier traces before recording new ones.
+static std::atomic<int> traceGeneration{0};
+static std::mutex traceBuffersMutex;
+// Buffers are never freed so that threads may hold on to pointers to them
+// across successive calls to TraceInit().
+static std::vector<std::unique_ptr<ThreadTraceBuffer>> traceBuffers;
+static thread_local ThreadTraceBuffer *threadTraceBuffer;
+
+namespace detail {
+
+std::atomic<bool> traceEnabled{false};
+
+int64_t TraceNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - traceEpoch)
+        .count();
+}
+
+void TraceRecordEvent(const char *name, int64_t startNS, int64_t endNS,
+                      const char *argNames[2], const int64_t args[2]) {
+    if (!threadTraceBuffer) {
+        // Allocate trace buffer for the current thread
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        traceBuffers.push_back(std::make_unique<ThreadTraceBuffer>());
+        threadTraceBuffer = traceBuffers.back().get();
+        threadTraceBuffer->threadIndex = int(traceBuffers.size()) - 1;
+        threadTraceBuffer->isMainThread =
+            std::this_thread::get_id() == traceMainThread;
+    }
+
+    ThreadTraceBuffer *buf = threadTraceBuffer;
+    int generation = traceGeneration.load(std::memory_order_acquire);
+    if (buf->generation.load(std::memory_order_relaxed) != generation) {
+        // Discard events from an earlier trace
+        buf->nEvents.store(0, std::memory_order_relaxed);
+        buf->nDropped.store(0, std::memory_order_relaxed);
+        buf->generation.store(generation, std::memory_order_release);
+    }
+
+    // Store event in the thread's current chunk, or drop it if all are full
+    int64_t n = buf->nEvents.load(std::memory_order_relaxed);
+    if (n == int64_t(ThreadTraceBuffer::MaxChunks) * ThreadTraceBuffer::ChunkSize) {
+        buf->nDropped.store(buf->nDropped.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+        return;
+    }
+    std::unique_ptr<TraceEvent[]> &chunk = buf->chunks[n / ThreadTraceBuffer::ChunkSize];
+    if (!chunk)
+        chunk = std::make_unique<TraceEvent[]>(ThreadTraceBuffer::ChunkSize);
+    chunk[n % ThreadTraceBuffer::ChunkSize] =
+        TraceEvent{name, {argNames[0], argNames[1]}, {args[0], args[1]}, startNS, endNS};
+    buf->nEvents.store(n + 1, std::memory_order_release);
+}
+
+}  // namespace detail
+
+// Trace Function Definitions
+void TraceInit(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    // Other threads' buffers are reset by those threads when they next record
+    traceGeneration.fetch_add(1, std::memory_order_release);
+    traceFilename = filename;
+    traceEpoch = std::chrono::steady_clock::now();
+    traceMainThread = std::this_thread::get_id();
+    detail::traceEnabled.store(true, std::memory_order_release);
+}
+
+static void AppendJSONString(std::string *s, const char *str) {
+    *s += '"';
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            *s += '\\';
+        *s += *str;
+    }
+    *s += '"';
+}
+
+std::string TraceToJSON() {
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    auto startEvent = [&]() {
+        json += first ? "  " : ",\n  ";
+        first = false;
+    };
+
+    int generation = traceGeneration.load(std::memory_order_relaxed);
+    for (const auto &buf : traceBuffers) {
+        if (buf->generation.load(std::memory_order_acquire) != generation)
+            continue;
+        int64_t nEvents = buf->nEvents.load(std::memory_order_acquire);
+        if (nEvents == 0)
+            continue;
+        // Emit metadata event that names the thread
+        startEvent();
+        std::string threadName = buf->isMainThread
+                                     ? std::string("Main thread")
+                                     : StringPrintf("Thread %d", buf->threadIndex);
+        json += StringPrintf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+                             "\"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                             buf->threadIndex, threadName);
+
+        // Emit complete events for the thread's recorded scopes
+        if (int64_t nDropped = buf->nDropped.load(std::memory_order_relaxed))
+            Warning("Trace: %d events from thread %d were dropped after its buffer "
+                    "filled.",
+                    nDropped, buf->threadIndex);
+        for (int64_t i = 0; i < nEvents; ++i) {
+            const TraceEvent &e = buf->chunks[i / ThreadTraceBuffer::ChunkSize]
+                                             [i % ThreadTraceBuffer::ChunkSize];
+            startEvent();
+            json += "{\"name\": ";
+            AppendJSONString(&json, e.name);
+            json += StringPrintf(", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+                                 "\"ts\": %.3f, \"dur\": %.3f",
+                                 buf->threadIndex, e.startNS / 1000.,
+                                 (e.endNS - e.startNS) / 1000.);
+            if (e.argNames[0]) {
+                json += ", \"args\": {";
+                for (int a = 0; a < 2 && e.argNames[a]; ++a) {
+                    json += a > 0 ? ", " : "";
+                    AppendJSONString(&json, e.argNames[a]);
+                    json += StringPrintf(": %d", e.args[a]);
+                }
+                json += "}";
+            }
+            json += "}";
+        }
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+void TraceCleanup() {
+    if (!detail::traceEnabled.exchange(false))
+        return;
+
+    if (!WriteFileContents(traceFilename, TraceToJSON()))
+        Error("%s: unable to write trace file.", traceFilename);
+    else
+        LOG_VERBOSE("Wrote trace to %s", traceFilename);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,76 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_TRACE_H
+#define PBRT_UTIL_TRACE_H
+
+#include <pbrt/pbrt.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace pbrt {
+
+// Trace Function Declarations
+void TraceInit(const std::string &filename);
+void TraceCleanup();
+std::string TraceToJSON();
+
+namespace detail {
+
+extern std::atomic<bool> traceEnabled;
+
+int64_t TraceNanoseconds();
+void TraceRecordEvent(const char *name, int64_t startNS, int64_t endNS,
+                      const char *argNames[2], const int64_t args[2]);
+
+}  // namespace detail
+
+// TraceScope Definition
+// Records the span of time between its construction and destruction to the
+// current thread's trace buffer. The event name and argument names are stored
+// by pointer and so must be string literals or otherwise outlive tracing.
+class TraceScope {
+  public:
+    // TraceScope Public Methods
+    explicit TraceScope(const char *name, const char *arg0Name = nullptr,
+                        int64_t arg0 = 0, const char *arg1Name = nullptr,
+                        int64_t arg1 = 0) {
+        if (!detail::traceEnabled.load(std::memory_order_relaxed))
+            return;
+        this->name = name;
+        argNames[0] = arg0Name;
+        argNames[1] = arg1Name;
+        args[0] = arg0;
+        args[1] = arg1;
+        startNS = detail::TraceNanoseconds();
+    }
+
+    ~TraceScope() {
+        if (name)
+            detail::TraceRecordEvent(name, startNS, detail::TraceNanoseconds(),
+                                     argNames, args);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+  private:
+    // TraceScope Private Members
+    const char *name = nullptr;
+    const char *argNames[2];
+    int64_t args[2];
+    int64_t startNS;
+};
+
+// Trace Macros
+#define PBRT_TRACE_CONCAT2(a, b) a##b
+#define PBRT_TRACE_CONCAT(a, b) PBRT_TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(...) \
+    pbrt::TraceScope PBRT_TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_TRACE_H
@@ -0,0 +1,69 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/trace.h>
+
+#include <string>
+
+using namespace pbrt;
+
+static int CountOccurrences(const std::string &str, const std::string &pattern) {
+    int count = 0;
+    for (size_t pos = str.find(pattern); pos != std::string::npos;
+         pos = str.find(pattern, pos + 1))
+        ++count;
+    return count;
+}
+
+TEST(Trace, Disabled) {
+    { TRACE_SCOPE("Untraced"); }
+    EXPECT_EQ(0, CountOccurrences(TraceToJSON(), "Untraced"));
+}
+
+TEST(Trace, Scopes) {
+    std::string fn = "trace.json";
+    TraceInit(fn);
+    {
+        TRACE_SCOPE("Outer", "value", 17);
+        ParallelFor(0, 100, [](int64_t i) { TRACE_SCOPE("Inner", "i", i, "j", 2 * i); });
+    }
+    TraceCleanup();
+
+    // Scopes recorded after tracing has finished should be ignored
+    { TRACE_SCOPE("Late"); }
+
+    std::string json = ReadFileContents(fn);
+    EXPECT_EQ(0, remove(fn.c_str()));
+    EXPECT_EQ(1, CountOccurrences(json, "\"name\": \"Outer\""));
+    EXPECT_EQ(1, CountOccurrences(json, "\"args\": {\"value\": 17}"));
+    EXPECT_EQ(100, CountOccurrences(json, "\"name\": \"Inner\""));
+    EXPECT_EQ(1, CountOccurrences(json, "\"args\": {\"i\": 99, \"j\": 198}"));
+    EXPECT_EQ(1, CountOccurrences(json, "\"Main thread\""));
+    EXPECT_EQ(0, CountOccurrences(json, "Late"));
+    EXPECT_EQ(CountOccurrences(json, "{"), CountOccurrences(json, "}"));
+}
+
+TEST(Trace, KeepsFirstEvents) {
+    std::string fn = "trace_first.json";
+    TraceInit(fn);
+    // Record more events than a thread's buffer holds; the first event
+    // should be kept and the last one dropped
+    { TRACE_SCOPE("First"); }
+    for (int i = 0; i < 200000; ++i) {
+        TRACE_SCOPE("Filler");
+    }
+    { TRACE_SCOPE("Last"); }
+    TraceCleanup();
+
+    std::string json = ReadFileContents(fn);
+    EXPECT_EQ(0, remove(fn.c_str()));
+    EXPECT_EQ(1, CountOccurrences(json, "\"name\": \"First\""));
+    EXPECT_EQ(0, CountOccurrences(json, "\"name\": \"Last\""));
+    EXPECT_GT(CountOccurrences(json, "\"name\": \"Filler\""), 100000);
+}
@@ -1081,23 +1081,40 @@ Transform AnimatedTransform::Interpolate(Float time) const {
 }
 
 Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b) const {
+    return MotionBounds(b, startTime, endTime);
+}
+
+Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b, Float time0,
+                                         Float time1) const {
     // Handle easy cases for _Bounds3f_ motion bounds
     if (!actuallyAnimated)
         return startTransform(b);
     if (!hasRotation)
-        return Union(startTransform(b), endTransform(b));
+        return Union(Interpolate(time0)(b), Interpolate(time1)(b));
 
     // Return motion bounds accounting for animated rotation
     Bounds3f bounds;
     for (int corner = 0; corner < 8; ++corner)
-        bounds = Union(bounds, BoundPointMotion(b.Corner(corner)));
+        bounds = Union(bounds, BoundPointMotion(b.Corner(corner), time0, time1));
     return bounds;
 }
 
 Bounds3f AnimatedTransform::BoundPointMotion(Point3f p) const {
+    return BoundPointMotion(p, startTime, endTime);
+}
+
+Bounds3f AnimatedTransform::BoundPointMotion(Point3f p, Float time0, Float time1) const {
     if (!actuallyAnimated)
         return Bounds3f(startTransform(p));
-    Bounds3f bounds(startTransform(p), endTransform(p));
+    // Clamp time interval to the transform's and find its parametric extent
+    time0 = Clamp(time0, startTime, endTime);
+    time1 = Clamp(time1, time0, endTime);
+    Interval u(0., 1.);
+    if (endTime > startTime)
+        u = Interval((time0 - startTime) / (endTime - startTime),
+                     (time1 - startTime) / (endTime - startTime));
+
+    Bounds3f bounds((*this)(p, time0), (*this)(p, time1));
     Float cosTheta = Dot(R[0], R[1]);
     Float theta = SafeACos(cosTheta);
     for (int c = 0; c < 3; ++c) {
@@ -1105,7 +1122,7 @@ Bounds3f AnimatedTransform::BoundPointMotion(Point3f p) const {
         Float zeros[8];
         int nZeros = 0;
         FindZeros(c1[c].Eval(p), c2[c].Eval(p), c3[c].Eval(p), c4[c].Eval(p),
-                  c5[c].Eval(p), theta, Interval(0., 1.), zeros, &nZeros);
+                  c5[c].Eval(p), theta, u, zeros, &nZeros);
         CHECK_LE(nZeros, PBRT_ARRAYSIZE(zeros));
 
         // Expand bounding box for any motion derivative zeros found
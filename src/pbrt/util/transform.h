@@ -502,9 +502,13 @@ class AnimatedTransform {
 
     PBRT_CPU_GPU
     Bounds3f MotionBounds(const Bounds3f &b) const;
+    PBRT_CPU_GPU
+    Bounds3f MotionBounds(const Bounds3f &b, Float time0, Float time1) const;
 
     PBRT_CPU_GPU
     Bounds3f BoundPointMotion(Point3f p) const;
+    PBRT_CPU_GPU
+    Bounds3f BoundPointMotion(Point3f p, Float time0, Float time1) const;
 
     // AnimatedTransform Public Members
     Transform startTransform, endTransform;
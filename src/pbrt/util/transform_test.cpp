@@ -71,6 +71,31 @@ TEST(AnimatedTransform, Randoms) {
     }
 }
 
+TEST(AnimatedTransform, SubintervalMotionBounds) {
+    RNG rng;
+    auto r = [&rng]() { return -10. + 20. * rng.Uniform<Float>(); };
+
+    for (int i = 0; i < 200; ++i) {
+        AnimatedTransform at(RandomTransform(rng), 0., RandomTransform(rng), 1.);
+        Bounds3f bounds(Point3f(r(), r(), r()), Point3f(r(), r(), r()));
+        EXPECT_EQ(at.MotionBounds(bounds), at.MotionBounds(bounds, 0., 1.));
+
+        // Bound the motion over a random subinterval of the time range
+        Float time0 = rng.Uniform<Float>();
+        Float time1 = std::min<Float>(1, time0 + .25 * rng.Uniform<Float>());
+        Bounds3f motionBounds = at.MotionBounds(bounds, time0, time1);
+
+        for (Float t = time0; t <= time1; t += 1e-2 * rng.Uniform<Float>()) {
+            // The bounds transformed at times in the subinterval should
+            // be inside the motion bounds, up to round-off error.
+            Bounds3f tb = at.Interpolate(t)(bounds);
+            tb.pMin += (Float)1e-4 * tb.Diagonal();
+            tb.pMax -= (Float)1e-4 * tb.Diagonal();
+            EXPECT_EQ(motionBounds, Union(motionBounds, tb));
+        }
+    }
+}
+
 TEST(RotateFromTo, Simple) {
     {
         // Same directions...
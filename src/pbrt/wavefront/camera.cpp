@@ -32,51 +32,100 @@ template <typename ConcreteSampler>
 void WavefrontPathIntegrator::GenerateCameraRays(int y0, Transform movingFromCamera,
                                                  int sampleIndex) {
     RayQueue *rayQueue = CurrentRayQueue(0);
+    if (!Options->useGPU) {
+        // Generate camera rays in batches of pixels on the CPU
+        constexpr int batchSize = CameraRayBatch::MaxSize;
+        int nBatches = (maxQueueSize + batchSize - 1) / batchSize;
+        CPUParallelFor("Generate camera rays", nBatches, [&](int batch) {
+            // Compute camera samples for batch's pixels
+            CameraSample cameraSamples[batchSize];
+            SampledWavelengths lambdas[batchSize];
+            int pixelIndices[batchSize], n = 0;
+            int end = std::min(maxQueueSize, (batch + 1) * batchSize);
+            for (int pixelIndex = batch * batchSize; pixelIndex < end; ++pixelIndex)
+                if (StartCameraSample<ConcreteSampler>(y0, pixelIndex, sampleIndex,
+                                                       &lambdas[n], &cameraSamples[n]))
+                    pixelIndices[n++] = pixelIndex;
+
+            // Generate camera rays for batch and enqueue them
+            pstd::optional<CameraRay> cameraRays[batchSize];
+            camera.GenerateRays(pstd::span<const CameraSample>(cameraSamples, n),
+                                pstd::span<SampledWavelengths>(lambdas, n),
+                                pstd::span<pstd::optional<CameraRay>>(cameraRays, n));
+            for (int i = 0; i < n; ++i)
+                FinishCameraSample(rayQueue, pixelIndices[i], movingFromCamera,
+                                   lambdas[i], cameraSamples[i].filterWeight,
+                                   cameraRays[i]);
+        });
+        return;
+    }
+
     ParallelFor(
         "Generate camera rays", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
             // Enqueue camera ray and set pixel state for sample
-            // Compute pixel coordinates for _pixelIndex_
-            Bounds2i pixelBounds = film.PixelBounds();
-            int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
-            Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
-                           y0 + pixelIndex / xResolution);
-            pixelSampleState.pPixel[pixelIndex] = pPixel;
-
-            // Test pixel coordinates against pixel bounds
-            if (!InsideExclusive(pPixel, pixelBounds))
+            SampledWavelengths lambda;
+            CameraSample cameraSample;
+            if (!StartCameraSample<ConcreteSampler>(y0, pixelIndex, sampleIndex, &lambda,
+                                                    &cameraSample))
                 return;
-
-            // Initialize _Sampler_ for current pixel and sample
-            ConcreteSampler pixelSampler = *sampler.Cast<ConcreteSampler>();
-            pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
-
-            // Sample wavelengths for ray path
-            Float lu = pixelSampler.Get1D();
-            if (GetOptions().disableWavelengthJitter)
-                lu = 0.5f;
-            SampledWavelengths lambda = film.SampleWavelengths(lu);
-
-            // Generate _CameraSample_ and corresponding ray
-            CameraSample cameraSample = GetCameraSample(pixelSampler, pPixel, filter);
             pstd::optional<CameraRay> cameraRay =
                 camera.GenerateRay(cameraSample, lambda);
-            if (cameraRay)
-                cameraRay->ray = movingFromCamera(cameraRay->ray);
-
-            // Initialize remainder of _PixelSampleState_ for ray
-            pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
-            pixelSampleState.lambda[pixelIndex] = lambda;
-            pixelSampleState.filterWeight[pixelIndex] = cameraSample.filterWeight;
-            if (initializeVisibleSurface)
-                pixelSampleState.visibleSurface[pixelIndex] = VisibleSurface();
-
-            // Enqueue camera ray for intersection tests
-            if (cameraRay) {
-                rayQueue->PushCameraRay(cameraRay->ray, lambda, pixelIndex);
-                pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay->weight;
-            } else
-                pixelSampleState.cameraRayWeight[pixelIndex] = SampledSpectrum(0);
+            FinishCameraSample(rayQueue, pixelIndex, movingFromCamera, lambda,
+                               cameraSample.filterWeight, cameraRay);
         });
 }
 
+template <typename ConcreteSampler>
+bool WavefrontPathIntegrator::StartCameraSample(int y0, int pixelIndex, int sampleIndex,
+                                                SampledWavelengths *lambda,
+                                                CameraSample *cameraSample) {
+    // Compute pixel coordinates for _pixelIndex_
+    Bounds2i pixelBounds = film.PixelBounds();
+    int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
+                   y0 + pixelIndex / xResolution);
+    pixelSampleState.pPixel[pixelIndex] = pPixel;
+
+    // Test pixel coordinates against pixel bounds
+    if (!InsideExclusive(pPixel, pixelBounds))
+        return false;
+
+    // Initialize _Sampler_ for current pixel and sample
+    ConcreteSampler pixelSampler = *sampler.Cast<ConcreteSampler>();
+    pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
+
+    // Sample wavelengths for ray path
+    Float lu = pixelSampler.Get1D();
+    if (GetOptions().disableWavelengthJitter)
+        lu = 0.5f;
+    *lambda = film.SampleWavelengths(lu);
+
+    // Generate _CameraSample_ for pixel
+    *cameraSample = GetCameraSample(pixelSampler, pPixel, filter);
+    return true;
+}
+
+void WavefrontPathIntegrator::FinishCameraSample(RayQueue *rayQueue, int pixelIndex,
+                                                 Transform movingFromCamera,
+                                                 const SampledWavelengths &lambda,
+                                                 Float filterWeight,
+                                                 pstd::optional<CameraRay> cameraRay) {
+    if (cameraRay)
+        cameraRay->ray = movingFromCamera(cameraRay->ray);
+
+    // Initialize remainder of _PixelSampleState_ for ray
+    pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
+    pixelSampleState.lambda[pixelIndex] = lambda;
+    pixelSampleState.filterWeight[pixelIndex] = filterWeight;
+    if (initializeVisibleSurface)
+        pixelSampleState.visibleSurface[pixelIndex] = VisibleSurface();
+
+    // Enqueue camera ray for intersection tests
+    if (cameraRay) {
+        rayQueue->PushCameraRay(cameraRay->ray, lambda, pixelIndex);
+        pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay->weight;
+    } else
+        pixelSampleState.cameraRayWeight[pixelIndex] = SampledSpectrum(0);
+}
+
 }  // namespace pbrt
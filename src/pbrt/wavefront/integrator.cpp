@@ -28,6 +28,7 @@
 #include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
 #include <pbrt/util/taggedptr.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/wavefront/aggregate.h>
 
 #include <atomic>
@@ -349,6 +350,7 @@ Float WavefrontPathIntegrator::Render() {
         // the GUI is being used so that the user can move the camera, etc.
         if (sampleIndex < lastSampleIndex) {
             // Render image for sample _sampleIndex_
+            TRACE_SCOPE("Render sample", "sampleIndex", sampleIndex);
             LOG_VERBOSE("Starting to submit work for sample %d", sampleIndex);
             for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
                  y0 += scanlinesPerPass) {
@@ -20,6 +20,7 @@
 #include <pbrt/options.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/wavefront/workitems.h>
 #include <pbrt/wavefront/workqueue.h>
 
@@ -62,6 +63,15 @@ class WavefrontPathIntegrator {
     void GenerateCameraRays(int y0, Transform movingFromcamera, int sampleIndex);
     template <typename Sampler>
     void GenerateCameraRays(int y0, Transform movingFromCamera, int sampleIndex);
+    template <typename Sampler>
+    PBRT_CPU_GPU bool StartCameraSample(int y0, int pixelIndex, int sampleIndex,
+                                        SampledWavelengths *lambda,
+                                        CameraSample *cameraSample);
+    PBRT_CPU_GPU void FinishCameraSample(RayQueue *rayQueue, int pixelIndex,
+                                         Transform movingFromCamera,
+                                         const SampledWavelengths &lambda,
+                                         Float filterWeight,
+                                         pstd::optional<CameraRay> cameraRay);
 
     void GenerateRaySamples(int wavefrontDepth, int sampleIndex);
     template <typename Sampler>
@@ -97,7 +107,16 @@ class WavefrontPathIntegrator {
             LOG_FATAL("Options->useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
 #endif
         else
-            pbrt::ParallelFor(0, nItems, func);
+            CPUParallelFor(description, nItems, func);
+    }
+
+    // Runs _func_ over _nItems_ items on the CPU, recording it in traces
+    // under _description_; unlike with ParallelFor(), _func_ may call
+    // CPU-only code.
+    template <typename F>
+    void CPUParallelFor(const char *description, int nItems, F &&func) {
+        TRACE_SCOPE(description, "items", nItems);
+        pbrt::ParallelFor(0, nItems, func);
     }
 
     template <typename F>